@@ -6,30 +6,18 @@ PRAGMA journal_mode = WAL;
 PRAGMA foreign_keys = ON;
 PRAGMA synchronous = NORMAL;
 
-CREATE TABLE packet_counts(
-	ip TEXT,
-	interface TEXT,
-
-	count_tcp INTEGER,
-	count_udp INTEGER,
-	count_icmp INTEGER,
-	count_other INTEGER,
-	count_total INTEGER,
-	count_tcpRst INTEGER,
-	count_tcpAck INTEGER,
-	count_tcpSyn INTEGER,
-	count_tcpFin INTEGER,
-	count_tcpSynAck INTEGER,
-	count_bytes INTEGER,
+/* Schema version 3, see DATABASE_SCHEMA_VERSION in NovaLibrary/src/Database.h. Novad migrates older files when it opens them. */
+PRAGMA user_version = 3;
 
-	FOREIGN KEY (ip, interface) REFERENCES suspects(ip, interface),
-	PRIMARY KEY(ip, interface)
+/* Suspects are keyed on their IPv4 address as an integer (host byte order) and an id from here */
+CREATE TABLE interfaces (
+	id INTEGER PRIMARY KEY,
+	name TEXT NOT NULL UNIQUE
 );
 
-
-CREATE TABLE suspects (
-	ip TEXT,
-	interface TEXT,
+CREATE TABLE suspect_records (
+	ip INTEGER NOT NULL,
+	interface INTEGER NOT NULL REFERENCES interfaces(id),
 
 	startTime INTEGER,
 	endTime INTEGER,
@@ -57,10 +45,121 @@ CREATE TABLE suspects (
 	haystack_percent_contacted DOUBLE,
 
 	PRIMARY KEY(ip, interface)
-);
+) WITHOUT ROWID;
+
+CREATE INDEX suspect_records_classification ON suspect_records(classification);
+CREATE INDEX suspect_records_hostile ON suspect_records(isHostile);
+
+CREATE TABLE suspect_packet_counts (
+	ip INTEGER NOT NULL,
+	interface INTEGER NOT NULL,
+
+	count_tcp INTEGER,
+	count_udp INTEGER,
+	count_icmp INTEGER,
+	count_other INTEGER,
+	count_total INTEGER,
+	count_tcpRst INTEGER,
+	count_tcpAck INTEGER,
+	count_tcpSyn INTEGER,
+	count_tcpFin INTEGER,
+	count_tcpSynAck INTEGER,
+	count_bytes INTEGER,
+
+	PRIMARY KEY(ip, interface),
+	FOREIGN KEY (ip, interface) REFERENCES suspect_records(ip, interface)
+) WITHOUT ROWID;
 
-CREATE INDEX idx ON suspects(classification);
+/* One serialized PacketSizeHistogram per suspect, see NovaLibrary/src/PacketSizeHistogram.h for the layout */
+CREATE TABLE suspect_packet_sizes (
+	ip INTEGER NOT NULL,
+	interface INTEGER NOT NULL,
 
+	histogram BLOB,
+
+	PRIMARY KEY(ip, interface),
+	FOREIGN KEY (ip, interface) REFERENCES suspect_records(ip, interface)
+) WITHOUT ROWID;
+
+/* Serialized DistinctCounter of the IP/port pairs a suspect contacted, one each for tcp (6) and udp (17).
+   See NovaLibrary/src/DistinctCounter.h for the layout */
+CREATE TABLE suspect_distinct_counts (
+	ip INTEGER NOT NULL,
+	interface INTEGER NOT NULL,
+
+	type INTEGER NOT NULL,
+	counter BLOB,
+
+	PRIMARY KEY(ip, interface, type),
+	FOREIGN KEY (ip, interface) REFERENCES suspect_records(ip, interface)
+) WITHOUT ROWID;
+
+/* type is the IP protocol number: 6 tcp, 17 udp, 1 icmp, 0 anything else */
+CREATE TABLE suspect_ip_port_counts (
+	ip INTEGER NOT NULL,
+	interface INTEGER NOT NULL,
+
+	type INTEGER NOT NULL,
+	dstip INTEGER NOT NULL,
+	port INTEGER NOT NULL,
+	count INTEGER,
+
+	PRIMARY KEY(ip, interface, type, dstip, port),
+	FOREIGN KEY (ip, interface) REFERENCES suspect_records(ip, interface)
+) WITHOUT ROWID;
+
+/* What the ip_port_counts of a suspect that's been idle for IP_PORT_DETAIL_HOURS are rolled up into */
+CREATE TABLE suspect_ip_summaries (
+	ip INTEGER NOT NULL,
+	interface INTEGER NOT NULL,
+
+	dstip INTEGER NOT NULL,
+	count INTEGER,
+
+	PRIMARY KEY(ip, interface, dstip),
+	FOREIGN KEY (ip, interface) REFERENCES suspect_records(ip, interface)
+) WITHOUT ROWID;
+
+CREATE TABLE suspect_port_summaries (
+	ip INTEGER NOT NULL,
+	interface INTEGER NOT NULL,
+
+	type INTEGER NOT NULL,
+	port INTEGER NOT NULL,
+	count INTEGER,
+
+	PRIMARY KEY(ip, interface, type, port),
+	FOREIGN KEY (ip, interface) REFERENCES suspect_records(ip, interface)
+) WITHOUT ROWID;
+
+/* For finding idle suspects */
+CREATE INDEX suspect_records_lastTime ON suspect_records(lastTime);
+
+/* The old text keyed tables, as views */
+CREATE VIEW suspects AS SELECT ((s.ip >> 24) & 255) || '.' || ((s.ip >> 16) & 255) || '.' || ((s.ip >> 8) & 255) || '.' || (s.ip & 255) AS ip, i.name AS interface,
+	startTime, endTime, lastTime, classification, hostileNeighbors, isHostile, classificationNotes,
+	ip_traffic_distribution, port_traffic_distribution, packet_size_mean, packet_size_deviation, distinct_ips,
+	distinct_tcp_ports, distinct_udp_ports, avg_tcp_ports_per_host, avg_udp_ports_per_host, tcp_percent_syn,
+	tcp_percent_fin, tcp_percent_rst, tcp_percent_synack, haystack_percent_contacted
+	FROM suspect_records s JOIN interfaces i ON i.id = s.interface;
+
+CREATE VIEW packet_counts AS SELECT ((c.ip >> 24) & 255) || '.' || ((c.ip >> 16) & 255) || '.' || ((c.ip >> 8) & 255) || '.' || (c.ip & 255) AS ip, i.name AS interface,
+	count_tcp, count_udp, count_icmp, count_other, count_total, count_tcpRst, count_tcpAck, count_tcpSyn,
+	count_tcpFin, count_tcpSynAck, count_bytes
+	FROM suspect_packet_counts c JOIN interfaces i ON i.id = c.interface;
+
+CREATE VIEW packet_sizes AS SELECT ((p.ip >> 24) & 255) || '.' || ((p.ip >> 16) & 255) || '.' || ((p.ip >> 8) & 255) || '.' || (p.ip & 255) AS ip, i.name AS interface,
+	histogram
+	FROM suspect_packet_sizes p JOIN interfaces i ON i.id = p.interface;
+
+CREATE VIEW distinct_counts AS SELECT ((d.ip >> 24) & 255) || '.' || ((d.ip >> 16) & 255) || '.' || ((d.ip >> 8) & 255) || '.' || (d.ip & 255) AS ip, i.name AS interface,
+	CASE d.type WHEN 6 THEN 'tcp' WHEN 17 THEN 'udp' WHEN 1 THEN 'icmp' ELSE 'other' END AS type, counter
+	FROM suspect_distinct_counts d JOIN interfaces i ON i.id = d.interface;
+
+CREATE VIEW ip_port_counts AS SELECT ((c.ip >> 24) & 255) || '.' || ((c.ip >> 16) & 255) || '.' || ((c.ip >> 8) & 255) || '.' || (c.ip & 255) AS ip, i.name AS interface,
+	CASE c.type WHEN 6 THEN 'tcp' WHEN 17 THEN 'udp' WHEN 1 THEN 'icmp' ELSE 'other' END AS type,
+	((c.dstip >> 24) & 255) || '.' || ((c.dstip >> 16) & 255) || '.' || ((c.dstip >> 8) & 255) || '.' || (c.dstip & 255) AS dstip, port, count
+	FROM suspect_ip_port_counts c JOIN interfaces i ON i.id = c.interface;
 
 /* Basically a copy of the suspects table with a new key added. Annoying there isn't a good way to copy the schema in sqlite */
 CREATE TABLE suspect_alerts (
@@ -94,31 +193,6 @@ CREATE TABLE suspect_alerts (
 	haystack_percent_contacted DOUBLE
 );
 
-CREATE TABLE packet_sizes (
-	ip TEXT,
-	interface,
-
-	packetSize INTEGER,
-	count INTEGER,
-	
-	PRIMARY KEY(ip, interface, packetSize),
-	FOREIGN KEY (ip, interface) REFERENCES suspects(ip, interface)
-);
-
-CREATE TABLE ip_port_counts (
-	ip TEXT,
-	interface,
-
-	type TEXT,
-	dstip TEXT,
-	port INTEGER,
-	count INTEGER,
-	
-	FOREIGN KEY (ip, interface) REFERENCES suspects(ip, interface),
-	PRIMARY KEY(ip, interface, type, dstip, port)
-);
-
-
 /* We keep track of what honeypot IPs are currently up so we can join against the ip_port_counts for haystack_percent_contacted */
 CREATE TABLE honeypots (
 	ip TEXT,
@@ -21,6 +21,7 @@
 #include "Config.h"
 #include "HashMapStructs.h"
 #include "MessageManager.h"
+#include "Lock.h"
 
 #include <map>
 
@@ -32,6 +33,17 @@ using namespace std;
 map<int32_t, Persistent<Function>> jsCallbacks;
 int32_t messageID = 0;
 
+struct ExplainReply
+{
+	int32_t m_messageID;
+	bool m_success;
+	string m_notes;
+};
+
+// Explain replies come in on the callback thread, but their callbacks can only be run on node's
+vector<ExplainReply> explainReplies;
+pthread_mutex_t explainRepliesLock = PTHREAD_MUTEX_INITIALIZER;
+
 void NovaNode::InitNovaCallbackProcessing()
 {
 	eio_custom(NovaCallbackHandling, EIO_PRI_DEFAULT, AfterNovaCallbackHandling, NULL);
@@ -80,6 +92,24 @@ void NovaNode::NovaCallbackHandling(eio_req*)
 				HandleSuspectCleared(suspect);
 				break;
 			}
+			case CONTROL_EXPLAIN_SUSPECT_REPLY:
+			{
+				if(!message->has_m_messageid())
+				{
+					break;
+				}
+
+				ExplainReply reply;
+				reply.m_messageID = message->m_messageid();
+				reply.m_success = message->m_success();
+				reply.m_notes = message->m_classificationnotes();
+				{
+					Lock lock(&explainRepliesLock);
+					explainReplies.push_back(reply);
+				}
+				uv_async_send(&m_explainReplyAsync);
+				break;
+			}
 			case REQUEST_PONG:
 			{
 				break;
@@ -118,6 +148,49 @@ void NovaNode::HandleCallbackError()
 	LOG(ERROR, "Novad provided CALLBACK_ERROR, will continue and move on","");
 }
 
+void NovaNode::HandleExplainReplies(uv_async_t *, int)
+{
+	HandleScope scope;
+
+	vector<ExplainReply> replies;
+	{
+		Lock lock(&explainRepliesLock);
+		replies.swap(explainReplies);
+	}
+
+	for(uint i = 0; i < replies.size(); i++)
+	{
+		map<int32_t, Persistent<Function>>::iterator it = jsCallbacks.find(replies[i].m_messageID);
+		if(it == jsCallbacks.end())
+		{
+			continue;
+		}
+		Persistent<Function> callback = it->second;
+		jsCallbacks.erase(it);
+
+		// Called back with (error, notes)
+		Handle<Value> argv[2];
+		if(replies[i].m_success)
+		{
+			argv[0] = Null();
+			argv[1] = String::New(replies[i].m_notes.c_str());
+		}
+		else
+		{
+			argv[0] = String::New("Novad couldn't find the suspect, or CLASSIFICATION_NOTES is 0");
+			argv[1] = Null();
+		}
+
+		TryCatch tryCatch;
+		callback->Call(Context::GetCurrent()->Global(), 2, argv);
+		callback.Dispose();
+		if(tryCatch.HasCaught())
+		{
+			FatalException(tryCatch);
+		}
+	}
+}
+
 bool StopNovadWrapper()
 {
 	StopNovad();
@@ -174,10 +247,13 @@ void NovaNode::Init(Handle<Object> target)
 
 	NODE_SET_PROTOTYPE_METHOD(s_ct, "Shutdown", Shutdown );
 	NODE_SET_PROTOTYPE_METHOD(s_ct, "ClearSuspect", ClearSuspect );
+	NODE_SET_PROTOTYPE_METHOD(s_ct, "ExplainSuspect", ExplainSuspect );
 
 	// Javascript object constructor
 	target->Set(String::NewSymbol("Instance"), s_ct->GetFunction());
 
+	uv_async_init(uv_default_loop(), &m_explainReplyAsync, HandleExplainReplies);
+
 	InitMessaging();
 	InitNovaCallbackProcessing();
 }
@@ -258,6 +334,33 @@ Handle<Value> NovaNode::ClearSuspect(const Arguments &args)
 	return scope.Close(Null());
 }
 
+// Asks Novad for the suspect's full classification notes. Takes an IP, an interface and a
+// callback, which gets (error, notes) once Novad replies.
+Handle<Value> NovaNode::ExplainSuspect(const Arguments &args)
+{
+	HandleScope scope;
+	if(args.Length() < 3 || !args[2]->IsFunction())
+	{
+		return ThrowException(Exception::TypeError(String::New("ExplainSuspect takes an IP, an interface and a callback")));
+	}
+
+	string suspectIp = cvv8::CastFromJS<string>(args[0]);
+	string suspectInterface = cvv8::CastFromJS<string>(args[1]);
+
+	in_addr_t address;
+	inet_pton(AF_INET, suspectIp.c_str(), &address);
+
+	SuspectID_pb id;
+	id.set_m_ifname(suspectInterface);
+	id.set_m_ip(ntohl(address));
+
+	messageID++;
+	jsCallbacks[messageID] = Persistent<Function>::New(Local<Function>::Cast(args[2]));
+	Nova::ExplainSuspect(id, messageID);
+
+	return scope.Close(Null());
+}
+
 NovaNode::NovaNode() :
 			m_count(0)
 {
@@ -289,4 +392,5 @@ void NovaNode::HandleOnNewSuspectWeakCollect(Persistent<Value> , void *)
 Persistent<FunctionTemplate> NovaNode::s_ct;
 
 pthread_t NovaNode::m_NovaCallbackThread=0;
+uv_async_t NovaNode::m_explainReplyAsync;
 
@@ -52,6 +52,10 @@ private:
 	static void HandleSuspectCleared(Suspect *);
 	static void HandleCallbackError();
 
+	// Wakes node's thread up to run the callbacks of ExplainSuspect replies
+	static uv_async_t m_explainReplyAsync;
+	static void HandleExplainReplies(uv_async_t *handle, int status);
+
 public:
 
 	static Persistent<FunctionTemplate> s_ct;
@@ -60,6 +64,7 @@ public:
 	static Handle<Value> CheckConnection(const Arguments __attribute__((__unused__)) &args);
 	static Handle<Value> Shutdown(const Arguments __attribute__((__unused__)) &args);
 	static Handle<Value> ClearSuspect(const Arguments &args);
+	static Handle<Value> ExplainSuspect(const Arguments &args);
 	NovaNode();
 	~NovaNode();
 
@@ -317,6 +317,24 @@ int main(int argc, const char *argv[])
 		}
 	}
 
+	// Explaining a suspect's classification
+	else if(!strcmp(argv[1], "explain"))
+	{
+		if(argc < 4)
+		{
+			PrintUsage();
+		}
+
+		in_addr_t address;
+		if(inet_pton(AF_INET, argv[3], &address) != 1)
+		{
+			cout << "Error: Unable to convert to IP address" << endl;
+			exit(EXIT_FAILURE);
+		}
+
+		ExplainSuspectWrapper(address, string(argv[2]));
+	}
+
 	// Checking status of components
 	else if(!strcmp(argv[1], "uptime"))
 	{
@@ -401,6 +419,9 @@ void PrintUsage()
 	cout << "  " << EXECUTABLE_NAME << " clear interface xxx.xxx.xxx.xxx" << endl;
 	cout << "    Clears all saved data for a specific suspect" << endl;
 	cout << endl;
+	cout << "  " << EXECUTABLE_NAME << " explain interface xxx.xxx.xxx.xxx" << endl;
+	cout << "    Classifies a specific suspect again and outputs the full classification notes" << endl;
+	cout << endl;
 	cout << "  " << EXECUTABLE_NAME << " writesetting SETTING VALUE" << endl;
 	cout << "    Writes setting to configuration file" << endl;
 	cout << endl;
@@ -665,6 +686,19 @@ void ClearSuspectWrapper(in_addr_t address, string interface)
 	DisconnectFromNovad();
 }
 
+void ExplainSuspectWrapper(in_addr_t address, string interface)
+{
+	Connect();
+
+	SuspectID_pb id;
+	id.set_m_ifname(interface);
+	id.set_m_ip(ntohl(address));
+
+	ExplainSuspect(id, 1);
+	MonitorCallback(1);
+	DisconnectFromNovad();
+}
+
 void PrintUptime()
 {
 	Connect();
@@ -739,6 +773,19 @@ void MonitorCallback(int32_t messageID)
     				}
     				break;
     			}
+    			case CONTROL_EXPLAIN_SUSPECT_REPLY:
+    			{
+    				if(message->m_success())
+    				{
+    					cout << message->m_classificationnotes() << endl;
+    				}
+    				else
+    				{
+    					cout << "Unable to explain Suspect " << Suspect::GetIpString(message->m_suspectid())
+    						<< ". It may be unknown, or classification notes are off (CLASSIFICATION_NOTES 0)" << endl;
+    				}
+    				break;
+    			}
     			case REQUEST_PONG:
     			{
     				cout << "Pong" << endl;
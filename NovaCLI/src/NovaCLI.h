@@ -51,6 +51,8 @@ void PrintAllSuspects(enum Nova::SuspectListType listType, bool csv);
 void ClearSuspectWrapper(in_addr_t address, std::string interface);
 void ClearAllSuspectsWrapper();
 
+void ExplainSuspectWrapper(in_addr_t address, std::string interface);
+
 void PrintSuspectList(enum Nova::SuspectListType listType);
 
 void PrintUptime();
@@ -7,18 +7,25 @@ CPP_SRCS += \
 ../src/Config.cpp \
 ../src/Database.cpp \
 ../src/DatabaseQueue.cpp \
+../src/DatabaseWriter.cpp \
+../src/DistinctCounter.cpp \
 ../src/Doppelganger.cpp \
 ../src/Evidence.cpp \
 ../src/EvidenceAccumulator.cpp \
 ../src/EvidenceTable.cpp \
+../src/FeatureAggregate.cpp \
 ../src/FilePacketCapture.cpp \
 ../src/HaystackControl.cpp \
 ../src/InterfacePacketCapture.cpp \
+../src/InterfaceTable.cpp \
 ../src/Logger.cpp \
 ../src/MessageManager.cpp \
 ../src/NovaUtil.cpp \
 ../src/PacketCapture.cpp \
+../src/PacketSizeHistogram.cpp \
 ../src/Point.cpp \
+../src/RingPacketCapture.cpp \
+../src/Snapshot.cpp \
 ../src/Suspect.cpp \
 ../src/WhitelistConfiguration.cpp 
 
@@ -26,18 +33,25 @@ OBJS += \
 ./src/Config.o \
 ./src/Database.o \
 ./src/DatabaseQueue.o \
+./src/DatabaseWriter.o \
+./src/DistinctCounter.o \
 ./src/Doppelganger.o \
 ./src/Evidence.o \
 ./src/EvidenceAccumulator.o \
 ./src/EvidenceTable.o \
+./src/FeatureAggregate.o \
 ./src/FilePacketCapture.o \
 ./src/HaystackControl.o \
 ./src/InterfacePacketCapture.o \
+./src/InterfaceTable.o \
 ./src/Logger.o \
 ./src/MessageManager.o \
 ./src/NovaUtil.o \
 ./src/PacketCapture.o \
+./src/PacketSizeHistogram.o \
 ./src/Point.o \
+./src/RingPacketCapture.o \
+./src/Snapshot.o \
 ./src/Suspect.o \
 ./src/WhitelistConfiguration.o 
 
@@ -45,18 +59,25 @@ CPP_DEPS += \
 ./src/Config.d \
 ./src/Database.d \
 ./src/DatabaseQueue.d \
+./src/DatabaseWriter.d \
+./src/DistinctCounter.d \
 ./src/Doppelganger.d \
 ./src/Evidence.d \
 ./src/EvidenceAccumulator.d \
 ./src/EvidenceTable.d \
+./src/FeatureAggregate.d \
 ./src/FilePacketCapture.d \
 ./src/HaystackControl.d \
 ./src/InterfacePacketCapture.d \
+./src/InterfaceTable.d \
 ./src/Logger.d \
 ./src/MessageManager.d \
 ./src/NovaUtil.d \
 ./src/PacketCapture.d \
+./src/PacketSizeHistogram.d \
 ./src/Point.d \
+./src/RingPacketCapture.d \
+./src/Snapshot.d \
 ./src/Suspect.d \
 ./src/WhitelistConfiguration.d 
 
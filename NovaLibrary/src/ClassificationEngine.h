@@ -30,6 +30,14 @@ namespace Nova
 //Forward declaration to resolve circular include
 class Suspect;
 
+// When the engines write a suspect's classification notes, see CLASSIFICATION_NOTES
+enum ClassificationNotesLevel
+{
+	NOTES_NONE = 0,
+	NOTES_ON_DEMAND = 1,
+	NOTES_FULL = 2
+};
+
 class ClassificationEngine
 {
 public:
@@ -38,14 +46,41 @@ public:
 	// Classify a suspect, returns the classification
 	virtual double Classify(Suspect *suspect) = 0;
 
+	// Classifies count suspects in one go, leaving each one's classification in classifications.
+	// Engines that can share work (buffers, locks, lookups) across suspects override this; by
+	// default it just calls Classify on each.
+	virtual void ClassifyBatch(Suspect **suspects, uint count, double *classifications);
+
 	// (Re)loads any configuration settings needed. Must be called before classification.
 	virtual void LoadConfiguration(std::string filePath);
 
 	virtual void Reload();
 
+	// True if the vote, the notes and whatever else the engine sets on a suspect depend only on
+	// its features and the engine's own configuration, so the aggregator may reuse them for a
+	// suspect whose features have barely moved. Off unless an engine says otherwise.
+	virtual bool IsCacheable()
+	{
+		return false;
+	}
+
+	// For a cacheable engine: does whatever classifying would do to the suspects' features (the KNN
+	// engine clamps them to its training ranges) and writes them out on the scale the engine compares
+	// them on, DIM per suspect. The aggregator buckets these to decide whether a cached vote still
+	// holds, and calls this whether it runs the engine or not. By default the features are left
+	// alone and written out as they are.
+	virtual void GetComparableFeatures(Suspect **suspects, uint count, double *features);
+
 protected:
 	ClassificationEngine();
 
+	// Notes level for this suspect, NOTES_FULL or NOTES_NONE: full notes if it's being explained or
+	// every suspect gets them, otherwise nothing is formatted
+	static uint GetNotesLevel(Suspect *suspect, uint configuredLevel)
+	{
+		return (suspect->m_explainClassification || configuredLevel == NOTES_FULL) ? (uint)NOTES_FULL : (uint)NOTES_NONE;
+	}
+
 };
 
 } /* namespace Nova */
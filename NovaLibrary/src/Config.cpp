@@ -106,7 +106,20 @@ string Config::m_prefixes[] =
 	"COMMAND_STOP_NOVAD",
 	"COMMAND_START_HAYSTACK",
 	"COMMAND_STOP_HAYSTACK",
-	"MESSAGE_WORKER_THREADS"
+	"MESSAGE_WORKER_THREADS",
+	"CAPTURE_RING_ENABLED",
+	"CAPTURE_RING_SIZE",
+	"CAPTURE_RING_BLOCK_TIMEOUT",
+	"CAPTURE_FANOUT_THREADS",
+	"CONSUMER_THREADS",
+	"MAX_SUSPECT_MEMORY",
+	"MAX_MEMORY_PER_SUSPECT",
+	"SUSPECT_RETENTION_HOURS",
+	"IP_PORT_DETAIL_HOURS",
+	"MAX_SUSPECT_ALERTS",
+	"CLASSIFICATION_NOTES",
+	"CLASSIFICATION_CACHE_RESOLUTION",
+	"CLASSIFICATION_CACHE_SIZE"
 };
 
 Config *Config::m_instance = NULL;
@@ -1103,6 +1116,188 @@ void Config::LoadConfig_Internal()
 
 				continue;
 			}
+
+			// CAPTURE_RING_ENABLED
+			prefixIndex++;
+			prefix = m_prefixes[prefixIndex];
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				if(line.size() > 0)
+				{
+					m_captureRingEnabled = atoi(line.c_str());
+					isValid[prefixIndex] = true;
+				}
+				continue;
+			}
+
+			// CAPTURE_RING_SIZE
+			prefixIndex++;
+			prefix = m_prefixes[prefixIndex];
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				if(line.size() > 0)
+				{
+					m_captureRingSize = atoi(line.c_str());
+					isValid[prefixIndex] = true;
+				}
+				continue;
+			}
+
+			// CAPTURE_RING_BLOCK_TIMEOUT
+			prefixIndex++;
+			prefix = m_prefixes[prefixIndex];
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				if(line.size() > 0)
+				{
+					m_captureRingBlockTimeout = atoi(line.c_str());
+					isValid[prefixIndex] = true;
+				}
+				continue;
+			}
+
+			// CAPTURE_FANOUT_THREADS
+			prefixIndex++;
+			prefix = m_prefixes[prefixIndex];
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				if(line.size() > 0)
+				{
+					m_captureFanoutThreads = atoi(line.c_str());
+					isValid[prefixIndex] = true;
+				}
+				continue;
+			}
+
+			// CONSUMER_THREADS
+			prefixIndex++;
+			prefix = m_prefixes[prefixIndex];
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				if(line.size() > 0)
+				{
+					m_consumerThreads = atoi(line.c_str());
+					isValid[prefixIndex] = true;
+				}
+				continue;
+			}
+
+			// MAX_SUSPECT_MEMORY
+			prefixIndex++;
+			prefix = m_prefixes[prefixIndex];
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				if(line.size() > 0)
+				{
+					m_maxSuspectMemory = atoi(line.c_str());
+					isValid[prefixIndex] = true;
+				}
+				continue;
+			}
+
+			// MAX_MEMORY_PER_SUSPECT
+			prefixIndex++;
+			prefix = m_prefixes[prefixIndex];
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				if(line.size() > 0)
+				{
+					m_maxMemoryPerSuspect = atoi(line.c_str());
+					isValid[prefixIndex] = true;
+				}
+				continue;
+			}
+
+			// SUSPECT_RETENTION_HOURS
+			prefixIndex++;
+			prefix = m_prefixes[prefixIndex];
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				if(line.size() > 0)
+				{
+					m_suspectRetentionHours = atoi(line.c_str());
+					isValid[prefixIndex] = true;
+				}
+				continue;
+			}
+
+			// IP_PORT_DETAIL_HOURS
+			prefixIndex++;
+			prefix = m_prefixes[prefixIndex];
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				if(line.size() > 0)
+				{
+					m_ipPortDetailHours = atoi(line.c_str());
+					isValid[prefixIndex] = true;
+				}
+				continue;
+			}
+
+			// MAX_SUSPECT_ALERTS
+			prefixIndex++;
+			prefix = m_prefixes[prefixIndex];
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				if(line.size() > 0)
+				{
+					m_maxSuspectAlerts = atoi(line.c_str());
+					isValid[prefixIndex] = true;
+				}
+				continue;
+			}
+
+			// CLASSIFICATION_NOTES
+			prefixIndex++;
+			prefix = m_prefixes[prefixIndex];
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				if(line.size() > 0)
+				{
+					m_classificationNotes = atoi(line.c_str());
+					isValid[prefixIndex] = true;
+				}
+				continue;
+			}
+
+			// CLASSIFICATION_CACHE_RESOLUTION
+			prefixIndex++;
+			prefix = m_prefixes[prefixIndex];
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				if(line.size() > 0)
+				{
+					m_classificationCacheResolution = atoi(line.c_str());
+					isValid[prefixIndex] = true;
+				}
+				continue;
+			}
+
+			// CLASSIFICATION_CACHE_SIZE
+			prefixIndex++;
+			prefix = m_prefixes[prefixIndex];
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				if(line.size() > 0)
+				{
+					m_classificationCacheSize = atoi(line.c_str());
+					isValid[prefixIndex] = true;
+				}
+				continue;
+			}
 		}
 	}
 	else
@@ -210,6 +210,20 @@ public:
 
 	MAKE_GETTER_SETTER(int, m_messageWorkerThreads, GetNumMessageWorkerThreads, SetNumMEssageWorkerThreads);
 
+	MAKE_GETTER_SETTER(bool, m_captureRingEnabled, GetCaptureRingEnabled, SetCaptureRingEnabled);
+	MAKE_GETTER_SETTER(int, m_captureRingSize, GetCaptureRingSize, SetCaptureRingSize);
+	MAKE_GETTER_SETTER(int, m_captureRingBlockTimeout, GetCaptureRingBlockTimeout, SetCaptureRingBlockTimeout);
+	MAKE_GETTER_SETTER(uint, m_captureFanoutThreads, GetCaptureFanoutThreads, SetCaptureFanoutThreads);
+	MAKE_GETTER_SETTER(uint, m_consumerThreads, GetConsumerThreads, SetConsumerThreads);
+	MAKE_GETTER_SETTER(uint, m_maxSuspectMemory, GetMaxSuspectMemory, SetMaxSuspectMemory);
+	MAKE_GETTER_SETTER(uint, m_maxMemoryPerSuspect, GetMaxMemoryPerSuspect, SetMaxMemoryPerSuspect);
+	MAKE_GETTER_SETTER(uint, m_suspectRetentionHours, GetSuspectRetentionHours, SetSuspectRetentionHours);
+	MAKE_GETTER_SETTER(uint, m_ipPortDetailHours, GetIpPortDetailHours, SetIpPortDetailHours);
+	MAKE_GETTER_SETTER(uint, m_maxSuspectAlerts, GetMaxSuspectAlerts, SetMaxSuspectAlerts);
+	MAKE_GETTER_SETTER(uint, m_classificationNotes, GetClassificationNotes, SetClassificationNotes);
+	MAKE_GETTER_SETTER(uint, m_classificationCacheResolution, GetClassificationCacheResolution, SetClassificationCacheResolution);
+	MAKE_GETTER_SETTER(uint, m_classificationCacheSize, GetClassificationCacheSize, SetClassificationCacheSize);
+
 protected:
 	Config();
 
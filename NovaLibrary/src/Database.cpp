@@ -21,7 +21,10 @@
 #include "NovaUtil.h"
 #include "Logger.h"
 #include "ClassificationEngine.h"
+#include "SerializationHelper.h"
 
+#include <deque>
+#include <arpa/inet.h>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -32,6 +35,155 @@ using namespace std;
 namespace Nova
 {
 
+// Everything in a suspects row after its key, in column order
+#define SUSPECT_COLUMNS \
+	"startTime, endTime, lastTime, classification, hostileNeighbors, isHostile, classificationNotes" \
+	", ip_traffic_distribution, port_traffic_distribution, packet_size_mean, packet_size_deviation, distinct_ips" \
+	", distinct_tcp_ports, distinct_udp_ports, avg_tcp_ports_per_host, avg_udp_ports_per_host, tcp_percent_syn" \
+	", tcp_percent_fin, tcp_percent_rst, tcp_percent_synack, haystack_percent_contacted"
+
+#define PACKET_COUNT_COLUMNS \
+	"count_tcp, count_udp, count_icmp, count_other, count_total, count_tcpRst, count_tcpAck, count_tcpSyn" \
+	", count_tcpFin, count_tcpSynAck, count_bytes"
+
+// Host order integer IP column as dotted quad text, the same as Suspect::GetIpString
+#define SQL_IP_TEXT(column) \
+	"((" column " >> 24) & 255) || '.' || ((" column " >> 16) & 255) || '.' || ((" column " >> 8) & 255) || '.' || (" column " & 255)"
+
+// Schema version 2. Suspects are keyed on their integer IP and an interface id, and the ip_port_counts
+// type is the IP protocol number (0 for anything that isn't TCP, UDP or ICMP). All the per suspect tables
+// are WITHOUT ROWID and clustered on their primary key, which starts with (ip, interface), so every
+// lookup we do is a range scan of one b-tree with no separate index to go through.
+//
+// Installer/createDatabase.sh has a copy of this for new installs. Keep them in sync.
+static const char *SUSPECT_TABLES =
+	"CREATE TABLE interfaces ("
+	"	id INTEGER PRIMARY KEY,"
+	"	name TEXT NOT NULL UNIQUE"
+	");"
+
+	"CREATE TABLE suspect_records ("
+	"	ip INTEGER NOT NULL,"
+	"	interface INTEGER NOT NULL REFERENCES interfaces(id),"
+	"	startTime INTEGER, endTime INTEGER, lastTime INTEGER,"
+	"	classification DOUBLE, hostileNeighbors INTEGER, isHostile INTEGER, classificationNotes TEXT,"
+	"	ip_traffic_distribution DOUBLE, port_traffic_distribution DOUBLE, packet_size_mean DOUBLE, packet_size_deviation DOUBLE,"
+	"	distinct_ips DOUBLE, distinct_tcp_ports DOUBLE, distinct_udp_ports DOUBLE, avg_tcp_ports_per_host DOUBLE,"
+	"	avg_udp_ports_per_host DOUBLE, tcp_percent_syn DOUBLE, tcp_percent_fin DOUBLE, tcp_percent_rst DOUBLE,"
+	"	tcp_percent_synack DOUBLE, haystack_percent_contacted DOUBLE,"
+	"	PRIMARY KEY(ip, interface)"
+	") WITHOUT ROWID;"
+	"CREATE INDEX suspect_records_classification ON suspect_records(classification);"
+	// Index entries carry the primary key, so listing the hostile suspects never touches the table
+	"CREATE INDEX suspect_records_hostile ON suspect_records(isHostile);"
+
+	"CREATE TABLE suspect_packet_counts ("
+	"	ip INTEGER NOT NULL, interface INTEGER NOT NULL,"
+	"	count_tcp INTEGER, count_udp INTEGER, count_icmp INTEGER, count_other INTEGER, count_total INTEGER,"
+	"	count_tcpRst INTEGER, count_tcpAck INTEGER, count_tcpSyn INTEGER, count_tcpFin INTEGER, count_tcpSynAck INTEGER,"
+	"	count_bytes INTEGER,"
+	"	PRIMARY KEY(ip, interface),"
+	"	FOREIGN KEY (ip, interface) REFERENCES suspect_records(ip, interface)"
+	") WITHOUT ROWID;"
+
+	"CREATE TABLE suspect_packet_sizes ("
+	"	ip INTEGER NOT NULL, interface INTEGER NOT NULL,"
+	"	histogram BLOB,"
+	"	PRIMARY KEY(ip, interface),"
+	"	FOREIGN KEY (ip, interface) REFERENCES suspect_records(ip, interface)"
+	") WITHOUT ROWID;"
+
+	"CREATE TABLE suspect_distinct_counts ("
+	"	ip INTEGER NOT NULL, interface INTEGER NOT NULL,"
+	"	type INTEGER NOT NULL, counter BLOB,"
+	"	PRIMARY KEY(ip, interface, type),"
+	"	FOREIGN KEY (ip, interface) REFERENCES suspect_records(ip, interface)"
+	") WITHOUT ROWID;"
+
+	"CREATE TABLE suspect_ip_port_counts ("
+	"	ip INTEGER NOT NULL, interface INTEGER NOT NULL,"
+	"	type INTEGER NOT NULL, dstip INTEGER NOT NULL, port INTEGER NOT NULL, count INTEGER,"
+	"	PRIMARY KEY(ip, interface, type, dstip, port),"
+	"	FOREIGN KEY (ip, interface) REFERENCES suspect_records(ip, interface)"
+	") WITHOUT ROWID;";
+
+// Schema version 3: where ApplyRetention rolls up the ip_port_counts of suspects that have been idle a while,
+// and an index to find those suspects by. Keep Installer/createDatabase.sh in sync with these too.
+static const char *RETENTION_TABLES =
+	"CREATE TABLE suspect_ip_summaries ("
+	"	ip INTEGER NOT NULL, interface INTEGER NOT NULL,"
+	"	dstip INTEGER NOT NULL, count INTEGER,"
+	"	PRIMARY KEY(ip, interface, dstip),"
+	"	FOREIGN KEY (ip, interface) REFERENCES suspect_records(ip, interface)"
+	") WITHOUT ROWID;"
+
+	"CREATE TABLE suspect_port_summaries ("
+	"	ip INTEGER NOT NULL, interface INTEGER NOT NULL,"
+	"	type INTEGER NOT NULL, port INTEGER NOT NULL, count INTEGER,"
+	"	PRIMARY KEY(ip, interface, type, port),"
+	"	FOREIGN KEY (ip, interface) REFERENCES suspect_records(ip, interface)"
+	") WITHOUT ROWID;"
+
+	"CREATE INDEX suspect_records_lastTime ON suspect_records(lastTime);";
+
+// The version 1 table names and columns, for Quasar, the CLI and anything else reading the database by hand
+#define SQL_PROTOCOL_TEXT(column) \
+	"CASE " column " WHEN 6 THEN 'tcp' WHEN 17 THEN 'udp' WHEN 1 THEN 'icmp' ELSE 'other' END"
+
+static const char *SUSPECT_VIEWS =
+	"CREATE VIEW suspects AS SELECT " SQL_IP_TEXT("s.ip") " AS ip, i.name AS interface, " SUSPECT_COLUMNS
+	" FROM suspect_records s JOIN interfaces i ON i.id = s.interface;"
+
+	"CREATE VIEW packet_counts AS SELECT " SQL_IP_TEXT("c.ip") " AS ip, i.name AS interface, " PACKET_COUNT_COLUMNS
+	" FROM suspect_packet_counts c JOIN interfaces i ON i.id = c.interface;"
+
+	"CREATE VIEW packet_sizes AS SELECT " SQL_IP_TEXT("p.ip") " AS ip, i.name AS interface, histogram"
+	" FROM suspect_packet_sizes p JOIN interfaces i ON i.id = p.interface;"
+
+	"CREATE VIEW distinct_counts AS SELECT " SQL_IP_TEXT("d.ip") " AS ip, i.name AS interface, "
+	SQL_PROTOCOL_TEXT("d.type") " AS type, counter"
+	" FROM suspect_distinct_counts d JOIN interfaces i ON i.id = d.interface;"
+
+	"CREATE VIEW ip_port_counts AS SELECT " SQL_IP_TEXT("c.ip") " AS ip, i.name AS interface, "
+	SQL_PROTOCOL_TEXT("c.type") " AS type, " SQL_IP_TEXT("c.dstip") " AS dstip, port, count"
+	" FROM suspect_ip_port_counts c JOIN interfaces i ON i.id = c.interface;";
+
+// Copies the version 1 tables into the version 2 ones and drops them. Rows with an IP that doesn't
+// parse can't be keyed any more, so they're left behind. Version 1 is what the installer has always
+// created: packet_sizes has a row per size seen and there's no distinct_counts table. The counters
+// don't need carrying over, LoadFeatureAggregate rebuilds them from the ip_port_counts rows.
+#define SQL_PROTOCOL_NUMBER(column) \
+	"CASE " column " WHEN 'tcp' THEN 6 WHEN 'udp' THEN 17 WHEN 'icmp' THEN 1 ELSE 0 END"
+
+static const char *MIGRATE_FROM_VERSION_1 =
+	"INSERT INTO interfaces (name) SELECT DISTINCT interface FROM suspects WHERE interface IS NOT NULL;"
+
+	"INSERT INTO suspect_records (ip, interface, " SUSPECT_COLUMNS ")"
+	" SELECT ipv4_to_integer(s.ip), i.id, " SUSPECT_COLUMNS
+	" FROM suspects s JOIN interfaces i ON i.name = s.interface WHERE ipv4_to_integer(s.ip) IS NOT NULL;"
+
+	"INSERT INTO suspect_packet_counts (ip, interface, " PACKET_COUNT_COLUMNS ")"
+	" SELECT ipv4_to_integer(c.ip), i.id, " PACKET_COUNT_COLUMNS
+	" FROM packet_counts c JOIN interfaces i ON i.name = c.interface WHERE ipv4_to_integer(c.ip) IS NOT NULL;"
+
+	// The text keys could spell the same IP two ways, so the sizes are grouped on the integer key
+	"INSERT INTO suspect_packet_sizes (ip, interface, histogram)"
+	" SELECT ipv4_to_integer(p.ip), i.id, packet_size_histogram(p.packetSize, p.count)"
+	" FROM packet_sizes p JOIN interfaces i ON i.name = p.interface WHERE ipv4_to_integer(p.ip) IS NOT NULL"
+	" GROUP BY ipv4_to_integer(p.ip), i.id;"
+
+	// The text keys could spell the same IP two ways, so counts that end up on one key are added together
+	"INSERT INTO suspect_ip_port_counts (ip, interface, type, dstip, port, count)"
+	" SELECT ipv4_to_integer(c.ip), i.id, " SQL_PROTOCOL_NUMBER("c.type") ", ipv4_to_integer(c.dstip), c.port, c.count"
+	" FROM ip_port_counts c JOIN interfaces i ON i.name = c.interface"
+	" WHERE ipv4_to_integer(c.ip) IS NOT NULL AND ipv4_to_integer(c.dstip) IS NOT NULL AND c.port IS NOT NULL"
+	" ON CONFLICT(ip, interface, type, dstip, port) DO UPDATE SET count = count + excluded.count;"
+
+	"DROP TABLE ip_port_counts;"
+	"DROP TABLE packet_sizes;"
+	"DROP TABLE packet_counts;"
+	"DROP TABLE suspects;";
+
 Database *Database::m_instance = NULL;
 
 int Database::callback(void *NotUsed, int argc, char **argv, char **azColName){
@@ -56,12 +208,21 @@ Database *Database::Inst(std::string databaseFile)
 Database::Database(std::string databaseFile)
 {
 	pthread_mutex_init(&this->m_lock, NULL);
+	pthread_mutex_init(&m_readerLock, NULL);
+	pthread_cond_init(&m_readerReleased, NULL);
+	pthread_mutex_init(&m_checkpointLock, NULL);
+	pthread_mutex_init(&m_loaderLock, NULL);
+	m_openReaders = 0;
+	m_checkpointDb = NULL;
 	if (databaseFile == "")
 	{
 		databaseFile = Config::Inst()->GetPathHome() + "/data/novadDatabase.db";
 	}
 	m_databaseFile = databaseFile;
 	m_count = 0;
+	m_rollupTime = 0;
+	m_rollupIp = 0;
+	m_rollupInterface = 0;
 }
 
 Database::~Database()
@@ -98,167 +259,289 @@ void Database::Connect()
 	if (err != NULL)
 		LOG(ERROR, "Error when trying to set cache_size: " + string(err), "");
 
-	sqlite3_exec(db, "PRAGMA synchronous = OFF", NULL, NULL, &err);
+	// WAL lets the UI's queries read from their own snapshot while we're writing, rather than waiting
+	// for the whole flush to commit. NORMAL only syncs the log at checkpoints, which is as much as OFF
+	// used to cost us with a rollback journal, but a crash can't corrupt the file anymore.
+	sqlite3_stmt *journalMode;
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db, "PRAGMA journal_mode = WAL", -1, &journalMode, NULL));
+	if (sqlite3_step(journalMode) != SQLITE_ROW || string((const char*)sqlite3_column_text(journalMode, 0)) != "wal")
+	{
+		LOG(WARNING, "Unable to put the database in WAL mode, queries will block on the classification flush", "");
+	}
+	sqlite3_finalize(journalMode);
+
+	sqlite3_exec(db, "PRAGMA synchronous = NORMAL", NULL, NULL, &err);
 	if (err != NULL)
 		LOG(ERROR, "Error when setting pragma: " + string(err), "");
 
+	stringstream sizeLimit;
+	sizeLimit << "PRAGMA journal_size_limit = " << DATABASE_WAL_SIZE_LIMIT;
+	sqlite3_exec(db, sizeLimit.str().c_str(), NULL, NULL, &err);
+	if (err != NULL)
+		LOG(ERROR, "Error when setting pragma: " + string(err), "");
+
+	// Checkpoints are Checkpoint()'s job so commits don't stall copying pages back; this is just a backstop
+	SQL_RUN(SQLITE_OK, sqlite3_wal_autocheckpoint(db, DATABASE_WAL_AUTOCHECKPOINT));
+
 	sqlite3_exec(db, "PRAGMA temp_store = MEMORY", NULL, NULL, &err);
 	if (err != NULL)
 		LOG(ERROR, "Error when setting pragma: " + string(err), "");
 
-	// Set up all our prepared queries
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"INSERT INTO packet_counts VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?);",
-		-1, &insertPacketCount,  NULL));
+	RegisterFunctions(db);
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"UPDATE packet_counts SET "
-		" count_tcp = count_tcp + ?3"
-		", count_udp = count_udp + ?4"
-		", count_icmp = count_icmp + ?5"
-		", count_other = count_other + ?6"
-		", count_total = count_total + ?7"
-		", count_tcpRst = count_tcpRst + ?8"
-		", count_tcpAck = count_tcpAck + ?9"
-		", count_tcpSyn = count_tcpSyn + ?10"
-		", count_tcpFin = count_tcpFin + ?11"
-		", count_tcpSynAck = count_tcpSynAck + ?12"
-		", count_bytes = count_bytes + ?13"
-		" WHERE ip = ?1 AND interface = ?2;",
-		-1, &incrementPacketCount,  NULL));
+	// Has to happen before anything is prepared against the suspect tables, none of which would work
+	// on a database that's been left half way between schemas
+	if (!MigrateSchema(db))
+	{
+		LOG(CRITICAL, "Unable to bring the suspect database " + m_databaseFile + " up to schema version "
+			+ to_string(DATABASE_SCHEMA_VERSION) + ". Unable to start.", "");
+		exit(EXIT_FAILURE);
+	}
+
+	// Batched writes of the evidence windows. Every table has a primary key to conflict on, so a
+	// row is inserted or merged into the stored one with a single statement.
+	//
+	// Ugh! I hate having features as columns, but trying to do EAV when sqlite doesn't have PIVOT makes the queries a pain (and slow),
+	// and we can't blob them into a single column since we need to be able to sort by them individually. So, we're stuck with binding
+	// 14+ doubles per suspect. Urgh...
+	InitBatchUpsert(upsertSuspects,
+		"INSERT INTO suspect_records (ip, interface, " SUSPECT_COLUMNS ") VALUES ",
+		9 + DIM,
+		"ON CONFLICT(ip, interface) DO UPDATE SET"
+		" startTime = excluded.startTime, endTime = excluded.endTime, lastTime = excluded.lastTime"
+		", ip_traffic_distribution = excluded.ip_traffic_distribution"
+		", port_traffic_distribution = excluded.port_traffic_distribution"
+		", packet_size_mean = excluded.packet_size_mean"
+		", packet_size_deviation = excluded.packet_size_deviation"
+		", distinct_ips = excluded.distinct_ips"
+		", distinct_tcp_ports = excluded.distinct_tcp_ports"
+		", distinct_udp_ports = excluded.distinct_udp_ports"
+		", avg_tcp_ports_per_host = excluded.avg_tcp_ports_per_host"
+		", avg_udp_ports_per_host = excluded.avg_udp_ports_per_host"
+		", tcp_percent_syn = excluded.tcp_percent_syn"
+		", tcp_percent_fin = excluded.tcp_percent_fin"
+		", tcp_percent_rst = excluded.tcp_percent_rst"
+		", tcp_percent_synack = excluded.tcp_percent_synack"
+		", haystack_percent_contacted = excluded.haystack_percent_contacted;");
+
+	InitBatchUpsert(upsertPacketCounts,
+		"INSERT INTO suspect_packet_counts VALUES ",
+		13,
+		"ON CONFLICT(ip, interface) DO UPDATE SET"
+		" count_tcp = count_tcp + excluded.count_tcp"
+		", count_udp = count_udp + excluded.count_udp"
+		", count_icmp = count_icmp + excluded.count_icmp"
+		", count_other = count_other + excluded.count_other"
+		", count_total = count_total + excluded.count_total"
+		", count_tcpRst = count_tcpRst + excluded.count_tcpRst"
+		", count_tcpAck = count_tcpAck + excluded.count_tcpAck"
+		", count_tcpSyn = count_tcpSyn + excluded.count_tcpSyn"
+		", count_tcpFin = count_tcpFin + excluded.count_tcpFin"
+		", count_tcpSynAck = count_tcpSynAck + excluded.count_tcpSynAck"
+		", count_bytes = count_bytes + excluded.count_bytes;");
+
+	InitBatchUpsert(upsertPacketSizes,
+		"INSERT INTO suspect_packet_sizes VALUES ",
+		3,
+		"ON CONFLICT(ip, interface) DO UPDATE SET histogram = packet_size_histogram_merge(histogram, excluded.histogram);");
+
+	InitBatchUpsert(upsertIpPortCounts,
+		"INSERT INTO suspect_ip_port_counts VALUES ",
+		6,
+		"ON CONFLICT(ip, interface, type, dstip, port) DO UPDATE SET count = count + excluded.count;");
+
+	InitBatchUpsert(upsertDistinctCounts,
+		"INSERT INTO suspect_distinct_counts VALUES ",
+		4,
+		"ON CONFLICT(ip, interface, type) DO UPDATE SET counter = excluded.counter;");
+
+
+	// Queries to rebuild a suspect's FeatureAggregate
+	SQL_RUN(SQLITE_OK, sqlite3_open_v2(m_databaseFile.c_str(), &m_loaderDb, SQLITE_OPEN_READONLY, NULL));
+	sqlite3_busy_timeout(m_loaderDb, DATABASE_READER_BUSY_TIMEOUT);
+
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(m_loaderDb,
+		"SELECT histogram FROM suspect_packet_sizes WHERE ip = ?1 AND interface = (SELECT id FROM interfaces WHERE name = ?2);",
+		-1, &selectPacketSizes, NULL));
+
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(m_loaderDb,
+		"SELECT type, dstip, port, count FROM suspect_ip_port_counts WHERE ip = ?1 AND interface = (SELECT id FROM interfaces WHERE name = ?2);",
+		-1, &selectIpPortCounts, NULL));
+
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(m_loaderDb,
+		"SELECT type, counter FROM suspect_distinct_counts WHERE ip = ?1 AND interface = (SELECT id FROM interfaces WHERE name = ?2);",
+		-1, &selectDistinctCounts, NULL));
+
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(m_loaderDb,
+		"SELECT * FROM suspect_packet_counts WHERE ip = ?1 AND interface = (SELECT id FROM interfaces WHERE name = ?2);",
+		-1, &selectPacketCounts, NULL));
+
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(m_loaderDb,
+		"SELECT dstip, count FROM suspect_ip_summaries WHERE ip = ?1 AND interface = (SELECT id FROM interfaces WHERE name = ?2);",
+		-1, &selectIpSummaries, NULL));
+
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(m_loaderDb,
+		"SELECT type, port, count FROM suspect_port_summaries WHERE ip = ?1 AND interface = (SELECT id FROM interfaces WHERE name = ?2);",
+		-1, &selectPortSummaries, NULL));
 
 	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"INSERT OR IGNORE INTO suspects (ip, interface, startTime, endTime, lastTime, classification, hostileNeighbors, isHostile, classificationNotes) "
-		"VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)",
-		-1, &insertSuspect,  NULL));
+		"INSERT OR IGNORE INTO honeypots VALUES(?1)",
+		-1, &insertHoneypotIp, NULL));
 
 	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"UPDATE suspects "
-		" SET startTime = ?3, endTime = ?4, lastTime = ?5"
+		"UPDATE suspect_records "
+		" SET classification = ?3, classificationNotes = ?4, hostileNeighbors = ?5, isHostile = ?6 "
 		" WHERE ip = ?1 AND interface = ?2",
-		-1, &updateSuspectTimestamps,  NULL));
+		-1, &updateClassification, NULL));
 
 	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"INSERT INTO ip_port_counts VALUES(?1, ?2, ?3, ?4, ?5, 1)",
-		-1, &insertPortContacted, NULL));
+		"INSERT INTO suspect_alerts (ip, interface, " SUSPECT_COLUMNS ") "
+		" SELECT " SQL_IP_TEXT("s.ip") ", i.name, " SUSPECT_COLUMNS
+		" FROM suspect_records s JOIN interfaces i ON i.id = s.interface"
+		" WHERE s.ip = ?1 AND s.interface = ?2",
+		-1 , &createHostileAlert, NULL));
 
 	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"UPDATE ip_port_counts SET count = count + ?6 WHERE ip = ?1 AND interface = ?2 AND type = ?3 AND dstip = ?4 AND port = ?5",
-		-1, &incrementPortContacted, NULL));
+		"SELECT isHostile, classification FROM suspect_records WHERE ip = ?1 AND interface = ?2",
+		-1, &isSuspectHostile, NULL));
 
 	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"INSERT INTO packet_sizes VALUES(?1, ?2, ?3, ?4);",
-		-1, &insertPacketSize,  NULL));
+		"SELECT count_total FROM suspect_packet_counts WHERE ip = ?1 AND interface = ?2",
+		-1, &getTotalPackets, NULL));
 
 	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"UPDATE packet_sizes SET count = count + ?4 WHERE ip = ?1 AND interface = ?2 AND packetSize = ?3;",
-		-1, &incrementPacketSize,  NULL));
+		"INSERT OR IGNORE INTO interfaces (name) VALUES(?1)",
+		-1, &insertInterface, NULL));
 
-	// Ugh! I hate having features as columns, but trying to do EAV when sqlite doesn't have PIVOT makes the queries a pain (and slow),
-	// and we can't blob them into a single column since we need to be able to sort by them individually. So, we're stuck with binding
-	// 14+ doubles into the prepared statement. Urgh...
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"UPDATE suspects SET"
-		" ip_traffic_distribution = ?1"
-		", port_traffic_distribution = ?2"
-		", packet_size_mean = ?3"
-		", packet_size_deviation = ?4"
-		", distinct_ips = ?5"
-		", distinct_tcp_ports = ?6"
-		", distinct_udp_ports = ?7"
-		", avg_tcp_ports_per_host = ?8"
-		", avg_udp_ports_per_host = ?9"
-		", tcp_percent_syn = ?10"
-	    ", tcp_percent_fin = ?11"
-		", tcp_percent_rst = ?12"
-		", tcp_percent_synack = ?13"
-		", haystack_percent_contacted = ?14"
-		" WHERE ip = ?15 AND interface = ?16",
-		-1, &setFeatureValues, NULL));
-
-
-	// Queries for featureset computation
 	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"SELECT (1.0*packet_counts.count_bytes) / (1.0*SUM(packet_sizes.count))"
-		" FROM packet_counts INNER JOIN packet_sizes"
-		" ON packet_counts.ip = packet_sizes.ip AND packet_counts.interface = packet_sizes.interface"
-		" AND packet_counts.ip = ?1"
-		" AND packet_counts.interface = ?2;",
-		-1, &computePacketSizeMean, NULL));
+		"SELECT id FROM interfaces WHERE name = ?1",
+		-1, &selectInterfaceId, NULL));
+}
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"SELECT SUM((packet_sizes.count)*(packet_sizes.packetSize-?3)*(packet_sizes.packetSize-?3))/(1.0*packet_counts.count_total)"
-		" FROM packet_counts INNER JOIN packet_sizes"
-		" ON packet_counts.ip = packet_sizes.ip AND packet_counts.interface = packet_sizes.interface"
-		" AND packet_counts.ip = ?1"
-		" AND packet_counts.interface = ?2",
-		-1, &computePacketSizeVariance, NULL));
+bool Database::MigrateDatabase(const string &databaseFile)
+{
+	int res;
+	sqlite3 *db;
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"SELECT COUNT(DISTINCT dstip) FROM ip_port_counts WHERE ip = ?1 AND interface = ?2",
-		-1, &computeDistinctIps, NULL));
+	SQL_RUN(SQLITE_OK, sqlite3_open(databaseFile.c_str(), &db));
+	if (res != SQLITE_OK)
+	{
+		sqlite3_close(db);
+		return false;
+	}
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"SELECT COUNT(DISTINCT port) FROM ip_port_counts WHERE ip = ?1 AND interface = ?2 AND type = ?3",
-		-1, &computeDistinctPorts, NULL));
+	sqlite3_exec(db, "PRAGMA foreign_keys = ON", NULL, NULL, NULL);
+	RegisterFunctions(db);
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"SELECT COUNT(*) FROM (SELECT DISTINCT port, dstip FROM ip_port_counts WHERE ip = ?1 AND interface = ?2 AND type = ?3);",
-		-1, &computeDistinctIpPorts, NULL));
+	bool migrated = MigrateSchema(db);
+	sqlite3_close(db);
+	return migrated;
+}
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"SELECT * FROM packet_counts WHERE ip = ?1 AND interface = ?2;",
-		-1, &selectPacketCounts, NULL));
+void Database::RegisterFunctions(sqlite3 *db)
+{
+	int res;
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		" SELECT MAX(t) FROM (SELECT dstip, SUM(count) AS t FROM ip_port_counts WHERE ip = ?1 AND interface = ?2 GROUP BY dstip);",
-		-1, &computeMaxPacketsToIp, NULL));
+	SQL_RUN(SQLITE_OK, sqlite3_create_function(db, "packet_size_histogram_merge", 2, SQLITE_UTF8, NULL,
+		&Database::MergeHistogramsFunction, NULL, NULL));
+	SQL_RUN(SQLITE_OK, sqlite3_create_function(db, "packet_size_histogram", 2, SQLITE_UTF8, NULL,
+		NULL, &Database::HistogramStepFunction, &Database::HistogramFinalFunction));
+	SQL_RUN(SQLITE_OK, sqlite3_create_function(db, "ipv4_to_integer", 1, SQLITE_UTF8, NULL,
+		&Database::IpToIntegerFunction, NULL, NULL));
+}
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		" SELECT MAX(t) FROM (SELECT port, SUM(count) AS t FROM ip_port_counts WHERE ip = ?1 AND interface = ?2 AND TYPE = ?3 GROUP BY port);",
-		-1, &computeMaxPacketsToPort, NULL));
+bool Database::MigrateSchema(sqlite3 *db)
+{
+	int res;
+	sqlite3_stmt *stmt;
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"INSERT OR IGNORE INTO honeypots VALUES(?1)",
-		-1, &insertHoneypotIp, NULL));
+	int version = 0;
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db, "PRAGMA user_version", -1, &stmt, NULL));
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		version = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"SELECT 1.0*(SELECT COUNT(DISTINCT honeypots.ip)"
-		" FROM honeypots, ip_port_counts "
-		" WHERE ip_port_counts.ip = ?1 AND interface = ?2 AND honeypots.ip = ip_port_counts.dstip) / (1.0*(SELECT COUNT(ip) FROM honeypots));",
-		-1, &computeHoneypotsContacted, NULL));
+	if (version >= DATABASE_SCHEMA_VERSION)
+	{
+		return true;
+	}
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"UPDATE suspects "
-		" SET classification = ?3, classificationNotes = ?4, hostileNeighbors = ?5, isHostile = ?6 "
-		" WHERE ip = ?1 AND interface = ?2",
-		-1, &updateClassification, NULL));
+	// Version 1 never set user_version, so tell it apart from an empty file by its tables
+	bool hasVersion1Tables = false;
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'suspects'", -1, &stmt, NULL));
+	hasVersion1Tables = (sqlite3_step(stmt) == SQLITE_ROW);
+	sqlite3_finalize(stmt);
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"INSERT INTO suspect_alerts (ip, interface, startTime, endTime, lastTime, classification, hostileNeighbors, isHostile, classificationNotes, ip_traffic_distribution, port_traffic_distribution, packet_size_mean, packet_size_deviation, distinct_ips, distinct_tcp_ports, distinct_udp_ports, avg_tcp_ports_per_host, avg_udp_ports_per_host, tcp_percent_syn, tcp_percent_fin, tcp_percent_rst, tcp_percent_synack, haystack_percent_contacted) "
-		" SELECT * FROM suspects"
-		" WHERE ip = ? AND interface = ?",
-		-1 , &createHostileAlert, NULL));
+	if (version != 0 || hasVersion1Tables)
+	{
+		LOG(INFO, "Migrating the suspect database to schema version " + to_string(DATABASE_SCHEMA_VERSION), "");
+	}
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"SELECT isHostile, classification FROM suspects WHERE ip = ? AND interface = ?",
-		-1, &isSuspectHostile, NULL));
+	string script = "BEGIN;";
+	if (version < 2)
+	{
+		script += SUSPECT_TABLES;
+		if (hasVersion1Tables)
+		{
+			script += MIGRATE_FROM_VERSION_1;
+		}
+		script += SUSPECT_VIEWS;
+	}
+	script += RETENTION_TABLES;
+	script += "PRAGMA user_version = " + to_string(DATABASE_SCHEMA_VERSION) + ";";
+	script += "COMMIT;";
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"SELECT count_total FROM packet_counts WHERE ip = ? AND interface = ?",
-		-1, &getTotalPackets, NULL));
+	char *err = NULL;
+	sqlite3_exec(db, script.c_str(), NULL, NULL, &err);
+	if (err != NULL)
+	{
+		LOG(ERROR, "Unable to migrate the suspect database, leaving it as it was: " + string(err), "");
+		sqlite3_free(err);
+		sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+		return false;
+	}
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
-		"SELECT ip, interface FROM suspects WHERE isHostile = 1",
-		-1, &getHostileSuspects, NULL));
+	return true;
+}
+
+int64_t Database::GetInterfaceId(const string &interface)
+{
+	map<string, int64_t>::iterator it = m_interfaceIds.find(interface);
+	if (it != m_interfaceIds.end())
+	{
+		return it->second;
+	}
+
+	int res;
+	int64_t id = -1;
+
+	SQL_RUN(SQLITE_OK, sqlite3_bind_text(insertInterface, 1, interface.c_str(), -1, SQLITE_STATIC));
+	SQL_RUN(SQLITE_DONE, sqlite3_step(insertInterface));
+	SQL_RUN(SQLITE_OK, sqlite3_reset(insertInterface));
+
+	SQL_RUN(SQLITE_OK, sqlite3_bind_text(selectInterfaceId, 1, interface.c_str(), -1, SQLITE_STATIC));
+	if (sqlite3_step(selectInterfaceId) == SQLITE_ROW)
+	{
+		id = sqlite3_column_int64(selectInterfaceId, 0);
+		m_interfaceIds[interface] = id;
+	}
+	else
+	{
+		LOG(ERROR, "Unable to get an id for interface " + interface + ": " + string(sqlite3_errmsg(db)), "");
+	}
+	SQL_RUN(SQLITE_OK, sqlite3_reset(selectInterfaceId));
+
+	return id;
 }
 
 void Database::WriteClassification(Suspect *s)
 {
 	int res;
 
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(updateClassification, 1, s->GetIpString().c_str(), -1, SQLITE_TRANSIENT));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(updateClassification, 2, s->GetInterface().c_str(), -1, SQLITE_TRANSIENT));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_int64(updateClassification, 1, s->GetIdentifier().m_ip()));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_int64(updateClassification, 2, GetInterfaceId(s->GetInterface())));
 	SQL_RUN(SQLITE_OK, sqlite3_bind_double(updateClassification, 3, s->GetClassification()));
 	SQL_RUN(SQLITE_OK, sqlite3_bind_text(updateClassification, 4, s->m_classificationNotes.c_str(), -1, SQLITE_TRANSIENT));
 	SQL_RUN(SQLITE_OK, sqlite3_bind_int(updateClassification, 5, s->GetHostileNeighbors()));
@@ -269,57 +552,52 @@ void Database::WriteClassification(Suspect *s)
 	SQL_RUN(SQLITE_OK, sqlite3_reset(updateClassification));
 }
 
-void Database::WriteTimestamps(Suspect *s)
-{
-	int res;
-
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(updateSuspectTimestamps, 1, s->GetIpString().c_str(), -1, SQLITE_TRANSIENT));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(updateSuspectTimestamps, 2, s->GetInterface().c_str(), -1, SQLITE_TRANSIENT));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(updateSuspectTimestamps, 3, static_cast<long int>(s->m_features.m_startTime)));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(updateSuspectTimestamps, 4, static_cast<long int>(s->m_features.m_endTime)));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(updateSuspectTimestamps, 5, static_cast<long int>(s->m_features.m_lastTime)));
-
-	m_count++;
-	SQL_RUN(SQLITE_DONE,sqlite3_step(updateSuspectTimestamps));
-	SQL_RUN(SQLITE_OK, sqlite3_reset(updateSuspectTimestamps));
-}
-
 vector<SuspectID_pb> Database::GetHostileSuspects()
 {
 	int res;
+	sqlite3_stmt *stmt;
 
 	vector<SuspectID_pb> hostiles;
 
-	m_count++;
-	res = sqlite3_step(getHostileSuspects);
+	// Shadows the writer so SQL_RUN reports this connection's errors
+	sqlite3 *db = AcquireReader();
+	if (db == NULL)
+	{
+		return hostiles;
+	}
+
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
+		"SELECT s.ip, i.name FROM suspect_records s JOIN interfaces i ON i.id = s.interface WHERE s.isHostile = 1",
+		-1, &stmt, NULL));
+
+	res = sqlite3_step(stmt);
 
 	while (res == SQLITE_ROW)
 	{
 		SuspectID_pb id;
 
-		id.set_m_ip(inet_network((const char*)sqlite3_column_text(getHostileSuspects, 0)));
-		id.set_m_ifname(string((const char*)sqlite3_column_text(getHostileSuspects, 1)));
+		id.set_m_ip(sqlite3_column_int64(stmt, 0));
+		id.set_m_ifname(string((const char*)sqlite3_column_text(stmt, 1)));
 
 		hostiles.push_back(id);
 
-		res = sqlite3_step(getHostileSuspects);
+		res = sqlite3_step(stmt);
 	}
 
-	SQL_RUN(SQLITE_OK, sqlite3_reset(getHostileSuspects));
-
-
+	sqlite3_finalize(stmt);
+	ReleaseReader(db);
 
 	return hostiles;
-
 }
 
-uint64_t Database::GetTotalPacketCount(const string &ip, const string &interface)
+uint64_t Database::GetTotalPacketCount(uint32_t ip, const string &interface)
 {
 	int res;
+	int64_t interfaceId = GetInterfaceId(interface);
 	uint64_t packets = 0;
 
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(getTotalPackets, 1, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(getTotalPackets, 2, interface.c_str(), -1, SQLITE_STATIC));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_int64(getTotalPackets, 1, ip));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_int64(getTotalPackets, 2, interfaceId));
 
 	m_count++;
 	res = sqlite3_step(getTotalPackets);
@@ -334,215 +612,179 @@ uint64_t Database::GetTotalPacketCount(const string &ip, const string &interface
 	return packets;
 }
 
-vector<double> Database::ComputeFeatures(const string &ip, const string &interface)
+void Database::LoadFeatureAggregate(uint32_t ip, const string &interface, FeatureAggregate &aggregate, const HoneypotSet &honeypots)
 {
 	int res;
+	Lock lock(&m_loaderLock);
+	// Shadows the writer so SQL_RUN reports this connection's errors
+	sqlite3 *db = m_loaderDb;
 
-	// Create someplace to store our computed results
-	vector<double> featureValues(DIM, 0);
-
-	// Compute the packet size mean
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(computePacketSizeMean, 1, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(computePacketSizeMean, 2, interface.c_str(), -1, SQLITE_STATIC));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_int64(selectPacketCounts, 1, ip));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_text(selectPacketCounts, 2, interface.c_str(), -1, SQLITE_STATIC));
 
 	m_count++;
-	SQL_RUN(SQLITE_ROW, sqlite3_step(computePacketSizeMean));
-	featureValues[PACKET_SIZE_MEAN] = sqlite3_column_double(computePacketSizeMean, 0);
-
-	SQL_RUN(SQLITE_OK, sqlite3_reset(computePacketSizeMean));
-
-
-	// Compute the packet size deviation
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(computePacketSizeVariance, 1, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(computePacketSizeVariance, 2, interface.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_double(computePacketSizeVariance, 3, featureValues[PACKET_SIZE_MEAN]));
+	res = sqlite3_step(selectPacketCounts);
 
-	// SQL query gives us the variance, take sqrt to get the standard deviation
-	m_count++;
-	SQL_RUN(SQLITE_ROW, sqlite3_step(computePacketSizeVariance));
-	featureValues[PACKET_SIZE_DEVIATION] = sqrt(sqlite3_column_double(computePacketSizeVariance, 0));
+	// No row just means this is a new suspect
+	if (res == SQLITE_ROW)
+	{
+		aggregate.AddPacketCounts(
+				sqlite3_column_int64(selectPacketCounts, 6),
+				sqlite3_column_int64(selectPacketCounts, 2),
+				sqlite3_column_int64(selectPacketCounts, 7),
+				sqlite3_column_int64(selectPacketCounts, 9),
+				sqlite3_column_int64(selectPacketCounts, 10),
+				sqlite3_column_int64(selectPacketCounts, 11));
+	}
+	else if (res != SQLITE_DONE)
+	{
+		LOG(ERROR, "Unable to get packet counts from the database for suspect: " + Suspect::GetIpString(ip) + "/" + interface, "");
+	}
 
-	SQL_RUN(SQLITE_OK, sqlite3_reset(computePacketSizeVariance));
+	SQL_RUN(SQLITE_OK, sqlite3_reset(selectPacketCounts));
 
 
-	// Compute the distinct IPs contacted
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeDistinctIps, 1, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeDistinctIps, 2, interface.c_str(), -1, SQLITE_STATIC));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_int64(selectPacketSizes, 1, ip));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_text(selectPacketSizes, 2, interface.c_str(), -1, SQLITE_STATIC));
 
 	m_count++;
-	SQL_RUN(SQLITE_ROW, sqlite3_step(computeDistinctIps));
-	featureValues[DISTINCT_IPS] = sqlite3_column_double(computeDistinctIps, 0);
-
-	SQL_RUN(SQLITE_OK, sqlite3_reset(computeDistinctIps));
-
-
-	// Compute the distinct TCP ports contacted
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeDistinctPorts, 1, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeDistinctPorts, 2, interface.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeDistinctPorts, 3, "tcp", -1, SQLITE_STATIC));
+	res = sqlite3_step(selectPacketSizes);
 
-	m_count++;
-	SQL_RUN(SQLITE_ROW, sqlite3_step(computeDistinctPorts));
-	featureValues[DISTINCT_TCP_PORTS] = sqlite3_column_double(computeDistinctPorts, 0);
+	if (res == SQLITE_ROW)
+	{
+		try
+		{
+			PacketSizeHistogram sizes;
+			sizes.Deserialize((u_char*)sqlite3_column_blob(selectPacketSizes, 0), sqlite3_column_bytes(selectPacketSizes, 0));
+			aggregate.AddPacketSizes(sizes);
+		}
+		catch(serializationException &e)
+		{
+			LOG(ERROR, "Unable to read the packet size histogram for suspect: " + Suspect::GetIpString(ip) + "/" + interface, "");
+		}
+	}
 
-	SQL_RUN(SQLITE_OK, sqlite3_reset(computeDistinctPorts));
+	SQL_RUN(SQLITE_OK, sqlite3_reset(selectPacketSizes));
 
 
-	// Compute the distinct UDP ports contacted
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeDistinctPorts, 1, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeDistinctPorts, 2, interface.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeDistinctPorts, 3, "udp", -1, SQLITE_STATIC));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_int64(selectIpPortCounts, 1, ip));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_text(selectIpPortCounts, 2, interface.c_str(), -1, SQLITE_STATIC));
 
 	m_count++;
-	SQL_RUN(SQLITE_ROW, sqlite3_step(computeDistinctPorts));
-	featureValues[DISTINCT_UDP_PORTS] = sqlite3_column_double(computeDistinctPorts, 0);
-
-	SQL_RUN(SQLITE_OK, sqlite3_reset(computeDistinctPorts));
-
-
-	if (featureValues[DISTINCT_IPS] > 0) {
-		// Compute the average TCP ports per host
-		SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeDistinctIpPorts, 1, ip.c_str(), -1, SQLITE_STATIC));
-		SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeDistinctIpPorts, 2, interface.c_str(), -1, SQLITE_STATIC));
-		SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeDistinctIpPorts, 3, "tcp", -1, SQLITE_STATIC));
-
-		m_count++;
-		SQL_RUN(SQLITE_ROW, sqlite3_step(computeDistinctIpPorts));
-		featureValues[AVG_TCP_PORTS_PER_HOST] = sqlite3_column_double(computeDistinctIpPorts, 0) / featureValues[DISTINCT_IPS];
+	res = sqlite3_step(selectIpPortCounts);
 
-		SQL_RUN(SQLITE_OK, sqlite3_reset(computeDistinctIpPorts));
-
-
-		// Compute the average UDP ports per host
-		SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeDistinctIpPorts, 1, ip.c_str(), -1, SQLITE_STATIC));
-		SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeDistinctIpPorts, 2, interface.c_str(), -1, SQLITE_STATIC));
-		SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeDistinctIpPorts, 3, "udp", -1, SQLITE_STATIC));
-
-		m_count++;
-		SQL_RUN(SQLITE_ROW, sqlite3_step(computeDistinctIpPorts));
-		featureValues[AVG_UDP_PORTS_PER_HOST] = sqlite3_column_double(computeDistinctIpPorts, 0) / featureValues[DISTINCT_IPS];
-
-		SQL_RUN(SQLITE_OK, sqlite3_reset(computeDistinctIpPorts));
+	while (res == SQLITE_ROW)
+	{
+		aggregate.AddIpPortCount(
+				sqlite3_column_int(selectIpPortCounts, 0),
+				sqlite3_column_int64(selectIpPortCounts, 1),
+				sqlite3_column_int(selectIpPortCounts, 2),
+				sqlite3_column_int64(selectIpPortCounts, 3),
+				honeypots);
+
+		res = sqlite3_step(selectIpPortCounts);
 	}
 
+	SQL_RUN(SQLITE_OK, sqlite3_reset(selectIpPortCounts));
 
 
-
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(selectPacketCounts, 1, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(selectPacketCounts, 2, interface.c_str(), -1, SQLITE_STATIC));
-
-	double totalTcpPackets = 0, synPackets = 0, finPackets = 0, rstPackets = 0, synAckPackets = 0, totalPackets = 0;
+	// Whatever of the IP/port counts retention has rolled up
+	SQL_RUN(SQLITE_OK, sqlite3_bind_int64(selectIpSummaries, 1, ip));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_text(selectIpSummaries, 2, interface.c_str(), -1, SQLITE_STATIC));
 
 	m_count++;
-	res = sqlite3_step(selectPacketCounts);
+	res = sqlite3_step(selectIpSummaries);
 
-	if (res == SQLITE_ROW)
-	{
-		totalTcpPackets = sqlite3_column_int64(selectPacketCounts, 2);
-		totalPackets = sqlite3_column_int64(selectPacketCounts, 6);
-		rstPackets = sqlite3_column_int64(selectPacketCounts, 7);
-		synPackets = sqlite3_column_int64(selectPacketCounts, 9);
-		finPackets = sqlite3_column_int64(selectPacketCounts, 10);
-		synAckPackets = sqlite3_column_int64(selectPacketCounts, 11);
-	}
-	else
+	while (res == SQLITE_ROW)
 	{
-		LOG(ERROR, "Unable to get packet counts from the database for suspect: " + ip + "/" + interface, "");
+		aggregate.AddDestinationTotal(sqlite3_column_int64(selectIpSummaries, 0), sqlite3_column_int64(selectIpSummaries, 1), honeypots);
+		res = sqlite3_step(selectIpSummaries);
 	}
 
-	SQL_RUN(SQLITE_OK, sqlite3_reset(selectPacketCounts));
+	SQL_RUN(SQLITE_OK, sqlite3_reset(selectIpSummaries));
+
+	SQL_RUN(SQLITE_OK, sqlite3_bind_int64(selectPortSummaries, 1, ip));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_text(selectPortSummaries, 2, interface.c_str(), -1, SQLITE_STATIC));
+
+	m_count++;
+	res = sqlite3_step(selectPortSummaries);
 
-	if (totalTcpPackets != 0)
+	while (res == SQLITE_ROW)
 	{
-		featureValues[TCP_PERCENT_SYN] = synPackets / totalTcpPackets;
-		featureValues[TCP_PERCENT_FIN] = finPackets / totalTcpPackets;
-		featureValues[TCP_PERCENT_RST] = rstPackets / totalTcpPackets;
-		featureValues[TCP_PERCENT_SYNACK] = synAckPackets / totalTcpPackets;
+		aggregate.AddPortTotal(sqlite3_column_int(selectPortSummaries, 0), sqlite3_column_int(selectPortSummaries, 1), sqlite3_column_int64(selectPortSummaries, 2));
+		res = sqlite3_step(selectPortSummaries);
 	}
 
+	SQL_RUN(SQLITE_OK, sqlite3_reset(selectPortSummaries));
 
-	if (featureValues[DISTINCT_IPS] > 0) {
-		// Compute the "ip traffic distribution", which is basically just (TotalSuspectPackets/TotalSuspectDstIps)/maxPacketsToSingleDstIp
-		SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeMaxPacketsToIp, 1, ip.c_str(), -1, SQLITE_STATIC));
-		SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeMaxPacketsToIp, 2, interface.c_str(), -1, SQLITE_STATIC));
 
-		m_count++;
-		SQL_RUN(SQLITE_ROW, sqlite3_step(computeMaxPacketsToIp));
-		featureValues[IP_TRAFFIC_DISTRIBUTION] = totalPackets / featureValues[DISTINCT_IPS] / sqlite3_column_double(computeMaxPacketsToIp, 0);
+	// Adding the same IP/port pair twice doesn't change a distinct count, so it doesn't matter
+	// that these cover the rows we just read
+	SQL_RUN(SQLITE_OK, sqlite3_bind_int64(selectDistinctCounts, 1, ip));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_text(selectDistinctCounts, 2, interface.c_str(), -1, SQLITE_STATIC));
 
-		SQL_RUN(SQLITE_OK, sqlite3_reset(computeMaxPacketsToIp));
+	m_count++;
+	res = sqlite3_step(selectDistinctCounts);
 
-		if ((featureValues[DISTINCT_TCP_PORTS] + featureValues[DISTINCT_UDP_PORTS]) > 0)
+	while (res == SQLITE_ROW)
+	{
+		try
 		{
-			// Compute the "port traffic distribution", which is basically just (TotalSuspectPackets/TotalSuspectDstPorts)/maxPacketsToSingleDstPort
-			SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeMaxPacketsToPort, 1, ip.c_str(), -1, SQLITE_STATIC));
-			SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeMaxPacketsToPort, 2, interface.c_str(), -1, SQLITE_STATIC));
-			SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeMaxPacketsToPort, 3, "tcp", -1, SQLITE_STATIC));
-
-			m_count++;
-			SQL_RUN(SQLITE_ROW, sqlite3_step(computeMaxPacketsToPort));
-			double maxPacketsToTcpPort = sqlite3_column_double(computeMaxPacketsToPort, 0);
-			SQL_RUN(SQLITE_OK, sqlite3_reset(computeMaxPacketsToPort));
-
-			SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeMaxPacketsToPort, 1, ip.c_str(), -1, SQLITE_STATIC));
-			SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeMaxPacketsToPort, 2, interface.c_str(), -1, SQLITE_STATIC));
-			SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeMaxPacketsToPort, 3, "udp", -1, SQLITE_STATIC));
-
-			m_count++;
-			SQL_RUN(SQLITE_ROW, sqlite3_step(computeMaxPacketsToPort));
-			double maxPacketsToUdpPort = sqlite3_column_double(computeMaxPacketsToPort, 0);
-			SQL_RUN(SQLITE_OK, sqlite3_reset(computeMaxPacketsToPort));
-
-			featureValues[PORT_TRAFFIC_DISTRIBUTION] = totalPackets
-					/ (featureValues[DISTINCT_TCP_PORTS] + featureValues[DISTINCT_UDP_PORTS])
-					/ max(maxPacketsToTcpPort, maxPacketsToUdpPort);
+			DistinctCounter counter;
+			counter.Deserialize((u_char*)sqlite3_column_blob(selectDistinctCounts, 1), sqlite3_column_bytes(selectDistinctCounts, 1));
+			aggregate.AddIpPorts(sqlite3_column_int(selectDistinctCounts, 0), counter);
+		}
+		catch(serializationException &e)
+		{
+			LOG(ERROR, "Unable to read the distinct IP/port count for suspect: " + Suspect::GetIpString(ip) + "/" + interface, "");
 		}
 
-
-		// Compute the haystack percent contacted
-		SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeHoneypotsContacted, 1, ip.c_str(), -1, SQLITE_STATIC));
-		SQL_RUN(SQLITE_OK, sqlite3_bind_text(computeHoneypotsContacted, 2, interface.c_str(), -1, SQLITE_STATIC));
-		m_count++;
-		SQL_RUN(SQLITE_ROW, sqlite3_step(computeHoneypotsContacted));
-		featureValues[HAYSTACK_PERCENT_CONTACTED] = sqlite3_column_double(computeHoneypotsContacted, 0);
-		SQL_RUN(SQLITE_OK, sqlite3_reset(computeHoneypotsContacted));
+		res = sqlite3_step(selectDistinctCounts);
 	}
 
-
-	// Dump all of our results back into the database
-	SetFeatureSetValue(ip, interface, featureValues);
-
-	return featureValues;
-
+	SQL_RUN(SQLITE_OK, sqlite3_reset(selectDistinctCounts));
 }
 
 bool Database::Disconnect()
 {
-	sqlite3_finalize(insertSuspect);
-	sqlite3_finalize(insertPacketCount);
-	sqlite3_finalize(incrementPacketCount);
-	sqlite3_finalize(insertPortContacted);
-	sqlite3_finalize(incrementPortContacted);
-	sqlite3_finalize(insertPacketSize);
-	sqlite3_finalize(incrementPacketSize);
-	sqlite3_finalize(setFeatureValues);
+	FinalizeBatchUpsert(upsertSuspects);
+	FinalizeBatchUpsert(upsertPacketCounts);
+	FinalizeBatchUpsert(upsertPacketSizes);
+	FinalizeBatchUpsert(upsertIpPortCounts);
+	FinalizeBatchUpsert(upsertDistinctCounts);
 	sqlite3_finalize(insertFeatureValue);
-	sqlite3_finalize(computePacketSizeMean);
-	sqlite3_finalize(computePacketSizeVariance);
-	sqlite3_finalize(computeDistinctIps);
-	sqlite3_finalize(computeDistinctPorts);
-	sqlite3_finalize(computeDistinctIpPorts);
+	sqlite3_finalize(selectPacketSizes);
 	sqlite3_finalize(selectPacketCounts);
-	sqlite3_finalize(computeMaxPacketsToIp);
-	sqlite3_finalize(computeMaxPacketsToPort);
-	sqlite3_finalize(computeHoneypotsContacted);
+	sqlite3_finalize(selectIpPortCounts);
+	sqlite3_finalize(selectDistinctCounts);
+	sqlite3_finalize(selectIpSummaries);
+	sqlite3_finalize(selectPortSummaries);
+	sqlite3_close(m_loaderDb);
 	sqlite3_finalize(insertHoneypotIp);
 	sqlite3_finalize(updateClassification);
-	sqlite3_finalize(updateSuspectTimestamps);
+	sqlite3_finalize(insertInterface);
+	sqlite3_finalize(selectInterfaceId);
 	sqlite3_finalize(createHostileAlert);
 	sqlite3_finalize(isSuspectHostile);
 	sqlite3_finalize(getTotalPackets);
-	sqlite3_finalize(getHostileSuspects);
+
+	m_interfaceIds.clear();
+
+	{
+		Lock lock(&m_readerLock);
+		for (uint i = 0; i < m_idleReaders.size(); i++)
+		{
+			sqlite3_close(m_idleReaders[i]);
+		}
+		m_openReaders -= m_idleReaders.size();
+		m_idleReaders.clear();
+	}
+
+	{
+		Lock lock(&m_checkpointLock);
+		sqlite3_close(m_checkpointDb);
+		m_checkpointDb = NULL;
+	}
 
 	if (sqlite3_close(db) != SQLITE_OK)
 	{
@@ -552,6 +794,74 @@ bool Database::Disconnect()
 	return true;
 }
 
+sqlite3 *Database::AcquireReader()
+{
+	Lock lock(&m_readerLock);
+
+	while (m_idleReaders.empty() && m_openReaders >= DATABASE_READERS)
+	{
+		pthread_cond_wait(&m_readerReleased, &m_readerLock);
+	}
+
+	if (!m_idleReaders.empty())
+	{
+		sqlite3 *reader = m_idleReaders.back();
+		m_idleReaders.pop_back();
+		return reader;
+	}
+
+	sqlite3 *reader;
+	if (sqlite3_open_v2(m_databaseFile.c_str(), &reader, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK)
+	{
+		LOG(ERROR, "Unable to open a read only connection to " + m_databaseFile + ": " + string(sqlite3_errmsg(reader)), "");
+		sqlite3_close(reader);
+		return NULL;
+	}
+	sqlite3_busy_timeout(reader, DATABASE_READER_BUSY_TIMEOUT);
+
+	m_openReaders++;
+	return reader;
+}
+
+void Database::ReleaseReader(sqlite3 *reader)
+{
+	Lock lock(&m_readerLock);
+	m_idleReaders.push_back(reader);
+	pthread_cond_signal(&m_readerReleased);
+}
+
+void Database::Checkpoint()
+{
+	// Deliberately not m_lock: a passive checkpoint only copies frames no reader still needs and
+	// never takes the write lock, so it runs alongside the classification flush
+	Lock lock(&m_checkpointLock);
+
+	if (m_checkpointDb == NULL)
+	{
+		if (sqlite3_open_v2(m_databaseFile.c_str(), &m_checkpointDb, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK)
+		{
+			LOG(ERROR, "Unable to open a connection to checkpoint " + m_databaseFile + ": " + string(sqlite3_errmsg(m_checkpointDb)), "");
+			sqlite3_close(m_checkpointDb);
+			m_checkpointDb = NULL;
+			return;
+		}
+	}
+
+	int logFrames, checkpointedFrames;
+	int res = sqlite3_wal_checkpoint_v2(m_checkpointDb, NULL, SQLITE_CHECKPOINT_PASSIVE, &logFrames, &checkpointedFrames);
+	if (res != SQLITE_OK && res != SQLITE_BUSY)
+	{
+		LOG(WARNING, "Unable to checkpoint the database: " + string(sqlite3_errmsg(m_checkpointDb)), "");
+	}
+	else if (checkpointedFrames < logFrames)
+	{
+		// Someone is still reading an older snapshot; the rest gets copied on a later pass
+		stringstream ss;
+		ss << "Checkpointed " << checkpointedFrames << " of " << logFrames << " write-ahead log frames";
+		LOG(DEBUG, ss.str(), "");
+	}
+}
+
 void Database::ResetPassword()
 {
 	stringstream ss;
@@ -572,13 +882,16 @@ void Database::ClearAllSuspects()
 	int rc;
 	 char *szErrMsg = 0;
 
-	  const char *pSQL[6];
-	  pSQL[0] = "DELETE FROM ip_port_counts;";
-	  pSQL[1] = "DELETE FROM packet_sizes;";
-	  pSQL[2] = "DELETE FROM packet_counts;";
-	  pSQL[3] = "DELETE FROM suspects;";
+	  const char *pSQL[7];
+	  pSQL[0] = "DELETE FROM suspect_ip_port_counts;";
+	  pSQL[1] = "DELETE FROM suspect_ip_summaries;";
+	  pSQL[2] = "DELETE FROM suspect_port_summaries;";
+	  pSQL[3] = "DELETE FROM suspect_distinct_counts;";
+	  pSQL[4] = "DELETE FROM suspect_packet_sizes;";
+	  pSQL[5] = "DELETE FROM suspect_packet_counts;";
+	  pSQL[6] = "DELETE FROM suspect_records;";
 
-	  for(int i = 0; i < 4; i++)
+	  for(int i = 0; i < 7; i++)
 	  {
 	    rc = sqlite3_exec(db, pSQL[i], callback, 0, &szErrMsg);
 	    if(rc != SQLITE_OK)
@@ -605,38 +918,60 @@ void Database::ClearAllSuspects()
 	  sqlite3_close(scriptDb);
 }
 
-void Database::ClearSuspect(const string &ip, const string &interface)
+void Database::ClearSuspect(uint32_t ip, const string &interface)
 {
-	cout << "Clearing suspect " << ip << " on interface " << interface << endl;
+	cout << "Clearing suspect " << Suspect::GetIpString(ip) << " on interface " << interface << endl;
 	int res;
-	sqlite3_stmt *deleteFromIpPortCounts,*deleteFromPacketSizes,*deleteFromPacketCounts,*deleteFromSuspects;
+	int64_t interfaceId = GetInterfaceId(interface);
+	sqlite3_stmt *deleteFromIpPortCounts,*deleteFromIpSummaries,*deleteFromPortSummaries,*deleteFromDistinctCounts,*deleteFromPacketSizes,*deleteFromPacketCounts,*deleteFromSuspects;
 
 	// Prepare the statements
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,"DELETE FROM ip_port_counts WHERE ip = ? AND interface = ?;",
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,"DELETE FROM suspect_ip_summaries WHERE ip = ? AND interface = ?;",
+		-1, &deleteFromIpSummaries,  NULL));
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,"DELETE FROM suspect_port_summaries WHERE ip = ? AND interface = ?;",
+		-1, &deleteFromPortSummaries,  NULL));
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,"DELETE FROM suspect_ip_port_counts WHERE ip = ? AND interface = ?;",
 		-1, &deleteFromIpPortCounts,  NULL));
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,"DELETE FROM packet_sizes WHERE ip = ? AND interface = ?;",
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,"DELETE FROM suspect_distinct_counts WHERE ip = ? AND interface = ?;",
+		-1, &deleteFromDistinctCounts,  NULL));
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,"DELETE FROM suspect_packet_sizes WHERE ip = ? AND interface = ?;",
 		-1, &deleteFromPacketSizes,  NULL));
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,"DELETE FROM packet_counts WHERE ip = ? AND interface = ?;",
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,"DELETE FROM suspect_packet_counts WHERE ip = ? AND interface = ?;",
 		-1, &deleteFromPacketCounts,  NULL));
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,"DELETE FROM suspects WHERE ip = ? AND interface = ?;",
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,"DELETE FROM suspect_records WHERE ip = ? AND interface = ?;",
 		-1, &deleteFromSuspects,  NULL));
 
 	// Bind the IP and interface into the statements
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(deleteFromIpPortCounts, 1, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(deleteFromPacketSizes, 1, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(deleteFromPacketCounts, 1, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(deleteFromSuspects, 1, ip.c_str(), -1, SQLITE_STATIC));
-
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(deleteFromIpPortCounts, 2, interface.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(deleteFromPacketSizes, 2, interface.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(deleteFromPacketCounts, 2, interface.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(deleteFromSuspects, 2, interface.c_str(), -1, SQLITE_STATIC));
+	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(deleteFromIpSummaries, 1, ip));
+	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(deleteFromPortSummaries, 1, ip));
+	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(deleteFromIpPortCounts, 1, ip));
+	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(deleteFromDistinctCounts, 1, ip));
+	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(deleteFromPacketSizes, 1, ip));
+	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(deleteFromPacketCounts, 1, ip));
+	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(deleteFromSuspects, 1, ip));
+
+	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(deleteFromIpSummaries, 2, interfaceId));
+	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(deleteFromPortSummaries, 2, interfaceId));
+	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(deleteFromIpPortCounts, 2, interfaceId));
+	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(deleteFromDistinctCounts, 2, interfaceId));
+	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(deleteFromPacketSizes, 2, interfaceId));
+	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(deleteFromPacketCounts, 2, interfaceId));
+	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(deleteFromSuspects, 2, interfaceId));
 
 	// Step and reset them. Make sure we get rid of foreign key references and do suspects table last
 	m_count++;
+	SQL_RUN(SQLITE_DONE,sqlite3_step(deleteFromIpSummaries));
+	SQL_RUN(SQLITE_OK, sqlite3_reset(deleteFromIpSummaries));
+	m_count++;
+	SQL_RUN(SQLITE_DONE,sqlite3_step(deleteFromPortSummaries));
+	SQL_RUN(SQLITE_OK, sqlite3_reset(deleteFromPortSummaries));
+	m_count++;
 	SQL_RUN(SQLITE_DONE,sqlite3_step(deleteFromIpPortCounts));
 	SQL_RUN(SQLITE_OK, sqlite3_reset(deleteFromIpPortCounts));
 	m_count++;
+	SQL_RUN(SQLITE_DONE,sqlite3_step(deleteFromDistinctCounts));
+	SQL_RUN(SQLITE_OK, sqlite3_reset(deleteFromDistinctCounts));
+	m_count++;
 	SQL_RUN(SQLITE_DONE,sqlite3_step(deleteFromPacketSizes));
 	SQL_RUN(SQLITE_OK, sqlite3_reset(deleteFromPacketSizes));
 	m_count++;
@@ -647,14 +982,18 @@ void Database::ClearSuspect(const string &ip, const string &interface)
 	SQL_RUN(SQLITE_OK, sqlite3_reset(deleteFromSuspects));
 
 	// Finalize all the statements
+	sqlite3_finalize(deleteFromIpSummaries);
+	sqlite3_finalize(deleteFromPortSummaries);
 	sqlite3_finalize(deleteFromIpPortCounts);
+	sqlite3_finalize(deleteFromDistinctCounts);
 	sqlite3_finalize(deleteFromPacketSizes);
 	sqlite3_finalize(deleteFromPacketCounts);
 	sqlite3_finalize(deleteFromSuspects);
 
 
 
-	// Delete from the suspect alerts database
+	// Delete from the suspect alerts database, which still keys on the IP text
+	string ipString = Suspect::GetIpString(ip);
 	sqlite3 *scriptDb;
 	SQL_RUN(SQLITE_OK,sqlite3_open(string(Config::Inst()->GetPathHome() + "/data/scriptAlerts.db").c_str(), &scriptDb));
 
@@ -662,7 +1001,7 @@ void Database::ClearSuspect(const string &ip, const string &interface)
 	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(scriptDb,"DELETE FROM script_alerts WHERE ip = ? AND interface = ?;",
 		-1, &deleteFromScriptAlerts,  NULL));
 
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(deleteFromScriptAlerts, 1, ip.c_str(), -1, SQLITE_STATIC));
+	SQL_RUN(SQLITE_OK,sqlite3_bind_text(deleteFromScriptAlerts, 1, ipString.c_str(), -1, SQLITE_STATIC));
 	SQL_RUN(SQLITE_OK,sqlite3_bind_text(deleteFromScriptAlerts, 2, interface.c_str(), -1, SQLITE_STATIC));
 	SQL_RUN(SQLITE_DONE,sqlite3_step(deleteFromScriptAlerts));
 	SQL_RUN(SQLITE_OK, sqlite3_reset(deleteFromScriptAlerts));
@@ -671,179 +1010,345 @@ void Database::ClearSuspect(const string &ip, const string &interface)
 	sqlite3_close(scriptDb);
 }
 
-void Database::InsertSuspect(Suspect *suspect)
+void Database::PersistSuspects(const vector<SuspectRecord> &records)
 {
-	int res;
+	// Blobs are bound without copying, so they're kept here until every upsert has run.
+	// Deques don't move their elements when they grow.
+	deque<vector<u_char> > blobs;
 
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(insertSuspect, 1, suspect->GetIpString().c_str(), -1, SQLITE_TRANSIENT));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(insertSuspect, 2, suspect->GetInterface().c_str(), -1, SQLITE_TRANSIENT));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(insertSuspect, 3, static_cast<long int>(suspect->m_features.m_startTime)));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(insertSuspect, 4, static_cast<long int>(suspect->m_features.m_endTime)));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(insertSuspect, 5, static_cast<long int>(suspect->m_features.m_lastTime)));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_double(insertSuspect, 6, suspect->GetClassification()));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int(insertSuspect, 7, suspect->GetHostileNeighbors()));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int(insertSuspect, 8, suspect->GetIsHostile()));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(insertSuspect, 9, suspect->m_classificationNotes.c_str(), -1, SQLITE_TRANSIENT));
+	vector<SqlValue> suspectRows, packetCountRows, packetSizeRows, ipPortRows, distinctCountRows;
+	suspectRows.reserve(records.size() * upsertSuspects.m_columns);
+	packetCountRows.reserve(records.size() * upsertPacketCounts.m_columns);
 
-	m_count++;
-	SQL_RUN(SQLITE_DONE,sqlite3_step(insertSuspect));
-	SQL_RUN(SQLITE_OK, sqlite3_reset(insertSuspect));
-}
+	for (uint i = 0; i < records.size(); i++)
+	{
+		Suspect *s = records[i].m_suspect;
+		EvidenceAccumulator &e = s->m_features;
+
+		uint32_t ip = s->GetIdentifier().m_ip();
+		int64_t interface = GetInterfaceId(s->GetInterface());
+
+		suspectRows.push_back(SqlValue::Integer(ip));
+		suspectRows.push_back(SqlValue::Integer(interface));
+		suspectRows.push_back(SqlValue::Integer(e.m_startTime));
+		suspectRows.push_back(SqlValue::Integer(e.m_endTime));
+		suspectRows.push_back(SqlValue::Integer(e.m_lastTime));
+		suspectRows.push_back(SqlValue::Real(s->GetClassification()));
+		suspectRows.push_back(SqlValue::Integer(s->GetHostileNeighbors()));
+		suspectRows.push_back(SqlValue::Integer(s->GetIsHostile()));
+		suspectRows.push_back(SqlValue::Text(s->m_classificationNotes.c_str()));
+		for (int f = 0; f < DIM; f++)
+		{
+			suspectRows.push_back(SqlValue::Real(e.m_features[f]));
+		}
 
-void Database::IncrementPacketCount(const string &ip, const string &interface, const EvidenceAccumulator &e)
-{
-	int res;
+		packetCountRows.push_back(SqlValue::Integer(ip));
+		packetCountRows.push_back(SqlValue::Integer(interface));
+		packetCountRows.push_back(SqlValue::Integer(e.m_tcpPacketCount));
+		packetCountRows.push_back(SqlValue::Integer(e.m_udpPacketCount));
+		packetCountRows.push_back(SqlValue::Integer(e.m_icmpPacketCount));
+		packetCountRows.push_back(SqlValue::Integer(e.m_otherPacketCount));
+		packetCountRows.push_back(SqlValue::Integer(e.m_packetCount));
+		packetCountRows.push_back(SqlValue::Integer(e.m_rstCount));
+		packetCountRows.push_back(SqlValue::Integer(e.m_ackCount));
+		packetCountRows.push_back(SqlValue::Integer(e.m_synCount));
+		packetCountRows.push_back(SqlValue::Integer(e.m_finCount));
+		packetCountRows.push_back(SqlValue::Integer(e.m_synAckCount));
+		packetCountRows.push_back(SqlValue::Integer(e.m_bytesTotal));
+
+		if (e.m_packetSizes.GetCount() != 0)
+		{
+			blobs.push_back(vector<u_char>(e.m_packetSizes.GetSerializeLength()));
+			e.m_packetSizes.Serialize(&blobs.back()[0], blobs.back().size());
 
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(incrementPacketCount, 1, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(incrementPacketCount, 2, interface.c_str(), -1, SQLITE_STATIC));
-
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(incrementPacketCount, 3, e.m_tcpPacketCount));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(incrementPacketCount, 4, e.m_udpPacketCount));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(incrementPacketCount, 5, e.m_icmpPacketCount));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(incrementPacketCount, 6, e.m_otherPacketCount));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(incrementPacketCount, 7, e.m_packetCount));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(incrementPacketCount, 8, e.m_rstCount));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(incrementPacketCount, 9, e.m_ackCount));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(incrementPacketCount, 10, e.m_synCount));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(incrementPacketCount, 11, e.m_finCount));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(incrementPacketCount, 12, e.m_synAckCount));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int64(incrementPacketCount, 13, e.m_bytesTotal));
+			packetSizeRows.push_back(SqlValue::Integer(ip));
+			packetSizeRows.push_back(SqlValue::Integer(interface));
+			packetSizeRows.push_back(SqlValue::Blob(blobs.back()));
+		}
 
-	m_count++;
-	SQL_RUN(SQLITE_DONE, sqlite3_step(incrementPacketCount));
-	SQL_RUN(SQLITE_OK, sqlite3_reset(incrementPacketCount));
+		AddIpPortRows(ipPortRows, ip, interface, IPPROTO_TCP, e.m_hasTcpPortIpBeenContacted);
+		AddIpPortRows(ipPortRows, ip, interface, IPPROTO_UDP, e.m_hasUdpPortIpBeenContacted);
+		AddIpPortRows(ipPortRows, ip, interface, IPPROTO_ICMP, e.m_icmpCodeTypes);
 
+		// Random non TCP/UDP packets, we just keep a generic "other" count
+		for (IP_Table::iterator it = e.m_IPTable.begin(); it != e.m_IPTable.end(); it++)
+		{
+			if (it->second == 0)
+				continue;
+
+			ipPortRows.push_back(SqlValue::Integer(ip));
+			ipPortRows.push_back(SqlValue::Integer(interface));
+			ipPortRows.push_back(SqlValue::Integer(0));
+			ipPortRows.push_back(SqlValue::Integer(it->first));
+			ipPortRows.push_back(SqlValue::Integer(0));
+			ipPortRows.push_back(SqlValue::Integer(it->second));
+		}
 
-	// If the update failed, we need to insert the port contacted count and set it
-	if (sqlite3_changes(db) == 0)
-	{
-		SQL_RUN(SQLITE_OK,sqlite3_bind_text(insertPacketCount, 1, ip.c_str(), -1, SQLITE_STATIC));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_text(insertPacketCount, 2, interface.c_str(), -1, SQLITE_STATIC));
+		// Only rewrite the distinct counts this window could have changed
+		if (!records[i].m_tcpIpPorts.empty())
+		{
+			distinctCountRows.push_back(SqlValue::Integer(ip));
+			distinctCountRows.push_back(SqlValue::Integer(interface));
+			distinctCountRows.push_back(SqlValue::Integer(IPPROTO_TCP));
+			distinctCountRows.push_back(SqlValue::Blob(records[i].m_tcpIpPorts));
+		}
+		if (!records[i].m_udpIpPorts.empty())
+		{
+			distinctCountRows.push_back(SqlValue::Integer(ip));
+			distinctCountRows.push_back(SqlValue::Integer(interface));
+			distinctCountRows.push_back(SqlValue::Integer(IPPROTO_UDP));
+			distinctCountRows.push_back(SqlValue::Blob(records[i].m_udpIpPorts));
+		}
+	}
 
-		SQL_RUN(SQLITE_OK,sqlite3_bind_int64(insertPacketCount, 3, e.m_tcpPacketCount));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_int64(insertPacketCount, 4, e.m_udpPacketCount));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_int64(insertPacketCount, 5, e.m_icmpPacketCount));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_int64(insertPacketCount, 6, e.m_otherPacketCount));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_int64(insertPacketCount, 7, e.m_packetCount));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_int64(insertPacketCount, 8, e.m_rstCount));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_int64(insertPacketCount, 9, e.m_ackCount));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_int64(insertPacketCount, 10, e.m_synCount));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_int64(insertPacketCount, 11, e.m_finCount));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_int64(insertPacketCount, 12, e.m_synAckCount));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_int64(insertPacketCount, 13, e.m_bytesTotal));
+	// The suspects rows go first, everything else has a foreign key on them
+	RunBatchUpsert(upsertSuspects, suspectRows);
+	RunBatchUpsert(upsertPacketCounts, packetCountRows);
+	RunBatchUpsert(upsertPacketSizes, packetSizeRows);
+	RunBatchUpsert(upsertIpPortCounts, ipPortRows);
+	RunBatchUpsert(upsertDistinctCounts, distinctCountRows);
+}
 
-		m_count++;
-		SQL_RUN(SQLITE_DONE, sqlite3_step(insertPacketCount));
-		SQL_RUN(SQLITE_OK, sqlite3_reset(insertPacketCount));
+void Database::AddIpPortRows(vector<SqlValue> &rows, uint32_t ip, int64_t interface, uint8_t protocol, IpPortTable &table)
+{
+	for (IpPortTable::iterator it = table.begin(); it != table.end(); it++)
+	{
+		if (it->second == 0)
+			continue;
+
+		rows.push_back(SqlValue::Integer(ip));
+		rows.push_back(SqlValue::Integer(interface));
+		rows.push_back(SqlValue::Integer(protocol));
+		rows.push_back(SqlValue::Integer(it->first.m_ip));
+		rows.push_back(SqlValue::Integer(it->first.m_port));
+		rows.push_back(SqlValue::Integer(it->second));
 	}
 }
 
-void Database::IncrementPacketSizeCount(const string &ip, const string &interface, uint16_t size, uint64_t increment)
+void Database::InitBatchUpsert(BatchUpsert &upsert, const string &prefix, uint columns, const string &suffix)
 {
-	if (!increment)
-		return;
+	upsert.m_prefix = prefix;
+	upsert.m_suffix = suffix;
+	upsert.m_columns = columns;
 
-	int res;
+	uint maxRows = min<uint>(UPSERT_BATCH_ROWS, SQLITE_SAFE_VARIABLES / columns);
+	upsert.m_statements.assign(maxRows + 1, NULL);
+}
+
+void Database::FinalizeBatchUpsert(BatchUpsert &upsert)
+{
+	for (uint i = 0; i < upsert.m_statements.size(); i++)
+	{
+		sqlite3_finalize(upsert.m_statements[i]);
+	}
+	upsert.m_statements.clear();
+}
 
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(incrementPacketSize, 1, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(incrementPacketSize, 2, interface.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_int(incrementPacketSize, 3, size));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_int(incrementPacketSize, 4, increment));
+void Database::RunBatchUpsert(BatchUpsert &upsert, const vector<SqlValue> &values)
+{
+	int res;
 
-	m_count++;
-	SQL_RUN(SQLITE_DONE, sqlite3_step(incrementPacketSize));
-	SQL_RUN(SQLITE_OK, sqlite3_reset(incrementPacketSize));
+	uint maxRows = upsert.m_statements.size() - 1;
+	uint rows = values.size() / upsert.m_columns;
 
-	if (sqlite3_changes(db) == 0)
+	for (uint row = 0; row < rows;)
 	{
-		SQL_RUN(SQLITE_OK,sqlite3_bind_text(insertPacketSize, 1, ip.c_str(), -1, SQLITE_STATIC));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_text(insertPacketSize, 2, interface.c_str(), -1, SQLITE_STATIC));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_int(insertPacketSize, 3, size));
-		SQL_RUN(SQLITE_OK, sqlite3_bind_int(insertPacketSize, 4, increment));
+		uint count = min(maxRows, rows - row);
+
+		// Statements are prepared the first time a batch of this many rows comes along. Only the full
+		// size and whatever is left over at the end of a batch get used much.
+		sqlite3_stmt *&statement = upsert.m_statements[count];
+		if (statement == NULL)
+		{
+			stringstream query;
+			query << upsert.m_prefix;
+			for (uint i = 0; i < count; i++)
+			{
+				query << (i == 0 ? "(" : ",(");
+				for (uint column = 0; column < upsert.m_columns; column++)
+				{
+					query << (column == 0 ? "?" : ",?");
+				}
+				query << ")";
+			}
+			query << " " << upsert.m_suffix;
+
+			SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db, query.str().c_str(), -1, &statement, NULL));
+			if (statement == NULL)
+			{
+				return;
+			}
+		}
 
-		m_count++;
-		SQL_RUN(SQLITE_DONE, sqlite3_step(insertPacketSize));
-		SQL_RUN(SQLITE_OK, sqlite3_reset(insertPacketSize));
+		const SqlValue *first = &values[row * upsert.m_columns];
+		for (uint i = 0; i < count * upsert.m_columns; i++)
+		{
+			BindSqlValue(statement, i + 1, first[i]);
+		}
+
+		// Counts rows rather than statements, so the transaction breaks in DatabaseQueue
+		// still happen after about the same amount of work
+		m_count += count;
+		SQL_RUN(SQLITE_DONE, sqlite3_step(statement));
+		SQL_RUN(SQLITE_OK, sqlite3_reset(statement));
+
+		row += count;
 	}
 }
 
-void Database::IncrementPortContactedCount(const string &ip, const string &interface, const string &protocol, const string &dstip, int port, uint64_t increment)
+void Database::BindSqlValue(sqlite3_stmt *statement, int index, const SqlValue &value)
 {
-	if (!increment)
-		return;
-
 	int res;
 
-	// Try to increment the port count if it exists
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(incrementPortContacted, 1, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(incrementPortContacted, 2, interface.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(incrementPortContacted, 3, protocol.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_text(incrementPortContacted, 4, dstip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int(incrementPortContacted, 5, port));
-	SQL_RUN(SQLITE_OK,sqlite3_bind_int(incrementPortContacted, 6, increment));
+	switch (value.m_type)
+	{
+		case SqlValue::SQL_INTEGER:
+			SQL_RUN(SQLITE_OK, sqlite3_bind_int64(statement, index, value.m_integer));
+			break;
+		case SqlValue::SQL_REAL:
+			SQL_RUN(SQLITE_OK, sqlite3_bind_double(statement, index, value.m_real));
+			break;
+		case SqlValue::SQL_TEXT:
+			SQL_RUN(SQLITE_OK, sqlite3_bind_text(statement, index, (const char*)value.m_data, -1, SQLITE_STATIC));
+			break;
+		case SqlValue::SQL_BLOB:
+			SQL_RUN(SQLITE_OK, sqlite3_bind_blob(statement, index, value.m_data, value.m_length, SQLITE_STATIC));
+			break;
+	}
+}
 
-	m_count++;
-	SQL_RUN(SQLITE_DONE, sqlite3_step(incrementPortContacted));
-	SQL_RUN(SQLITE_OK, sqlite3_reset(incrementPortContacted));
+Database::SqlValue Database::SqlValue::Integer(int64_t value)
+{
+	SqlValue v;
+	v.m_type = SQL_INTEGER;
+	v.m_integer = value;
+	return v;
+}
+
+Database::SqlValue Database::SqlValue::Real(double value)
+{
+	SqlValue v;
+	v.m_type = SQL_REAL;
+	v.m_real = value;
+	return v;
+}
+
+Database::SqlValue Database::SqlValue::Text(const char *text)
+{
+	SqlValue v;
+	v.m_type = SQL_TEXT;
+	v.m_data = text;
+	return v;
+}
 
-	// If the update failed, we need to insert the port contacted count and set it to 1
-	if (sqlite3_changes(db) == 0)
+Database::SqlValue Database::SqlValue::Blob(const vector<u_char> &blob)
+{
+	SqlValue v;
+	v.m_type = SQL_BLOB;
+	v.m_data = &blob[0];
+	v.m_length = blob.size();
+	return v;
+}
+
+void Database::MergeHistogramsFunction(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+	// Merging into a NULL column is just taking the new histogram
+	if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
 	{
-		SQL_RUN(SQLITE_OK,sqlite3_bind_text(insertPortContacted, 1, ip.c_str(), -1, SQLITE_STATIC));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_text(insertPortContacted, 2, interface.c_str(), -1, SQLITE_STATIC));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_text(insertPortContacted, 3, protocol.c_str(), -1, SQLITE_STATIC));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_text(insertPortContacted, 4, dstip.c_str(), -1, SQLITE_STATIC));
-		SQL_RUN(SQLITE_OK,sqlite3_bind_int(insertPortContacted, 5, port));
+		sqlite3_result_value(context, argv[1]);
+		return;
+	}
 
-		m_count++;
-		SQL_RUN(SQLITE_DONE, sqlite3_step(insertPortContacted));
-		SQL_RUN(SQLITE_OK, sqlite3_reset(insertPortContacted));
+	try
+	{
+		PacketSizeHistogram merged, other;
+		merged.Deserialize((u_char*)sqlite3_value_blob(argv[0]), sqlite3_value_bytes(argv[0]));
+		other.Deserialize((u_char*)sqlite3_value_blob(argv[1]), sqlite3_value_bytes(argv[1]));
+		merged.Merge(other);
+
+		vector<u_char> blob(merged.GetSerializeLength());
+		merged.Serialize(&blob[0], blob.size());
+		sqlite3_result_blob(context, &blob[0], blob.size(), SQLITE_TRANSIENT);
+	}
+	catch (serializationException &e)
+	{
+		sqlite3_result_error(context, "Invalid packet size histogram", -1);
 	}
 }
 
-void Database::InsertHoneypotIp(std::string ip)
+void Database::HistogramStepFunction(sqlite3_context *context, int argc, sqlite3_value **argv)
 {
-	int res;
+	PacketSizeHistogram **histogram = (PacketSizeHistogram **)sqlite3_aggregate_context(context, sizeof(PacketSizeHistogram *));
+	if (histogram == NULL)
+	{
+		sqlite3_result_error_nomem(context);
+		return;
+	}
+	if (*histogram == NULL)
+	{
+		*histogram = new PacketSizeHistogram();
+	}
 
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(insertHoneypotIp, 1, ip.c_str(), -1, SQLITE_STATIC));
+	sqlite3_int64 size = sqlite3_value_int64(argv[0]);
+	sqlite3_int64 count = sqlite3_value_int64(argv[1]);
+	if (size < 0 || count <= 0)
+	{
+		return;
+	}
+	(*histogram)->Add(size > UINT16_MAX ? UINT16_MAX : size, count);
+}
 
-	m_count++;
-	SQL_RUN(SQLITE_DONE, sqlite3_step(insertHoneypotIp));
-	SQL_RUN(SQLITE_OK, sqlite3_reset(insertHoneypotIp));
+void Database::HistogramFinalFunction(sqlite3_context *context)
+{
+	// Nothing is allocated for a group with no rows
+	PacketSizeHistogram **histogram = (PacketSizeHistogram **)sqlite3_aggregate_context(context, 0);
+	if (histogram == NULL || *histogram == NULL)
+	{
+		sqlite3_result_null(context);
+		return;
+	}
+
+	vector<u_char> blob((*histogram)->GetSerializeLength());
+	(*histogram)->Serialize(&blob[0], blob.size());
+	sqlite3_result_blob(context, &blob[0], blob.size(), SQLITE_TRANSIENT);
 
+	delete *histogram;
+	*histogram = NULL;
 }
 
-void Database::SetFeatureSetValue(const string &ip, const string &interface, const vector<double> &features)
+void Database::IpToIntegerFunction(sqlite3_context *context, int argc, sqlite3_value **argv)
 {
-	int res;
+	struct in_addr address;
+	const char *text = (const char*)sqlite3_value_text(argv[0]);
 
-	if (features.size() != DIM)
+	if (text == NULL || inet_pton(AF_INET, text, &address) != 1)
 	{
-		LOG(ERROR, "Features must have DIM entries. This shouldn't happen.", "");
+		sqlite3_result_null(context);
 		return;
 	}
 
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(setFeatureValues, 15, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(setFeatureValues, 16, interface.c_str(), -1, SQLITE_STATIC));
+	sqlite3_result_int64(context, ntohl(address.s_addr));
+}
 
+void Database::InsertHoneypotIp(std::string ip)
+{
+	int res;
 
-	for (int i = 0; i < DIM; i++)
-	{
-		SQL_RUN(SQLITE_OK, sqlite3_bind_double(setFeatureValues, i + 1, features[i]));
-	}
+	SQL_RUN(SQLITE_OK, sqlite3_bind_text(insertHoneypotIp, 1, ip.c_str(), -1, SQLITE_STATIC));
 
 	m_count++;
-	SQL_RUN(SQLITE_DONE, sqlite3_step(setFeatureValues));
-	SQL_RUN(SQLITE_OK, sqlite3_reset(setFeatureValues));
-}
+	SQL_RUN(SQLITE_DONE, sqlite3_step(insertHoneypotIp));
+	SQL_RUN(SQLITE_OK, sqlite3_reset(insertHoneypotIp));
 
+}
 
-void Database::InsertSuspectHostileAlert(const std::string &ip, const std::string &interface)
+void Database::InsertSuspectHostileAlert(uint32_t ip, const std::string &interface)
 {
 	int res;
+	int64_t interfaceId = GetInterfaceId(interface);
 
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(createHostileAlert, 1, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(createHostileAlert, 2, interface.c_str(), -1, SQLITE_STATIC));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_int64(createHostileAlert, 1, ip));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_int64(createHostileAlert, 2, interfaceId));
 
 	m_count++;
 	SQL_RUN(SQLITE_DONE, sqlite3_step(createHostileAlert));
@@ -851,13 +1356,14 @@ void Database::InsertSuspectHostileAlert(const std::string &ip, const std::strin
 
 }
 
-bool Database::IsSuspectHostile(const std::string &ip, const std::string &interface)
+bool Database::IsSuspectHostile(uint32_t ip, const std::string &interface)
 {
 	int res;
 	bool suspectHostile;
+	int64_t interfaceId = GetInterfaceId(interface);
 
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(isSuspectHostile, 1, ip.c_str(), -1, SQLITE_STATIC));
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(isSuspectHostile, 2, interface.c_str(), -1, SQLITE_STATIC));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_int64(isSuspectHostile, 1, ip));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_int64(isSuspectHostile, 2, interfaceId));
 
 
 	m_count++;
@@ -877,6 +1383,216 @@ bool Database::IsSuspectHostile(const std::string &ip, const std::string &interf
 	return suspectHostile;
 }
 
+void Database::ApplyRetention(const RetentionPolicy &policy, RetentionResult &result)
+{
+	int res;
+	sqlite3_stmt *stmt;
+	vector<int64_t> parameters;
+
+	result.m_finished = true;
+
+	// Idle is measured back from the newest traffic we've stored
+	int64_t newest = 0;
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db, "SELECT MAX(lastTime) FROM suspect_records;", -1, &stmt, NULL));
+	m_count++;
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		newest = sqlite3_column_int64(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+
+	// The suspects a step works on. It's a temp table, so filling it doesn't touch the database file.
+	RunRetentionStatement("CREATE TEMP TABLE IF NOT EXISTS retention_batch ("
+		"ip INTEGER NOT NULL, interface INTEGER NOT NULL, lastTime INTEGER,"
+		"PRIMARY KEY(ip, interface)) WITHOUT ROWID;", parameters);
+
+	if (policy.m_suspectHours != 0)
+	{
+		RunRetentionStatement("DELETE FROM temp.retention_batch;", parameters);
+
+		parameters.push_back(newest - (int64_t)policy.m_suspectHours * 3600);
+		parameters.push_back(policy.m_batchSize);
+		uint64_t suspects = RunRetentionStatement("INSERT INTO temp.retention_batch "
+			"SELECT ip, interface, lastTime FROM suspect_records WHERE lastTime < ?1 ORDER BY lastTime LIMIT ?2;", parameters);
+		parameters.clear();
+
+		if (suspects != 0)
+		{
+			SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
+				"SELECT b.ip, i.name FROM temp.retention_batch b JOIN interfaces i ON i.id = b.interface;",
+				-1, &stmt, NULL));
+
+			m_count++;
+			res = sqlite3_step(stmt);
+			while (res == SQLITE_ROW)
+			{
+				SuspectID_pb id;
+				id.set_m_ip(sqlite3_column_int64(stmt, 0));
+				id.set_m_ifname(string((const char*)sqlite3_column_text(stmt, 1)));
+				result.m_removedSuspects.push_back(id);
+
+				res = sqlite3_step(stmt);
+			}
+			sqlite3_finalize(stmt);
+
+			// Foreign key references first, suspects table last
+			const char *deletes[] = {
+				"DELETE FROM suspect_ip_port_counts WHERE (ip, interface) IN (SELECT ip, interface FROM temp.retention_batch);",
+				"DELETE FROM suspect_ip_summaries WHERE (ip, interface) IN (SELECT ip, interface FROM temp.retention_batch);",
+				"DELETE FROM suspect_port_summaries WHERE (ip, interface) IN (SELECT ip, interface FROM temp.retention_batch);",
+				"DELETE FROM suspect_distinct_counts WHERE (ip, interface) IN (SELECT ip, interface FROM temp.retention_batch);",
+				"DELETE FROM suspect_packet_sizes WHERE (ip, interface) IN (SELECT ip, interface FROM temp.retention_batch);",
+				"DELETE FROM suspect_packet_counts WHERE (ip, interface) IN (SELECT ip, interface FROM temp.retention_batch);",
+				"DELETE FROM suspect_records WHERE (ip, interface) IN (SELECT ip, interface FROM temp.retention_batch);"};
+
+			for (uint i = 0; i < sizeof(deletes) / sizeof(deletes[0]); i++)
+			{
+				result.m_rowsRemoved += RunRetentionStatement(deletes[i], parameters);
+			}
+		}
+
+		if (suspects >= policy.m_batchSize)
+		{
+			result.m_finished = false;
+		}
+	}
+
+	if (policy.m_detailHours != 0)
+	{
+		RunRetentionStatement("DELETE FROM temp.retention_batch;", parameters);
+
+		// Picks up after the last suspect rolled up, so a pass doesn't keep walking past the ones
+		// it has already done. Only suspects with any detail left count towards the batch.
+		parameters.push_back(newest - (int64_t)policy.m_detailHours * 3600);
+		parameters.push_back(m_rollupTime);
+		parameters.push_back(m_rollupIp);
+		parameters.push_back(m_rollupInterface);
+		parameters.push_back(policy.m_batchSize);
+		uint64_t suspects = RunRetentionStatement("INSERT INTO temp.retention_batch "
+			"SELECT ip, interface, lastTime FROM suspect_records s "
+			"WHERE lastTime < ?1 AND (lastTime, ip, interface) > (?2, ?3, ?4) "
+			"AND EXISTS (SELECT 1 FROM suspect_ip_port_counts c WHERE c.ip = s.ip AND c.interface = s.interface) "
+			"ORDER BY lastTime, ip, interface LIMIT ?5;", parameters);
+		parameters.clear();
+
+		if (suspects != 0)
+		{
+			// The WHERE 1 keeps SQLite from reading ON CONFLICT as part of the join
+			RunRetentionStatement("INSERT INTO suspect_ip_summaries (ip, interface, dstip, count) "
+				"SELECT c.ip, c.interface, c.dstip, SUM(c.count) FROM suspect_ip_port_counts c "
+				"JOIN temp.retention_batch b ON b.ip = c.ip AND b.interface = c.interface WHERE 1 "
+				"GROUP BY c.ip, c.interface, c.dstip "
+				"ON CONFLICT (ip, interface, dstip) DO UPDATE SET count = count + excluded.count;", parameters);
+
+			RunRetentionStatement("INSERT INTO suspect_port_summaries (ip, interface, type, port, count) "
+				"SELECT c.ip, c.interface, c.type, c.port, SUM(c.count) FROM suspect_ip_port_counts c "
+				"JOIN temp.retention_batch b ON b.ip = c.ip AND b.interface = c.interface WHERE c.type IN (6, 17) "
+				"GROUP BY c.ip, c.interface, c.type, c.port "
+				"ON CONFLICT (ip, interface, type, port) DO UPDATE SET count = count + excluded.count;", parameters);
+
+			result.m_rowsRemoved += RunRetentionStatement("DELETE FROM suspect_ip_port_counts "
+				"WHERE (ip, interface) IN (SELECT ip, interface FROM temp.retention_batch);", parameters);
+			result.m_suspectsRolledUp += suspects;
+
+			SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
+				"SELECT lastTime, ip, interface FROM temp.retention_batch ORDER BY lastTime DESC, ip DESC, interface DESC LIMIT 1;",
+				-1, &stmt, NULL));
+			m_count++;
+			if (sqlite3_step(stmt) == SQLITE_ROW)
+			{
+				m_rollupTime = sqlite3_column_int64(stmt, 0);
+				m_rollupIp = sqlite3_column_int64(stmt, 1);
+				m_rollupInterface = sqlite3_column_int64(stmt, 2);
+			}
+			sqlite3_finalize(stmt);
+		}
+
+		if (suspects >= policy.m_batchSize)
+		{
+			result.m_finished = false;
+		}
+		else
+		{
+			m_rollupTime = 0;
+			m_rollupIp = 0;
+			m_rollupInterface = 0;
+		}
+	}
+
+	if (policy.m_maxAlerts != 0)
+	{
+		parameters.push_back(policy.m_maxAlerts);
+		parameters.push_back(policy.m_batchSize);
+		uint64_t alerts = RunRetentionStatement("DELETE FROM suspect_alerts WHERE id IN "
+			"(SELECT id FROM suspect_alerts WHERE id <= (SELECT MAX(id) FROM suspect_alerts) - ?1 ORDER BY id LIMIT ?2);", parameters);
+		parameters.clear();
+
+		result.m_alertsRemoved += alerts;
+		if (alerts >= policy.m_batchSize)
+		{
+			result.m_finished = false;
+		}
+	}
+}
+
+uint64_t Database::RunRetentionStatement(const char *sql, const vector<int64_t> &parameters)
+{
+	int res;
+	sqlite3_stmt *stmt;
+	uint64_t changes = 0;
+
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db, sql, -1, &stmt, NULL));
+	if (res != SQLITE_OK)
+	{
+		return 0;
+	}
+
+	for (uint i = 0; i < parameters.size(); i++)
+	{
+		SQL_RUN(SQLITE_OK, sqlite3_bind_int64(stmt, i + 1, parameters[i]));
+	}
+
+	m_count++;
+	SQL_RUN(SQLITE_DONE, sqlite3_step(stmt));
+	if (res == SQLITE_DONE)
+	{
+		changes = sqlite3_changes(db);
+	}
+	sqlite3_finalize(stmt);
+
+	return changes;
+}
+
+void Database::GetDatabaseSize(uint64_t &totalBytes, uint64_t &freeBytes)
+{
+	int res;
+	sqlite3_stmt *stmt;
+
+	totalBytes = 0;
+	freeBytes = 0;
+
+	// Shadows the writer so SQL_RUN reports this connection's errors
+	sqlite3 *db = AcquireReader();
+	if (db == NULL)
+	{
+		return;
+	}
+
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
+		"SELECT p.page_count * s.page_size, f.freelist_count * s.page_size "
+		"FROM pragma_page_count() p, pragma_freelist_count() f, pragma_page_size() s;",
+		-1, &stmt, NULL));
+
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		totalBytes = sqlite3_column_int64(stmt, 0);
+		freeBytes = sqlite3_column_int64(stmt, 1);
+	}
+
+	sqlite3_finalize(stmt);
+	ReleaseReader(db);
+}
+
 
 std::vector<string> Database::GetSuspectList(enum SuspectListType listType)
 {
@@ -884,6 +1600,12 @@ std::vector<string> Database::GetSuspectList(enum SuspectListType listType)
 	int res;
 	sqlite3_stmt *stmt;
 
+	sqlite3 *db = AcquireReader();
+	if (db == NULL)
+	{
+		return suspects;
+	}
+
 	if (listType == SUSPECTLIST_ALL)
 	{
 	   SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db, "SELECT ip, interface FROM suspects", -1, &stmt, NULL));
@@ -912,6 +1634,7 @@ std::vector<string> Database::GetSuspectList(enum SuspectListType listType)
 	}
 
 	sqlite3_finalize(stmt);
+	ReleaseReader(db);
 
 	return suspects;
 }
@@ -922,6 +1645,12 @@ std::vector<Suspect> Database::GetSuspects(enum SuspectListType listType)
 	int res;
 	sqlite3_stmt *stmt;
 
+	sqlite3 *db = AcquireReader();
+	if (db == NULL)
+	{
+		return suspects;
+	}
+
 	if (listType == SUSPECTLIST_ALL)
 	{
 	   SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db, "SELECT * FROM suspects", -1, &stmt, NULL));
@@ -963,6 +1692,7 @@ std::vector<Suspect> Database::GetSuspects(enum SuspectListType listType)
 	}
 
 	sqlite3_finalize(stmt);
+	ReleaseReader(db);
 
 	return suspects;
 }
@@ -973,9 +1703,17 @@ Suspect Database::GetSuspect(SuspectID_pb id)
 	int res;
 	sqlite3_stmt *stmt;
 
-	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db, "SELECT * FROM suspects WHERE ip = ? AND interface = ?", -1, &stmt, NULL));
+	sqlite3 *db = AcquireReader();
+	if (db == NULL)
+	{
+		return s;
+	}
+
+	SQL_RUN(SQLITE_OK, sqlite3_prepare_v2(db,
+		"SELECT s.* FROM suspect_records s JOIN interfaces i ON i.id = s.interface WHERE s.ip = ? AND i.name = ?",
+		-1, &stmt, NULL));
 
-	SQL_RUN(SQLITE_OK, sqlite3_bind_text(stmt, 1, Suspect::GetIpString(id).c_str(), -1, SQLITE_TRANSIENT));
+	SQL_RUN(SQLITE_OK, sqlite3_bind_int64(stmt, 1, id.m_ip()));
 	SQL_RUN(SQLITE_OK, sqlite3_bind_text(stmt, 2, id.m_ifname().c_str(), -1, SQLITE_TRANSIENT));
 
 	res = sqlite3_step(stmt);
@@ -996,6 +1734,7 @@ Suspect Database::GetSuspect(SuspectID_pb id)
 	}
 
 	sqlite3_finalize(stmt);
+	ReleaseReader(db);
 
 	return s;
 }
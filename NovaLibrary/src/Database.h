@@ -21,12 +21,43 @@
 
 #include "protobuf/marshalled_classes.pb.h"
 #include "Suspect.h"
+#include "FeatureAggregate.h"
 
 #include <Lock.h>
+#include <map>
 #include <string>
 #include <sqlite3.h>
 #include <stdexcept>
 
+// PRAGMA user_version of the novad database this code reads and writes. Version 2 keys the suspect
+// tables on integer IPs and interface ids, version 3 adds the retention summaries; older files are
+// migrated when they're opened.
+#define DATABASE_SCHEMA_VERSION 3
+
+// Most rows a batched upsert puts in one statement
+#define UPSERT_BATCH_ROWS 128
+// Older SQLite builds cap a statement at 999 bound parameters
+#define SQLITE_SAFE_VARIABLES 999
+
+// Read only connections kept open for the query APIs (GetSuspects and friends)
+#define DATABASE_READERS 4
+// How long a reader waits on a lock before giving up, in ms. In WAL mode that only happens
+// while a checkpoint is resetting the log.
+#define DATABASE_READER_BUSY_TIMEOUT 5000
+// Seconds between the background checkpoints of the write-ahead log
+#define DATABASE_CHECKPOINT_INTERVAL 5
+// The writer still checkpoints on commit once the log gets this many pages long, in case nobody is
+// calling Checkpoint() (NovaCLI, the tests). Normally the background checkpoints keep it well under this.
+#define DATABASE_WAL_AUTOCHECKPOINT 16384
+// Size the log file is truncated back to after a checkpoint resets it
+#define DATABASE_WAL_SIZE_LIMIT (64 * 1024 * 1024)
+
+// Seconds between passes of the retention policy
+#define RETENTION_INTERVAL 600
+// Most suspects (or alerts) one retention step touches. Each step is its own short transaction
+// on the writer thread, so this is about how long it holds up the next classification flush.
+#define RETENTION_BATCH_SIZE 500
+
 // Quick error checking macro so we don't have to copy/paste this over and over
 #define SQL_RUN(val, stmt) \
 res = stmt; \
@@ -46,6 +77,45 @@ public:
 
 };
 
+// One suspect's evidence window on its way to PersistSuspects, along with the distinct IP/port counts
+// from its aggregate. Those are serialized up front since the aggregate keeps changing while this
+// waits to be written. Either is left empty if the window didn't contact any ports of that protocol.
+struct SuspectRecord
+{
+	Suspect *m_suspect;
+	std::vector<u_char> m_tcpIpPorts;
+	std::vector<u_char> m_udpIpPorts;
+
+	// Set if the suspect had enough packets to be classified this time around
+	bool m_classified;
+};
+
+// What ApplyRetention is allowed to reclaim. Zero leaves that part alone.
+struct RetentionPolicy
+{
+	// Suspects that haven't sent anything in this many hours are deleted outright
+	uint m_suspectHours;
+	// Suspects idle this long have their ip_port_counts rolled up into per destination and per port totals
+	uint m_detailHours;
+	// Most rows kept in suspect_alerts; the oldest go first
+	uint m_maxAlerts;
+
+	uint m_batchSize;
+};
+
+struct RetentionResult
+{
+	// Suspects deleted from the database, which whoever is holding them in memory should forget too
+	std::vector<SuspectID_pb> m_removedSuspects;
+	// Rows deleted from the suspect tables, counting the ip_port_counts that were rolled up
+	uint64_t m_rowsRemoved;
+	uint64_t m_suspectsRolledUp;
+	uint64_t m_alertsRemoved;
+
+	// False if a step stopped at m_batchSize with more left to do
+	bool m_finished;
+};
+
 class Database
 {
 public:
@@ -58,94 +128,184 @@ public:
 	void StartTransaction();
 	void StopTransaction();
 
-	void InsertSuspect(Suspect *suspect);
 	void InsertHoneypotIp(std::string ip);
 
-	void InsertSuspectHostileAlert(const std::string &ip, const std::string &interface);
+	// Suspects are identified by their IP in host byte order and the name of the interface they were seen on
+	void InsertSuspectHostileAlert(uint32_t ip, const std::string &interface);
 	void WriteClassification(Suspect *s);
-	void WriteTimestamps(Suspect *s);
 
 	void ClearAllSuspects();
-	void ClearSuspect(const std::string &ip, const std::string &interface);
-	uint64_t GetTotalPacketCount(const std::string &ip, const std::string &interface);
+	void ClearSuspect(uint32_t ip, const std::string &interface);
+	uint64_t GetTotalPacketCount(uint32_t ip, const std::string &interface);
 
-	void IncrementPacketCount(const std::string &ip, const std::string &interface, const EvidenceAccumulator &e);
-	void IncrementPacketSizeCount(const std::string &ip, const std::string &interface, uint16_t size, uint64_t increment = 1);
-	void IncrementPortContactedCount(const std::string &ip, const std::string &interface, const std::string &protocol, const std::string &dstip, int port, uint64_t increment = 1);
+	// Writes out the evidence windows of a batch of suspects: their suspects rows (timestamps and the
+	// current feature values), packet_counts, packet_sizes, ip_port_counts, and whichever distinct counts
+	// the records carry. Every table gets multi row INSERT ... ON CONFLICT DO UPDATE statements rather
+	// than an UPDATE and maybe an INSERT per row. Should be run inside a transaction.
+	void PersistSuspects(const std::vector<SuspectRecord> &records);
 
-	std::vector<double> ComputeFeatures(const std::string &ip, const std::string &interface);
+	// Seeds an empty aggregate with everything already stored for the suspect. Reads the last commit
+	// on a connection of its own, so it never waits on (or sees) a write transaction in progress.
+	void LoadFeatureAggregate(uint32_t ip, const std::string &interface, FeatureAggregate &aggregate, const HoneypotSet &honeypots);
 
-	void SetFeatureSetValue(const std::string &ip, const std::string &interface, const std::vector<double> &features);
+	bool IsSuspectHostile(uint32_t ip, const std::string &interface);
 
-	bool IsSuspectHostile(const std::string &ip, const std::string &interface);
+	// Runs one step of the retention policy, at most policy.m_batchSize suspects and alerts for each part
+	// of it, adding what it reclaimed to result. Should be run inside a transaction; call it again
+	// (in a new one) until result.m_finished. "Idle" is measured back from the newest lastTime in
+	// the database rather than the clock, so replaying an old capture doesn't age everything out.
+	void ApplyRetention(const RetentionPolicy &policy, RetentionResult &result);
+
+	// Size of the database file and how much of it is free pages, in bytes. Deleted rows only go
+	// back to the free list; the file itself doesn't shrink unless it's vacuumed.
+	void GetDatabaseSize(uint64_t &totalBytes, uint64_t &freeBytes);
 
 	void ResetPassword();
 
+	// These run on a pool of read only connections rather than the writer's. The database is in WAL
+	// mode, so each query reads a consistent snapshot of the last commit and neither waits on nor
+	// holds up a transaction in progress; they don't need (and shouldn't take) StartTransaction.
 	std::vector<SuspectID_pb> GetHostileSuspects();
-
-
 	std::vector<std::string> GetSuspectList(enum SuspectListType listType);
 	std::vector<Suspect> GetSuspects(enum SuspectListType listType);
 	Suspect GetSuspect(SuspectID_pb id);
 
 	static int callback(void *NotUsed, int argc, char **argv, char **azColName);
 
+	// Brings a novad database file up to DATABASE_SCHEMA_VERSION in place, in one transaction.
+	// Connect does this on its own; this is for upgrading a file without starting novad.
+	static bool MigrateDatabase(const std::string &databaseFile);
+
+	// Copies as much of the write-ahead log back into the database as it can without waiting on the
+	// writer or any reader. Uses its own connection, so it's safe to call from any thread at any time.
+	void Checkpoint();
+
 
 	// This is just for debugging performance issues
 	int m_count;
 private:
 	Database(std::string databaseFile = "");
 
+	// SQL function packet_size_histogram_merge(a, b): merges two serialized PacketSizeHistograms
+	static void MergeHistogramsFunction(sqlite3_context *context, int argc, sqlite3_value **argv);
+	// SQL aggregate packet_size_histogram(size, count): a serialized PacketSizeHistogram of the rows
+	static void HistogramStepFunction(sqlite3_context *context, int argc, sqlite3_value **argv);
+	static void HistogramFinalFunction(sqlite3_context *context);
+	// SQL function ipv4_to_integer(text): dotted quad to a host order integer, NULL if it isn't one
+	static void IpToIntegerFunction(sqlite3_context *context, int argc, sqlite3_value **argv);
+	// Makes the functions above available on a connection
+	static void RegisterFunctions(sqlite3 *db);
+
+	// Creates the schema in an empty database, or brings an older one (even the text keyed version 1) up to date
+	static bool MigrateSchema(sqlite3 *db);
+
+	// Id of an interface in the interfaces table, added if it isn't there yet. Caller must have a transaction open.
+	int64_t GetInterfaceId(const std::string &interface);
+
+	// One value to bind into a batch. Text and blobs aren't copied, so whatever they point to has to
+	// outlive the statement being run.
+	struct SqlValue
+	{
+		enum Type {SQL_INTEGER, SQL_REAL, SQL_TEXT, SQL_BLOB};
+
+		Type m_type;
+		int64_t m_integer;
+		double m_real;
+		const void *m_data;
+		int m_length;
+
+		static SqlValue Integer(int64_t value);
+		static SqlValue Real(double value);
+		static SqlValue Text(const char *text);
+		static SqlValue Blob(const std::vector<u_char> &blob);
+	};
+
+	// "prefix (?,?,...),(?,?,...) suffix", prepared on first use for each number of rows
+	struct BatchUpsert
+	{
+		std::string m_prefix;
+		std::string m_suffix;
+		uint m_columns;
+
+		// Indexed by row count, so m_statements.size() - 1 is the most rows one statement takes
+		std::vector<sqlite3_stmt *> m_statements;
+	};
+
+	// Adds ip_port_counts rows for one window's IP/port table, skipping anything it didn't see this time
+	static void AddIpPortRows(std::vector<SqlValue> &rows, uint32_t ip, int64_t interface, uint8_t protocol, IpPortTable &table);
+
+	// Runs a statement that takes nothing but integer parameters and returns the rows it changed
+	uint64_t RunRetentionStatement(const char *sql, const std::vector<int64_t> &parameters);
+
+	void InitBatchUpsert(BatchUpsert &upsert, const std::string &prefix, uint columns, const std::string &suffix);
+	void FinalizeBatchUpsert(BatchUpsert &upsert);
+	// Runs the upsert over values, m_columns values per row, in as few statements as it can
+	void RunBatchUpsert(BatchUpsert &upsert, const std::vector<SqlValue> &values);
+	void BindSqlValue(sqlite3_stmt *statement, int index, const SqlValue &value);
+
+	// Hands out an idle reader, opening another if there are fewer than DATABASE_READERS and
+	// waiting for one to come back otherwise. NULL if the database couldn't be opened.
+	sqlite3 *AcquireReader();
+	void ReleaseReader(sqlite3 *reader);
+
 	pthread_mutex_t m_lock;
 
 	std::string m_databaseFile;
 
-	static Database * m_instance;
-
-	sqlite3 *db;
-
-	sqlite3_stmt *insertSuspect;
+	std::vector<sqlite3 *> m_idleReaders;
+	uint m_openReaders;
+	pthread_mutex_t m_readerLock;
+	pthread_cond_t m_readerReleased;
 
-	sqlite3_stmt *insertPacketCount;
-	sqlite3_stmt *incrementPacketCount;
+	sqlite3 *m_checkpointDb;
+	pthread_mutex_t m_checkpointLock;
 
-	sqlite3_stmt *insertPortContacted;
-	sqlite3_stmt *incrementPortContacted;
+	static Database * m_instance;
 
-	sqlite3_stmt *insertPacketSize;
-	sqlite3_stmt *incrementPacketSize;
+	sqlite3 *db;
 
-	sqlite3_stmt *setFeatureValues;
+	BatchUpsert upsertSuspects;
+	BatchUpsert upsertPacketCounts;
+	BatchUpsert upsertPacketSizes;
+	BatchUpsert upsertIpPortCounts;
+	BatchUpsert upsertDistinctCounts;
 
 	// Query to populate a featureset
 	sqlite3_stmt *insertFeatureValue;
 
-	// Queries to compute featuresets;
-	sqlite3_stmt *computePacketSizeMean;
-	sqlite3_stmt *computePacketSizeVariance;
-
-	sqlite3_stmt *computeDistinctIps;
-	sqlite3_stmt *computeDistinctPorts;
+	// Read only connection for LoadFeatureAggregate and its queries, which are keyed on the interface name
+	// since only the writer can add interface ids
+	sqlite3 *m_loaderDb;
+	pthread_mutex_t m_loaderLock;
 
-	sqlite3_stmt *computeDistinctIpPorts;
+	// Queries to rebuild a suspect's FeatureAggregate
+	sqlite3_stmt *selectPacketSizes;
 	sqlite3_stmt *selectPacketCounts;
+	sqlite3_stmt *selectIpPortCounts;
+	sqlite3_stmt *selectDistinctCounts;
+	sqlite3_stmt *selectIpSummaries;
+	sqlite3_stmt *selectPortSummaries;
 
-	// This gets the max packets sent to any one IP or port
-	sqlite3_stmt *computeMaxPacketsToIp;
-	sqlite3_stmt *computeMaxPacketsToPort;
-
-	sqlite3_stmt *computeHoneypotsContacted;
 	sqlite3_stmt *insertHoneypotIp;
 
 	sqlite3_stmt *updateClassification;
-	sqlite3_stmt *updateSuspectTimestamps;
+
+	sqlite3_stmt *insertInterface;
+	sqlite3_stmt *selectInterfaceId;
+
+	// Interface names never change ids, so they're only looked up once
+	std::map<std::string, int64_t> m_interfaceIds;
 
 	sqlite3_stmt *isSuspectHostile;
 	sqlite3_stmt *createHostileAlert;
 
 	sqlite3_stmt *getTotalPackets;
 
-	sqlite3_stmt *getHostileSuspects;
+	// Where the retention rollups left off: (lastTime, ip, interface) of the last suspect rolled up.
+	// Reset once a pass gets to the end.
+	int64_t m_rollupTime;
+	int64_t m_rollupIp;
+	int64_t m_rollupInterface;
 };
 
 } /* namespace Nova */
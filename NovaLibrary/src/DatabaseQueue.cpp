@@ -19,15 +19,20 @@
 
 #include "ClassificationEngine.h"
 #include "SerializationHelper.h"
+#include "InterfaceTable.h"
 #include "DatabaseQueue.h"
 #include "HashMap.h"
 #include "Config.h"
 #include "Logger.h"
 #include "Lock.h"
 #include "Database.h"
+#include "DatabaseWriter.h"
+#include "Snapshot.h"
 
 #include <fstream>
+#include <algorithm>
 #include <sstream>
+#include <unistd.h>
 
 using namespace std;
 using namespace Nova;
@@ -38,28 +43,262 @@ namespace Nova
 {
 DatabaseQueue::DatabaseQueue()
 {
+	// The config isn't loaded yet when the global queue gets constructed, so start with a
+	// single shard until Novad knows how many consumers it'll run
+	SetShardCount(1);
+
+	pthread_rwlock_init(&m_honeypotLock, NULL);
+	pthread_mutex_init(&m_classifyLock, NULL);
+	pthread_mutex_init(&m_snapshotLock, NULL);
+
+	m_writeGeneration = 0;
+	m_snapshotValid = false;
+
+	m_shardMemoryBudget = 0;
+	m_suspectMemoryBudget = 0;
+	m_bytesInUse = 0;
+	m_evictions = 0;
+	m_oversizeFlushes = 0;
+	m_aggregateBytes = 0;
+	m_aggregateEvictions = 0;
+}
+
+DatabaseQueue::~DatabaseQueue()
+{
+	ClearShards();
+	pthread_rwlock_destroy(&m_honeypotLock);
+	pthread_mutex_destroy(&m_classifyLock);
+	pthread_mutex_destroy(&m_snapshotLock);
+}
+
+void DatabaseQueue::SetShardCount(uint shardCount)
+{
+	if(shardCount == 0)
+	{
+		shardCount = 1;
+	}
+	else if(shardCount > MAX_SUSPECT_SHARDS)
+	{
+		shardCount = MAX_SUSPECT_SHARDS;
+	}
+
+	ClearShards();
+
 	pthread_rwlockattr_t tempAttr;
 	pthread_rwlockattr_init(&tempAttr);
 	pthread_rwlockattr_setkind_np(&tempAttr,PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
-	pthread_rwlock_init(&m_lock, &tempAttr);
+	for(uint i = 0; i < shardCount; i++)
+	{
+		SuspectShard *shard = new SuspectShard();
+		shard->m_bytesInUse = 0;
+		shard->m_aggregateBytes = 0;
+		pthread_rwlock_init(&shard->m_lock, &tempAttr);
+		pthread_mutex_init(&shard->m_aggregateLock, NULL);
+		m_shards.push_back(shard);
+	}
+	pthread_rwlockattr_destroy(&tempAttr);
 }
 
-DatabaseQueue::~DatabaseQueue()
+uint DatabaseQueue::GetShardCount() const
+{
+	return m_shards.size();
+}
+
+void DatabaseQueue::ClearShards()
+{
+	for(uint i = 0; i < m_shards.size(); i++)
+	{
+		//Deletes the suspects pointed to by the table
+		SuspectHashTable &table = m_shards[i]->m_suspectTable;
+		for(SuspectHashTable::iterator it = table.begin(); it != table.end(); it++)
+		{
+			delete it->second;
+		}
+		table.clear();
+
+		FeatureAggregateTable &aggregates = m_shards[i]->m_aggregates;
+		for(FeatureAggregateTable::iterator it = aggregates.begin(); it != aggregates.end(); it++)
+		{
+			delete it->second.m_aggregate;
+		}
+		aggregates.clear();
+
+		pthread_rwlock_destroy(&m_shards[i]->m_lock);
+		pthread_mutex_destroy(&m_shards[i]->m_aggregateLock);
+		delete m_shards[i];
+	}
+	m_shards.clear();
+	m_bytesInUse = 0;
+	m_aggregateBytes = 0;
+}
+
+void DatabaseQueue::SetMemoryBudget(uint64_t totalBytes, uint64_t perSuspectBytes)
+{
+	m_shardMemoryBudget = totalBytes / m_shards.size();
+	m_suspectMemoryBudget = perSuspectBytes;
+}
+
+SuspectMemoryStatistics DatabaseQueue::GetMemoryStatistics()
+{
+	SuspectMemoryStatistics stats;
+	stats.m_bytesInUse = m_bytesInUse;
+	stats.m_evictions = m_evictions;
+	stats.m_oversizeFlushes = m_oversizeFlushes;
+	stats.m_aggregateBytes = m_aggregateBytes;
+	stats.m_aggregateEvictions = m_aggregateEvictions;
+	stats.m_suspectCount = 0;
+	stats.m_aggregateCount = 0;
+
+	for(uint i = 0; i < m_shards.size(); i++)
+	{
+		{
+			Lock lock(&m_shards[i]->m_lock, READ_LOCK);
+			stats.m_suspectCount += m_shards[i]->m_suspectTable.size();
+		}
+		Lock aggregateLock(&m_shards[i]->m_aggregateLock);
+		stats.m_aggregateCount += m_shards[i]->m_aggregates.size();
+	}
+
+	return stats;
+}
+
+// Orders biggest first
+static bool CompareSuspectSizes(const pair<SuspectID_pb, size_t> &a, const pair<SuspectID_pb, size_t> &b)
+{
+	return a.second > b.second;
+}
+
+vector<pair<SuspectID_pb, size_t> > DatabaseQueue::GetLargestSuspects(uint count)
+{
+	vector<pair<SuspectID_pb, size_t> > sizes;
+	for(uint i = 0; i < m_shards.size(); i++)
+	{
+		Lock lock(&m_shards[i]->m_lock, READ_LOCK);
+		SuspectHashTable &table = m_shards[i]->m_suspectTable;
+		for(SuspectHashTable::iterator it = table.begin(); it != table.end(); it++)
+		{
+			sizes.push_back(pair<SuspectID_pb, size_t>(it->first, it->second->GetMemoryUsage()));
+		}
+	}
+
+	count = min((size_t)count, sizes.size());
+	partial_sort(sizes.begin(), sizes.begin() + count, sizes.end(), CompareSuspectSizes);
+	sizes.resize(count);
+
+	return sizes;
+}
+
+void DatabaseQueue::SetHoneypots(const vector<uint32_t> &honeypots)
+{
+	Lock lock(&m_honeypotLock, WRITE_LOCK);
+	m_honeypots.Set(honeypots);
+}
+
+void DatabaseQueue::ForgetSuspect(const SuspectID_pb &id)
+{
+	SuspectShard *shard = GetShard(id.m_ip());
+	Lock lock(&shard->m_aggregateLock);
+	ForgetSuspect_noLocking(shard, id);
+}
+
+void DatabaseQueue::ForgetSuspect_noLocking(SuspectShard *shard, const SuspectID_pb &id)
+{
+	FeatureAggregateTable::iterator it = shard->m_aggregates.find(id);
+	if(it != shard->m_aggregates.end())
+	{
+		shard->m_aggregateBytes -= it->second.m_bytes;
+		m_aggregateBytes -= it->second.m_bytes;
+		delete it->second.m_aggregate;
+		shard->m_aggregates.erase(it);
+	}
+}
+
+void DatabaseQueue::ForgetAllSuspects()
 {
-	//Deletes the suspects pointed to by the table
-	for(SuspectHashTable::iterator it = m_suspectTable.begin(); it != m_suspectTable.end(); it++)
+	for(uint i = 0; i < m_shards.size(); i++)
 	{
-		delete m_suspectTable[it->first];
-		m_suspectTable[it->first] = NULL;
+		Lock lock(&m_shards[i]->m_aggregateLock);
+
+		FeatureAggregateTable &aggregates = m_shards[i]->m_aggregates;
+		for(FeatureAggregateTable::iterator it = aggregates.begin(); it != aggregates.end(); it++)
+		{
+			delete it->second.m_aggregate;
+		}
+		aggregates.clear();
+
+		m_aggregateBytes -= m_shards[i]->m_aggregateBytes;
+		m_shards[i]->m_aggregateBytes = 0;
 	}
-	m_suspectTable.clear();
+}
+
+AggregateEntry &DatabaseQueue::AddAggregate_noLocking(SuspectShard *shard, const SuspectID_pb &id, FeatureAggregate *aggregate)
+{
+	AggregateEntry &entry = shard->m_aggregates[id];
+	entry.m_aggregate = aggregate;
+	entry.m_bytes = 0;
+	entry.m_lastUsed = 0;
+	entry.m_writeSequence = 0;
+	UpdateAggregateUsage_noLocking(shard, entry);
+	return entry;
+}
+
+void DatabaseQueue::UpdateAggregateUsage_noLocking(SuspectShard *shard, AggregateEntry &entry)
+{
+	size_t bytes = entry.m_aggregate->GetMemoryUsage();
+	shard->m_aggregateBytes += bytes - entry.m_bytes;
+	m_aggregateBytes += bytes - entry.m_bytes;
+	entry.m_bytes = bytes;
+}
 
-	pthread_rwlock_destroy(&m_lock);
+// Orders least recently used first
+static bool CompareLastUsed(const pair<time_t, SuspectID_pb> &a, const pair<time_t, SuspectID_pb> &b)
+{
+	return a.first < b.first;
+}
+
+void DatabaseQueue::EvictColdAggregates_noLocking(SuspectShard *shard, uint64_t targetBytes)
+{
+	FeatureAggregateTable &aggregates = shard->m_aggregates;
+	uint64_t committed = DatabaseWriter::Inst()->GetCommittedSequence();
+
+	vector<pair<time_t, SuspectID_pb> > byLastUse;
+	byLastUse.reserve(aggregates.size());
+	for(FeatureAggregateTable::iterator it = aggregates.begin(); it != aggregates.end(); it++)
+	{
+		if(it->second.m_writeSequence <= committed)
+		{
+			byLastUse.push_back(pair<time_t, SuspectID_pb>(it->second.m_lastUsed, it->first));
+		}
+	}
+	sort(byLastUse.begin(), byLastUse.end(), CompareLastUsed);
+
+	uint evicted = 0;
+	for(uint i = 0; i < byLastUse.size() && shard->m_aggregateBytes > targetBytes; i++)
+	{
+		ForgetSuspect_noLocking(shard, byLastUse[i].second);
+		evicted++;
+	}
+	m_aggregateEvictions += evicted;
+
+	stringstream ss;
+	ss << "Suspect memory budget reached, dropped the feature totals of " << evicted << " idle suspects";
+	if(shard->m_aggregateBytes > targetBytes)
+	{
+		ss << ". The rest are still waiting to be written to the database";
+	}
+	LOG(DEBUG, ss.str(), "");
 }
 
 bool DatabaseQueue::empty()
 {
-	return m_suspectTable.size() == 0;
+	for(uint i = 0; i < m_shards.size(); i++)
+	{
+		if(m_shards[i]->m_suspectTable.size() != 0)
+		{
+			return false;
+		}
+	}
+	return true;
 }
 
 
@@ -70,124 +309,451 @@ bool DatabaseQueue::empty()
 //		this is a specialized function designed only for use by Consumer threads.
 void DatabaseQueue::ProcessEvidence(Evidence *evidence, bool readOnly)
 {
-	Lock lock (&m_lock, WRITE_LOCK);
-	SuspectID_pb key;
-	key.set_m_ip(evidence->m_evidencePacket.ip_src);
-	key.set_m_ifname(evidence->m_evidencePacket.interface);
+	SuspectShard *shard = GetShard(evidence->m_evidencePacket.ip_src);
+	SuspectHashTable evicted;
+	{
+		Lock lock (&shard->m_lock, WRITE_LOCK);
+		SuspectID_pb key;
+		key.set_m_ip(evidence->m_evidencePacket.ip_src);
+		key.set_m_ifname(InterfaceTable::Inst()->GetName(evidence->m_evidencePacket.interface));
+
+		//Consume and deallocate all the evidence
+		size_t bytesBefore;
+		Suspect *suspect = GetSuspect_noLocking(shard, key, bytesBefore);
+		suspect->ReadEvidence(evidence, !readOnly);
+
+		UpdateMemoryUsage_noLocking(shard, key, suspect, bytesBefore, evicted);
+	}
+
+	WriteEvictedSuspects(shard, evicted);
+}
+
+void DatabaseQueue::ProcessEvidence(const _evidencePacket &packet)
+{
+	SuspectShard *shard = GetShard(packet.ip_src);
+	SuspectHashTable evicted;
+	{
+		Lock lock (&shard->m_lock, WRITE_LOCK);
+		SuspectID_pb key;
+		key.set_m_ip(packet.ip_src);
+		key.set_m_ifname(InterfaceTable::Inst()->GetName(packet.interface));
+
+		size_t bytesBefore;
+		Suspect *suspect = GetSuspect_noLocking(shard, key, bytesBefore);
+		suspect->ReadEvidence(packet);
+
+		UpdateMemoryUsage_noLocking(shard, key, suspect, bytesBefore, evicted);
+	}
+
+	WriteEvictedSuspects(shard, evicted);
+}
 
-	//Consume and deallocate all the evidence
-	//If a suspect already exists
-	if(!m_suspectTable.keyExists(key))
+Suspect *DatabaseQueue::GetSuspect_noLocking(SuspectShard *shard, const SuspectID_pb &key, size_t &bytesBefore)
+{
+	if(!shard->m_suspectTable.keyExists(key))
 	{
-		m_suspectTable[key] = new Suspect();
+		bytesBefore = 0;
+		return shard->m_suspectTable[key] = new Suspect();
 	}
 
-	m_suspectTable[key]->ReadEvidence(evidence, !readOnly);
+	Suspect *suspect = shard->m_suspectTable[key];
+	bytesBefore = suspect->GetMemoryUsage();
+	return suspect;
+}
+
+void DatabaseQueue::UpdateMemoryUsage_noLocking(SuspectShard *shard, const SuspectID_pb &key, Suspect *suspect, size_t bytesBefore, SuspectHashTable &evicted)
+{
+	size_t bytesAfter = suspect->GetMemoryUsage();
+	shard->m_bytesInUse += bytesAfter - bytesBefore;
+	m_bytesInUse += bytesAfter - bytesBefore;
+
+	if(m_suspectMemoryBudget != 0 && bytesAfter > m_suspectMemoryBudget)
+	{
+		DetachSuspect_noLocking(shard, key, evicted);
+		m_oversizeFlushes++;
+	}
+
+	if(m_shardMemoryBudget == 0)
+	{
+		return;
+	}
+
+	// The suspects get what the aggregates leave of the budget, but never less than half of it
+	uint64_t aggregateBytes = shard->m_aggregateBytes.load(memory_order_relaxed);
+	uint64_t budget = m_shardMemoryBudget - min(aggregateBytes, m_shardMemoryBudget / 2);
+
+	// Evicting down to 90% of the budget rather than just under it means the sort in
+	// EvictColdSuspects_noLocking isn't redone for every packet while we're at the limit
+	if(shard->m_bytesInUse > budget)
+	{
+		EvictColdSuspects_noLocking(shard, budget / 10 * 9, evicted);
+	}
+}
+
+// Orders least recently seen first
+static bool CompareLastPacketTimes(const pair<time_t, SuspectID_pb> &a, const pair<time_t, SuspectID_pb> &b)
+{
+	return a.first < b.first;
+}
+
+void DatabaseQueue::EvictColdSuspects_noLocking(SuspectShard *shard, uint64_t targetBytes, SuspectHashTable &evicted)
+{
+	SuspectHashTable &table = shard->m_suspectTable;
+
+	vector<pair<time_t, SuspectID_pb> > byLastPacket;
+	byLastPacket.reserve(table.size());
+	for(SuspectHashTable::iterator it = table.begin(); it != table.end(); it++)
+	{
+		byLastPacket.push_back(pair<time_t, SuspectID_pb>(it->second->m_features.m_lastTime, it->first));
+	}
+	sort(byLastPacket.begin(), byLastPacket.end(), CompareLastPacketTimes);
+
+	uint count = 0;
+	for(uint i = 0; i < byLastPacket.size() && shard->m_bytesInUse > targetBytes; i++)
+	{
+		DetachSuspect_noLocking(shard, byLastPacket[i].second, evicted);
+		count++;
+	}
+
+	stringstream ss;
+	ss << "Suspect memory budget reached, writing out " << count << " idle suspects early";
+	LOG(DEBUG, ss.str(), "");
+
+	m_evictions += count;
+}
+
+void DatabaseQueue::DetachSuspect_noLocking(SuspectShard *shard, const SuspectID_pb &key, SuspectHashTable &detached)
+{
+	SuspectHashTable::iterator it = shard->m_suspectTable.find(key);
+	if(it == shard->m_suspectTable.end())
+	{
+		return;
+	}
+
+	// Still counted in the total until WriteDetachedSuspects hands it over, just not against the shard's budget
+	shard->m_bytesInUse -= it->second->GetMemoryUsage();
+	detached[key] = it->second;
+	shard->m_suspectTable.erase(it);
+}
+
+void DatabaseQueue::WriteEvictedSuspects(SuspectShard *shard, SuspectHashTable &evicted)
+{
+	if(evicted.empty())
+	{
+		return;
+	}
+
+	// Same as WriteToDatabase: the honeypots are locked without the shard's lock held
+	InvalidateSnapshot();
+	Lock honeypotLock(&m_honeypotLock, READ_LOCK);
+	WriteDetachedSuspects(shard, evicted);
 }
 
 
 void DatabaseQueue::WriteToDatabase()
 {
-	Lock lock (&m_lock, WRITE_LOCK);
-	int totalCount = 0;
+	InvalidateSnapshot();
+
+	// Keeps the honeypot set from changing under the feature computation
+	Lock honeypotLock(&m_honeypotLock, READ_LOCK);
+
+	for(uint i = 0; i < m_shards.size(); i++)
+	{
+		SuspectShard *shard = m_shards[i];
+
+		// The shard's lock is only held long enough to swap in an empty table. Its consumer carries
+		// on filling that while the old one is classified and queued up for the database writer.
+		SuspectHashTable detached;
+		{
+			Lock lock (&shard->m_lock, WRITE_LOCK);
+			detached.swap(shard->m_suspectTable);
+			shard->m_bytesInUse = 0;
+		}
+
+		WriteDetachedSuspects(shard, detached);
+	}
+}
+
+void DatabaseQueue::InvalidateSnapshot()
+{
+	Lock lock(&m_snapshotLock);
+	m_writeGeneration++;
+
+	if(m_snapshotValid)
+	{
+		unlink(m_snapshotPath.c_str());
+		m_snapshotValid = false;
+	}
+}
 
-	// This is in a while loop because we break out of the for loop every now and then to keep the
-	// queries per transaction down and improve responsiveness of readers
-	while (!m_suspectTable.empty())
+bool DatabaseQueue::SaveSnapshot(const string &path)
+{
+	uint64_t generation;
 	{
-		Database::Inst()->StartTransaction();
-		Database::Inst()->m_count = 0;
+		Lock lock(&m_snapshotLock);
+		generation = m_writeGeneration;
+	}
 
-		for(SuspectHashTable::iterator it = m_suspectTable.begin(); it != m_suspectTable.end();)
+	SnapshotWriter snapshot(path, SNAPSHOT_SUSPECTS);
+	vector<u_char> buffer;
+	uint suspectCount = 0;
+
+	// Each suspect is its ip, interface name and serialized evidence, one after the other
+	for(uint i = 0; i < m_shards.size() && snapshot.IsGood(); i++)
+	{
+		Lock lock(&m_shards[i]->m_lock, READ_LOCK);
+		SuspectHashTable &table = m_shards[i]->m_suspectTable;
+		for(SuspectHashTable::iterator it = table.begin(); it != table.end(); it++)
 		{
-			Suspect *s = it->second;
+			EvidenceAccumulator &evidence = it->second->m_features;
+			buffer.resize(evidence.GetSerializeLength());
+			uint32_t length = evidence.Serialize(&buffer[0], buffer.size());
+
+			uint32_t ip = it->first.m_ip();
+			const string &interface = it->first.m_ifname();
+			uint32_t interfaceLength = interface.size();
+
+			snapshot.Write(ip);
+			snapshot.Write(interfaceLength);
+			snapshot.WriteBytes(interface.data(), interfaceLength);
+			snapshot.Write(length);
+			snapshot.WriteBytes(&buffer[0], length);
+			suspectCount++;
+		}
+	}
 
-			Database::Inst()->InsertSuspect(s);
-			Database::Inst()->WriteTimestamps(s);
+	if(!snapshot.Sync())
+	{
+		return false;
+	}
 
-			string ip = s->GetIpString();
-			string interface = s->GetInterface();
+	// Only moved into place if nothing was written out to the database in the meantime
+	Lock lock(&m_snapshotLock);
+	if(m_writeGeneration != generation)
+	{
+		LOG(DEBUG, "Suspects were written to the database while the snapshot was being taken, dropping it", "");
+		return false;
+	}
+	if(!snapshot.Commit())
+	{
+		return false;
+	}
 
-			Database::Inst()->IncrementPacketCount(ip, interface, s->m_features);
+	m_snapshotPath = path;
+	m_snapshotValid = true;
 
-			for(Packet_Table::iterator it = s->m_features.m_packTable.begin() ; it != s->m_features.m_packTable.end(); it++)
-			{
-				Database::Inst()->IncrementPacketSizeCount(ip, interface, it->first, it->second);
-			}
+	stringstream ss;
+	ss << "Snapshot of " << suspectCount << " suspects waiting to be written saved to " << path;
+	LOG(DEBUG, ss.str(), "");
+	return true;
+}
 
-			for (IpPortTable::iterator it = s->m_features.m_hasTcpPortIpBeenContacted.begin(); it != s->m_features.m_hasTcpPortIpBeenContacted.end(); it++)
-			{
-				Database::Inst()->IncrementPortContactedCount(ip, interface, "tcp", Suspect::GetIpString(it->first.m_ip), it->first.m_port, it->second);
-			}
+bool DatabaseQueue::LoadSnapshot(const string &path)
+{
+	MappedSnapshot snapshot;
+	if(!snapshot.Open(path, SNAPSHOT_SUSPECTS))
+	{
+		return false;
+	}
+
+	// What's on disk is still good until the first of these suspects gets written out
+	{
+		Lock lock(&m_snapshotLock);
+		m_snapshotPath = path;
+		m_snapshotValid = true;
+	}
 
-			for (IpPortTable::iterator it = s->m_features.m_hasUdpPortIpBeenContacted.begin(); it != s->m_features.m_hasUdpPortIpBeenContacted.end(); it++)
+	uint suspectCount = 0;
+	while(snapshot.GetRemaining() != 0)
+	{
+		uint32_t ip, interfaceLength, length;
+		const char *interface;
+		const void *evidence;
+
+		if(!snapshot.Read(ip) || !snapshot.Read(interfaceLength)
+				|| (interface = (const char *)snapshot.ReadBytes(interfaceLength)) == NULL
+				|| !snapshot.Read(length)
+				|| (evidence = snapshot.ReadBytes(length)) == NULL)
+		{
+			LOG(WARNING, "Snapshot " + path + " is damaged, only some of its suspects were read back", "");
+			break;
+		}
+
+		SuspectID_pb key;
+		key.set_m_ip(ip);
+		key.set_m_ifname(string(interface, interfaceLength));
+
+		SuspectShard *shard = GetShard(ip);
+		SuspectHashTable evicted;
+		{
+			Lock lock(&shard->m_lock, WRITE_LOCK);
+
+			size_t bytesBefore;
+			Suspect *suspect = GetSuspect_noLocking(shard, key, bytesBefore);
+			if(bytesBefore != 0)
 			{
-				Database::Inst()->IncrementPortContactedCount(ip, interface, "udp", Suspect::GetIpString(it->first.m_ip), it->first.m_port, it->second);
+				// Only happens if evidence beat us here, in which case that's what's kept
+				continue;
 			}
 
-			for (IpPortTable::iterator it = s->m_features.m_icmpCodeTypes.begin(); it != s->m_features.m_icmpCodeTypes.end(); it++)
+			try
 			{
-				Database::Inst()->IncrementPortContactedCount(ip, interface, "icmp", Suspect::GetIpString(it->first.m_ip), it->first.m_port, it->second);
+				suspect->SetIdentifier(key);
+				suspect->m_features.Deserialize((u_char *)evidence, length);
 			}
-
-			// Random non TCP/UDP packets, we just keep a generic "other" count
-			for (IP_Table::iterator it = s->m_features.m_IPTable.begin(); it != s->m_features.m_IPTable.end(); it++)
+			catch(serializationException &e)
 			{
-				Database::Inst()->IncrementPortContactedCount(ip, interface, "other", Suspect::GetIpString(it->first), 0, it->second);
+				LOG(WARNING, "Unable to read suspect " + Suspect::GetIpString(ip) + " back from snapshot " + path, "");
+				// Never counted in the memory usage, so it's just taken back out of the table
+				shard->m_suspectTable.erase(key);
+				delete suspect;
+				continue;
 			}
 
+			UpdateMemoryUsage_noLocking(shard, key, suspect, bytesBefore, evicted);
+			suspectCount++;
+		}
 
-			vector<double> featureset = Database::Inst()->ComputeFeatures(Suspect::GetIpString(it->first), it->first.m_ifname());
-			copy(featureset.begin(), featureset.begin() + DIM, it->second->m_features.m_features);
+		WriteEvictedSuspects(shard, evicted);
+	}
 
-			if (Database::Inst()->GetTotalPacketCount(ip, interface) >= Config::Inst()->GetMinPacketThreshold())
-			{
-				// Classify the suspect with the new featureset we computed
-				engine->Classify(it->second);
-
-				// If it's hostile, see if we need to copy it into the hostile_alerts table
-				bool generateHostileAlert = false;
-				if (s->GetIsHostile())
-				{
-					// If it wasn't hostile before, but it is now, make an alert
-					if (!Database::Inst()->IsSuspectHostile(s->GetIpString(), s->GetInterface())){
-						generateHostileAlert = true;
-					}
-				}
-
-				// Store result back into database
-				Database::Inst()->WriteClassification(s);
-
-				if (generateHostileAlert)
-				{
-					LOG(ALERT, "Detected potentially hostile traffic from: " + s->ToString(), "");
-					Database::Inst()->InsertSuspectHostileAlert(s->GetIpString(), s->GetInterface());
-
-					if(Config::Inst()->GetClearAfterHostile())
-					{
-						Database::Inst()->ClearSuspect(s->GetIpString(), s->GetInterface());
-					}
-				}
-			}
+	stringstream ss;
+	ss << "Read " << suspectCount << " suspects that hadn't been written to the database back from " << path;
+	LOG(INFO, ss.str(), "");
+	return true;
+}
 
+void DatabaseQueue::WriteDetachedSuspects(SuspectShard *shard, SuspectHashTable &detached)
+{
+	vector<Suspect *> batch;
+	batch.reserve(SUSPECT_WRITE_BATCH);
 
-			it = m_suspectTable.erase(it);
-			delete s;
+	while (!detached.empty())
+	{
+		batch.clear();
+		for(SuspectHashTable::iterator it = detached.begin(); it != detached.end() && batch.size() < SUSPECT_WRITE_BATCH;)
+		{
+			// Still counted in the total until now, just not against the shard's budget
+			m_bytesInUse -= it->second->GetMemoryUsage();
+			batch.push_back(it->second);
+			it = detached.erase(it);
+		}
 
-			// Don't do more than 100k queries per transaction. Not a hard and fast rule,
-			// but it causes readers to not get new suspects for a long time if we're
-			// fuzzing things with the FAST tool, and it doesn't hurt to break things
-			// up into multiple transactions if we get really behind processing suspects.
-			if (Database::Inst()->m_count > 100000)
-			{
-				totalCount += Database::Inst()->m_count;
-				break;
-			}
+		WriteSuspects(shard, batch);
+	}
+}
 
+void DatabaseQueue::WriteSuspects(SuspectShard *shard, const vector<Suspect *> &batch)
+{
+	if (batch.empty())
+	{
+		return;
+	}
+
+	// Held until the batch is queued, so windows of the same suspect reach the writer in the order
+	// they were added to its aggregate
+	Lock aggregateLock(&shard->m_aggregateLock);
+
+	vector<SuspectRecord> records(batch.size());
+	vector<SuspectID_pb> keys(batch.size());
+	vector<Suspect *> classify;
+	classify.reserve(batch.size());
+	for(uint i = 0; i < batch.size(); i++)
+	{
+		Suspect *s = batch[i];
+		SuspectID_pb &key = keys[i] = s->GetIdentifier();
+
+		// The first time we see a suspect since startup (or since it was cleared), pick up
+		// whatever history the database already has for it before this window is written. The same
+		// goes for a suspect whose aggregate was dropped to stay within the memory budget.
+		FeatureAggregateTable::iterator it = shard->m_aggregates.find(key);
+		AggregateEntry *entry;
+		if(it != shard->m_aggregates.end())
+		{
+			entry = &it->second;
 		}
+		else
+		{
+			FeatureAggregate *loaded = new FeatureAggregate();
+			Database::Inst()->LoadFeatureAggregate(key.m_ip(), s->GetInterface(), *loaded, m_honeypots);
+			entry = &AddAggregate_noLocking(shard, key, loaded);
+		}
+		FeatureAggregate *aggregate = entry->m_aggregate;
+		aggregate->Add(s->m_features, m_honeypots);
+		aggregate->ComputeFeatures(s->m_features.m_features, m_honeypots);
+		entry->m_lastUsed = max(entry->m_lastUsed, s->m_features.m_lastTime);
+		UpdateAggregateUsage_noLocking(shard, *entry);
+
+		records[i].m_suspect = s;
+		if (!s->m_features.m_hasTcpPortIpBeenContacted.empty())
+		{
+			records[i].m_tcpIpPorts.resize(aggregate->GetTcpIpPorts().GetSerializeLength());
+			aggregate->GetTcpIpPorts().Serialize(&records[i].m_tcpIpPorts[0], records[i].m_tcpIpPorts.size());
+		}
+		if (!s->m_features.m_hasUdpPortIpBeenContacted.empty())
+		{
+			records[i].m_udpIpPorts.resize(aggregate->GetUdpIpPorts().GetSerializeLength());
+			aggregate->GetUdpIpPorts().Serialize(&records[i].m_udpIpPorts[0], records[i].m_udpIpPorts.size());
+		}
+
+		// Suspects without enough packets yet are written, just not classified
+		records[i].m_classified = aggregate->GetPacketCount() >= Config::Inst()->GetMinPacketThreshold();
+		if (records[i].m_classified)
+		{
+			classify.push_back(s);
+		}
+	}
+
+	ClassifySuspects(shard, classify);
+
+	uint64_t sequence = DatabaseWriter::Inst()->WriteSuspects(records);
+
+	// None of these aggregates can be dropped until this write is committed. The suspects are the
+	// writer's now, so it goes by the keys.
+	for(uint i = 0; i < keys.size(); i++)
+	{
+		FeatureAggregateTable::iterator it = shard->m_aggregates.find(keys[i]);
+		if(it != shard->m_aggregates.end())
+		{
+			it->second.m_writeSequence = sequence;
+		}
+	}
+
+	if(m_shardMemoryBudget != 0 && shard->m_aggregateBytes > m_shardMemoryBudget / 2)
+	{
+		EvictColdAggregates_noLocking(shard, m_shardMemoryBudget / 2 / 10 * 9);
+	}
+}
+
+void DatabaseQueue::ClassifySuspects(SuspectShard *shard, vector<Suspect *> &suspects)
+{
+	if (suspects.empty())
+	{
+		return;
+	}
 
-		Database::Inst()->m_count = totalCount;
-		Database::Inst()->StopTransaction();
+	// Classify the suspects with the new featuresets we computed
+	{
+		Lock classifyLock(&m_classifyLock);
+		m_classifications.resize(suspects.size());
+		engine->ClassifyBatch(&suspects[0], suspects.size(), &m_classifications[0]);
+	}
+
+	// The writer clears a newly hostile suspect out of the database once its alert is written. Its history
+	// starts over here too, with an empty aggregate rather than none at all so the next window doesn't go back
+	// to the database for rows the writer may not have cleared yet.
+	if (!Config::Inst()->GetClearAfterHostile())
+	{
+		return;
+	}
+	for(uint i = 0; i < suspects.size(); i++)
+	{
+		if (suspects[i]->GetIsHostile())
+		{
+			SuspectID_pb key = suspects[i]->GetIdentifier();
+			ForgetSuspect_noLocking(shard, key);
+			AddAggregate_noLocking(shard, key, new FeatureAggregate());
+		}
 	}
 }
 
@@ -24,8 +24,10 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <atomic>
 
 #include "Suspect.h"
+#include "FeatureAggregate.h"
 #include "protobuf/marshalled_classes.pb.h"
 
 namespace std
@@ -57,6 +59,47 @@ struct SuspectIDEq
 
 typedef Nova::HashMap<Nova::SuspectID_pb, Nova::Suspect *, std::hash<Nova::SuspectID_pb>, Nova::SuspectIDEq> SuspectHashTable;
 
+// A suspect's FeatureAggregate, with what it takes to decide whether it can be dropped for now
+struct AggregateEntry
+{
+	FeatureAggregate *m_aggregate;
+	// What GetMemoryUsage said last time it was accounted for
+	size_t m_bytes;
+	// Last packet time of the last window added to it
+	time_t m_lastUsed;
+	// DatabaseWriter sequence number of the last write it went out with. Until that's committed the
+	// database is behind the aggregate, so reloading it from there would lose those windows.
+	uint64_t m_writeSequence;
+};
+
+typedef Nova::HashMap<Nova::SuspectID_pb, Nova::AggregateEntry, std::hash<Nova::SuspectID_pb>, Nova::SuspectIDEq> FeatureAggregateTable;
+
+// Upper bound on CONSUMER_THREADS, there's one suspect shard per consumer
+#define MAX_SUSPECT_SHARDS 64
+
+// Suspects handed to the database per batch of upserts
+#define SUSPECT_WRITE_BATCH 256
+
+// Where novad keeps the suspects it hasn't written out yet across a restart, relative to the home folder
+#define SUSPECT_SNAPSHOT_FILE "data/suspects.snapshot"
+
+struct SuspectMemoryStatistics
+{
+	// Bytes held by suspects waiting to be written to the database
+	uint64_t m_bytesInUse;
+	uint m_suspectCount;
+
+	// Suspects written out early because their shard went over its share of the memory budget
+	uint64_t m_evictions;
+	// Suspects written out early because they went over the per suspect budget on their own
+	uint64_t m_oversizeFlushes;
+
+	// Bytes held by the feature totals of suspects seen since startup, and how many of those were
+	// dropped to stay within the budget (to be read back from the database when next needed)
+	uint64_t m_aggregateBytes;
+	uint m_aggregateCount;
+	uint64_t m_aggregateEvictions;
+};
 
 class DatabaseQueue
 {
@@ -67,6 +110,26 @@ public:
 
 	bool empty();
 
+	// Splits the suspects into shardCount partitions by source IP, each with its own lock.
+	// Must be called before any evidence is processed.
+	void SetShardCount(uint shardCount);
+	uint GetShardCount() const;
+
+	// Caps the memory held by suspects between database writes and by their feature totals, in
+	// bytes, 0 for no limit. The total is split evenly between the shards. Feature totals over half
+	// of a shard's share are dropped least recently used first, once the database has caught up
+	// with them; a shard whose suspects are over what's left writes out its least recently seen
+	// suspects early. Any suspect over perSuspectBytes is written out right away.
+	void SetMemoryBudget(uint64_t totalBytes, uint64_t perSuspectBytes);
+
+	// Shard that evidence from this source IP belongs to. Evidence for one shard should only
+	// ever be handed over by a single consumer thread, which then never waits on another consumer.
+	uint GetShardIndex(uint32_t ip) const
+	{
+		// Same multiplicative hash the capture fanout uses
+		return ((ip * 2654435761u) >> 16) % m_shards.size();
+	}
+
 	//Consumes the linked list of evidence objects, extracting their information and inserting them into the Suspects.
 	// evidence: Evidence object, if consuming more than one piece of evidence this is the start
 	//				of the linked list.
@@ -74,13 +137,126 @@ public:
 	//		this is a specialized function designed only for use by Consumer threads.
 	void ProcessEvidence(Evidence *evidence, bool readOnly = false);
 
+	// Adds a single evidence record to its suspect
+	void ProcessEvidence(const _evidencePacket &packet);
+
+	// Classifies every suspect gathered since the last call and hands them to the DatabaseWriter. Each shard is
+	// swapped for an empty one up front, so ProcessEvidence never waits on the classification.
 	void WriteToDatabase();
+
+	// Replaces the honeypot IPs (host byte order) that HAYSTACK_PERCENT_CONTACTED is computed against
+	void SetHoneypots(const std::vector<uint32_t> &honeypots);
+
+	// Drops the in memory feature totals for a suspect that was cleared from the database, so
+	// they start over from nothing rather than from the old history
+	void ForgetSuspect(const SuspectID_pb &id);
+	void ForgetAllSuspects();
+
+	SuspectMemoryStatistics GetMemoryStatistics();
+
+	// The count suspects holding the most memory right now, biggest first
+	std::vector<std::pair<SuspectID_pb, size_t> > GetLargestSuspects(uint count);
+
+	// Writes the evidence of every suspect still waiting to be written to the database out to a
+	// snapshot at path, without holding up the consumers for more than a shard at a time. The
+	// snapshot is deleted as soon as any of those suspects is written to the database, so it never
+	// holds evidence that's already been stored. False if it couldn't be written, or if a write to
+	// the database started while it was being taken.
+	bool SaveSnapshot(const std::string &path);
+
+	// Reads the suspects in a snapshot from SaveSnapshot back in. Meant to be called on startup,
+	// before any evidence comes in. The snapshot is left in place until they've been written out.
+	bool LoadSnapshot(const std::string &path);
 private:
 
-	// Hashmap used for constant time key lookups
-	SuspectHashTable m_suspectTable;
+	struct SuspectShard
+	{
+		// Hashmap used for constant time key lookups
+		SuspectHashTable m_suspectTable;
+
+		// Feature totals over each suspect's whole history. These outlive the suspects in
+		// m_suspectTable, which only hold evidence until the next database write.
+		FeatureAggregateTable m_aggregates;
+		// Guards m_aggregates. Suspects that were swapped out of m_suspectTable are written
+		// without m_lock, at the same time as consumers may be writing out new ones.
+		pthread_mutex_t m_aggregateLock;
+
+		// Sum of GetMemoryUsage over m_suspectTable
+		uint64_t m_bytesInUse;
+		// Sum of m_bytes over m_aggregates. Written with m_aggregateLock held, read by the
+		// consumer without it when working out what's left of the budget for suspects.
+		std::atomic<uint64_t> m_aggregateBytes;
+
+		pthread_rwlock_t m_lock;
+	};
+
+	std::vector<SuspectShard *> m_shards;
+
+	HoneypotSet m_honeypots;
+	pthread_rwlock_t m_honeypotLock;
+
+	// The classification engines aren't safe to run from more than one thread at once, and
+	// suspects can be written out early by consumers while the main write is running
+	pthread_mutex_t m_classifyLock;
+	// Where ClassifySuspects has the engine put its results, only touched under m_classifyLock
+	std::vector<double> m_classifications;
+
+	uint64_t m_shardMemoryBudget;
+	uint64_t m_suspectMemoryBudget;
+
+	std::atomic<uint64_t> m_bytesInUse;
+	std::atomic<uint64_t> m_evictions;
+	std::atomic<uint64_t> m_oversizeFlushes;
+	std::atomic<uint64_t> m_aggregateBytes;
+	std::atomic<uint64_t> m_aggregateEvictions;
+
+	// Bumped every time suspects are written out, so SaveSnapshot can tell if its snapshot went stale
+	// while it was being taken
+	uint64_t m_writeGeneration;
+	// Snapshot at m_snapshotPath holds suspects that haven't been written yet
+	bool m_snapshotValid;
+	std::string m_snapshotPath;
+	pthread_mutex_t m_snapshotLock;
+
+	SuspectShard *GetShard(uint32_t ip) const
+	{
+		return m_shards[GetShardIndex(ip)];
+	}
+
+	void ClearShards();
+
+	// Called before any suspect leaves a shard for the database
+	void InvalidateSnapshot();
+
+	// Caller must hold the shard's aggregate lock for these
+	void ForgetSuspect_noLocking(SuspectShard *shard, const SuspectID_pb &id);
+	AggregateEntry &AddAggregate_noLocking(SuspectShard *shard, const SuspectID_pb &id, FeatureAggregate *aggregate);
+	// Brings the memory accounting up to date after the aggregate changed
+	void UpdateAggregateUsage_noLocking(SuspectShard *shard, AggregateEntry &entry);
+	// Drops the least recently used aggregates whose writes have been committed until the shard's
+	// aggregates are down to targetBytes, or there are none left that can go
+	void EvictColdAggregates_noLocking(SuspectShard *shard, uint64_t targetBytes);
 
-	pthread_rwlock_t m_lock;
+	// Suspect for this key, created if it's not there yet. bytesBefore is set to what it held beforehand.
+	Suspect *GetSuspect_noLocking(SuspectShard *shard, const SuspectID_pb &key, size_t &bytesBefore);
+	// Accounts for a suspect's growth since bytesBefore and moves whatever is over budget into evicted,
+	// to be written out with WriteEvictedSuspects once the shard's lock is released
+	void UpdateMemoryUsage_noLocking(SuspectShard *shard, const SuspectID_pb &key, Suspect *suspect, size_t bytesBefore, SuspectHashTable &evicted);
+	// Moves the least recently seen suspects into evicted until the shard is down to targetBytes
+	void EvictColdSuspects_noLocking(SuspectShard *shard, uint64_t targetBytes, SuspectHashTable &evicted);
+	// Takes a suspect out of the shard and its budget, into detached
+	void DetachSuspect_noLocking(SuspectShard *shard, const SuspectID_pb &key, SuspectHashTable &detached);
+	// Classifies the suspects UpdateMemoryUsage_noLocking evicted and hands them to the DatabaseWriter.
+	// Caller mustn't hold the shard's lock, this goes to the database and waits on the writer.
+	void WriteEvictedSuspects(SuspectShard *shard, SuspectHashTable &evicted);
+	// Computes the features of a batch of suspects, classifies them and queues them for the DatabaseWriter,
+	// which frees them once they're written. They mustn't be in the shard's table any more, so the shard's
+	// lock isn't needed. Caller must hold a read lock on the honeypots.
+	void WriteSuspects(SuspectShard *shard, const std::vector<Suspect *> &batch);
+	// Classifies the suspects in one call to the engine. Caller holds the shard's aggregate lock.
+	void ClassifySuspects(SuspectShard *shard, std::vector<Suspect *> &suspects);
+	// Classifies and queues up every suspect in a table that's been swapped out of the shard
+	void WriteDetachedSuspects(SuspectShard *shard, SuspectHashTable &detached);
 };
 
 }
@@ -0,0 +1,423 @@
+//============================================================================
+// Name        : DatabaseWriter.cpp
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Thread owning the database's write connection. Writes are queued up
+//               and committed in groups, so nothing else waits on the SQL.
+//============================================================================
+
+#include "DatabaseWriter.h"
+#include "Config.h"
+#include "Logger.h"
+#include "Lock.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <algorithm>
+
+using namespace std;
+
+namespace Nova
+{
+
+DatabaseWriter *DatabaseWriter::m_instance = NULL;
+
+static double MillisecondsSince(const struct timeval &start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start.tv_sec) * 1000.0 + (now.tv_usec - start.tv_usec) / 1000.0;
+}
+
+DatabaseWriter *DatabaseWriter::Inst()
+{
+	if(m_instance == NULL)
+	{
+		m_instance = new DatabaseWriter();
+	}
+	return m_instance;
+}
+
+DatabaseWriter::DatabaseWriter()
+{
+	pthread_mutex_init(&m_queueLock, NULL);
+	pthread_cond_init(&m_queueNotEmpty, NULL);
+	pthread_cond_init(&m_queueNotFull, NULL);
+	pthread_cond_init(&m_committed, NULL);
+
+	m_queuedWeight = 0;
+	m_flushWaiters = 0;
+	m_queuedSequence = 0;
+	m_committedSequence = 0;
+	m_running = false;
+	m_stopping = false;
+
+	m_statistics.m_queueDepth = 0;
+	m_statistics.m_peakQueueDepth = 0;
+	m_statistics.m_commits = 0;
+	m_statistics.m_writesCommitted = 0;
+	m_statistics.m_averageCommitLatency = 0;
+	m_statistics.m_maxCommitLatency = 0;
+	m_statistics.m_producerStalls = 0;
+	m_statistics.m_producerStallTime = 0;
+	m_totalCommitLatency = 0;
+}
+
+void DatabaseWriter::Start()
+{
+	Lock lock(&m_queueLock);
+	if(m_running)
+	{
+		return;
+	}
+
+	m_running = true;
+	pthread_create(&m_thread, NULL, WriterThread, this);
+}
+
+void DatabaseWriter::Stop()
+{
+	{
+		Lock lock(&m_queueLock);
+		if(!m_running || m_stopping)
+		{
+			return;
+		}
+		m_stopping = true;
+		pthread_cond_broadcast(&m_queueNotEmpty);
+		pthread_cond_broadcast(&m_queueNotFull);
+	}
+
+	pthread_join(m_thread, NULL);
+
+	Lock lock(&m_queueLock);
+	m_running = false;
+	m_stopping = false;
+	pthread_cond_broadcast(&m_committed);
+}
+
+uint64_t DatabaseWriter::WriteSuspects(vector<SuspectRecord> &records)
+{
+	if(records.empty())
+	{
+		return 0;
+	}
+
+	Write *write = new Write();
+	write->m_type = Write::WRITE_SUSPECTS;
+	write->m_records.swap(records);
+	write->m_weight = write->m_records.size();
+	return Enqueue(write);
+}
+
+void DatabaseWriter::ClearSuspect(uint32_t ip, const string &interface)
+{
+	Write *write = new Write();
+	write->m_type = Write::CLEAR_SUSPECT;
+	write->m_ip = ip;
+	write->m_interface = interface;
+	write->m_weight = 1;
+	Enqueue(write);
+}
+
+void DatabaseWriter::ClearAllSuspects()
+{
+	Write *write = new Write();
+	write->m_type = Write::CLEAR_ALL_SUSPECTS;
+	write->m_weight = 1;
+	Enqueue(write);
+}
+
+void DatabaseWriter::InsertHoneypotIps(const vector<string> &ips)
+{
+	Write *write = new Write();
+	write->m_type = Write::INSERT_HONEYPOTS;
+	write->m_honeypots = ips;
+	write->m_weight = 1;
+	Enqueue(write);
+}
+
+void DatabaseWriter::ApplyRetention(const RetentionPolicy &policy, RetentionResult &result)
+{
+	Write *write = new Write();
+	write->m_type = Write::APPLY_RETENTION;
+	write->m_policy = policy;
+	write->m_result = &result;
+	write->m_weight = DATABASE_GROUP_COMMIT_WRITES;
+	Enqueue(write);
+	Flush();
+}
+
+void DatabaseWriter::Flush()
+{
+	Lock lock(&m_queueLock);
+	uint64_t sequence = m_queuedSequence;
+
+	// Tells the writer not to hold the transaction open for the rest of the group commit timeout
+	m_flushWaiters++;
+	pthread_cond_signal(&m_queueNotEmpty);
+
+	while(m_running && m_committedSequence < sequence)
+	{
+		pthread_cond_wait(&m_committed, &m_queueLock);
+	}
+	m_flushWaiters--;
+}
+
+uint64_t DatabaseWriter::GetCommittedSequence()
+{
+	Lock lock(&m_queueLock);
+	return m_committedSequence;
+}
+
+DatabaseWriterStatistics DatabaseWriter::GetStatistics()
+{
+	Lock lock(&m_queueLock);
+
+	DatabaseWriterStatistics statistics = m_statistics;
+	statistics.m_queueDepth = m_queuedWeight;
+	if(m_statistics.m_commits != 0)
+	{
+		statistics.m_averageCommitLatency = m_totalCommitLatency / m_statistics.m_commits;
+	}
+
+	m_statistics.m_peakQueueDepth = m_queuedWeight;
+	m_statistics.m_maxCommitLatency = 0;
+
+	return statistics;
+}
+
+uint64_t DatabaseWriter::Enqueue(Write *write)
+{
+	gettimeofday(&write->m_queued, NULL);
+
+	{
+		Lock lock(&m_queueLock);
+
+		// This is the back pressure: a producer that gets too far ahead of the writer waits for it here.
+		// A write bigger than the whole limit still goes through once the queue is empty.
+		if(m_running && !m_stopping && m_queuedWeight != 0 && m_queuedWeight + write->m_weight > DATABASE_WRITE_QUEUE_LIMIT)
+		{
+			struct timeval start;
+			gettimeofday(&start, NULL);
+
+			while(m_running && !m_stopping && m_queuedWeight != 0 && m_queuedWeight + write->m_weight > DATABASE_WRITE_QUEUE_LIMIT)
+			{
+				pthread_cond_wait(&m_queueNotFull, &m_queueLock);
+			}
+
+			m_statistics.m_producerStalls++;
+			m_statistics.m_producerStallTime += MillisecondsSince(start);
+		}
+
+		if(m_running && !m_stopping)
+		{
+			uint64_t sequence = write->m_sequence = ++m_queuedSequence;
+			m_queue.push_back(write);
+			m_queuedWeight += write->m_weight;
+			m_statistics.m_peakQueueDepth = max(m_statistics.m_peakQueueDepth, m_queuedWeight);
+
+			pthread_cond_signal(&m_queueNotEmpty);
+			return sequence;
+		}
+	}
+
+	Database::Inst()->StartTransaction();
+	Apply(write);
+	Database::Inst()->StopTransaction();
+	delete write;
+	return 0;
+}
+
+DatabaseWriter::Write *DatabaseWriter::Dequeue(const struct timespec *deadline)
+{
+	Lock lock(&m_queueLock);
+
+	while(m_queue.empty() && !m_stopping)
+	{
+		// Someone is waiting on what's already in the transaction, so commit it now
+		if(deadline != NULL && m_flushWaiters != 0)
+		{
+			break;
+		}
+
+		if(deadline == NULL)
+		{
+			pthread_cond_wait(&m_queueNotEmpty, &m_queueLock);
+		}
+		else if(pthread_cond_timedwait(&m_queueNotEmpty, &m_queueLock, deadline) == ETIMEDOUT)
+		{
+			break;
+		}
+	}
+
+	if(m_queue.empty())
+	{
+		return NULL;
+	}
+
+	Write *write = m_queue.front();
+	m_queue.pop_front();
+	m_queuedWeight -= write->m_weight;
+	pthread_cond_broadcast(&m_queueNotFull);
+
+	return write;
+}
+
+void *DatabaseWriter::WriterThread(void *ptr)
+{
+	// Leave the kill signals to the main thread, whose handler calls Stop and waits on this one
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	((DatabaseWriter *)ptr)->WriterLoop();
+	return NULL;
+}
+
+void DatabaseWriter::WriterLoop()
+{
+	while(true)
+	{
+		// Wait as long as it takes for the first write, then no longer than the group commit timeout for the rest
+		Write *write = Dequeue(NULL);
+		if(write == NULL)
+		{
+			return;
+		}
+
+		struct timeval oldest = write->m_queued;
+
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		struct timespec deadline;
+		deadline.tv_sec = now.tv_sec + DATABASE_GROUP_COMMIT_TIMEOUT / 1000;
+		deadline.tv_nsec = now.tv_usec * 1000 + (DATABASE_GROUP_COMMIT_TIMEOUT % 1000) * 1000000;
+		if(deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		uint64_t sequence = 0;
+		uint written = 0;
+
+		Database::Inst()->StartTransaction();
+		while(write != NULL)
+		{
+			Apply(write);
+			written += write->m_weight;
+			sequence = write->m_sequence;
+			delete write;
+
+			if(written >= DATABASE_GROUP_COMMIT_WRITES)
+			{
+				break;
+			}
+			write = Dequeue(&deadline);
+		}
+		Database::Inst()->StopTransaction();
+
+		double latency = MillisecondsSince(oldest);
+
+		Lock lock(&m_queueLock);
+		m_committedSequence = sequence;
+		m_statistics.m_commits++;
+		m_statistics.m_writesCommitted += written;
+		m_statistics.m_maxCommitLatency = max(m_statistics.m_maxCommitLatency, latency);
+		m_totalCommitLatency += latency;
+		pthread_cond_broadcast(&m_committed);
+	}
+}
+
+void DatabaseWriter::Apply(Write *write)
+{
+	switch(write->m_type)
+	{
+		case Write::WRITE_SUSPECTS:
+		{
+			ApplySuspects(write->m_records);
+			break;
+		}
+		case Write::CLEAR_SUSPECT:
+		{
+			Database::Inst()->ClearSuspect(write->m_ip, write->m_interface);
+			break;
+		}
+		case Write::CLEAR_ALL_SUSPECTS:
+		{
+			Database::Inst()->ClearAllSuspects();
+			break;
+		}
+		case Write::INSERT_HONEYPOTS:
+		{
+			for(uint i = 0; i < write->m_honeypots.size(); i++)
+			{
+				Database::Inst()->InsertHoneypotIp(write->m_honeypots[i]);
+			}
+			break;
+		}
+		case Write::APPLY_RETENTION:
+		{
+			Database::Inst()->ApplyRetention(write->m_policy, *write->m_result);
+			break;
+		}
+	}
+}
+
+void DatabaseWriter::ApplySuspects(vector<SuspectRecord> &records)
+{
+	Database *database = Database::Inst();
+
+	// A suspect seen for the first time is inserted with whatever it was just classified as, so
+	// this has to be looked up before the write to know whether it's newly hostile
+	vector<bool> wasHostile(records.size(), false);
+	for(uint i = 0; i < records.size(); i++)
+	{
+		Suspect *s = records[i].m_suspect;
+		if(records[i].m_classified && s->GetIsHostile())
+		{
+			wasHostile[i] = database->IsSuspectHostile(s->GetIdentifier().m_ip(), s->GetInterface());
+		}
+	}
+
+	database->PersistSuspects(records);
+
+	for(uint i = 0; i < records.size(); i++)
+	{
+		Suspect *s = records[i].m_suspect;
+		if(records[i].m_classified)
+		{
+			database->WriteClassification(s);
+
+			// If it wasn't hostile before, but it is now, make an alert
+			if(s->GetIsHostile() && !wasHostile[i])
+			{
+				LOG(ALERT, "Detected potentially hostile traffic from: " + s->ToString(), "");
+				database->InsertSuspectHostileAlert(s->GetIdentifier().m_ip(), s->GetInterface());
+
+				if(Config::Inst()->GetClearAfterHostile())
+				{
+					database->ClearSuspect(s->GetIdentifier().m_ip(), s->GetInterface());
+				}
+			}
+		}
+		delete s;
+	}
+}
+
+}
@@ -0,0 +1,156 @@
+//============================================================================
+// Name        : DatabaseWriter.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Thread owning the database's write connection. Writes are queued up
+//               and committed in groups, so nothing else waits on the SQL.
+//============================================================================
+
+#ifndef DATABASEWRITER_H_
+#define DATABASEWRITER_H_
+
+#include "Database.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+// Most suspects (or other writes) allowed to wait in the queue. Anyone queueing more blocks until
+// the writer catches up.
+#define DATABASE_WRITE_QUEUE_LIMIT 16384
+// A transaction is committed once it has this many suspects (or other writes) in it...
+#define DATABASE_GROUP_COMMIT_WRITES 4096
+// ...or once it has been open this long, in milliseconds
+#define DATABASE_GROUP_COMMIT_TIMEOUT 250
+
+namespace Nova
+{
+
+struct DatabaseWriterStatistics
+{
+	// Writes waiting to be applied, counting a suspect as one
+	uint m_queueDepth;
+	// The deepest the queue got since the last GetStatistics
+	uint m_peakQueueDepth;
+
+	uint64_t m_commits;
+	uint64_t m_writesCommitted;
+
+	// From the oldest write in a transaction being queued to the transaction committing, in ms
+	double m_averageCommitLatency;
+	// The longest since the last GetStatistics
+	double m_maxCommitLatency;
+
+	// Times a producer had to wait for room in the queue, and how long it waited in all, in ms
+	uint64_t m_producerStalls;
+	double m_producerStallTime;
+};
+
+class DatabaseWriter
+{
+public:
+	static DatabaseWriter *Inst();
+
+	// Starts the writer thread. Until this is called (and after Stop), writes are applied on the
+	// calling thread, each in a transaction of its own.
+	void Start();
+
+	// Commits everything still queued and stops the writer thread
+	void Stop();
+
+	// Writes out and classifies a batch of suspects. The writer takes ownership of the suspects and frees them
+	// once they've been written, so the caller mustn't touch them after this. Newly hostile suspects get an
+	// alert, and are cleared from the database afterwards if CLEAR_AFTER_HOSTILE is set.
+	// Returns the write's sequence number, see GetCommittedSequence.
+	uint64_t WriteSuspects(std::vector<SuspectRecord> &records);
+
+	void ClearSuspect(uint32_t ip, const std::string &interface);
+	void ClearAllSuspects();
+	void InsertHoneypotIps(const std::vector<std::string> &ips);
+
+	// Runs one step of Database::ApplyRetention on the writer and waits for it to commit. The step is
+	// counted as a full group commit, so it waits its turn behind any backlog and is committed right
+	// after it runs rather than holding the transaction open.
+	void ApplyRetention(const RetentionPolicy &policy, RetentionResult &result);
+
+	// Blocks until everything queued before the call has been committed
+	void Flush();
+
+	// Sequence number of the last write committed. A write from WriteSuspects is in the database,
+	// where the other connections can read it, once this has reached its sequence number.
+	uint64_t GetCommittedSequence();
+
+	DatabaseWriterStatistics GetStatistics();
+
+private:
+	DatabaseWriter();
+
+	struct Write
+	{
+		enum Type {WRITE_SUSPECTS, CLEAR_SUSPECT, CLEAR_ALL_SUSPECTS, INSERT_HONEYPOTS, APPLY_RETENTION};
+
+		Type m_type;
+		std::vector<SuspectRecord> m_records;
+		uint32_t m_ip;
+		std::string m_interface;
+		std::vector<std::string> m_honeypots;
+		RetentionPolicy m_policy;
+		// Belongs to whoever queued the write, who waits for it
+		RetentionResult *m_result;
+
+		// How much of the queue limit this write takes up
+		uint m_weight;
+		uint64_t m_sequence;
+		struct timeval m_queued;
+	};
+
+	static DatabaseWriter *m_instance;
+
+	static void *WriterThread(void *ptr);
+	void WriterLoop();
+
+	// Queues the write, waiting for room first if the queue is full. Applies it right away if the thread isn't running.
+	// Returns its sequence number, or 0 if it was applied right away.
+	uint64_t Enqueue(Write *write);
+	// Oldest queued write, waiting until deadline (forever if NULL) for one. NULL if none came or we're stopping.
+	Write *Dequeue(const struct timespec *deadline);
+	void Apply(Write *write);
+	void ApplySuspects(std::vector<SuspectRecord> &records);
+
+	std::deque<Write *> m_queue;
+	uint m_queuedWeight;
+	pthread_mutex_t m_queueLock;
+	pthread_cond_t m_queueNotEmpty;
+	pthread_cond_t m_queueNotFull;
+
+	// Sequence numbers of the last write queued and the last one committed
+	uint64_t m_queuedSequence;
+	uint64_t m_committedSequence;
+	pthread_cond_t m_committed;
+	uint m_flushWaiters;
+
+	pthread_t m_thread;
+	bool m_running;
+	bool m_stopping;
+
+	DatabaseWriterStatistics m_statistics;
+	double m_totalCommitLatency;
+};
+
+}
+
+#endif /* DATABASEWRITER_H_ */
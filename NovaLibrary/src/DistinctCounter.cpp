@@ -0,0 +1,250 @@
+//============================================================================
+// Name        : DistinctCounter.cpp
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Distinct count that is exact for small sets and turns into a
+//				HyperLogLog sketch once it gets big
+//============================================================================
+
+#include "DistinctCounter.h"
+#include "SerializationHelper.h"
+
+#include <math.h>
+#include <iterator>
+#include <algorithm>
+
+using namespace std;
+
+namespace Nova
+{
+
+DistinctCounter::DistinctCounter()
+{
+}
+
+void DistinctCounter::Add(uint64_t item)
+{
+	AddHash(Hash(item));
+}
+
+void DistinctCounter::AddHash(uint64_t hash)
+{
+	if(!IsExact())
+	{
+		AddToSketch(hash);
+		return;
+	}
+
+	vector<uint64_t>::iterator it = lower_bound(m_exact.begin(), m_exact.end(), hash);
+	if(it != m_exact.end() && *it == hash)
+	{
+		return;
+	}
+
+	m_exact.insert(it, hash);
+	if(m_exact.size() > DISTINCT_COUNTER_EXACT_LIMIT)
+	{
+		Promote();
+	}
+}
+
+void DistinctCounter::AddToSketch(uint64_t hash)
+{
+	// The top bits pick the register, which keeps the largest run of leading zeros in the rest
+	uint index = hash >> (64 - DISTINCT_COUNTER_PRECISION);
+	uint64_t rest = hash << DISTINCT_COUNTER_PRECISION;
+
+	uint8_t rank = 64 - DISTINCT_COUNTER_PRECISION + 1;
+	if(rest != 0)
+	{
+		rank = __builtin_clzll(rest) + 1;
+	}
+
+	if(rank > m_registers[index])
+	{
+		m_registers[index] = rank;
+	}
+}
+
+void DistinctCounter::Promote()
+{
+	m_registers.assign(DISTINCT_COUNTER_REGISTERS, 0);
+	for(uint i = 0; i < m_exact.size(); i++)
+	{
+		AddToSketch(m_exact[i]);
+	}
+
+	// Swap rather than clear so the memory is actually given back
+	vector<uint64_t>().swap(m_exact);
+}
+
+void DistinctCounter::Merge(const DistinctCounter &other)
+{
+	if(other.IsExact() && IsExact())
+	{
+		// Both are sorted, so they merge in one pass
+		vector<uint64_t> merged;
+		set_union(m_exact.begin(), m_exact.end(), other.m_exact.begin(), other.m_exact.end(), back_inserter(merged));
+		m_exact.swap(merged);
+		if(m_exact.size() > DISTINCT_COUNTER_EXACT_LIMIT)
+		{
+			Promote();
+		}
+		return;
+	}
+
+	if(other.IsExact())
+	{
+		for(uint i = 0; i < other.m_exact.size(); i++)
+		{
+			AddToSketch(other.m_exact[i]);
+		}
+		return;
+	}
+
+	if(IsExact())
+	{
+		Promote();
+	}
+
+	for(uint i = 0; i < DISTINCT_COUNTER_REGISTERS; i++)
+	{
+		if(other.m_registers[i] > m_registers[i])
+		{
+			m_registers[i] = other.m_registers[i];
+		}
+	}
+}
+
+void DistinctCounter::Clear()
+{
+	vector<uint64_t>().swap(m_exact);
+	vector<uint8_t>().swap(m_registers);
+}
+
+size_t DistinctCounter::GetMemoryUsage() const
+{
+	return m_exact.capacity() * sizeof(uint64_t) + m_registers.capacity();
+}
+
+uint64_t DistinctCounter::GetCount() const
+{
+	if(IsExact())
+	{
+		return m_exact.size();
+	}
+
+	double registers = DISTINCT_COUNTER_REGISTERS;
+	double sum = 0;
+	uint zeros = 0;
+	for(uint i = 0; i < DISTINCT_COUNTER_REGISTERS; i++)
+	{
+		sum += ldexp(1.0, -m_registers[i]);
+		if(m_registers[i] == 0)
+		{
+			zeros++;
+		}
+	}
+
+	double alpha = 0.7213 / (1 + 1.079 / registers);
+	double estimate = alpha * registers * registers / sum;
+
+	// The raw estimate is biased for small counts, linear counting is better there. With a
+	// 64 bit hash there's no need for the usual large range correction.
+	if(estimate <= 2.5 * registers && zeros != 0)
+	{
+		estimate = registers * log(registers / zeros);
+	}
+
+	return (uint64_t)(estimate + 0.5);
+}
+
+uint32_t DistinctCounter::GetSerializeLength() const
+{
+	if(IsExact())
+	{
+		return sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint32_t) + m_exact.size() * sizeof(uint64_t);
+	}
+	return sizeof(uint8_t) + sizeof(uint8_t) + DISTINCT_COUNTER_REGISTERS;
+}
+
+uint32_t DistinctCounter::Serialize(u_char *buf, uint32_t bufferSize) const
+{
+	uint32_t offset = 0;
+	uint8_t version = DISTINCT_COUNTER_VERSION;
+	uint8_t exact = IsExact();
+
+	SerializeChunk(buf, offset, (char*)&version, sizeof(version), bufferSize);
+	SerializeChunk(buf, offset, (char*)&exact, sizeof(exact), bufferSize);
+
+	if(exact)
+	{
+		uint32_t count = m_exact.size();
+		SerializeChunk(buf, offset, (char*)&count, sizeof(count), bufferSize);
+
+		for(uint i = 0; i < m_exact.size(); i++)
+		{
+			SerializeChunk(buf, offset, (char*)&m_exact[i], sizeof(uint64_t), bufferSize);
+		}
+	}
+	else
+	{
+		SerializeChunk(buf, offset, (char*)&m_registers[0], DISTINCT_COUNTER_REGISTERS, bufferSize);
+	}
+
+	return offset;
+}
+
+uint32_t DistinctCounter::Deserialize(u_char *buf, uint32_t bufferSize)
+{
+	Clear();
+
+	uint32_t offset = 0;
+	uint8_t version, exact;
+
+	DeserializeChunk(buf, offset, (char*)&version, sizeof(version), bufferSize);
+	if(version != DISTINCT_COUNTER_VERSION)
+	{
+		throw serializationException();
+	}
+
+	DeserializeChunk(buf, offset, (char*)&exact, sizeof(exact), bufferSize);
+	if(exact)
+	{
+		uint32_t count;
+		DeserializeChunk(buf, offset, (char*)&count, sizeof(count), bufferSize);
+		for(uint32_t i = 0; i < count; i++)
+		{
+			uint64_t hash;
+			DeserializeChunk(buf, offset, (char*)&hash, sizeof(hash), bufferSize);
+			AddHash(hash);
+		}
+	}
+	else
+	{
+		m_registers.assign(DISTINCT_COUNTER_REGISTERS, 0);
+		DeserializeChunk(buf, offset, (char*)&m_registers[0], DISTINCT_COUNTER_REGISTERS, bufferSize);
+		for(uint i = 0; i < DISTINCT_COUNTER_REGISTERS; i++)
+		{
+			if(m_registers[i] > 64 - DISTINCT_COUNTER_PRECISION + 1)
+			{
+				throw serializationException();
+			}
+		}
+	}
+
+	return offset;
+}
+
+}
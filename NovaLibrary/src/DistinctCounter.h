@@ -0,0 +1,94 @@
+//============================================================================
+// Name        : DistinctCounter.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Distinct count that is exact for small sets and turns into a
+//				HyperLogLog sketch once it gets big
+//============================================================================
+
+#ifndef DISTINCTCOUNTER_H_
+#define DISTINCTCOUNTER_H_
+
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+
+// 2^12 one byte registers: 4KB per sketch, about 1.6% standard error
+#define DISTINCT_COUNTER_PRECISION 12
+#define DISTINCT_COUNTER_REGISTERS (1 << DISTINCT_COUNTER_PRECISION)
+// Past this many distinct items the exact set is traded for a sketch, which is when the
+// hashes would take more room than the registers
+#define DISTINCT_COUNTER_EXACT_LIMIT (DISTINCT_COUNTER_REGISTERS / sizeof(uint64_t))
+
+// Version byte at the start of serialized counters
+#define DISTINCT_COUNTER_VERSION 1
+
+namespace Nova
+{
+
+// Items are reduced to a 64 bit hash up front. Up to DISTINCT_COUNTER_EXACT_LIMIT hashes are kept
+// in a sorted vector and counted exactly; the first item past that promotes the counter to a
+// HyperLogLog sketch. Either way it never takes more than DISTINCT_COUNTER_REGISTERS bytes however
+// many items are added. Counters can be merged in any mode, and the result is the same as if every
+// item had been added to one counter.
+class DistinctCounter
+{
+public:
+	DistinctCounter();
+
+	void Add(uint64_t item);
+	void Merge(const DistinctCounter &other);
+	void Clear();
+
+	uint64_t GetCount() const;
+	bool IsExact() const {return m_registers.empty();}
+
+	// Bytes held beyond sizeof(DistinctCounter)
+	size_t GetMemoryUsage() const;
+
+	// The counter as one blob, in host byte order:
+	//   uint8 version, uint8 exact (1) or sketch (0), then either
+	//   uint32 number of hashes followed by each uint64 hash, or the DISTINCT_COUNTER_REGISTERS uint8 registers
+	uint32_t GetSerializeLength() const;
+	// Returns the number of bytes written. Throws serializationException if buf is too small.
+	uint32_t Serialize(u_char *buf, uint32_t bufferSize) const;
+	// Replaces the contents with a serialized counter. Throws serializationException if it's truncated or malformed.
+	uint32_t Deserialize(u_char *buf, uint32_t bufferSize);
+
+	// Scrambles an item into the hash that's actually counted
+	static inline uint64_t Hash(uint64_t item)
+	{
+		item ^= item >> 33;
+		item *= 0xff51afd7ed558ccdULL;
+		item ^= item >> 33;
+		item *= 0xc4ceb9fe1a85ec53ULL;
+		item ^= item >> 33;
+		return item;
+	}
+
+private:
+	// The hashes seen so far in ascending order, only used while the count is exact
+	std::vector<uint64_t> m_exact;
+
+	// The sketch, empty while the count is exact
+	std::vector<uint8_t> m_registers;
+
+	void AddHash(uint64_t hash);
+	void AddToSketch(uint64_t hash);
+	void Promote();
+};
+
+}
+
+#endif /* DISTINCTCOUNTER_H_ */
@@ -57,9 +57,7 @@ void Doppelganger::UpdateDoppelganger()
 		InitDoppelganger();
 	}
 
-	Database::Inst()->StartTransaction();
 	vector<SuspectID_pb> keys = Database::Inst()->GetHostileSuspects();
-	Database::Inst()->StopTransaction();
 
 	vector<SuspectID_pb> keysCopy = keys;
 
@@ -256,9 +254,7 @@ void Doppelganger::ResetDoppelganger()
 	}
 	m_suspectKeys.clear();
 
-	Database::Inst()->StartTransaction();
 	m_suspectKeys = Database::Inst()->GetHostileSuspects();
-	Database::Inst()->StopTransaction();
 
 	prefix = "sudo iptables -t nat -I DOPP -s ";
 	string suffix = " -j DNAT --to-destination " + Config::Inst()->GetDoppelIp();
@@ -18,8 +18,6 @@
 //============================================================================/*
 
 #include "Evidence.h"
-#include "netinet/tcp.h"
-#include <dumbnet.h>
 #include <iostream>
 
 using namespace std;
@@ -37,51 +35,17 @@ Evidence::Evidence()
 	m_evidencePacket.ip_p = 0;
 	m_evidencePacket.ip_src = ~0;
 	m_evidencePacket.ts = 0;
+	m_evidencePacket.interface = 0;
+	m_evidencePacket.tcp_hdr.ack = false;
+	m_evidencePacket.tcp_hdr.rst = false;
+	m_evidencePacket.tcp_hdr.syn = false;
+	m_evidencePacket.tcp_hdr.fin = false;
 }
 
-Evidence::Evidence(const u_char *packet_at_ip_header, const pcap_pkthdr *pkthdr)
+Evidence::Evidence(const _evidencePacket &packet)
 {
-
-	struct ip_hdr *ip;
-	ip = (ip_hdr *) packet_at_ip_header;
-
-	m_evidencePacket.ts = pkthdr->ts.tv_sec;
-
-	uint8_t ip_hl = ip->ip_hl;
+	m_evidencePacket = packet;
 	m_next = NULL;
-
-	m_evidencePacket.ip_len = ntohs(ip->ip_len);
-	m_evidencePacket.ip_p = ip->ip_p;
-	m_evidencePacket.ip_src = ntohl(ip->ip_src);
-	m_evidencePacket.ip_dst = ntohl(ip->ip_dst);
-
-	m_evidencePacket.dst_port = -1;
-
-	if((m_evidencePacket.ip_p == IPPROTO_TCP))
-	{
-		struct tcp_hdr *tcp = (tcp_hdr*) (packet_at_ip_header + ip_hl*4);
-
-		m_evidencePacket.dst_port = ntohs(tcp->th_dport);
-
-		// Read in the tcp flags
-		m_evidencePacket.tcp_hdr.ack = tcp->th_flags & TH_ACK;
-		m_evidencePacket.tcp_hdr.rst = tcp->th_flags & TH_RST;
-		m_evidencePacket.tcp_hdr.syn = tcp->th_flags & TH_SYN;
-		m_evidencePacket.tcp_hdr.fin = tcp->th_flags & TH_FIN;
-	}
-	else if(m_evidencePacket.ip_p == IPPROTO_UDP)
-	{
-		struct udp_hdr *udp = (udp_hdr*) (packet_at_ip_header + ip_hl*4);
-		m_evidencePacket.dst_port = ntohs(udp->uh_dport);
-	}
-	else if (m_evidencePacket.ip_p == IPPROTO_ICMP)
-	{
-		struct icmp_hdr *hdr = (icmp_hdr*) (packet_at_ip_header + ip_hl*4);
-		m_evidencePacket.dst_port = (uint16_t)0 | (uint16_t)hdr->icmp_type | ((uint16_t)hdr->icmp_code << 8);
-	}
-
-
-
 }
 
 Evidence::Evidence(Evidence *evidence)
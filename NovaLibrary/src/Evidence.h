@@ -20,9 +20,19 @@
 #ifndef EVIDENCE_H_
 #define EVIDENCE_H_
 
+#include "SlabAllocator.h"
+
 #include <string>
 #include <pcap.h>
+#include <type_traits>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+
+// Most packets a capture thread collects before publishing them to the evidence table
+#define EVIDENCE_BATCH_SIZE 512
+
+// Captures are all on ethernet, the IP header starts right after this
+#define EVIDENCE_ETHER_HEADER_LENGTH 14
 
 namespace Nova
 {
@@ -35,19 +45,22 @@ struct _tcpFlags
 	bool fin : 1;
 };
 
-struct _evidencePacket // Total of 18 bytes
+// Fixed size and trivially copyable, so records can be batched, copied and recycled without touching the heap
+struct _evidencePacket // Total of 20 bytes
 {
-	std::string interface;
-
-	uint16_t ip_len; 	//Length in bytes
-	uint8_t ip_p;		//Ip protocol (UDP, TCP or ICMP)
 	uint32_t ip_src;	//Source IPv4 address
 	uint32_t ip_dst;	//Destination IPv4 address
+	uint32_t ts;		//Arrival Timestamp (in seconds)
+	uint16_t ip_len; 	//Length in bytes
 	uint16_t dst_port;	//Destination Port (UDP or TCP Only) or type/code if ICMP
-	time_t ts;		//Arrival Timestamp (in seconds)
+	uint16_t interface;	//Capture interface, an id from the InterfaceTable
+	uint8_t ip_p;		//Ip protocol (UDP, TCP or ICMP)
 	_tcpFlags tcp_hdr;
 };
 
+static_assert(sizeof(_evidencePacket) <= 24, "_evidencePacket should stay small, there's one per captured packet");
+static_assert(std::is_pod<_evidencePacket>::value, "_evidencePacket must stay trivially copyable");
+
 class Evidence
 {
 
@@ -56,11 +69,121 @@ public:
 	_evidencePacket m_evidencePacket;
 	Evidence *m_next;
 
-	Evidence(const u_char *packet_at_ip_header, const pcap_pkthdr *pkthdr);
+	Evidence(const _evidencePacket &packet);
 
 	Evidence(Evidence *evidence);
 
 	Evidence();
+
+	// Evidence is created and destroyed once per packet, so it comes out of a recycling slab instead of malloc
+	static void *operator new(size_t size)
+	{
+		return SlabAllocator<Evidence>::Allocate();
+	}
+
+	static void operator delete(void *evidence)
+	{
+		SlabAllocator<Evidence>::Free(evidence);
+	}
+
+	// Fills in everything but the interface of packet from the IP header and the TCP/UDP/ICMP header after it
+	//	packet_at_ip_header: start of the IP header
+	//	caplen: number of captured bytes starting at packet_at_ip_header
+	//	ts: arrival time of the packet
+	// Returns false if too little of the packet was captured to read the IP header
+	static inline bool ParseHeaders(const u_char *packet_at_ip_header, uint32_t caplen, time_t ts, _evidencePacket &packet)
+	{
+		if(caplen < 20)
+		{
+			return false;
+		}
+
+		const u_char *ip = packet_at_ip_header;
+		uint32_t ipHeaderLength = (ip[0] & 0x0f) * 4;
+
+		packet.ts = ts;
+		packet.ip_len = ntohs(*(const uint16_t *)(ip + 2));
+		packet.ip_p = ip[9];
+		packet.ip_src = ntohl(*(const uint32_t *)(ip + 12));
+		packet.ip_dst = ntohl(*(const uint32_t *)(ip + 16));
+		packet.dst_port = -1;
+		packet.tcp_hdr.ack = false;
+		packet.tcp_hdr.rst = false;
+		packet.tcp_hdr.syn = false;
+		packet.tcp_hdr.fin = false;
+
+		const u_char *transport = ip + ipHeaderLength;
+		if(packet.ip_p == IPPROTO_TCP)
+		{
+			// Flags are 13 bytes into the TCP header
+			if(caplen >= ipHeaderLength + 14)
+			{
+				packet.dst_port = ntohs(*(const uint16_t *)(transport + 2));
+				packet.tcp_hdr.ack = transport[13] & TH_ACK;
+				packet.tcp_hdr.rst = transport[13] & TH_RST;
+				packet.tcp_hdr.syn = transport[13] & TH_SYN;
+				packet.tcp_hdr.fin = transport[13] & TH_FIN;
+			}
+		}
+		else if(packet.ip_p == IPPROTO_UDP)
+		{
+			if(caplen >= ipHeaderLength + 4)
+			{
+				packet.dst_port = ntohs(*(const uint16_t *)(transport + 2));
+			}
+		}
+		else if(packet.ip_p == IPPROTO_ICMP)
+		{
+			if(caplen >= ipHeaderLength + 2)
+			{
+				packet.dst_port = (uint16_t)transport[0] | ((uint16_t)transport[1] << 8);
+			}
+		}
+
+		return true;
+	}
+};
+
+// A contiguous run of parsed packets from one capture, published to the evidence table in one go
+class EvidenceBatch
+{
+public:
+	_evidencePacket m_packets[EVIDENCE_BATCH_SIZE];
+	uint m_count;
+
+	// InterfaceTable id stamped on every packet added to the batch
+	uint16_t m_interface;
+
+	EvidenceBatch()
+	{
+		m_count = 0;
+		m_interface = 0;
+	}
+
+	// Parses an ethernet frame carrying IPv4 into the next free record
+	inline void Add(const u_char *packet, const pcap_pkthdr *pkthdr)
+	{
+		if(pkthdr->caplen <= EVIDENCE_ETHER_HEADER_LENGTH)
+		{
+			return;
+		}
+
+		if(Evidence::ParseHeaders(packet + EVIDENCE_ETHER_HEADER_LENGTH, pkthdr->caplen - EVIDENCE_ETHER_HEADER_LENGTH, pkthdr->ts.tv_sec, m_packets[m_count]))
+		{
+			m_packets[m_count].interface = m_interface;
+			m_count++;
+		}
+	}
+
+	bool IsFull() const
+	{
+		return m_count == EVIDENCE_BATCH_SIZE;
+	}
+
+	void Clear()
+	{
+		m_count = 0;
+	}
 };
 
 // The GenericQueue requires an m_next pointer, so this is just so
@@ -77,6 +200,16 @@ public:
 		m_next = NULL;
 		this->ip = ip;
 	}
+
+	static void *operator new(size_t size)
+	{
+		return SlabAllocator<IpWrapper>::Allocate();
+	}
+
+	static void operator delete(void *wrapper)
+	{
+		SlabAllocator<IpWrapper>::Free(wrapper);
+	}
 };
 
 }
@@ -78,25 +78,18 @@ EvidenceAccumulator::EvidenceAccumulator()
 	}
 }
 
-void EvidenceAccumulator::Add(const Evidence &evidence)
+void EvidenceAccumulator::Add(const _evidencePacket &packet)
 {
-	switch(evidence.m_evidencePacket.ip_p)
+	switch(packet.ip_p)
 	{
 		case IPPROTO_UDP:
 		{
 			m_udpPacketCount++;
 
 			IpPortCombination t;
-			t.m_ip = evidence.m_evidencePacket.ip_dst;
-			t.m_port = evidence.m_evidencePacket.dst_port;
-			if (!m_hasUdpPortIpBeenContacted.keyExists(t))
-			{
-				m_hasUdpPortIpBeenContacted[t] = 1;
-			}
-			else
-			{
-				m_hasUdpPortIpBeenContacted[t]++;
-			}
+			t.m_ip = packet.ip_dst;
+			t.m_port = packet.dst_port;
+			m_hasUdpPortIpBeenContacted.upsert(t, 0)++;
 
 			break;
 		}
@@ -105,42 +98,35 @@ void EvidenceAccumulator::Add(const Evidence &evidence)
 			m_tcpPacketCount++;
 
 			// Only count as an IP/port contacted if it looks like a scan (SYN or NULL packet)
-			if ((evidence.m_evidencePacket.tcp_hdr.syn && !evidence.m_evidencePacket.tcp_hdr.ack)
-					|| (!evidence.m_evidencePacket.tcp_hdr.syn && !evidence.m_evidencePacket.tcp_hdr.ack
-							&& !evidence.m_evidencePacket.tcp_hdr.rst))
+			if ((packet.tcp_hdr.syn && !packet.tcp_hdr.ack)
+					|| (!packet.tcp_hdr.syn && !packet.tcp_hdr.ack
+							&& !packet.tcp_hdr.rst))
 			{
 				IpPortCombination t;
-				t.m_ip = evidence.m_evidencePacket.ip_dst;
-				t.m_port = evidence.m_evidencePacket.dst_port;
-				if (!m_hasTcpPortIpBeenContacted.keyExists(t))
-				{
-					m_hasTcpPortIpBeenContacted[t] = 1;
-				}
-				else
-				{
-					m_hasTcpPortIpBeenContacted[t]++;
-				}
+				t.m_ip = packet.ip_dst;
+				t.m_port = packet.dst_port;
+				m_hasTcpPortIpBeenContacted.upsert(t, 0)++;
 			}
 
-			if(evidence.m_evidencePacket.tcp_hdr.syn && evidence.m_evidencePacket.tcp_hdr.ack)
+			if(packet.tcp_hdr.syn && packet.tcp_hdr.ack)
 			{
 				m_synAckCount++;
 			}
-			else if(evidence.m_evidencePacket.tcp_hdr.syn)
+			else if(packet.tcp_hdr.syn)
 			{
 				m_synCount++;
 			}
-			else if(evidence.m_evidencePacket.tcp_hdr.ack)
+			else if(packet.tcp_hdr.ack)
 			{
 				m_ackCount++;
 			}
 
-			if(evidence.m_evidencePacket.tcp_hdr.rst)
+			if(packet.tcp_hdr.rst)
 			{
 				m_rstCount++;
 			}
 
-			if(evidence.m_evidencePacket.tcp_hdr.fin)
+			if(packet.tcp_hdr.fin)
 			{
 				m_finCount++;
 			}
@@ -151,45 +137,195 @@ void EvidenceAccumulator::Add(const Evidence &evidence)
 		{
 			m_icmpPacketCount++;
 			IpPortCombination t;
-			t.m_ip = evidence.m_evidencePacket.ip_dst;
-			t.m_port = evidence.m_evidencePacket.dst_port;
+			t.m_ip = packet.ip_dst;
+			t.m_port = packet.dst_port;
 
-			if (!m_icmpCodeTypes.keyExists(t))
-			{
-				m_icmpCodeTypes[t] = 1;
-			}
-			else
-			{
-				m_icmpCodeTypes[t]++;
-			}
+			m_icmpCodeTypes.upsert(t, 0)++;
 			break;
 		}
 		//If untracked IP protocol or error case ignore it
 		default:
 		{
 			m_otherPacketCount++;
-			m_IPTable[evidence.m_evidencePacket.ip_dst]++;
+			m_IPTable.upsert(packet.ip_dst, 0)++;
 			break;
 		}
 	}
 
 	m_packetCount++;
-	m_bytesTotal += evidence.m_evidencePacket.ip_len;
+	m_bytesTotal += packet.ip_len;
 
 
-	m_packTable[evidence.m_evidencePacket.ip_len]++;
-	m_lastTime = evidence.m_evidencePacket.ts;
+	m_packetSizes.Add(packet.ip_len);
+	m_lastTime = packet.ts;
 
 	//Accumulate to find the lowest Start time and biggest end time.
-	if(evidence.m_evidencePacket.ts < m_startTime)
+	if(packet.ts < m_startTime)
 	{
-		m_startTime = evidence.m_evidencePacket.ts;
+		m_startTime = packet.ts;
 	}
-	if(evidence.m_evidencePacket.ts > m_endTime)
+	if(packet.ts > m_endTime)
 	{
-		m_endTime =  evidence.m_evidencePacket.ts;
+		m_endTime =  packet.ts;
 	}
 }
 
 
+size_t EvidenceAccumulator::GetMemoryUsage() const
+{
+	return m_IPTable.GetMemoryUsage()
+			+ m_hasTcpPortIpBeenContacted.GetMemoryUsage()
+			+ m_hasUdpPortIpBeenContacted.GetMemoryUsage()
+			+ m_icmpCodeTypes.GetMemoryUsage()
+			+ m_packetSizes.GetMemoryUsage();
+}
+
+uint32_t EvidenceAccumulator::GetSerializeLength()
+{
+	uint32_t ipPortEntry = sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint64_t);
+
+	return sizeof(uint8_t) + 14 * sizeof(uint64_t)
+		+ sizeof(uint32_t) + m_packetSizes.GetSerializeLength()
+		+ sizeof(uint32_t) + m_IPTable.size() * (sizeof(uint32_t) + sizeof(uint64_t))
+		+ 3 * sizeof(uint32_t) + (m_hasTcpPortIpBeenContacted.size() + m_hasUdpPortIpBeenContacted.size() + m_icmpCodeTypes.size()) * ipPortEntry;
+}
+
+uint32_t EvidenceAccumulator::Serialize(u_char *buf, uint32_t bufferSize)
+{
+	uint32_t offset = 0;
+	uint8_t version = EVIDENCE_ACCUMULATOR_VERSION;
+	int64_t times[3] = {m_startTime, m_endTime, m_lastTime};
+
+	SerializeChunk(buf, offset, (char*)&version, sizeof(version), bufferSize);
+	SerializeChunk(buf, offset, (char*)&m_packetCount, sizeof(m_packetCount), bufferSize);
+	SerializeChunk(buf, offset, (char*)&m_tcpPacketCount, sizeof(m_tcpPacketCount), bufferSize);
+	SerializeChunk(buf, offset, (char*)&m_udpPacketCount, sizeof(m_udpPacketCount), bufferSize);
+	SerializeChunk(buf, offset, (char*)&m_icmpPacketCount, sizeof(m_icmpPacketCount), bufferSize);
+	SerializeChunk(buf, offset, (char*)&m_otherPacketCount, sizeof(m_otherPacketCount), bufferSize);
+	SerializeChunk(buf, offset, (char*)&m_rstCount, sizeof(m_rstCount), bufferSize);
+	SerializeChunk(buf, offset, (char*)&m_ackCount, sizeof(m_ackCount), bufferSize);
+	SerializeChunk(buf, offset, (char*)&m_synCount, sizeof(m_synCount), bufferSize);
+	SerializeChunk(buf, offset, (char*)&m_finCount, sizeof(m_finCount), bufferSize);
+	SerializeChunk(buf, offset, (char*)&m_synAckCount, sizeof(m_synAckCount), bufferSize);
+	SerializeChunk(buf, offset, (char*)times, sizeof(times), bufferSize);
+	SerializeChunk(buf, offset, (char*)&m_bytesTotal, sizeof(m_bytesTotal), bufferSize);
+
+	uint32_t histogramLength = m_packetSizes.GetSerializeLength();
+	SerializeChunk(buf, offset, (char*)&histogramLength, sizeof(histogramLength), bufferSize);
+	if(offset + histogramLength > bufferSize)
+	{
+		throw serializationException();
+	}
+	offset += m_packetSizes.Serialize(buf + offset, histogramLength);
+
+	uint32_t entries = m_IPTable.size();
+	SerializeChunk(buf, offset, (char*)&entries, sizeof(entries), bufferSize);
+	for(IP_Table::iterator it = m_IPTable.begin(); it != m_IPTable.end(); it++)
+	{
+		SerializeChunk(buf, offset, (char*)&it->first, sizeof(uint32_t), bufferSize);
+		SerializeChunk(buf, offset, (char*)&it->second, sizeof(uint64_t), bufferSize);
+	}
+
+	SerializeIpPortTable(m_hasTcpPortIpBeenContacted, buf, offset, bufferSize);
+	SerializeIpPortTable(m_hasUdpPortIpBeenContacted, buf, offset, bufferSize);
+	SerializeIpPortTable(m_icmpCodeTypes, buf, offset, bufferSize);
+
+	return offset;
+}
+
+uint32_t EvidenceAccumulator::Deserialize(u_char *buf, uint32_t bufferSize)
+{
+	uint32_t offset = 0;
+	uint8_t version;
+	int64_t times[3];
+
+	DeserializeChunk(buf, offset, (char*)&version, sizeof(version), bufferSize);
+	if(version != EVIDENCE_ACCUMULATOR_VERSION)
+	{
+		throw serializationException();
+	}
+
+	DeserializeChunk(buf, offset, (char*)&m_packetCount, sizeof(m_packetCount), bufferSize);
+	DeserializeChunk(buf, offset, (char*)&m_tcpPacketCount, sizeof(m_tcpPacketCount), bufferSize);
+	DeserializeChunk(buf, offset, (char*)&m_udpPacketCount, sizeof(m_udpPacketCount), bufferSize);
+	DeserializeChunk(buf, offset, (char*)&m_icmpPacketCount, sizeof(m_icmpPacketCount), bufferSize);
+	DeserializeChunk(buf, offset, (char*)&m_otherPacketCount, sizeof(m_otherPacketCount), bufferSize);
+	DeserializeChunk(buf, offset, (char*)&m_rstCount, sizeof(m_rstCount), bufferSize);
+	DeserializeChunk(buf, offset, (char*)&m_ackCount, sizeof(m_ackCount), bufferSize);
+	DeserializeChunk(buf, offset, (char*)&m_synCount, sizeof(m_synCount), bufferSize);
+	DeserializeChunk(buf, offset, (char*)&m_finCount, sizeof(m_finCount), bufferSize);
+	DeserializeChunk(buf, offset, (char*)&m_synAckCount, sizeof(m_synAckCount), bufferSize);
+	DeserializeChunk(buf, offset, (char*)times, sizeof(times), bufferSize);
+	DeserializeChunk(buf, offset, (char*)&m_bytesTotal, sizeof(m_bytesTotal), bufferSize);
+	m_startTime = times[0];
+	m_endTime = times[1];
+	m_lastTime = times[2];
+
+	uint32_t histogramLength;
+	DeserializeChunk(buf, offset, (char*)&histogramLength, sizeof(histogramLength), bufferSize);
+	if(offset + histogramLength > bufferSize)
+	{
+		throw serializationException();
+	}
+	offset += m_packetSizes.Deserialize(buf + offset, histogramLength);
+
+	uint32_t entries;
+	DeserializeChunk(buf, offset, (char*)&entries, sizeof(entries), bufferSize);
+	// Checked up front so a damaged count can't make us reserve a huge table
+	if(entries > (bufferSize - offset) / (sizeof(uint32_t) + sizeof(uint64_t)))
+	{
+		throw serializationException();
+	}
+	m_IPTable.clear();
+	m_IPTable.reserve(entries);
+	for(uint32_t i = 0; i < entries; i++)
+	{
+		uint32_t ip;
+		uint64_t count;
+		DeserializeChunk(buf, offset, (char*)&ip, sizeof(ip), bufferSize);
+		DeserializeChunk(buf, offset, (char*)&count, sizeof(count), bufferSize);
+		m_IPTable[ip] = count;
+	}
+
+	DeserializeIpPortTable(m_hasTcpPortIpBeenContacted, buf, offset, bufferSize);
+	DeserializeIpPortTable(m_hasUdpPortIpBeenContacted, buf, offset, bufferSize);
+	DeserializeIpPortTable(m_icmpCodeTypes, buf, offset, bufferSize);
+
+	return offset;
+}
+
+void EvidenceAccumulator::SerializeIpPortTable(IpPortTable &table, u_char *buf, uint32_t &offset, uint32_t bufferSize)
+{
+	uint32_t entries = table.size();
+	SerializeChunk(buf, offset, (char*)&entries, sizeof(entries), bufferSize);
+	for(IpPortTable::iterator it = table.begin(); it != table.end(); it++)
+	{
+		SerializeChunk(buf, offset, (char*)&it->first.m_ip, sizeof(uint32_t), bufferSize);
+		SerializeChunk(buf, offset, (char*)&it->first.m_port, sizeof(uint16_t), bufferSize);
+		SerializeChunk(buf, offset, (char*)&it->second, sizeof(uint64_t), bufferSize);
+	}
+}
+
+void EvidenceAccumulator::DeserializeIpPortTable(IpPortTable &table, u_char *buf, uint32_t &offset, uint32_t bufferSize)
+{
+	uint32_t entries;
+	DeserializeChunk(buf, offset, (char*)&entries, sizeof(entries), bufferSize);
+	if(entries > (bufferSize - offset) / (sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint64_t)))
+	{
+		throw serializationException();
+	}
+
+	table.clear();
+	table.reserve(entries);
+	for(uint32_t i = 0; i < entries; i++)
+	{
+		IpPortCombination pair;
+		uint64_t count;
+		DeserializeChunk(buf, offset, (char*)&pair.m_ip, sizeof(uint32_t), bufferSize);
+		DeserializeChunk(buf, offset, (char*)&pair.m_port, sizeof(uint16_t), bufferSize);
+		DeserializeChunk(buf, offset, (char*)&count, sizeof(count), bufferSize);
+		table[pair] = count;
+	}
+}
+
 }
@@ -22,6 +22,8 @@
 
 #include "Evidence.h"
 #include "HashMapStructs.h"
+#include "FlatHashMap.h"
+#include "PacketSizeHistogram.h"
 
 #include <pcap.h>
 #include <netinet/ip.h>
@@ -32,12 +34,13 @@
 //dimension
 #define DIM 14
 
+// Bumped whenever the serialized layout of an EvidenceAccumulator changes
+#define EVIDENCE_ACCUMULATOR_VERSION 1
+
 //Table of IP destinations and a count;
-typedef Nova::HashMap<uint32_t, uint64_t, std::hash<time_t>, eqtime > IP_Table;
+typedef Nova::FlatHashMap<uint32_t, uint64_t, std::hash<time_t>, eqtime > IP_Table;
 //Table of destination ports and a count;
-typedef Nova::HashMap<in_port_t, uint64_t, std::hash<in_port_t>, eqport > Port_Table;
-//Table of packet sizes and a count
-typedef Nova::HashMap<uint16_t, uint64_t, std::hash<uint16_t>, eq_uint16_t > Packet_Table;
+typedef Nova::FlatHashMap<in_port_t, uint64_t, std::hash<in_port_t>, eqport > Port_Table;
 
 struct IpPortCombination
 {
@@ -108,7 +111,7 @@ struct IpPortCombinationEquals
 };
 
 
-typedef Nova::HashMap<IpPortCombination, uint64_t, std::hash<IpPortCombination>, IpPortCombinationEquals> IpPortTable;
+typedef Nova::FlatHashMap<IpPortCombination, uint64_t, std::hash<IpPortCombination>, IpPortCombinationEquals> IpPortTable;
 
 namespace Nova
 {
@@ -121,7 +124,22 @@ public:
 	EvidenceAccumulator();
 
 	// Adds evidence to the accumulated data we've gathered for a suspect
-	void Add(const Evidence &evidence);
+	void Add(const _evidencePacket &packet);
+
+	// Heap bytes held by the tables and the histogram, not counting the accumulator itself
+	size_t GetMemoryUsage() const;
+
+	// Everything gathered so far as one blob, in host byte order. The feature values aren't
+	// included, they're recomputed from the rest:
+	//   uint8 version, the packet/flag counters, times and byte total as uint64s,
+	//   uint32 histogram length followed by the serialized PacketSizeHistogram,
+	//   uint32 number of IP table entries followed by (uint32 ip, uint64 count) for each, then the
+	//   TCP, UDP and ICMP IP/port tables, each a uint32 entry count and (uint32 ip, uint16 port, uint64 count) entries
+	uint32_t GetSerializeLength();
+	// Returns the number of bytes written. Throws serializationException if buf is too small.
+	uint32_t Serialize(u_char *buf, uint32_t bufferSize);
+	// Replaces the contents with a serialized accumulator. Throws serializationException if it's truncated or malformed.
+	uint32_t Deserialize(u_char *buf, uint32_t bufferSize);
 
 
 	/// The computed feature values used for KNN
@@ -150,8 +168,8 @@ public:
 	time_t m_endTime;
 	time_t m_lastTime;
 
-	//Table of Packet sizes and counts for variance calc
-	Packet_Table m_packTable;
+	//Histogram of packet sizes, also gives the exact mean and deviation
+	PacketSizeHistogram m_packetSizes;
 
 	time_t m_totalInterval;
 
@@ -165,6 +183,10 @@ public:
 	IpPortTable m_hasTcpPortIpBeenContacted;
 	IpPortTable m_hasUdpPortIpBeenContacted;
 	IpPortTable m_icmpCodeTypes;
+
+private:
+	static void SerializeIpPortTable(IpPortTable &table, u_char *buf, uint32_t &offset, uint32_t bufferSize);
+	static void DeserializeIpPortTable(IpPortTable &table, u_char *buf, uint32_t &offset, uint32_t bufferSize);
 };
 }
 
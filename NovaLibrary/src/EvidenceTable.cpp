@@ -18,8 +18,13 @@
 //============================================================================
 
 #include "EvidenceTable.h"
-#include "Lock.h"
-#include <pthread.h>
+#include "Logger.h"
+
+#include <sched.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
 
 using namespace std;
 
@@ -27,47 +32,198 @@ namespace Nova
 {
 	EvidenceTable::EvidenceTable()
 	{
-		pthread_mutex_init(&m_lock, NULL);
-		pthread_cond_init(&m_cond, NULL);
+		m_inboxHead = &m_stub;
+		m_inboxTail = &m_stub;
+		m_consumerWaiting = false;
+		m_stopping = false;
+
+		m_wakeFd = eventfd(0, EFD_CLOEXEC);
+		if(m_wakeFd == -1)
+		{
+			LOG(ERROR, "Unable to create the evidence table eventfd, the consumer will have to poll", "");
+		}
 	}
 
 	EvidenceTable::~EvidenceTable()
 	{
-		pthread_mutex_destroy(&m_lock);
+		if(m_wakeFd != -1)
+		{
+			close(m_wakeFd);
+		}
 		m_table.clear();
 	}
 
 	void EvidenceTable::InsertEvidence(Evidence *evidence)
 	{
-		Lock lock(&m_lock);
-		if(m_table.find(evidence->m_evidencePacket.ip_src) == m_table.end())
+		Push(evidence, evidence);
+	}
+
+	void EvidenceTable::InsertEvidence(Evidence *first, Evidence *last)
+	{
+		Push(first, last);
+	}
+
+	void EvidenceTable::InsertEvidence(const EvidenceBatch &batch)
+	{
+		if(batch.m_count == 0)
+		{
+			return;
+		}
+
+		// Link the batch up privately so it goes into the inbox in one exchange
+		Evidence *first = new Evidence(batch.m_packets[0]);
+		Evidence *last = first;
+		for(uint i = 1; i < batch.m_count; i++)
+		{
+			last->m_next = new Evidence(batch.m_packets[i]);
+			last = last->m_next;
+		}
+
+		Push(first, last);
+	}
+
+	void EvidenceTable::Push(Evidence *first, Evidence *last)
+	{
+		__atomic_store_n(&last->m_next, (Evidence *)NULL, __ATOMIC_RELAXED);
+		Evidence *previous = __atomic_exchange_n(&m_inboxHead, last, __ATOMIC_SEQ_CST);
+		// Between the exchange and this store the chain is invisible to the consumer, see IsInboxEmpty
+		__atomic_store_n(&previous->m_next, first, __ATOMIC_RELEASE);
+
+		// Pairs with the store in WaitForEvidence: either the consumer sees our evidence
+		// before it goes to sleep, or we see that it's waiting and wake it up
+		if(__atomic_load_n(&m_consumerWaiting, __ATOMIC_SEQ_CST)
+			&& __atomic_exchange_n(&m_consumerWaiting, false, __ATOMIC_SEQ_CST))
+		{
+			if(m_wakeFd != -1)
+			{
+				uint64_t one = 1;
+				while((write(m_wakeFd, &one, sizeof(one)) == -1) && (errno == EINTR));
+			}
+		}
+	}
+
+	Evidence *EvidenceTable::Pop()
+	{
+		Evidence *tail = m_inboxTail;
+		Evidence *next = __atomic_load_n(&tail->m_next, __ATOMIC_ACQUIRE);
+
+		if(tail == &m_stub)
+		{
+			if(next == NULL)
+			{
+				return NULL;
+			}
+			m_inboxTail = next;
+			tail = next;
+			next = __atomic_load_n(&next->m_next, __ATOMIC_ACQUIRE);
+		}
+
+		if(next != NULL)
+		{
+			m_inboxTail = next;
+			return tail;
+		}
+
+		// tail looks like the last node. If it isn't, a producer is in the middle of linking onto it.
+		if(tail != __atomic_load_n(&m_inboxHead, __ATOMIC_ACQUIRE))
+		{
+			return NULL;
+		}
+
+		// Put the stub back behind tail so we can hand out tail without leaving the inbox empty
+		Push(&m_stub, &m_stub);
+		next = __atomic_load_n(&tail->m_next, __ATOMIC_ACQUIRE);
+		if(next != NULL)
+		{
+			m_inboxTail = next;
+			return tail;
+		}
+		return NULL;
+	}
+
+	bool EvidenceTable::IsInboxEmpty()
+	{
+		// Pop only comes back empty handed while head and tail differ if a producer has swapped
+		// itself in as the head but hasn't linked onto the previous node yet
+		return __atomic_load_n(&m_inboxHead, __ATOMIC_SEQ_CST) == m_inboxTail;
+	}
+
+	void EvidenceTable::DrainInbox()
+	{
+		for(uint drained = 0; drained < EVIDENCE_DRAIN_LIMIT; drained++)
 		{
-			m_table[evidence->m_evidencePacket.ip_src] = GenericQueue<Evidence>();
+			Evidence *evidence = Pop();
+			if(evidence == NULL)
+			{
+				if(IsInboxEmpty())
+				{
+					return;
+				}
+				// A producer is mid push, it's only a couple of instructions away from finishing
+				sched_yield();
+				continue;
+			}
+
+			evidence->m_next = NULL;
+			//Pushes the evidence and queues the IP if it's the first piece of evidence
+			if(m_table[evidence->m_evidencePacket.ip_src].Push(evidence))
+			{
+				m_processingList.Push(new IpWrapper(evidence->m_evidencePacket.ip_src));
+			}
 		}
-		//Pushes the evidence and enters the conditional if it's the first piece of evidence
-		if(m_table[evidence->m_evidencePacket.ip_src].Push(evidence))
+	}
+
+	void EvidenceTable::Stop()
+	{
+		__atomic_store_n(&m_stopping, true, __ATOMIC_SEQ_CST);
+		if(m_wakeFd != -1)
 		{
-			IpWrapper *temp = new IpWrapper(evidence->m_evidencePacket.ip_src);
-			m_processingList.Push(temp);
-			//Wake up any consumers waiting for evidence
-			pthread_cond_signal(&m_cond);
+			uint64_t one = 1;
+			while((write(m_wakeFd, &one, sizeof(one)) == -1) && (errno == EINTR));
 		}
 	}
 
+	void EvidenceTable::WaitForEvidence()
+	{
+		if(m_wakeFd == -1)
+		{
+			usleep(1000);
+			return;
+		}
+
+		__atomic_store_n(&m_consumerWaiting, true, __ATOMIC_SEQ_CST);
+		if(!IsInboxEmpty())
+		{
+			__atomic_store_n(&m_consumerWaiting, false, __ATOMIC_SEQ_CST);
+			return;
+		}
+
+		// A leftover count from a wakeup we didn't need just makes this return early once
+		uint64_t count;
+		while((read(m_wakeFd, &count, sizeof(count)) == -1) && (errno == EINTR));
+	}
+
 	Evidence *EvidenceTable::GetEvidence()
 	{
-		Lock lock(&m_lock);
-		IpWrapper *lookup = m_processingList.Pop();
-		//While we are unable to get evidence (other consumers got it first)
-		while(lookup == NULL)
+		while(true)
 		{
+			DrainInbox();
+
+			IpWrapper *lookup = m_processingList.Pop();
+			if(lookup != NULL)
+			{
+				Evidence *ret = m_table[lookup->ip].PopAll();
+				delete lookup;
+				return ret;
+			}
+
+			if(__atomic_load_n(&m_stopping, __ATOMIC_SEQ_CST) && IsInboxEmpty())
+			{
+				return NULL;
+			}
+
 			//block until evidence is inserted
-			pthread_cond_wait(&m_cond, &m_lock);
-			lookup = m_processingList.Pop();
+			WaitForEvidence();
 		}
-
-		Evidence *ret =  m_table[lookup->ip].PopAll();;
-		delete lookup;
-		return ret;
 	}
 }
@@ -24,11 +24,22 @@
 #include "GenericQueue.h"
 #include "Evidence.h"
 
+// Most evidence GetEvidence moves out of the inbox per call. Without a limit, producers that keep
+// up with the consumer would keep it draining forever and it'd never hand anything out
+#define EVIDENCE_DRAIN_LIMIT (8 * EVIDENCE_BATCH_SIZE)
+
 typedef Nova::HashMap<uint64_t, Nova::GenericQueue<Nova::Evidence>, std::hash<uint64_t>, eqkey > EvidenceHashTable;
 
 namespace Nova
 {
 
+// Capture threads publish evidence into a lock free multi producer inbox: an intrusive
+// linked list (linked through Evidence::m_next) that producers append to with a single
+// atomic exchange per packet or per batch. The consumer drains the inbox into its own
+// private table, where the evidence is grouped by source IP exactly as before, so
+// GetEvidence still hands out everything pending for one IP as a single chain.
+//
+// Only one thread may call GetEvidence on a given table.
 class EvidenceTable
 {
 
@@ -39,12 +50,35 @@ public:
 	//Inserts the Evidence into the table at the location specified by the destination address
 	void InsertEvidence(Evidence *packet);
 
-	// Returns the first evidence object in a Evidence linked list or NULL if no evidence for any entries
+	// Inserts every packet of the batch with a single atomic operation
+	void InsertEvidence(const EvidenceBatch &batch);
+
+	// Inserts an already linked chain of evidence, from first to last, with a single atomic operation
+	void InsertEvidence(Evidence *first, Evidence *last);
+
+	// Returns the first evidence object in a Evidence linked list, blocking until there is some
 	// After use each Evidence object must be explicitly deallocated
+	// Returns NULL once the table has been stopped and everything inserted before that has been handed out
 	Evidence *GetEvidence();
 
+	// Wakes the consumer up and makes GetEvidence return NULL instead of blocking when it runs dry
+	void Stop();
+
 private:
 
+	// Most recently pushed evidence, swapped in by the producers
+	Evidence *m_inboxHead;
+	// Oldest evidence not yet drained, only touched by the consumer
+	Evidence *m_inboxTail;
+	// Placeholder node so the inbox is never truly empty, which keeps producers from ever touching m_inboxTail
+	Evidence m_stub;
+
+	// The consumer sleeps on this eventfd. Producers only write to it when m_consumerWaiting
+	// is set, so there's at most one wakeup syscall per time the consumer ran dry
+	int m_wakeFd;
+	bool m_consumerWaiting;
+	bool m_stopping;
+
 	// This is a FIFO list of suspect IP addresses that we have evidence for and need processing
 	GenericQueue<IpWrapper> m_processingList;
 
@@ -52,9 +86,19 @@ private:
 	// May contain multiple chunks of evidence per suspect (stored with a GenericQueue)
 	EvidenceHashTable m_table;
 
+	// Appends an already linked chain of evidence to the inbox
+	void Push(Evidence *first, Evidence *last);
+
+	// Takes the oldest evidence out of the inbox. Returns NULL if the inbox is empty or if a
+	// producer is halfway through a push (see IsInboxEmpty)
+	Evidence *Pop();
+	bool IsInboxEmpty();
+
+	// Moves up to EVIDENCE_DRAIN_LIMIT pieces of evidence from the inbox into m_table and m_processingList
+	void DrainInbox();
 
-	pthread_mutex_t m_lock;
-	pthread_cond_t m_cond;
+	// Blocks until a producer pushes something
+	void WaitForEvidence();
 };
 
 }
@@ -0,0 +1,313 @@
+//============================================================================
+// Name        : FeatureAggregate.cpp
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Running totals for a suspect's whole history that the classification
+//				features can be read from directly
+//============================================================================
+
+#include "FeatureAggregate.h"
+#include "Suspect.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace Nova
+{
+
+// Drops the lighter half of a count table that has reached FEATURE_TABLE_LIMIT. Keys honeypots
+// says to keep stay whatever their count, when given.
+template <class TableType>
+static void DropLightest(TableType &table, const HoneypotSet *honeypots)
+{
+	vector<uint64_t> counts;
+	counts.reserve(table.size());
+	for(typename TableType::iterator it = table.begin(); it != table.end(); it++)
+	{
+		counts.push_back(it->second);
+	}
+	nth_element(counts.begin(), counts.begin() + counts.size() / 2, counts.end());
+	uint64_t median = counts[counts.size() / 2];
+
+	for(typename TableType::iterator it = table.begin(); it != table.end();)
+	{
+		if(it->second <= median && !(honeypots != NULL && honeypots->Contains(it->first)))
+		{
+			it = table.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+HoneypotSet::HoneypotSet()
+{
+	m_generation = 0;
+}
+
+void HoneypotSet::Set(const vector<uint32_t> &honeypots)
+{
+	m_honeypots.clear();
+	for(uint i = 0; i < honeypots.size(); i++)
+	{
+		m_honeypots[honeypots[i]] = true;
+	}
+	m_generation++;
+}
+
+bool HoneypotSet::Contains(uint32_t ip) const
+{
+	return m_honeypots.keyExists(ip);
+}
+
+uint HoneypotSet::size() const
+{
+	return m_honeypots.size();
+}
+
+uint HoneypotSet::GetGeneration() const
+{
+	return m_generation;
+}
+
+FeatureAggregate::FeatureAggregate()
+{
+	m_packetCount = 0;
+	m_tcpPacketCount = 0;
+	m_rstCount = 0;
+	m_synCount = 0;
+	m_finCount = 0;
+	m_synAckCount = 0;
+
+	m_maxPacketsToIp = 0;
+	m_maxPacketsToTcpPort = 0;
+	m_maxPacketsToUdpPort = 0;
+
+	m_honeypotsContacted = 0;
+	m_honeypotGeneration = 0;
+}
+
+void FeatureAggregate::Add(const EvidenceAccumulator &window, const HoneypotSet &honeypots)
+{
+	AddPacketCounts(window.m_packetCount, window.m_tcpPacketCount, window.m_rstCount,
+			window.m_synCount, window.m_finCount, window.m_synAckCount);
+	AddPacketSizes(window.m_packetSizes);
+
+	// The tables aren't modified, FlatHashMap just doesn't have const iterators
+	EvidenceAccumulator &w = const_cast<EvidenceAccumulator &>(window);
+
+	for(IpPortTable::iterator it = w.m_hasTcpPortIpBeenContacted.begin(); it != w.m_hasTcpPortIpBeenContacted.end(); it++)
+	{
+		AddIpCount(it->first.m_ip, it->second, honeypots);
+		AddPortCount(IPPROTO_TCP, it->first, it->second, true);
+	}
+
+	for(IpPortTable::iterator it = w.m_hasUdpPortIpBeenContacted.begin(); it != w.m_hasUdpPortIpBeenContacted.end(); it++)
+	{
+		AddIpCount(it->first.m_ip, it->second, honeypots);
+		AddPortCount(IPPROTO_UDP, it->first, it->second, true);
+	}
+
+	for(IpPortTable::iterator it = w.m_icmpCodeTypes.begin(); it != w.m_icmpCodeTypes.end(); it++)
+	{
+		AddIpCount(it->first.m_ip, it->second, honeypots);
+	}
+
+	for(IP_Table::iterator it = w.m_IPTable.begin(); it != w.m_IPTable.end(); it++)
+	{
+		AddIpCount(it->first, it->second, honeypots);
+	}
+}
+
+void FeatureAggregate::AddPacketCounts(uint64_t total, uint64_t tcp, uint64_t rst, uint64_t syn, uint64_t fin, uint64_t synAck)
+{
+	m_packetCount += total;
+	m_tcpPacketCount += tcp;
+	m_rstCount += rst;
+	m_synCount += syn;
+	m_finCount += fin;
+	m_synAckCount += synAck;
+}
+
+void FeatureAggregate::AddIpPortCount(uint8_t protocol, uint32_t dstIp, uint16_t port, uint64_t count, const HoneypotSet &honeypots)
+{
+	AddIpCount(dstIp, count, honeypots);
+
+	IpPortCombination pair;
+	pair.m_ip = dstIp;
+	pair.m_port = port;
+	AddPortCount(protocol, pair, count, true);
+}
+
+void FeatureAggregate::AddDestinationTotal(uint32_t dstIp, uint64_t count, const HoneypotSet &honeypots)
+{
+	AddIpCount(dstIp, count, honeypots);
+}
+
+void FeatureAggregate::AddPortTotal(uint8_t protocol, uint16_t port, uint64_t count)
+{
+	// The pairs behind a rolled up total are already in the stored distinct counts
+	IpPortCombination pair;
+	pair.m_ip = 0;
+	pair.m_port = port;
+	AddPortCount(protocol, pair, count, false);
+}
+
+void FeatureAggregate::AddPacketSizes(const PacketSizeHistogram &sizes)
+{
+	m_packetSizes.Merge(sizes);
+}
+
+void FeatureAggregate::AddIpPorts(uint8_t protocol, const DistinctCounter &ipPorts)
+{
+	if(protocol == IPPROTO_TCP)
+	{
+		m_tcpIpPorts.Merge(ipPorts);
+	}
+	else if(protocol == IPPROTO_UDP)
+	{
+		m_udpIpPorts.Merge(ipPorts);
+	}
+}
+
+void FeatureAggregate::ComputeFeatures(double *features, const HoneypotSet &honeypots)
+{
+	for(int i = 0; i < DIM; i++)
+	{
+		features[i] = 0;
+	}
+
+	features[PACKET_SIZE_MEAN] = m_packetSizes.GetMean();
+	features[PACKET_SIZE_DEVIATION] = m_packetSizes.GetDeviation();
+
+	double distinctIps = m_distinctIps.GetCount();
+	features[DISTINCT_IPS] = distinctIps;
+	features[DISTINCT_TCP_PORTS] = m_distinctTcpPorts.GetCount();
+	features[DISTINCT_UDP_PORTS] = m_distinctUdpPorts.GetCount();
+
+	if(m_tcpPacketCount != 0)
+	{
+		features[TCP_PERCENT_SYN] = (double)m_synCount / m_tcpPacketCount;
+		features[TCP_PERCENT_FIN] = (double)m_finCount / m_tcpPacketCount;
+		features[TCP_PERCENT_RST] = (double)m_rstCount / m_tcpPacketCount;
+		features[TCP_PERCENT_SYNACK] = (double)m_synAckCount / m_tcpPacketCount;
+	}
+
+	if(distinctIps > 0)
+	{
+		features[AVG_TCP_PORTS_PER_HOST] = m_tcpIpPorts.GetCount() / distinctIps;
+		features[AVG_UDP_PORTS_PER_HOST] = m_udpIpPorts.GetCount() / distinctIps;
+
+		// (TotalSuspectPackets/TotalSuspectDstIps)/maxPacketsToSingleDstIp
+		if(m_maxPacketsToIp != 0)
+		{
+			features[IP_TRAFFIC_DISTRIBUTION] = m_packetCount / distinctIps / m_maxPacketsToIp;
+		}
+
+		// (TotalSuspectPackets/TotalSuspectDstPorts)/maxPacketsToSingleDstPort
+		double distinctPorts = features[DISTINCT_TCP_PORTS] + features[DISTINCT_UDP_PORTS];
+		uint64_t maxPacketsToPort = max(m_maxPacketsToTcpPort, m_maxPacketsToUdpPort);
+		if(distinctPorts > 0 && maxPacketsToPort != 0)
+		{
+			features[PORT_TRAFFIC_DISTRIBUTION] = m_packetCount / distinctPorts / maxPacketsToPort;
+		}
+
+		// The honeypots changed since we last counted, start over
+		if(m_honeypotGeneration != honeypots.GetGeneration())
+		{
+			m_honeypotsContacted = 0;
+			for(IP_Table::iterator it = m_packetsPerIp.begin(); it != m_packetsPerIp.end(); it++)
+			{
+				if(honeypots.Contains(it->first))
+				{
+					m_honeypotsContacted++;
+				}
+			}
+			m_honeypotGeneration = honeypots.GetGeneration();
+		}
+
+		if(honeypots.size() != 0)
+		{
+			features[HAYSTACK_PERCENT_CONTACTED] = (double)m_honeypotsContacted / honeypots.size();
+		}
+	}
+}
+
+size_t FeatureAggregate::GetMemoryUsage() const
+{
+	return sizeof(FeatureAggregate)
+			+ m_packetSizes.GetMemoryUsage()
+			+ m_packetsPerIp.GetMemoryUsage()
+			+ m_packetsPerTcpPort.GetMemoryUsage()
+			+ m_packetsPerUdpPort.GetMemoryUsage()
+			+ m_distinctIps.GetMemoryUsage()
+			+ m_distinctTcpPorts.GetMemoryUsage()
+			+ m_distinctUdpPorts.GetMemoryUsage()
+			+ m_tcpIpPorts.GetMemoryUsage()
+			+ m_udpIpPorts.GetMemoryUsage();
+}
+
+void FeatureAggregate::AddIpCount(uint32_t ip, uint64_t count, const HoneypotSet &honeypots)
+{
+	if(m_packetsPerIp.size() >= FEATURE_TABLE_LIMIT && !m_packetsPerIp.keyExists(ip))
+	{
+		DropLightest(m_packetsPerIp, &honeypots);
+	}
+
+	uint64_t &packets = m_packetsPerIp.upsert(ip, 0);
+	if(packets == 0 && m_honeypotGeneration == honeypots.GetGeneration() && honeypots.Contains(ip))
+	{
+		m_honeypotsContacted++;
+	}
+
+	packets += count;
+	m_maxPacketsToIp = max(m_maxPacketsToIp, packets);
+	m_distinctIps.Add(ip);
+}
+
+void FeatureAggregate::AddPortCount(uint8_t protocol, const IpPortCombination &pair, uint64_t count, bool countPair)
+{
+	if(protocol != IPPROTO_TCP && protocol != IPPROTO_UDP)
+	{
+		return;
+	}
+
+	bool tcp = (protocol == IPPROTO_TCP);
+	Port_Table &table = tcp ? m_packetsPerTcpPort : m_packetsPerUdpPort;
+
+	if(table.size() >= FEATURE_TABLE_LIMIT && !table.keyExists(pair.m_port))
+	{
+		DropLightest(table, (const HoneypotSet *)NULL);
+	}
+
+	uint64_t &packets = table.upsert(pair.m_port, 0);
+	packets += count;
+
+	uint64_t &max = tcp ? m_maxPacketsToTcpPort : m_maxPacketsToUdpPort;
+	if(packets > max)
+	{
+		max = packets;
+	}
+
+	(tcp ? m_distinctTcpPorts : m_distinctUdpPorts).Add(pair.m_port);
+	if(countPair)
+	{
+		(tcp ? m_tcpIpPorts : m_udpIpPorts).Add(GetIpPortKey(pair.m_ip, pair.m_port));
+	}
+}
+
+}
@@ -0,0 +1,142 @@
+//============================================================================
+// Name        : FeatureAggregate.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Running totals for a suspect's whole history that the classification
+//				features can be read from directly
+//============================================================================
+
+#ifndef FEATUREAGGREGATE_H_
+#define FEATUREAGGREGATE_H_
+
+#include "EvidenceAccumulator.h"
+#include "PacketSizeHistogram.h"
+#include "HashMapStructs.h"
+#include "FlatHashMap.h"
+#include "DistinctCounter.h"
+
+#include <vector>
+#include <stdint.h>
+#include <netinet/in.h>
+
+// Most destination IPs, or ports per protocol, a FeatureAggregate keeps exact packet counts for
+#define FEATURE_TABLE_LIMIT 4096
+
+namespace Nova
+{
+
+// The honeypot IPs that HAYSTACK_PERCENT_CONTACTED is measured against. The generation changes
+// every time the set does, so aggregates know when their cached count is stale.
+class HoneypotSet
+{
+public:
+	HoneypotSet();
+
+	void Set(const std::vector<uint32_t> &honeypots);
+	bool Contains(uint32_t ip) const;
+
+	uint size() const;
+	uint GetGeneration() const;
+
+private:
+	FlatHashMap<uint32_t, bool, std::hash<uint32_t>, eq_uint32_t> m_honeypots;
+	uint m_generation;
+};
+
+// Everything the DIM features need, for the whole history of a suspect: distinct IPs, ports
+// and IP/port pairs, per IP and per port packet counts with their running maximums, the TCP
+// flag counts and the packet size histogram. Each EvidenceAccumulator window is folded in once
+// when it's written out, and the features are then computed without going through SQL.
+class FeatureAggregate
+{
+public:
+	FeatureAggregate();
+
+	// Folds in a window of evidence
+	void Add(const EvidenceAccumulator &window, const HoneypotSet &honeypots);
+
+	// Used to rebuild the aggregate from the rows already in the database
+	void AddPacketCounts(uint64_t total, uint64_t tcp, uint64_t rst, uint64_t syn, uint64_t fin, uint64_t synAck);
+	// protocol is the ip_port_counts type: IPPROTO_TCP, IPPROTO_UDP, IPPROTO_ICMP or 0 for anything else
+	void AddIpPortCount(uint8_t protocol, uint32_t dstIp, uint16_t port, uint64_t count, const HoneypotSet &honeypots);
+	// The totals ip_port_counts rows are rolled up into once they're old: packets to a destination IP over
+	// every protocol, and packets to a TCP/UDP port over every destination. The distinct IP/port pairs
+	// they came from are still in the stored distinct counts.
+	void AddDestinationTotal(uint32_t dstIp, uint64_t count, const HoneypotSet &honeypots);
+	void AddPortTotal(uint8_t protocol, uint16_t port, uint64_t count);
+	void AddPacketSizes(const PacketSizeHistogram &sizes);
+	// protocol is IPPROTO_TCP or IPPROTO_UDP
+	void AddIpPorts(uint8_t protocol, const DistinctCounter &ipPorts);
+
+	// Fills in the DIM feature values
+	void ComputeFeatures(double *features, const HoneypotSet &honeypots);
+
+	uint64_t GetPacketCount() const {return m_packetCount;}
+
+	// Approximate bytes held by the aggregate, tables included
+	size_t GetMemoryUsage() const;
+
+	const DistinctCounter &GetTcpIpPorts() const {return m_tcpIpPorts;}
+	const DistinctCounter &GetUdpIpPorts() const {return m_udpIpPorts;}
+
+	// Key an IP/port pair is counted under in the DistinctCounters
+	static uint64_t GetIpPortKey(uint32_t ip, uint16_t port)
+	{
+		return ((uint64_t)ip << 16) | port;
+	}
+
+private:
+	uint64_t m_packetCount;
+	uint64_t m_tcpPacketCount;
+	uint64_t m_rstCount;
+	uint64_t m_synCount;
+	uint64_t m_finCount;
+	uint64_t m_synAckCount;
+
+	PacketSizeHistogram m_packetSizes;
+
+	// Packets sent to each destination IP over every protocol, and to each TCP/UDP port over
+	// every destination IP. A sweep or a spoofed flood can hit millions of these, so once a table
+	// reaches FEATURE_TABLE_LIMIT its lighter half is dropped. The heavy hitters the traffic
+	// distribution features are taken from keep their counts, an IP or port that comes back
+	// after being dropped starts again from 0. The distinct counts are kept on the side.
+	IP_Table m_packetsPerIp;
+	uint64_t m_maxPacketsToIp;
+	DistinctCounter m_distinctIps;
+
+	Port_Table m_packetsPerTcpPort;
+	Port_Table m_packetsPerUdpPort;
+	uint64_t m_maxPacketsToTcpPort;
+	uint64_t m_maxPacketsToUdpPort;
+	DistinctCounter m_distinctTcpPorts;
+	DistinctCounter m_distinctUdpPorts;
+
+	// Distinct destination IP/port pairs. A sweep can contact millions of these, so past
+	// a point they're only estimated.
+	DistinctCounter m_tcpIpPorts;
+	DistinctCounter m_udpIpPorts;
+
+	// How many of m_packetsPerIp are honeypots, as of honeypot set generation m_honeypotGeneration.
+	// Honeypots are never dropped from m_packetsPerIp, but an IP dropped before it became a
+	// honeypot isn't counted.
+	uint m_honeypotsContacted;
+	uint m_honeypotGeneration;
+
+	void AddIpCount(uint32_t ip, uint64_t count, const HoneypotSet &honeypots);
+	void AddPortCount(uint8_t protocol, const IpPortCombination &pair, uint64_t count, bool countPair);
+};
+
+}
+
+#endif /* FEATUREAGGREGATE_H_ */
@@ -0,0 +1,370 @@
+//============================================================================
+// Name        : FlatHashMap.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Open addressing hash map that keeps its entries inline in one array
+//============================================================================
+
+#ifndef FLATHASHMAP_H_
+#define FLATHASHMAP_H_
+
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+namespace Nova
+{
+
+// Drop-in for HashMap on small, hot tables (the per suspect counters). Entries live in a
+// single array probed linearly, so a lookup is a hash and usually one cache line instead
+// of a node allocation per entry and a pointer chase per lookup.
+//
+// Erased entries leave a tombstone behind until the next rehash. Iterators and references
+// are invalidated by any insert that grows the table.
+template <class KeyType, class ValueType, class HashFcn, class EqualKey>
+class FlatHashMap
+{
+public:
+	typedef std::pair<KeyType, ValueType> value_type;
+
+	class iterator
+	{
+	public:
+		iterator() : m_map(NULL), m_index(0) {}
+		iterator(FlatHashMap *map, uint index) : m_map(map), m_index(index) {}
+
+		value_type& operator*() const {return m_map->m_slots[m_index];}
+		value_type* operator->() const {return &m_map->m_slots[m_index];}
+
+		iterator& operator++()
+		{
+			m_index = m_map->NextFull(m_index + 1);
+			return *this;
+		}
+		iterator operator++(int)
+		{
+			iterator ret = *this;
+			++(*this);
+			return ret;
+		}
+
+		bool operator==(const iterator &rhs) const {return m_index == rhs.m_index && m_map == rhs.m_map;}
+		bool operator!=(const iterator &rhs) const {return !(*this == rhs);}
+
+	private:
+		friend class FlatHashMap;
+		FlatHashMap *m_map;
+		uint m_index;
+	};
+
+	FlatHashMap();
+
+	// Inserts a default constructed value if the key isn't there yet
+	ValueType& operator[](const KeyType &key);
+	ValueType& get(const KeyType &key);
+
+	// Returns the value for key, inserting initial first if the key isn't there yet
+	ValueType& upsert(const KeyType &key, const ValueType &initial);
+
+	bool keyExists(const KeyType &key) const;
+	void erase(const KeyType &key);
+	iterator erase(iterator it);
+
+	void clear();
+	uint size() const;
+	bool empty() const;
+
+	// Makes room for count entries without rehashing
+	void reserve(uint count);
+
+	// Bytes held by the slot arrays
+	size_t GetMemoryUsage() const;
+
+	iterator begin();
+	iterator end();
+	iterator find(const KeyType &key);
+
+private:
+	enum SlotState {SLOT_EMPTY = 0, SLOT_FULL, SLOT_DELETED};
+
+	// Capacity of the first allocation, always a power of two
+	static const uint MIN_CAPACITY = 16;
+
+	std::vector<value_type> m_slots;
+	std::vector<uint8_t> m_states;
+
+	uint m_size;
+	// Full slots plus tombstones, what the load factor is checked against
+	uint m_used;
+	uint m_mask;
+
+	HashFcn m_hasher;
+	EqualKey m_equalityChecker;
+
+	uint HomeSlot(const KeyType &key) const;
+
+	// Index of the slot holding key, or the capacity if it's not in the table
+	uint FindSlot(const KeyType &key) const;
+
+	// Index of the slot holding key, claiming one for it (with a default value) if needed
+	uint FindOrInsertSlot(const KeyType &key, bool &inserted);
+
+	uint NextFull(uint index) const;
+	void Rehash(uint capacity);
+};
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::FlatHashMap()
+{
+	m_size = 0;
+	m_used = 0;
+	m_mask = 0;
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+const uint FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::MIN_CAPACITY;
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+ValueType& FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::operator[](const KeyType &key)
+{
+	bool inserted;
+	return m_slots[FindOrInsertSlot(key, inserted)].second;
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+ValueType& FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::get(const KeyType &key)
+{
+	return (*this)[key];
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+ValueType& FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::upsert(const KeyType &key, const ValueType &initial)
+{
+	bool inserted;
+	value_type &slot = m_slots[FindOrInsertSlot(key, inserted)];
+	if(inserted)
+	{
+		slot.second = initial;
+	}
+	return slot.second;
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+bool FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::keyExists(const KeyType &key) const
+{
+	return FindSlot(key) != m_slots.size();
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+void FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::erase(const KeyType &key)
+{
+	uint index = FindSlot(key);
+	if(index != m_slots.size())
+	{
+		erase(iterator(this, index));
+	}
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+typename FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::iterator FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::erase(iterator it)
+{
+	m_states[it.m_index] = SLOT_DELETED;
+	m_slots[it.m_index] = value_type();
+	m_size--;
+	return iterator(this, NextFull(it.m_index + 1));
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+void FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::clear()
+{
+	m_slots.clear();
+	m_states.clear();
+	m_size = 0;
+	m_used = 0;
+	m_mask = 0;
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+uint FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::size() const
+{
+	return m_size;
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+size_t FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::GetMemoryUsage() const
+{
+	return m_slots.capacity() * sizeof(value_type) + m_states.capacity() * sizeof(uint8_t);
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+bool FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::empty() const
+{
+	return m_size == 0;
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+void FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::reserve(uint count)
+{
+	uint capacity = MIN_CAPACITY;
+	// Keep the load factor at or under 3/4
+	while(capacity - capacity / 4 < count)
+	{
+		capacity *= 2;
+	}
+	if(capacity > m_slots.size())
+	{
+		Rehash(capacity);
+	}
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+typename FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::iterator FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::begin()
+{
+	return iterator(this, NextFull(0));
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+typename FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::iterator FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::end()
+{
+	return iterator(this, m_slots.size());
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+typename FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::iterator FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::find(const KeyType &key)
+{
+	return iterator(this, FindSlot(key));
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+uint FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::HomeSlot(const KeyType &key) const
+{
+	// std::hash is the identity for integers, so spread the bits (Fibonacci hashing) before masking
+	uint64_t hash = (uint64_t)m_hasher(key) * 0x9E3779B97F4A7C15ULL;
+	return (uint)(hash >> 32) & m_mask;
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+uint FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::FindSlot(const KeyType &key) const
+{
+	if(m_size == 0)
+	{
+		return m_slots.size();
+	}
+
+	for(uint index = HomeSlot(key); ; index = (index + 1) & m_mask)
+	{
+		if(m_states[index] == SLOT_EMPTY)
+		{
+			return m_slots.size();
+		}
+		if(m_states[index] == SLOT_FULL && m_equalityChecker(m_slots[index].first, key))
+		{
+			return index;
+		}
+	}
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+uint FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::FindOrInsertSlot(const KeyType &key, bool &inserted)
+{
+	if(m_slots.empty())
+	{
+		Rehash(MIN_CAPACITY);
+	}
+
+	uint tombstone = m_slots.size();
+	uint index = HomeSlot(key);
+	for(; m_states[index] != SLOT_EMPTY; index = (index + 1) & m_mask)
+	{
+		if(m_states[index] == SLOT_DELETED)
+		{
+			if(tombstone == m_slots.size())
+			{
+				tombstone = index;
+			}
+		}
+		else if(m_equalityChecker(m_slots[index].first, key))
+		{
+			inserted = false;
+			return index;
+		}
+	}
+
+	// Not there, take the first tombstone on the way or else the empty slot we stopped on
+	if(tombstone != m_slots.size())
+	{
+		index = tombstone;
+	}
+	else if(m_used + 1 > m_slots.size() - m_slots.size() / 4)
+	{
+		// Keep the load factor under 3/4 so probes stay short and always hit an empty slot.
+		// If it's mostly tombstones, rehashing at the same size is enough to clear them out.
+		Rehash(m_size + 1 > m_slots.size() / 2 ? m_slots.size() * 2 : m_slots.size());
+		return FindOrInsertSlot(key, inserted);
+	}
+	else
+	{
+		m_used++;
+	}
+
+	m_states[index] = SLOT_FULL;
+	m_slots[index].first = key;
+	m_slots[index].second = ValueType();
+	m_size++;
+	inserted = true;
+	return index;
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+uint FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::NextFull(uint index) const
+{
+	while(index < m_states.size() && m_states[index] != SLOT_FULL)
+	{
+		index++;
+	}
+	return index;
+}
+
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+void FlatHashMap<KeyType,ValueType,HashFcn,EqualKey>::Rehash(uint capacity)
+{
+	std::vector<value_type> oldSlots(capacity);
+	std::vector<uint8_t> oldStates(capacity, (uint8_t)SLOT_EMPTY);
+	oldSlots.swap(m_slots);
+	oldStates.swap(m_states);
+	m_mask = capacity - 1;
+	m_used = m_size;
+
+	for(uint i = 0; i < oldSlots.size(); i++)
+	{
+		if(oldStates[i] != SLOT_FULL)
+		{
+			continue;
+		}
+
+		uint index = HomeSlot(oldSlots[i].first);
+		while(m_states[index] != SLOT_EMPTY)
+		{
+			index = (index + 1) & m_mask;
+		}
+		m_states[index] = SLOT_FULL;
+		m_slots[index] = oldSlots[i];
+	}
+}
+
+}
+
+#endif /* FLATHASHMAP_H_ */
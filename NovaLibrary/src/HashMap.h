@@ -24,6 +24,10 @@ public:
 	ValueType& operator[](KeyType key);
 	ValueType& get(KeyType key);
 
+	// Returns the value for key, inserting initial first if the key isn't there yet. Only hashes once,
+	// so counters can be bumped with upsert(key, 0)++ instead of a keyExists and an operator[]
+	ValueType& upsert(KeyType key, const ValueType &initial);
+
 	bool keyExists(KeyType key);
 	void erase(KeyType key);
 	typename std::unordered_map<KeyType, ValueType, HashFcn, EqualKey>::iterator erase(typename std::unordered_map<KeyType, ValueType, HashFcn, EqualKey>::iterator key);
@@ -33,6 +37,9 @@ public:
 	uint size() const;
 	bool empty() const;
 
+	// Exchanges contents with other in constant time
+	void swap(HashMap &other);
+
 	// Expose the iterators
 	typedef typename std::unordered_map<KeyType, ValueType, HashFcn, EqualKey>::iterator iterator;
 
@@ -104,6 +111,12 @@ bool HashMap<KeyType,ValueType,HashFcn,EqualKey>::empty() const
 	return m_map.empty();
 }
 
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+void HashMap<KeyType,ValueType,HashFcn,EqualKey>::swap(HashMap &other)
+{
+	m_map.swap(other.m_map);
+}
+
 template<class KeyType, class ValueType, class HashFcn, class EqualKey>
 bool HashMap<KeyType,ValueType,HashFcn,EqualKey>::keyExists(KeyType key)
 {
@@ -122,6 +135,12 @@ ValueType& HashMap<KeyType,ValueType,HashFcn,EqualKey>::get(KeyType key)
 	return m_map[key];
 }
 
+template<class KeyType, class ValueType, class HashFcn, class EqualKey>
+ValueType& HashMap<KeyType,ValueType,HashFcn,EqualKey>::upsert(KeyType key, const ValueType &initial)
+{
+	return m_map.insert(std::make_pair(key, initial)).first->second;
+}
+
 }
 
 #endif /* NOVAHASH_H_ */
@@ -0,0 +1,92 @@
+//============================================================================
+// Name        : InterfaceTable.cpp
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Interns capture interface names as small integer ids so evidence
+//               records don't have to carry a string
+
+#include "InterfaceTable.h"
+#include "Lock.h"
+
+using namespace std;
+
+namespace Nova
+{
+
+InterfaceTable *InterfaceTable::m_instance = NULL;
+
+// Capture threads can race to create the table. pthread_once also makes sure every thread
+// sees the table fully built, which a plain NULL check on m_instance wouldn't.
+static pthread_once_t instanceOnce = PTHREAD_ONCE_INIT;
+
+void InterfaceTable::CreateInstance()
+{
+	m_instance = new InterfaceTable();
+}
+
+InterfaceTable *InterfaceTable::Inst()
+{
+	pthread_once(&instanceOnce, &InterfaceTable::CreateInstance);
+	return m_instance;
+}
+
+InterfaceTable::InterfaceTable()
+{
+	pthread_rwlock_init(&m_lock, NULL);
+}
+
+uint16_t InterfaceTable::GetIndex(const string &name)
+{
+	{
+		Lock lock(&m_lock, READ_LOCK);
+		for(uint16_t i = 0; i < m_names.size(); i++)
+		{
+			if(m_names[i] == name)
+			{
+				return i;
+			}
+		}
+	}
+
+	Lock lock(&m_lock, WRITE_LOCK);
+	// Someone else may have added it while we didn't hold the lock
+	for(uint16_t i = 0; i < m_names.size(); i++)
+	{
+		if(m_names[i] == name)
+		{
+			return i;
+		}
+	}
+
+	m_names.push_back(name);
+	return m_names.size() - 1;
+}
+
+const string &InterfaceTable::GetName(uint16_t index)
+{
+	Lock lock(&m_lock, READ_LOCK);
+	if(index >= m_names.size())
+	{
+		return m_unknown;
+	}
+	return m_names[index];
+}
+
+uint16_t InterfaceTable::size()
+{
+	Lock lock(&m_lock, READ_LOCK);
+	return m_names.size();
+}
+
+}
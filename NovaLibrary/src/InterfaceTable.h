@@ -0,0 +1,60 @@
+//============================================================================
+// Name        : InterfaceTable.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Interns capture interface names as small integer ids so evidence
+//               records don't have to carry a string
+//============================================================================
+
+#ifndef INTERFACETABLE_H_
+#define INTERFACETABLE_H_
+
+#include <deque>
+#include <string>
+#include <stdint.h>
+#include <pthread.h>
+
+namespace Nova
+{
+
+class InterfaceTable
+{
+public:
+	static InterfaceTable *Inst();
+
+	// Returns the id for an interface name, adding it to the table if it's new
+	uint16_t GetIndex(const std::string &name);
+
+	// Returns the name for an id handed out by GetIndex, or an empty string for unknown ids.
+	// Ids are never reused, so the reference stays valid for the life of the process.
+	const std::string &GetName(uint16_t index);
+
+	uint16_t size();
+
+private:
+	InterfaceTable();
+
+	static InterfaceTable *m_instance;
+	static void CreateInstance();
+
+	// A deque so references returned by GetName survive later insertions
+	std::deque<std::string> m_names;
+	std::string m_unknown;
+
+	pthread_rwlock_t m_lock;
+};
+
+}
+
+#endif /* INTERFACETABLE_H_ */
@@ -17,6 +17,7 @@
 //============================================================================
 
 #include "PacketCapture.h"
+#include "InterfaceTable.h"
 #include "Logger.h"
 #include "Lock.h"
 
@@ -31,6 +32,7 @@ PacketCapture::PacketCapture()
 {
 	m_handle = NULL;
 	m_packetCb = NULL;
+	m_batchCb = NULL;
 	isCapturing = false;
 	stoppingCapture = false;
 	pthread_mutex_init(&this->stoppingMutex, NULL);
@@ -47,6 +49,11 @@ void PacketCapture::SetPacketCb(void (*cb)(unsigned char *index, const struct pc
 	m_packetCb = cb;
 }
 
+void PacketCapture::SetBatchCb(void (*cb)(PacketCapture *cap))
+{
+	m_batchCb = cb;
+}
+
 void PacketCapture::SetFilter(string filter)
 {
 	if(m_handle == NULL)
@@ -109,7 +116,7 @@ bool PacketCapture::StartCapture()
 bool PacketCapture::StartCaptureBlocking()
 {
 	LOG(DEBUG, "Starting packet capture on: " + m_identifier, "");
-	return (pcap_loop(m_handle, -1, m_packetCb, reinterpret_cast<u_char*>(this)) == 0);
+	return (DispatchLoop(true) == 0);
 }
 
 void PacketCapture::StopCapture()
@@ -149,7 +156,7 @@ void PacketCapture::InternalThreadEntry()
 		if (activationReturnValue == 0 || activationReturnValue == PCAP_ERROR_ACTIVATED)
 		{
 			isCapturing = true;
-			int loopReturn = pcap_loop(m_handle, -1, m_packetCb, reinterpret_cast<u_char*>(this));
+			int loopReturn = DispatchLoop(false);
 			isCapturing = false;
 
 			if (loopReturn == -1)
@@ -179,3 +186,27 @@ void PacketCapture::InternalThreadEntry()
 		}
 	}
 }
+
+int PacketCapture::DispatchLoop(bool stopAtEnd)
+{
+	m_evidenceBatch.m_interface = InterfaceTable::Inst()->GetIndex(m_identifier);
+
+	while(true)
+	{
+		int dispatchReturn = pcap_dispatch(m_handle, EVIDENCE_BATCH_SIZE, m_packetCb, reinterpret_cast<u_char*>(this));
+		if(dispatchReturn < 0)
+		{
+			return dispatchReturn;
+		}
+
+		if(m_batchCb != NULL)
+		{
+			m_batchCb(this);
+		}
+
+		if(dispatchReturn == 0 && stopAtEnd)
+		{
+			return 0;
+		}
+	}
+}
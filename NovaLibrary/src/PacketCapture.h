@@ -19,6 +19,8 @@
 #ifndef PACKETCAPTURE_H_
 #define PACKETCAPTURE_H_
 
+#include "Evidence.h"
+
 #include <string>
 #include <pcap.h>
 
@@ -32,24 +34,30 @@ public:
 	virtual ~PacketCapture();
 
 	void SetPacketCb(void (*cb)(unsigned char *index, const struct pcap_pkthdr *pkthdr, const unsigned char *packet));
-	void SetFilter(std::string filter);
+
+	// Called after every pcap_dispatch so the packet callback's work can be published as one batch
+	void SetBatchCb(void (*cb)(PacketCapture *cap));
+	virtual void SetFilter(std::string filter);
 
 	pcap_t* GetPcapHandle();
 
-	bool StartCapture();
-	bool StartCaptureBlocking();
+	virtual bool StartCapture();
+	virtual bool StartCaptureBlocking();
 
-	void StopCapture();
+	virtual void StopCapture();
 
-	int GetDroppedPackets();
+	virtual int GetDroppedPackets();
 
 	// This is the pcap API id that's passed to the packet capture callback
 	u_char GetIdIndex() {return m_index;}
 	void SetIdIndex(u_char index) {m_index = index;}
 
-	std::string GetIdentifier() {return m_identifier;}
+	const std::string &GetIdentifier() {return m_identifier;}
 	void SetIdentifier(std::string identifier) {m_identifier = identifier;}
 
+	// Packets parsed by the packet callback since the last batch callback. Only touched by the capture thread.
+	EvidenceBatch *GetEvidenceBatch() {return &m_evidenceBatch;}
+
 protected:
 	std::string m_identifier;
 	u_char m_index;
@@ -63,7 +71,14 @@ protected:
 	pthread_t m_thread;
 	char m_errorbuf[PCAP_ERRBUF_SIZE];
 
-	void InternalThreadEntry();
+	virtual void InternalThreadEntry();
+
+	// Runs pcap_dispatch until it fails or is broken out of, calling the batch callback after every dispatch.
+	// If stopAtEnd is set, also stops when a dispatch returns no packets (end of a pcap file)
+	int DispatchLoop(bool stopAtEnd);
+
+	EvidenceBatch m_evidenceBatch;
+	void (*m_batchCb)(PacketCapture *cap);
 
 	// Work around for conversion of class method to C style function pointer for pcap
 	void (*m_packetCb)(unsigned char *index, const struct pcap_pkthdr *pkthdr, const unsigned char *packet);
@@ -0,0 +1,287 @@
+//============================================================================
+// Name        : PacketSizeHistogram.cpp
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Log-linear histogram of packet sizes with exact running moments
+//============================================================================
+
+#include "PacketSizeHistogram.h"
+#include "SerializationHelper.h"
+
+#include <math.h>
+#include <string.h>
+
+using namespace std;
+
+#define PACKET_SIZE_PAGES (PACKET_SIZE_BUCKETS / PACKET_SIZE_SUB_BUCKETS)
+
+namespace Nova
+{
+
+PacketSizeHistogram::PacketSizeHistogram()
+{
+	memset(m_pages, 0, sizeof(m_pages));
+	m_count = 0;
+	m_sum = 0;
+	m_sumOfSquares = 0;
+}
+
+PacketSizeHistogram::PacketSizeHistogram(const PacketSizeHistogram &other)
+{
+	memset(m_pages, 0, sizeof(m_pages));
+	m_count = 0;
+	m_sum = 0;
+	m_sumOfSquares = 0;
+	Merge(other);
+}
+
+PacketSizeHistogram &PacketSizeHistogram::operator=(const PacketSizeHistogram &other)
+{
+	if(this != &other)
+	{
+		Clear();
+		Merge(other);
+	}
+	return *this;
+}
+
+PacketSizeHistogram::~PacketSizeHistogram()
+{
+	Clear();
+}
+
+void PacketSizeHistogram::Add(uint16_t size, uint64_t count)
+{
+	AddToBucket(GetBucketIndex(size), count);
+	m_count += count;
+	m_sum += (uint64_t)size * count;
+	m_sumOfSquares += (uint64_t)size * size * count;
+}
+
+void PacketSizeHistogram::Merge(const PacketSizeHistogram &other)
+{
+	for(uint page = 0; page < PACKET_SIZE_PAGES; page++)
+	{
+		if(other.m_pages[page] == NULL)
+		{
+			continue;
+		}
+		for(uint i = 0; i < PACKET_SIZE_SUB_BUCKETS; i++)
+		{
+			if(other.m_pages[page][i] != 0)
+			{
+				AddToBucket(page * PACKET_SIZE_SUB_BUCKETS + i, other.m_pages[page][i]);
+			}
+		}
+	}
+
+	m_count += other.m_count;
+	m_sum += other.m_sum;
+	m_sumOfSquares += other.m_sumOfSquares;
+}
+
+void PacketSizeHistogram::Clear()
+{
+	for(uint page = 0; page < PACKET_SIZE_PAGES; page++)
+	{
+		delete[] m_pages[page];
+		m_pages[page] = NULL;
+	}
+	m_count = 0;
+	m_sum = 0;
+	m_sumOfSquares = 0;
+}
+
+double PacketSizeHistogram::GetMean() const
+{
+	if(m_count == 0)
+	{
+		return 0;
+	}
+	return (double)m_sum / m_count;
+}
+
+double PacketSizeHistogram::GetDeviation() const
+{
+	if(m_count == 0)
+	{
+		return 0;
+	}
+	double mean = GetMean();
+	double variance = (double)m_sumOfSquares / m_count - mean * mean;
+	// Rounding can take a zero variance slightly negative
+	return variance > 0 ? sqrt(variance) : 0;
+}
+
+uint64_t PacketSizeHistogram::GetBucket(uint index) const
+{
+	if(index >= PACKET_SIZE_BUCKETS)
+	{
+		return 0;
+	}
+	uint64_t *page = m_pages[index / PACKET_SIZE_SUB_BUCKETS];
+	return page == NULL ? 0 : page[index % PACKET_SIZE_SUB_BUCKETS];
+}
+
+uint PacketSizeHistogram::GetBucketIndex(uint16_t size)
+{
+	if(size < 2 * PACKET_SIZE_SUB_BUCKETS)
+	{
+		return size;
+	}
+
+	// Keep the top PACKET_SIZE_SUB_BUCKET_BITS + 1 bits of the size
+	uint shift = (31 - __builtin_clz(size)) - PACKET_SIZE_SUB_BUCKET_BITS;
+	return shift * PACKET_SIZE_SUB_BUCKETS + (size >> shift);
+}
+
+uint16_t PacketSizeHistogram::GetBucketLowerBound(uint index)
+{
+	if(index < 2 * PACKET_SIZE_SUB_BUCKETS)
+	{
+		return index;
+	}
+
+	uint shift = index / PACKET_SIZE_SUB_BUCKETS - 1;
+	return (index - shift * PACKET_SIZE_SUB_BUCKETS) << shift;
+}
+
+uint16_t PacketSizeHistogram::GetBucketUpperBound(uint index)
+{
+	if(index < 2 * PACKET_SIZE_SUB_BUCKETS)
+	{
+		return index;
+	}
+
+	uint shift = index / PACKET_SIZE_SUB_BUCKETS - 1;
+	return GetBucketLowerBound(index) + (1 << shift) - 1;
+}
+
+uint32_t PacketSizeHistogram::GetSerializeLength() const
+{
+	return sizeof(uint8_t) + 3 * sizeof(uint64_t) + sizeof(uint16_t)
+		+ GetUsedBuckets() * (sizeof(uint16_t) + sizeof(uint64_t));
+}
+
+uint32_t PacketSizeHistogram::Serialize(u_char *buf, uint32_t bufferSize) const
+{
+	uint32_t offset = 0;
+	uint8_t version = PACKET_SIZE_HISTOGRAM_VERSION;
+	uint16_t usedBuckets = GetUsedBuckets();
+
+	SerializeChunk(buf, offset, (char*)&version, sizeof(version), bufferSize);
+	SerializeChunk(buf, offset, (char*)&m_count, sizeof(m_count), bufferSize);
+	SerializeChunk(buf, offset, (char*)&m_sum, sizeof(m_sum), bufferSize);
+	SerializeChunk(buf, offset, (char*)&m_sumOfSquares, sizeof(m_sumOfSquares), bufferSize);
+	SerializeChunk(buf, offset, (char*)&usedBuckets, sizeof(usedBuckets), bufferSize);
+
+	for(uint page = 0; page < PACKET_SIZE_PAGES; page++)
+	{
+		if(m_pages[page] == NULL)
+		{
+			continue;
+		}
+		for(uint i = 0; i < PACKET_SIZE_SUB_BUCKETS; i++)
+		{
+			if(m_pages[page][i] != 0)
+			{
+				uint16_t index = page * PACKET_SIZE_SUB_BUCKETS + i;
+				SerializeChunk(buf, offset, (char*)&index, sizeof(index), bufferSize);
+				SerializeChunk(buf, offset, (char*)&m_pages[page][i], sizeof(uint64_t), bufferSize);
+			}
+		}
+	}
+
+	return offset;
+}
+
+uint32_t PacketSizeHistogram::Deserialize(u_char *buf, uint32_t bufferSize)
+{
+	Clear();
+
+	uint32_t offset = 0;
+	uint8_t version;
+	uint16_t usedBuckets;
+
+	DeserializeChunk(buf, offset, (char*)&version, sizeof(version), bufferSize);
+	if(version != PACKET_SIZE_HISTOGRAM_VERSION)
+	{
+		throw serializationException();
+	}
+
+	DeserializeChunk(buf, offset, (char*)&m_count, sizeof(m_count), bufferSize);
+	DeserializeChunk(buf, offset, (char*)&m_sum, sizeof(m_sum), bufferSize);
+	DeserializeChunk(buf, offset, (char*)&m_sumOfSquares, sizeof(m_sumOfSquares), bufferSize);
+	DeserializeChunk(buf, offset, (char*)&usedBuckets, sizeof(usedBuckets), bufferSize);
+
+	for(uint i = 0; i < usedBuckets; i++)
+	{
+		uint16_t index;
+		uint64_t count;
+		DeserializeChunk(buf, offset, (char*)&index, sizeof(index), bufferSize);
+		DeserializeChunk(buf, offset, (char*)&count, sizeof(count), bufferSize);
+		if(index >= PACKET_SIZE_BUCKETS)
+		{
+			throw serializationException();
+		}
+		AddToBucket(index, count);
+	}
+
+	return offset;
+}
+
+void PacketSizeHistogram::AddToBucket(uint index, uint64_t count)
+{
+	uint64_t *&page = m_pages[index / PACKET_SIZE_SUB_BUCKETS];
+	if(page == NULL)
+	{
+		page = new uint64_t[PACKET_SIZE_SUB_BUCKETS]();
+	}
+	page[index % PACKET_SIZE_SUB_BUCKETS] += count;
+}
+
+uint32_t PacketSizeHistogram::GetMemoryUsage() const
+{
+	uint32_t bytes = 0;
+	for(uint page = 0; page < PACKET_SIZE_PAGES; page++)
+	{
+		if(m_pages[page] != NULL)
+		{
+			bytes += PACKET_SIZE_SUB_BUCKETS * sizeof(uint64_t);
+		}
+	}
+	return bytes;
+}
+
+uint PacketSizeHistogram::GetUsedBuckets() const
+{
+	uint used = 0;
+	for(uint page = 0; page < PACKET_SIZE_PAGES; page++)
+	{
+		if(m_pages[page] == NULL)
+		{
+			continue;
+		}
+		for(uint i = 0; i < PACKET_SIZE_SUB_BUCKETS; i++)
+		{
+			if(m_pages[page][i] != 0)
+			{
+				used++;
+			}
+		}
+	}
+	return used;
+}
+
+}
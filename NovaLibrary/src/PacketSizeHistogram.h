@@ -0,0 +1,93 @@
+//============================================================================
+// Name        : PacketSizeHistogram.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Log-linear histogram of packet sizes with exact running moments
+//============================================================================
+
+#ifndef PACKETSIZEHISTOGRAM_H_
+#define PACKETSIZEHISTOGRAM_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Sizes below 2^(bits+1) get a bucket each, above that every power of two is split into 2^bits buckets
+#define PACKET_SIZE_SUB_BUCKET_BITS 6
+#define PACKET_SIZE_SUB_BUCKETS (1 << PACKET_SIZE_SUB_BUCKET_BITS)
+// Enough to cover every uint16_t size: 704 buckets, at most 16 bytes wide up to 2047
+#define PACKET_SIZE_BUCKETS ((16 - PACKET_SIZE_SUB_BUCKET_BITS + 1) * PACKET_SIZE_SUB_BUCKETS)
+
+// Version byte at the start of serialized histograms
+#define PACKET_SIZE_HISTOGRAM_VERSION 1
+
+namespace Nova
+{
+
+// Counts are kept in pages of PACKET_SIZE_SUB_BUCKETS buckets that are only allocated once
+// a size in their range shows up, so a suspect sending a handful of sizes costs a page or two.
+// The count, sum and sum of squares are tracked exactly, so the mean and deviation never
+// depend on the bucket widths.
+class PacketSizeHistogram
+{
+public:
+	PacketSizeHistogram();
+	PacketSizeHistogram(const PacketSizeHistogram &other);
+	PacketSizeHistogram &operator=(const PacketSizeHistogram &other);
+	~PacketSizeHistogram();
+
+	void Add(uint16_t size, uint64_t count = 1);
+	void Merge(const PacketSizeHistogram &other);
+	void Clear();
+
+	uint64_t GetCount() const {return m_count;}
+	uint64_t GetSum() const {return m_sum;}
+	uint64_t GetSumOfSquares() const {return m_sumOfSquares;}
+
+	double GetMean() const;
+	// Population standard deviation
+	double GetDeviation() const;
+
+	uint64_t GetBucket(uint index) const;
+
+	// Bytes held by the allocated pages
+	uint32_t GetMemoryUsage() const;
+
+	static uint GetBucketIndex(uint16_t size);
+	// Smallest and largest size counted in a bucket
+	static uint16_t GetBucketLowerBound(uint index);
+	static uint16_t GetBucketUpperBound(uint index);
+
+	// The whole histogram as one blob, in host byte order:
+	//   uint8 version, uint64 count, uint64 sum, uint64 sum of squares,
+	//   uint16 number of non empty buckets, then (uint16 bucket index, uint64 count) for each
+	uint32_t GetSerializeLength() const;
+	// Returns the number of bytes written. Throws serializationException if buf is too small.
+	uint32_t Serialize(u_char *buf, uint32_t bufferSize) const;
+	// Replaces the contents with a serialized histogram. Throws serializationException if it's truncated or malformed.
+	uint32_t Deserialize(u_char *buf, uint32_t bufferSize);
+
+private:
+	uint64_t *m_pages[PACKET_SIZE_BUCKETS / PACKET_SIZE_SUB_BUCKETS];
+
+	uint64_t m_count;
+	uint64_t m_sum;
+	uint64_t m_sumOfSquares;
+
+	void AddToBucket(uint index, uint64_t count);
+	uint GetUsedBuckets() const;
+};
+
+}
+
+#endif /* PACKETSIZEHISTOGRAM_H_ */
@@ -0,0 +1,131 @@
+//============================================================================
+// Name        : RcuPointer.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Pointer to an immutable object that readers use without locking.
+//			 Publishing a replacement frees the old object once no reader can still have it.
+//============================================================================
+
+#ifndef RCUPOINTER_H_
+#define RCUPOINTER_H_
+
+#include "Lock.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// How long Publish sleeps between checks on the readers it's waiting for
+#define RCU_WAIT_MICROSECONDS 1000
+
+namespace Nova
+{
+
+template <typename T>
+class RcuPointer
+{
+public:
+	// Takes ownership of initial, which can be NULL
+	RcuPointer(T *initial = NULL)
+	{
+		m_current = initial;
+		m_epoch = 0;
+		m_readers[0] = 0;
+		m_readers[1] = 0;
+		pthread_mutex_init(&m_publishLock, NULL);
+	}
+
+	~RcuPointer()
+	{
+		delete m_current.load();
+		pthread_mutex_destroy(&m_publishLock);
+	}
+
+	// Holds on to whatever object was current when it was made, for as long as it's in scope.
+	// Costs two atomic increments, never waits on anything.
+	class ReadGuard
+	{
+	public:
+		ReadGuard(RcuPointer<T> &pointer)
+			: m_pointer(pointer)
+		{
+			// The reader is counted before it loads the pointer, so a publish can't miss it
+			m_slot = pointer.m_epoch.load() & 1;
+			pointer.m_readers[m_slot]++;
+			m_object = pointer.m_current.load();
+		}
+
+		~ReadGuard()
+		{
+			m_pointer.m_readers[m_slot]--;
+		}
+
+		T *Get() const
+		{
+			return m_object;
+		}
+
+		T *operator->() const
+		{
+			return m_object;
+		}
+
+	private:
+		RcuPointer<T> &m_pointer;
+		uint m_slot;
+		T *m_object;
+
+		ReadGuard(const ReadGuard &);
+		ReadGuard &operator=(const ReadGuard &);
+	};
+
+	// Makes next (which it takes ownership of) the current object, then frees the old one once
+	// every read that might have it is over. Only waits on reads already in progress: new ones see next.
+	void Publish(T *next)
+	{
+		Lock lock(&m_publishLock);
+
+		T *previous = m_current.exchange(next);
+
+		// Anyone who got the old object was counted in one of the two counters before getting it.
+		// Flipping the epoch first sends new readers to the other counter, so the one being
+		// waited on can only go down.
+		for(uint i = 0; i < 2; i++)
+		{
+			uint slot = m_epoch++ & 1;
+			while(m_readers[slot].load() != 0)
+			{
+				usleep(RCU_WAIT_MICROSECONDS);
+			}
+		}
+
+		delete previous;
+	}
+
+private:
+	std::atomic<T *> m_current;
+	std::atomic<uint64_t> m_epoch;
+	std::atomic<uint64_t> m_readers[2];
+
+	// One publish at a time
+	pthread_mutex_t m_publishLock;
+
+	RcuPointer(const RcuPointer &);
+	RcuPointer &operator=(const RcuPointer &);
+};
+
+}
+
+#endif /* RCUPOINTER_H_ */
@@ -0,0 +1,350 @@
+//============================================================================
+// Name        : RingPacketCapture.cpp
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Interface capture that reads an AF_PACKET TPACKET_V3 ring
+//               directly instead of going through libpcap
+//============================================================================
+
+#include "RingPacketCapture.h"
+#include "InterfaceTable.h"
+#include "Config.h"
+#include "Logger.h"
+#include "Lock.h"
+
+#include <poll.h>
+#include <errno.h>
+#include <net/if.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+
+// Size of one ring block. Must be a power of two multiple of the page size.
+#define RING_BLOCK_SIZE (1 << 20)
+// Frames in a TPACKET_V3 block are variable length, this is only used for the kernel's sanity checks
+#define RING_FRAME_SIZE 2048
+// How long the capture thread sleeps in poll before checking if it should stop
+#define RING_POLL_TIMEOUT 500
+
+using namespace std;
+
+namespace Nova
+{
+
+RingPacketCapture::RingPacketCapture(string interface)
+{
+	m_interface = interface;
+	m_identifier = interface;
+	m_socket = -1;
+	m_ring = NULL;
+	m_currentBlock = 0;
+	m_blockCb = NULL;
+	m_fanoutSize = 1;
+	m_droppedPackets = 0;
+	memset(&m_request, 0, sizeof(m_request));
+}
+
+RingPacketCapture::~RingPacketCapture()
+{
+	CloseRing();
+}
+
+void RingPacketCapture::Init()
+{
+	m_socket = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if(m_socket == -1)
+	{
+		throw PacketCaptureException("Unable to open packet socket for " + m_interface + ": " + string(strerror(errno)));
+	}
+
+	int version = TPACKET_V3;
+	if(setsockopt(m_socket, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+	{
+		throw PacketCaptureException("Unable to set TPACKET_V3 on " + m_interface + ": " + string(strerror(errno)));
+	}
+
+	uint blockCount = Config::Inst()->GetCaptureRingSize() / RING_BLOCK_SIZE;
+	if(blockCount < 2)
+	{
+		blockCount = 2;
+	}
+
+	m_request.tp_block_size = RING_BLOCK_SIZE;
+	m_request.tp_block_nr = blockCount;
+	m_request.tp_frame_size = RING_FRAME_SIZE;
+	m_request.tp_frame_nr = (RING_BLOCK_SIZE / RING_FRAME_SIZE) * blockCount;
+	m_request.tp_retire_blk_tov = Config::Inst()->GetCaptureRingBlockTimeout();
+	m_request.tp_sizeof_priv = 0;
+	m_request.tp_feature_req_word = 0;
+
+	if(setsockopt(m_socket, SOL_PACKET, PACKET_RX_RING, &m_request, sizeof(m_request)) == -1)
+	{
+		throw PacketCaptureException("Unable to create capture ring on " + m_interface + ": " + string(strerror(errno)));
+	}
+
+	void *ring = mmap(NULL, (size_t)m_request.tp_block_size * m_request.tp_block_nr, PROT_READ | PROT_WRITE, MAP_SHARED, m_socket, 0);
+	if(ring == MAP_FAILED)
+	{
+		throw PacketCaptureException("Unable to map capture ring on " + m_interface + ": " + string(strerror(errno)));
+	}
+	m_ring = (uint8_t *)ring;
+	m_currentBlock = 0;
+
+	// Truncate everything to our snap length until the real filter is installed, this keeps the blocks dense
+	struct sock_filter snapOnly = BPF_STMT(BPF_RET | BPF_K, RING_CAPTURE_SNAPLEN);
+	struct sock_fprog program;
+	program.len = 1;
+	program.filter = &snapOnly;
+	if(setsockopt(m_socket, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) == -1)
+	{
+		throw PacketCaptureException("Unable to install snap length filter on " + m_interface + ": " + string(strerror(errno)));
+	}
+
+	struct sockaddr_ll address;
+	memset(&address, 0, sizeof(address));
+	address.sll_family = AF_PACKET;
+	address.sll_protocol = htons(ETH_P_ALL);
+	address.sll_ifindex = if_nametoindex(m_interface.c_str());
+	if(address.sll_ifindex == 0)
+	{
+		throw PacketCaptureException("Unable to find interface " + m_interface + ": " + string(strerror(errno)));
+	}
+
+	if(bind(m_socket, (struct sockaddr *)&address, sizeof(address)) == -1)
+	{
+		throw PacketCaptureException("Unable to bind capture ring to " + m_interface + ": " + string(strerror(errno)));
+	}
+
+	struct packet_mreq membership;
+	memset(&membership, 0, sizeof(membership));
+	membership.mr_ifindex = address.sll_ifindex;
+	membership.mr_type = PACKET_MR_PROMISC;
+	if(setsockopt(m_socket, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &membership, sizeof(membership)) == -1)
+	{
+		throw PacketCaptureException("Unable to set interface mode to promisc on " + m_interface + ": " + string(strerror(errno)));
+	}
+
+	if(m_fanoutSize > 1)
+	{
+		JoinFanout(address.sll_ifindex);
+	}
+}
+
+void RingPacketCapture::SetFanout(uint fanoutSize)
+{
+	m_fanoutSize = fanoutSize;
+}
+
+void RingPacketCapture::JoinFanout(int interfaceIndex)
+{
+	// Every socket on this interface in this process has to agree on the group id
+	uint16_t groupId = (getpid() ^ (interfaceIndex << 8)) & 0xffff;
+
+	// The kernel takes the return value of this program modulo the group size to pick a socket.
+	// Hashing only the source address keeps every packet from a suspect on the same socket.
+	struct sock_filter sourceHash[] = {
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 4),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 26),
+		BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 2654435761u),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+		BPF_STMT(BPF_RET | BPF_K, 0)
+	};
+	struct sock_fprog program;
+	program.len = sizeof(sourceHash) / sizeof(sourceHash[0]);
+	program.filter = sourceHash;
+
+	int fanout = groupId | (PACKET_FANOUT_CBPF << 16);
+	if(setsockopt(m_socket, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) == 0)
+	{
+		if(setsockopt(m_socket, SOL_PACKET, PACKET_FANOUT_DATA, &program, sizeof(program)) == -1)
+		{
+			throw PacketCaptureException("Unable to install fanout program on " + m_interface + ": " + string(strerror(errno)));
+		}
+		return;
+	}
+
+	// Kernels before 4.2 can't run a program for fanout. The flow hash still spreads the load,
+	// but a suspect talking to several ports can end up split over more than one thread.
+	LOG(WARNING, "Unable to use source IP fanout on " + m_interface + ", falling back to flow hash fanout: " + string(strerror(errno)), "");
+
+	fanout = groupId | (PACKET_FANOUT_HASH << 16);
+	if(setsockopt(m_socket, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) == -1)
+	{
+		throw PacketCaptureException("Unable to join fanout group on " + m_interface + ": " + string(strerror(errno)));
+	}
+}
+
+void RingPacketCapture::SetBlockCb(BlockCallback cb)
+{
+	m_blockCb = cb;
+}
+
+void RingPacketCapture::SetFilter(string filter)
+{
+	if(m_socket == -1)
+	{
+		LOG(ERROR, "Capture ring is not open, returning", "");
+		return;
+	}
+
+	// libpcap is only used as a BPF compiler here. The accept return value of the
+	// compiled program is the snap length, so the kernel truncates frames for us.
+	pcap_t *compiler = pcap_open_dead(DLT_EN10MB, RING_CAPTURE_SNAPLEN);
+	if(compiler == NULL)
+	{
+		throw PacketCaptureException("Couldn't create BPF compiler for filter: " + filter + ".");
+	}
+
+	struct bpf_program fp;
+	if(pcap_compile(compiler, &fp, filter.c_str(), 0, PCAP_NETMASK_UNKNOWN) == -1)
+	{
+		string error = pcap_geterr(compiler);
+		pcap_close(compiler);
+		throw PacketCaptureException("Couldn't parse filter: " + filter + " " + error + ".");
+	}
+
+	// struct bpf_insn and struct sock_filter have the same layout
+	struct sock_fprog program;
+	program.len = fp.bf_len;
+	program.filter = reinterpret_cast<struct sock_filter *>(fp.bf_insns);
+
+	int result = setsockopt(m_socket, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program));
+
+	pcap_freecode(&fp);
+	pcap_close(compiler);
+
+	if(result == -1)
+	{
+		throw PacketCaptureException("Couldn't install filter: " + filter + " " + string(strerror(errno)) + ".");
+	}
+}
+
+int RingPacketCapture::GetDroppedPackets()
+{
+	if(m_socket == -1 || !isCapturing)
+	{
+		return 0;
+	}
+
+	struct tpacket_stats_v3 stats;
+	socklen_t length = sizeof(stats);
+	if(getsockopt(m_socket, SOL_PACKET, PACKET_STATISTICS, &stats, &length) == -1)
+	{
+		return -1;
+	}
+
+	m_droppedPackets += stats.tp_drops;
+	return m_droppedPackets;
+}
+
+bool RingPacketCapture::StartCaptureBlocking()
+{
+	LOG(DEBUG, "Starting packet capture on: " + m_identifier, "");
+	CaptureLoop();
+	return true;
+}
+
+void RingPacketCapture::StopCapture()
+{
+	{
+		Lock lock(&this->stoppingMutex);
+		stoppingCapture = true;
+	}
+
+	// The capture loop wakes up from poll at least every RING_POLL_TIMEOUT ms to notice this
+	pthread_join(m_thread, NULL);
+	CloseRing();
+
+	{
+		Lock lock(&this->stoppingMutex);
+		stoppingCapture = false;
+	}
+}
+
+void RingPacketCapture::InternalThreadEntry()
+{
+	CaptureLoop();
+}
+
+void RingPacketCapture::CaptureLoop()
+{
+	struct pollfd pfd;
+	pfd.fd = m_socket;
+	pfd.events = POLLIN | POLLERR;
+	pfd.revents = 0;
+
+	m_evidenceBatch.m_interface = InterfaceTable::Inst()->GetIndex(m_identifier);
+
+	isCapturing = true;
+	while(!stoppingCapture)
+	{
+		struct tpacket_block_desc *block = (struct tpacket_block_desc *)(m_ring + (size_t)m_currentBlock * m_request.tp_block_size);
+
+		if((block->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+		{
+			if(poll(&pfd, 1, RING_POLL_TIMEOUT) == -1 && errno != EINTR)
+			{
+				LOG(ERROR, "Dropped out of capture ring loop because of error for packet capture: " + m_identifier + ". Error was: " + string(strerror(errno)), "");
+				break;
+			}
+			continue;
+		}
+
+		if(m_blockCb != NULL)
+		{
+			m_blockCb(this, block);
+		}
+		else
+		{
+			WalkBlock(block, m_packetCb, reinterpret_cast<u_char*>(static_cast<PacketCapture*>(this)));
+
+			if(m_batchCb != NULL)
+			{
+				m_batchCb(this);
+			}
+		}
+
+		// Make sure we're done reading the block before the kernel can refill it
+		__sync_synchronize();
+		block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		m_currentBlock = (m_currentBlock + 1) % m_request.tp_block_nr;
+	}
+	isCapturing = false;
+
+	LOG(DEBUG, "Dropped out of capture ring loop normally for packet capture: " + m_identifier, "");
+}
+
+void RingPacketCapture::CloseRing()
+{
+	if(m_ring != NULL)
+	{
+		munmap(m_ring, (size_t)m_request.tp_block_size * m_request.tp_block_nr);
+		m_ring = NULL;
+	}
+
+	if(m_socket != -1)
+	{
+		close(m_socket);
+		m_socket = -1;
+	}
+}
+
+} /* namespace Nova */
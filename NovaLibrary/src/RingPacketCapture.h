@@ -0,0 +1,108 @@
+//============================================================================
+// Name        : RingPacketCapture.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Interface capture that reads an AF_PACKET TPACKET_V3 ring
+//               directly instead of going through libpcap
+//============================================================================
+
+#ifndef RINGPACKETCAPTURE_H_
+#define RINGPACKETCAPTURE_H_
+
+#include "PacketCapture.h"
+
+#include <string>
+#include <stdint.h>
+#include <linux/if_packet.h>
+
+// Same snap length as InterfacePacketCapture: ethernet + max IP header + ports
+#define RING_CAPTURE_SNAPLEN 88
+
+namespace Nova
+{
+
+class RingPacketCapture : public PacketCapture
+{
+public:
+	// Called once per retired block. The block belongs to the handler until it returns,
+	// after which it is handed back to the kernel.
+	typedef void (*BlockCallback)(RingPacketCapture *cap, struct tpacket_block_desc *block);
+
+	RingPacketCapture(std::string interface);
+	~RingPacketCapture();
+
+	// Opens the socket, maps the ring and binds it to the interface
+	void Init();
+
+	// If no block callback is set, the packet callback is run on every frame of each block
+	// and the batch callback once the block is done
+	void SetBlockCb(BlockCallback cb);
+
+	// Joins this socket to a PACKET_FANOUT group of fanoutSize sockets on the same interface.
+	// Packets are spread over the group by source IP. Must be called before Init.
+	void SetFanout(uint fanoutSize);
+
+	void SetFilter(std::string filter);
+
+	bool StartCaptureBlocking();
+	void StopCapture();
+
+	int GetDroppedPackets();
+
+	// Runs cb on every frame of a block straight out of the ring: no syscalls or copies.
+	// The pcap_pkthdr passed to cb is only valid for the duration of the call.
+	static inline void WalkBlock(struct tpacket_block_desc *block, pcap_handler cb, u_char *user)
+	{
+		uint32_t packetCount = block->hdr.bh1.num_pkts;
+		struct tpacket3_hdr *frame = (struct tpacket3_hdr *)((uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+		struct pcap_pkthdr pkthdr;
+
+		for(uint32_t i = 0; i < packetCount; i++)
+		{
+			pkthdr.ts.tv_sec = frame->tp_sec;
+			pkthdr.ts.tv_usec = frame->tp_nsec / 1000;
+			pkthdr.caplen = frame->tp_snaplen;
+			pkthdr.len = frame->tp_len;
+
+			cb(user, &pkthdr, (uint8_t *)frame + frame->tp_mac);
+
+			frame = (struct tpacket3_hdr *)((uint8_t *)frame + frame->tp_next_offset);
+		}
+	}
+
+protected:
+	void InternalThreadEntry();
+
+private:
+	std::string m_interface;
+
+	int m_socket;
+	uint8_t *m_ring;
+	struct tpacket_req3 m_request;
+	uint m_currentBlock;
+
+	BlockCallback m_blockCb;
+
+	uint m_fanoutSize;
+
+	// PACKET_STATISTICS resets the kernel counters on every read, so keep a running total
+	uint m_droppedPackets;
+
+	void CaptureLoop();
+	void CloseRing();
+	void JoinFanout(int interfaceIndex);
+};
+
+} /* namespace Nova */
+#endif /* RINGPACKETCAPTURE_H_ */
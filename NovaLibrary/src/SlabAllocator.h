@@ -0,0 +1,385 @@
+//============================================================================
+// Name        : SlabAllocator.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Recycling slab allocator for the small objects that get created
+//			 and destroyed once per packet (Evidence, IpWrapper)
+//============================================================================
+
+#ifndef SLABALLOCATOR_H_
+#define SLABALLOCATOR_H_
+
+#include "Lock.h"
+
+#include <new>
+#include <vector>
+#include <atomic>
+#include <utility>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+namespace Nova
+{
+
+struct SlabStatistics
+{
+	// Number of slabs carved so far and how many objects they hold in total
+	uint64_t m_slabs;
+	uint64_t m_capacity;
+
+	// Objects currently handed out
+	uint64_t m_inUse;
+
+	// Allocations, and how many of those were served from a free list instead of a fresh slab
+	uint64_t m_allocations;
+	uint64_t m_recycled;
+
+	double GetOccupancy() const
+	{
+		return m_capacity == 0 ? 0 : (double)m_inUse / m_capacity;
+	}
+
+	double GetHitRate() const
+	{
+		return m_allocations == 0 ? 0 : (double)m_recycled / m_allocations;
+	}
+};
+
+// Each thread allocates from and frees into its own free list without any locking.
+// When a thread's list runs dry it takes a whole chain of free objects from a shared
+// depot, and when it grows too long the list goes back to the depot, so producer
+// threads that only allocate and consumer threads that only free still recycle memory.
+// When a thread exits, whatever it was holding goes back to the depot too.
+//
+// elementType needs an elementType *m_next, the same as GenericQueue, which is used
+// to link free objects. Memory is never handed back to the system.
+template <class elementType>
+class SlabAllocator
+{
+public:
+	// Objects carved out of the system allocator at a time
+	static const uint SLAB_OBJECTS = 1024;
+	// Free objects a thread keeps before handing them back to the depot
+	static const uint LOCAL_LIMIT = 4 * SLAB_OBJECTS;
+
+	// Returns uninitialized memory for one elementType
+	static void *Allocate();
+
+	// Returns the memory of a single object (already destroyed) to the free list
+	static void Free(void *object);
+
+	// Destroys and returns a whole m_next linked chain of objects to the depot in one go
+	static void FreeChain(elementType *first);
+
+	// Same as above, for when the caller already walked the chain and knows its end and length
+	static void FreeChain(elementType *first, elementType *last, uint count);
+
+	static SlabStatistics GetStatistics();
+
+private:
+	// Everything one thread keeps to itself. The counters are only ever written by the thread
+	// that owns them, they're atomic so GetStatistics can read them without waiting for it.
+	struct ThreadCache
+	{
+		elementType *m_localFree;
+		uint m_localCount;
+
+		// Untouched part of the last slab this thread carved
+		elementType *m_slabNext;
+		elementType *m_slabEnd;
+
+		std::atomic<uint64_t> m_allocations;
+		std::atomic<uint64_t> m_recycled;
+		std::atomic<uint64_t> m_frees;
+	};
+
+	static ThreadCache *GetCache()
+	{
+		ThreadCache *cache = m_cache;
+		return cache != NULL ? cache : CreateCache();
+	}
+
+	// Owner only, so a plain load and store will do instead of a locked add
+	static void Add(std::atomic<uint64_t> &counter, uint64_t amount)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	static ThreadCache *CreateCache();
+	static void CreateKey();
+	// Thread exit destructor for m_cacheKey
+	static void ReleaseCache(void *cache);
+	static void Refill(ThreadCache *cache);
+
+	static __thread ThreadCache *m_cache;
+	static pthread_key_t m_cacheKey;
+	static pthread_once_t m_keyOnce;
+
+	// Free chains given back by threads, with their lengths
+	static std::vector<std::pair<elementType *, uint> > m_depot;
+	// Caches of the threads still running
+	static std::vector<ThreadCache *> m_threads;
+	static pthread_mutex_t m_depotLock;
+
+	static std::atomic<uint64_t> m_slabs;
+
+	// Counters of threads that have exited, only touched with m_depotLock held
+	static uint64_t m_allocations;
+	static uint64_t m_recycled;
+	static uint64_t m_frees;
+};
+
+template <class elementType>
+const uint SlabAllocator<elementType>::SLAB_OBJECTS;
+template <class elementType>
+const uint SlabAllocator<elementType>::LOCAL_LIMIT;
+
+template <class elementType>
+__thread typename SlabAllocator<elementType>::ThreadCache *SlabAllocator<elementType>::m_cache = NULL;
+template <class elementType>
+pthread_key_t SlabAllocator<elementType>::m_cacheKey;
+template <class elementType>
+pthread_once_t SlabAllocator<elementType>::m_keyOnce = PTHREAD_ONCE_INIT;
+
+template <class elementType>
+std::vector<std::pair<elementType *, uint> > SlabAllocator<elementType>::m_depot;
+template <class elementType>
+std::vector<typename SlabAllocator<elementType>::ThreadCache *> SlabAllocator<elementType>::m_threads;
+template <class elementType>
+pthread_mutex_t SlabAllocator<elementType>::m_depotLock = PTHREAD_MUTEX_INITIALIZER;
+
+template <class elementType>
+std::atomic<uint64_t> SlabAllocator<elementType>::m_slabs(0);
+template <class elementType>
+uint64_t SlabAllocator<elementType>::m_allocations = 0;
+template <class elementType>
+uint64_t SlabAllocator<elementType>::m_recycled = 0;
+template <class elementType>
+uint64_t SlabAllocator<elementType>::m_frees = 0;
+
+template <class elementType>
+void *SlabAllocator<elementType>::Allocate()
+{
+	ThreadCache *cache = GetCache();
+	Add(cache->m_allocations, 1);
+
+	if(cache->m_localFree == NULL && cache->m_slabNext == cache->m_slabEnd)
+	{
+		Refill(cache);
+	}
+
+	if(cache->m_localFree != NULL)
+	{
+		elementType *ret = cache->m_localFree;
+		cache->m_localFree = ret->m_next;
+		cache->m_localCount--;
+		Add(cache->m_recycled, 1);
+		return ret;
+	}
+
+	return cache->m_slabNext++;
+}
+
+template <class elementType>
+void SlabAllocator<elementType>::Free(void *object)
+{
+	if(object == NULL)
+	{
+		return;
+	}
+
+	ThreadCache *cache = GetCache();
+	elementType *element = static_cast<elementType *>(object);
+	element->m_next = cache->m_localFree;
+	cache->m_localFree = element;
+	cache->m_localCount++;
+	Add(cache->m_frees, 1);
+
+	if(cache->m_localCount >= LOCAL_LIMIT)
+	{
+		Lock lock(&m_depotLock);
+		m_depot.push_back(std::make_pair(cache->m_localFree, cache->m_localCount));
+		cache->m_localFree = NULL;
+		cache->m_localCount = 0;
+	}
+}
+
+template <class elementType>
+void SlabAllocator<elementType>::FreeChain(elementType *first)
+{
+	if(first == NULL)
+	{
+		return;
+	}
+
+	elementType *last = first;
+	uint count = 1;
+	while(last->m_next != NULL)
+	{
+		last = last->m_next;
+		count++;
+	}
+
+	FreeChain(first, last, count);
+}
+
+template <class elementType>
+void SlabAllocator<elementType>::FreeChain(elementType *first, elementType *last, uint count)
+{
+	if(first == NULL)
+	{
+		return;
+	}
+
+	// The chain stays linked through m_next, so destroying the objects must not touch it
+	for(elementType *element = first; element != last; element = element->m_next)
+	{
+		element->~elementType();
+	}
+	last->~elementType();
+	last->m_next = NULL;
+
+	Add(GetCache()->m_frees, count);
+
+	Lock lock(&m_depotLock);
+	m_depot.push_back(std::make_pair(first, count));
+}
+
+template <class elementType>
+SlabStatistics SlabAllocator<elementType>::GetStatistics()
+{
+	SlabStatistics stats;
+	stats.m_slabs = m_slabs.load(std::memory_order_relaxed);
+	stats.m_capacity = stats.m_slabs * SLAB_OBJECTS;
+
+	uint64_t frees;
+	{
+		Lock lock(&m_depotLock);
+		stats.m_allocations = m_allocations;
+		stats.m_recycled = m_recycled;
+		frees = m_frees;
+		for(uint i = 0; i < m_threads.size(); i++)
+		{
+			stats.m_allocations += m_threads[i]->m_allocations.load(std::memory_order_relaxed);
+			stats.m_recycled += m_threads[i]->m_recycled.load(std::memory_order_relaxed);
+			frees += m_threads[i]->m_frees.load(std::memory_order_relaxed);
+		}
+	}
+
+	stats.m_inUse = stats.m_allocations > frees ? stats.m_allocations - frees : 0;
+	return stats;
+}
+
+template <class elementType>
+void SlabAllocator<elementType>::CreateKey()
+{
+	pthread_key_create(&m_cacheKey, &SlabAllocator<elementType>::ReleaseCache);
+}
+
+template <class elementType>
+typename SlabAllocator<elementType>::ThreadCache *SlabAllocator<elementType>::CreateCache()
+{
+	pthread_once(&m_keyOnce, &SlabAllocator<elementType>::CreateKey);
+
+	ThreadCache *cache = new ThreadCache();
+	cache->m_localFree = NULL;
+	cache->m_localCount = 0;
+	cache->m_slabNext = NULL;
+	cache->m_slabEnd = NULL;
+	cache->m_allocations.store(0, std::memory_order_relaxed);
+	cache->m_recycled.store(0, std::memory_order_relaxed);
+	cache->m_frees.store(0, std::memory_order_relaxed);
+
+	{
+		Lock lock(&m_depotLock);
+		m_threads.push_back(cache);
+	}
+
+	// The key only exists so the cache is handed back when the thread exits
+	pthread_setspecific(m_cacheKey, cache);
+	m_cache = cache;
+	return cache;
+}
+
+template <class elementType>
+void SlabAllocator<elementType>::ReleaseCache(void *object)
+{
+	ThreadCache *cache = static_cast<ThreadCache *>(object);
+
+	// Link up whatever is left of the slab so it can go to the depot with the free list
+	uint leftover = cache->m_slabEnd - cache->m_slabNext;
+	if(leftover != 0)
+	{
+		for(elementType *element = cache->m_slabNext; element + 1 != cache->m_slabEnd; element++)
+		{
+			element->m_next = element + 1;
+		}
+		(cache->m_slabEnd - 1)->m_next = NULL;
+	}
+
+	{
+		Lock lock(&m_depotLock);
+		if(cache->m_localFree != NULL)
+		{
+			m_depot.push_back(std::make_pair(cache->m_localFree, cache->m_localCount));
+		}
+		if(leftover != 0)
+		{
+			m_depot.push_back(std::make_pair(cache->m_slabNext, leftover));
+		}
+
+		m_allocations += cache->m_allocations.load(std::memory_order_relaxed);
+		m_recycled += cache->m_recycled.load(std::memory_order_relaxed);
+		m_frees += cache->m_frees.load(std::memory_order_relaxed);
+
+		for(uint i = 0; i < m_threads.size(); i++)
+		{
+			if(m_threads[i] == cache)
+			{
+				m_threads[i] = m_threads.back();
+				m_threads.pop_back();
+				break;
+			}
+		}
+	}
+
+	m_cache = NULL;
+	delete cache;
+}
+
+template <class elementType>
+void SlabAllocator<elementType>::Refill(ThreadCache *cache)
+{
+	{
+		Lock lock(&m_depotLock);
+		if(!m_depot.empty())
+		{
+			cache->m_localFree = m_depot.back().first;
+			cache->m_localCount = m_depot.back().second;
+			m_depot.pop_back();
+			return;
+		}
+	}
+
+	// Nothing to recycle, carve a new slab
+	cache->m_slabNext = static_cast<elementType *>(::operator new(sizeof(elementType) * SLAB_OBJECTS));
+	cache->m_slabEnd = cache->m_slabNext + SLAB_OBJECTS;
+	m_slabs.fetch_add(1, std::memory_order_relaxed);
+}
+
+}
+
+#endif /* SLABALLOCATOR_H_ */
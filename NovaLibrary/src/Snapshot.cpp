@@ -0,0 +1,258 @@
+//============================================================================
+// Name        : Snapshot.cpp
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Binary snapshot files, written out whole and read back with mmap so the
+//               data in them can be used where it lies instead of being parsed
+//============================================================================
+
+#include "Snapshot.h"
+#include "Logger.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace Nova
+{
+
+SnapshotWriter::SnapshotWriter(const string &path, SnapshotType type)
+{
+	m_path = path;
+	m_temporaryPath = path + ".tmp";
+	m_failed = false;
+	m_synced = false;
+	m_committed = false;
+
+	m_header.m_magic = SNAPSHOT_MAGIC;
+	m_header.m_version = SNAPSHOT_FORMAT_VERSION;
+	m_header.m_type = type;
+	m_header.m_length = 0;
+
+	m_file = fopen(m_temporaryPath.c_str(), "wb");
+	if(m_file == NULL)
+	{
+		LOG(WARNING, "Unable to create snapshot " + m_temporaryPath + ": " + string(strerror(errno)), "");
+		return;
+	}
+
+	// The real length goes in once it's known
+	if(fwrite(&m_header, sizeof(m_header), 1, m_file) != 1)
+	{
+		m_failed = true;
+	}
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+	if(m_file != NULL)
+	{
+		fclose(m_file);
+	}
+	if(!m_committed)
+	{
+		unlink(m_temporaryPath.c_str());
+	}
+}
+
+void SnapshotWriter::WriteBytes(const void *data, size_t size)
+{
+	if(!IsGood() || size == 0)
+	{
+		return;
+	}
+
+	if(fwrite(data, size, 1, m_file) != 1)
+	{
+		m_failed = true;
+		return;
+	}
+	m_header.m_length += size;
+}
+
+void SnapshotWriter::Align()
+{
+	static const uint8_t padding[8] = {0};
+
+	// The header is a multiple of 8 bytes itself, so the payload offset is all that matters
+	if(m_header.m_length % 8 != 0)
+	{
+		WriteBytes(padding, 8 - m_header.m_length % 8);
+	}
+}
+
+bool SnapshotWriter::Sync()
+{
+	if(m_synced)
+	{
+		return !m_failed;
+	}
+	if(m_file == NULL)
+	{
+		return false;
+	}
+
+	if(!m_failed)
+	{
+		if(fseek(m_file, 0, SEEK_SET) != 0
+				|| fwrite(&m_header, sizeof(m_header), 1, m_file) != 1
+				|| fflush(m_file) != 0
+				|| fsync(fileno(m_file)) != 0)
+		{
+			m_failed = true;
+		}
+	}
+
+	if(fclose(m_file) != 0)
+	{
+		m_failed = true;
+	}
+	m_file = NULL;
+	m_synced = true;
+
+	if(m_failed)
+	{
+		LOG(WARNING, "Unable to write snapshot " + m_temporaryPath + ": " + string(strerror(errno)), "");
+	}
+	return !m_failed;
+}
+
+bool SnapshotWriter::Commit()
+{
+	if(!Sync())
+	{
+		return false;
+	}
+
+	if(rename(m_temporaryPath.c_str(), m_path.c_str()) != 0)
+	{
+		LOG(WARNING, "Unable to move snapshot into place at " + m_path + ": " + string(strerror(errno)), "");
+		return false;
+	}
+
+	m_committed = true;
+	return true;
+}
+
+MappedSnapshot::MappedSnapshot()
+{
+	m_map = NULL;
+	m_mapLength = 0;
+	m_data = NULL;
+	m_length = 0;
+	m_offset = 0;
+}
+
+MappedSnapshot::~MappedSnapshot()
+{
+	Close();
+}
+
+bool MappedSnapshot::Open(const string &path, SnapshotType type)
+{
+	Close();
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd == -1)
+	{
+		return false;
+	}
+
+	struct stat info;
+	if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SnapshotHeader))
+	{
+		close(fd);
+		return false;
+	}
+
+	// Private and read only: pages come straight out of the page cache and are never copied
+	void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		LOG(WARNING, "Unable to map snapshot " + path + ": " + string(strerror(errno)), "");
+		return false;
+	}
+
+	const SnapshotHeader *header = (const SnapshotHeader *)map;
+	if(header->m_magic != SNAPSHOT_MAGIC
+			|| header->m_version != SNAPSHOT_FORMAT_VERSION
+			|| header->m_type != type
+			|| header->m_length != info.st_size - sizeof(SnapshotHeader))
+	{
+		LOG(DEBUG, "Ignoring snapshot " + path + ", which is from another version or incomplete", "");
+		munmap(map, info.st_size);
+		return false;
+	}
+
+	m_map = map;
+	m_mapLength = info.st_size;
+	m_data = (const uint8_t *)map + sizeof(SnapshotHeader);
+	m_length = header->m_length;
+	m_offset = 0;
+
+	return true;
+}
+
+void MappedSnapshot::Close()
+{
+	if(m_map != NULL)
+	{
+		munmap(m_map, m_mapLength);
+	}
+
+	m_map = NULL;
+	m_mapLength = 0;
+	m_data = NULL;
+	m_length = 0;
+	m_offset = 0;
+}
+
+void MappedSnapshot::Take(MappedSnapshot &other)
+{
+	Close();
+
+	m_map = other.m_map;
+	m_mapLength = other.m_mapLength;
+	m_data = other.m_data;
+	m_length = other.m_length;
+	m_offset = other.m_offset;
+
+	other.m_map = NULL;
+	other.Close();
+}
+
+const void *MappedSnapshot::ReadBytes(size_t size)
+{
+	if(m_data == NULL || size > m_length - m_offset)
+	{
+		return NULL;
+	}
+
+	const void *data = m_data + m_offset;
+	m_offset += size;
+	return data;
+}
+
+void MappedSnapshot::Align()
+{
+	m_offset = min(m_length, (m_offset + 7) & ~(size_t)7);
+}
+
+}
@@ -0,0 +1,138 @@
+//============================================================================
+// Name        : Snapshot.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Binary snapshot files, written out whole and read back with mmap so the
+//               data in them can be used where it lies instead of being parsed
+//============================================================================
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+// "NOVASNAP"
+#define SNAPSHOT_MAGIC 0x50414e5341564f4eULL
+// Bumped whenever the header or any snapshot's layout changes. Snapshots are only ever read
+// by the build that wrote them, so an old one is just thrown away.
+#define SNAPSHOT_FORMAT_VERSION 2
+
+namespace Nova
+{
+
+enum SnapshotType : uint32_t
+{
+	SNAPSHOT_SUSPECTS = 1,
+	SNAPSHOT_KNN = 2
+};
+
+struct SnapshotHeader
+{
+	uint64_t m_magic;
+	uint32_t m_version;
+	uint32_t m_type;
+	// Bytes after the header
+	uint64_t m_length;
+};
+
+// Writes a snapshot to path.tmp and renames it over path on Commit, so whatever is at path is
+// always a whole snapshot. Everything is in host byte order.
+class SnapshotWriter
+{
+public:
+	SnapshotWriter(const std::string &path, SnapshotType type);
+	// Throws the temporary file away if it wasn't committed
+	~SnapshotWriter();
+
+	// False if the file couldn't be created or a write failed
+	bool IsGood() const {return m_file != NULL && !m_failed;}
+
+	void WriteBytes(const void *data, size_t size);
+
+	template <typename T>
+	void Write(const T &value)
+	{
+		WriteBytes(&value, sizeof(T));
+	}
+
+	// Pads to an 8 byte boundary, so an array written next can be used straight out of the mapping
+	void Align();
+
+	// Finishes the temporary file and syncs it to disk, which is the slow part of committing.
+	// Commit does this itself if it hasn't been done yet.
+	bool Sync();
+
+	// Moves the snapshot into place. False (and logs why) if anything failed.
+	bool Commit();
+
+private:
+	std::string m_path;
+	std::string m_temporaryPath;
+	FILE *m_file;
+	SnapshotHeader m_header;
+	bool m_failed;
+	bool m_synced;
+	bool m_committed;
+};
+
+// A snapshot mapped read only. What Read hands out points into the mapping and stays valid until
+// the snapshot is closed.
+class MappedSnapshot
+{
+public:
+	MappedSnapshot();
+	~MappedSnapshot();
+
+	// Maps the file and checks its header. False if it's missing, truncated, or of another type or format version.
+	bool Open(const std::string &path, SnapshotType type);
+	void Close();
+
+	// Takes over the mapping of another snapshot (and where it was reading), leaving that one closed
+	void Take(MappedSnapshot &other);
+
+	// The next size bytes, NULL if the snapshot doesn't have that many left
+	const void *ReadBytes(size_t size);
+
+	template <typename T>
+	bool Read(T &value)
+	{
+		const void *data = ReadBytes(sizeof(T));
+		if(data == NULL)
+		{
+			return false;
+		}
+		memcpy(&value, data, sizeof(T));
+		return true;
+	}
+
+	void Align();
+
+	// Bytes of the snapshot not read yet
+	size_t GetRemaining() const {return m_length - m_offset;}
+
+private:
+	void *m_map;
+	size_t m_mapLength;
+
+	const uint8_t *m_data;
+	size_t m_length;
+	size_t m_offset;
+};
+
+}
+
+#endif /* SNAPSHOT_H_ */
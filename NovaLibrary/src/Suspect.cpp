@@ -19,6 +19,7 @@
 //============================================================================
 
 #include "SerializationHelper.h"
+#include "InterfaceTable.h"
 #include "Suspect.h"
 #include "Logger.h"
 #include "Config.h"
@@ -42,6 +43,7 @@ Suspect::Suspect()
 	m_needsClassificationUpdate = false;
 	m_isHostile = false;
 	m_classificationNotes = "";
+	m_explainClassification = false;
 
 	for(int i = 0; i < DIM; i++)
 	{
@@ -121,30 +123,39 @@ string Suspect::ToString()
 //Just like Consume but doesn't deallocate
 void Suspect::ReadEvidence(Evidence *evidence, bool deleteEvidence)
 {
-
 	if(m_id.m_ip() == 0)
 	{
 		m_id.set_m_ip(evidence->m_evidencePacket.ip_src);
-		m_id.set_m_ifname(evidence->m_evidencePacket.interface);
+		m_id.set_m_ifname(InterfaceTable::Inst()->GetName(evidence->m_evidencePacket.interface));
 	}
 
-	Evidence *curEvidence = evidence, *tempEv = NULL;
+	Evidence *curEvidence = evidence, *lastEv = NULL;
+	uint count = 0;
 	while(curEvidence != NULL)
 	{
-		m_features.Add(*curEvidence);
-
-		m_id.set_m_ifname(curEvidence->m_evidencePacket.interface);
+		m_features.Add(curEvidence->m_evidencePacket);
 
+		lastEv = curEvidence;
+		curEvidence = curEvidence->m_next;
+		count++;
+	}
 
-		tempEv = curEvidence;
-		curEvidence = tempEv->m_next;
+	// Hand the whole chain back to the slab at once instead of deleting it piece by piece
+	if (deleteEvidence)
+	{
+		SlabAllocator<Evidence>::FreeChain(evidence, lastEv, count);
+	}
+}
 
-		if (deleteEvidence)
-		{
-			delete tempEv;
-		}
+void Suspect::ReadEvidence(const _evidencePacket &packet)
+{
+	if(m_id.m_ip() == 0)
+	{
+		m_id.set_m_ip(packet.ip_src);
+		m_id.set_m_ifname(InterfaceTable::Inst()->GetName(packet.interface));
 	}
 
+	m_features.Add(packet);
 }
 
 //Returns a copy of the suspects in_addr.s_addr
@@ -231,4 +242,9 @@ void Suspect::SetFeatureAccuracy(FeatureIndex fi, double d)
 	m_featureAccuracy[fi] = d;
 }
 
+size_t Suspect::GetMemoryUsage() const
+{
+	return sizeof(Suspect) + m_features.GetMemoryUsage();
+}
+
 }
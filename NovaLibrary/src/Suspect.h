@@ -75,6 +75,9 @@ public:
 	// Proccesses a packet in m_evidence and puts them into the suspects unsent FeatureSet data
 	void ReadEvidence(Evidence *evidence, bool deleteEvidence);
 
+	// Same as above, for a single evidence record
+	void ReadEvidence(const _evidencePacket &packet);
+
 
 	//Returns a copy of the suspects in_addr
 	//Returns: Suspect's in_addr_t or NULL on failure
@@ -110,6 +113,10 @@ public:
 	// Get the last time we saw this suspect
 	long int GetLastPacketTime();
 
+	// Approximate bytes held by the suspect, including its evidence tables. Doesn't change
+	// except when evidence is added.
+	size_t GetMemoryUsage() const;
+
 
 	bool m_needsClassificationUpdate;
 
@@ -117,6 +124,10 @@ public:
 
 	std::string m_classificationNotes;
 
+	// Set on a suspect being classified again just so the UI can see why, which gets the full
+	// classification notes whatever CLASSIFICATION_NOTES says
+	bool m_explainClassification;
+
 private:
 	SuspectID_pb m_id;
 
@@ -5,10 +5,13 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 CPP_SRCS += \
 ../NovadSource/ClassificationAggregator.cpp \
+../NovadSource/ClassificationCache.cpp \
 ../NovadSource/ClassificationEngine.cpp \
 ../NovadSource/ClassificationEngineFactory.cpp \
 ../NovadSource/Control.cpp \
+../NovadSource/HnswIndex.cpp \
 ../NovadSource/KnnClassification.cpp \
+../NovadSource/NearestNeighborIndex.cpp \
 ../NovadSource/Novad.cpp \
 ../NovadSource/ProtocolHandler.cpp \
 ../NovadSource/ScriptAlertClassification.cpp \
@@ -17,10 +20,13 @@ CPP_SRCS += \
 
 OBJS += \
 ./NovadSource/ClassificationAggregator.o \
+./NovadSource/ClassificationCache.o \
 ./NovadSource/ClassificationEngine.o \
 ./NovadSource/ClassificationEngineFactory.o \
 ./NovadSource/Control.o \
+./NovadSource/HnswIndex.o \
 ./NovadSource/KnnClassification.o \
+./NovadSource/NearestNeighborIndex.o \
 ./NovadSource/Novad.o \
 ./NovadSource/ProtocolHandler.o \
 ./NovadSource/ScriptAlertClassification.o \
@@ -29,10 +35,13 @@ OBJS += \
 
 CPP_DEPS += \
 ./NovadSource/ClassificationAggregator.d \
+./NovadSource/ClassificationCache.d \
 ./NovadSource/ClassificationEngine.d \
 ./NovadSource/ClassificationEngineFactory.d \
 ./NovadSource/Control.d \
+./NovadSource/HnswIndex.d \
 ./NovadSource/KnnClassification.d \
+./NovadSource/NearestNeighborIndex.d \
 ./NovadSource/Novad.d \
 ./NovadSource/ProtocolHandler.d \
 ./NovadSource/ScriptAlertClassification.d \
@@ -3,8 +3,16 @@
 
 #include "tester_Config.h"
 #include "tester_EvidenceTable.h"
+#include "tester_SlabAllocator.h"
+#include "tester_RcuPointer.h"
+#include "tester_FlatHashMap.h"
+#include "tester_PacketSizeHistogram.h"
+#include "tester_DistinctCounter.h"
+#include "tester_FeatureAggregate.h"
 #include "tester_Suspect.h"
 #include "tester_ClassificationEngine.h"
+#include "tester_NearestNeighborIndex.h"
+#include "tester_ClassificationCache.h"
 #include "tester_RequestMessage.h"
 #include "tester_VendorMacDb.h"
 #include "tester_HoneydConfiguration.h"
@@ -0,0 +1,219 @@
+//============================================================================
+// Name        : tester_ClassificationCache.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : This file contains unit tests for the class ClassificationCache
+//============================================================================/*
+
+#include "gtest/gtest.h"
+
+#include "ClassificationAggregator.h"
+#include "ClassificationCache.h"
+#include "ClassificationEngine.h"
+
+#include <math.h>
+#include <string.h>
+
+using namespace Nova;
+using namespace std;
+
+class ClassificationCacheTest : public ::testing::Test
+{
+protected:
+	static const uint m_resolution = 100;
+	static const uint m_engines = 2;
+
+	ClassificationCache m_cache;
+	Suspect m_suspect;
+	double m_features[DIM];
+
+	ClassificationCacheTest()
+	{
+		SuspectID_pb id;
+		id.set_m_ip(0x0a000001);
+		id.set_m_ifname("eth0");
+		m_suspect.SetIdentifier(id);
+		for(int i = 0; i < DIM; i++)
+		{
+			m_features[i] = 0.5;
+		}
+		m_cache.Trim(100);
+	}
+
+	ClassificationCacheEntry *Lookup(uint64_t epoch = 1, uint notesLevel = NOTES_ON_DEMAND)
+	{
+		return m_cache.Lookup(&m_suspect, m_engines, epoch, notesLevel, m_resolution);
+	}
+
+	void Fill(ClassificationCacheEntry *entry)
+	{
+		entry->m_hasVote[0] = true;
+		entry->m_votes[0] = 0.75;
+		entry->m_notes[0] = "KNN: 0.75\n";
+	}
+};
+
+const uint ClassificationCacheTest::m_resolution;
+const uint ClassificationCacheTest::m_engines;
+
+TEST_F(ClassificationCacheTest, quantizeBoundaries)
+{
+	EXPECT_EQ(0, ClassificationCache::Quantize(0, m_resolution));
+	EXPECT_EQ(-1, ClassificationCache::Quantize(-0.001, m_resolution));
+
+	// A bucket for every hundredth of a normalized unit
+	EXPECT_EQ(19, ClassificationCache::Quantize(0.1999, m_resolution));
+	EXPECT_EQ(20, ClassificationCache::Quantize(0.2001, m_resolution));
+	EXPECT_EQ(100, ClassificationCache::Quantize(1, m_resolution));
+
+	// Nothing overflows, and NaN matches no real value
+	EXPECT_GT(ClassificationCache::Quantize(INFINITY, m_resolution), 0);
+	EXPECT_LT(ClassificationCache::Quantize(-INFINITY, m_resolution), 0);
+	EXPECT_NE(ClassificationCache::Quantize(NAN, m_resolution), ClassificationCache::Quantize(-INFINITY, m_resolution));
+}
+
+TEST_F(ClassificationCacheTest, hitWithinBucket)
+{
+	ClassificationCacheEntry *entry = Lookup();
+	ASSERT_TRUE(entry != NULL);
+	EXPECT_FALSE(m_cache.Match(entry, 0, m_features));
+	EXPECT_FALSE(entry->m_hasVote[0]);
+	Fill(entry);
+
+	// 0.5 and 0.505 share a bucket
+	m_features[0] = 0.505;
+	entry = Lookup();
+	EXPECT_TRUE(m_cache.Match(entry, 0, m_features));
+	EXPECT_EQ(0.75, entry->m_votes[0]);
+	EXPECT_EQ("KNN: 0.75\n", entry->m_notes[0]);
+	// The other engine never voted
+	EXPECT_FALSE(m_cache.Match(entry, 1, m_features));
+
+	// 0.6 doesn't, and the old vote is gone
+	m_features[0] = 0.6;
+	entry = Lookup();
+	EXPECT_FALSE(m_cache.Match(entry, 0, m_features));
+	EXPECT_FALSE(entry->m_hasVote[0]);
+	EXPECT_EQ("", entry->m_notes[0]);
+
+	ClassificationCacheStatistics stats = m_cache.GetStatistics();
+	EXPECT_EQ(4u, stats.m_lookups);
+	EXPECT_EQ(1u, stats.m_hits);
+	EXPECT_EQ(1u, stats.m_entries);
+}
+
+TEST_F(ClassificationCacheTest, missJustOverOneBucketApart)
+{
+	// Even on a feature that's barely used, a little over 1% of the range is too far
+	for(int i = 0; i < DIM; i++)
+	{
+		for(int j = 0; j < DIM; j++)
+		{
+			m_features[j] = 0.5;
+		}
+
+		ClassificationCacheEntry *entry = Lookup();
+		m_cache.Match(entry, 0, m_features);
+		Fill(entry);
+
+		m_features[i] = 0.5 + 1.01 / m_resolution;
+		EXPECT_FALSE(m_cache.Match(Lookup(), 0, m_features));
+	}
+}
+
+TEST_F(ClassificationCacheTest, missOnEpochOrNotesLevel)
+{
+	ClassificationCacheEntry *entry = Lookup(1);
+	m_cache.Match(entry, 0, m_features);
+	Fill(entry);
+	EXPECT_FALSE(m_cache.Match(Lookup(2), 0, m_features));
+
+	Fill(Lookup(2));
+	EXPECT_FALSE(m_cache.Match(Lookup(2, NOTES_FULL), 0, m_features));
+}
+
+TEST_F(ClassificationCacheTest, trimDropsUnusedSuspects)
+{
+	Suspect suspects[4];
+	for(uint i = 0; i < 4; i++)
+	{
+		SuspectID_pb id;
+		id.set_m_ip(0x0a000010 + i);
+		id.set_m_ifname("eth0");
+		suspects[i].SetIdentifier(id);
+	}
+
+	m_cache.Trim(3);
+	for(uint i = 0; i < 3; i++)
+	{
+		EXPECT_TRUE(m_cache.Lookup(&suspects[i], m_engines, 1, NOTES_ON_DEMAND, m_resolution) != NULL);
+	}
+	// Full, so a new suspect isn't cached until the next trim
+	EXPECT_TRUE(m_cache.Lookup(&suspects[3], m_engines, 1, NOTES_ON_DEMAND, m_resolution) == NULL);
+
+	// All in use, so they stay but have to be looked up again to survive the next trim
+	m_cache.Trim(3);
+	EXPECT_EQ(3u, m_cache.GetStatistics().m_entries);
+
+	ClassificationCacheEntry *entry = m_cache.Lookup(&suspects[0], m_engines, 1, NOTES_ON_DEMAND, m_resolution);
+	m_cache.Match(entry, 0, m_features);
+	Fill(entry);
+	m_cache.Trim(3);
+	EXPECT_EQ(1u, m_cache.GetStatistics().m_entries);
+	entry = m_cache.Lookup(&suspects[0], m_engines, 1, NOTES_ON_DEMAND, m_resolution);
+	EXPECT_TRUE(m_cache.Match(entry, 0, m_features));
+}
+
+// Classifies a suspect with features outside the training ranges once with nothing cached and once
+// out of the cache, with the configured engines. Both have to leave it with the same features (the
+// KNN engine clamps them) and the same verdict, or the engines after KNN would see different values.
+TEST(ClassificationCacheAggregatorTest, hitMatchesMiss)
+{
+	uint resolution = Config::Inst()->GetClassificationCacheResolution();
+	Config::Inst()->SetClassificationCacheResolution(100);
+
+	ClassificationAggregator aggregator;
+	Suspect suspect;
+	SuspectID_pb id;
+	id.set_m_ip(0x0a000020);
+	id.set_m_ifname("eth0");
+	suspect.SetIdentifier(id);
+
+	double raw[DIM];
+	for(int i = 0; i < DIM; i++)
+	{
+		raw[i] = 1e12;
+	}
+
+	memcpy(suspect.m_features.m_features, raw, sizeof(raw));
+	uint64_t hits = aggregator.GetCacheStatistics().m_hits;
+	double missVerdict = aggregator.Classify(&suspect);
+	bool missHostile = suspect.GetIsHostile();
+	double missFeatures[DIM];
+	memcpy(missFeatures, suspect.m_features.m_features, sizeof(missFeatures));
+	EXPECT_EQ(hits, aggregator.GetCacheStatistics().m_hits);
+
+	memcpy(suspect.m_features.m_features, raw, sizeof(raw));
+	double hitVerdict = aggregator.Classify(&suspect);
+	EXPECT_LT(hits, aggregator.GetCacheStatistics().m_hits);
+
+	EXPECT_EQ(missVerdict, hitVerdict);
+	EXPECT_EQ(missHostile, suspect.GetIsHostile());
+	for(int i = 0; i < DIM; i++)
+	{
+		EXPECT_EQ(missFeatures[i], suspect.m_features.m_features[i]);
+	}
+
+	Config::Inst()->SetClassificationCacheResolution(resolution);
+}
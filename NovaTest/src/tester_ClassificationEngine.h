@@ -19,8 +19,10 @@
 #include "gtest/gtest.h"
 #include <iostream>
 #include <fstream>
+#include <string.h>
 
 #include "KnnClassification.h"
+#include "ThresholdTriggerClassification.h"
 
 using namespace Nova;
 using namespace std;
@@ -49,6 +51,103 @@ TEST_F(KnnClassificationTest, test_someMethod)
 	Config::Inst()->SetIsDmEnabled(isDmEn);
 }
 
+// Engine that only implements Classify, so batches go through the default ClassifyBatch
+class CountingEngine : public ClassificationEngine
+{
+public:
+	uint m_calls;
+
+	CountingEngine()
+	{
+		m_calls = 0;
+	}
+
+	double Classify(Suspect *suspect)
+	{
+		m_calls++;
+		suspect->SetClassification(m_calls / 10.0);
+		return m_calls / 10.0;
+	}
+};
+
+TEST(ClassificationEngineTest, test_defaultClassifyBatch)
+{
+	CountingEngine engine;
+	Suspect suspects[3];
+	Suspect *batch[3] = {&suspects[0], &suspects[1], &suspects[2]};
+	double classifications[3];
+
+	engine.ClassifyBatch(batch, 3, classifications);
+	EXPECT_EQ(3, engine.m_calls);
+	for(uint i = 0; i < 3; i++)
+	{
+		EXPECT_EQ((i + 1) / 10.0, classifications[i]);
+		EXPECT_EQ(classifications[i], suspects[i].GetClassification());
+	}
+
+	engine.ClassifyBatch(batch, 0, classifications);
+	EXPECT_EQ(3, engine.m_calls);
+}
+
+TEST(ClassificationEngineTest, test_notesOnDemand)
+{
+	uint notesLevel = Config::Inst()->GetClassificationNotes();
+
+	ThresholdTriggerClassification engine;
+	HostileThreshold threshold = {100, 0, false, true};
+	engine.m_hostileThresholds.assign(DIM, threshold);
+
+	Suspect suspect;
+	suspect.m_features.m_features[DISTINCT_TCP_PORTS] = 200;
+
+	// Only formatted for a suspect being explained
+	Config::Inst()->SetClassificationNotes(NOTES_ON_DEMAND);
+	EXPECT_EQ(1, engine.Classify(&suspect));
+	EXPECT_EQ("", suspect.m_classificationNotes);
+
+	suspect.m_explainClassification = true;
+	EXPECT_EQ(1, engine.Classify(&suspect));
+	EXPECT_NE(string::npos, suspect.m_classificationNotes.find("has surpassed threshold"));
+
+	// Or for everyone
+	suspect.m_classificationNotes = "";
+	suspect.m_explainClassification = false;
+	Config::Inst()->SetClassificationNotes(NOTES_FULL);
+	engine.Classify(&suspect);
+	EXPECT_NE("", suspect.m_classificationNotes);
+
+	Config::Inst()->SetClassificationNotes(notesLevel);
+}
+
+TEST(KnnNormalizationTest, test_normalizeColumn)
+{
+	// Every other value is a different feature and has to be left alone
+	double values[6] = {42, -1, 7, -1, 0, -1};
+	NormalizationType types[4] = {LINEAR, LINEAR_SHIFT, NONORM, LOGARITHMIC};
+
+	for(uint t = 0; t < 4; t++)
+	{
+		double column[6];
+		memcpy(column, values, sizeof(values));
+		KnnClassification::NormalizeColumn(types[t], column, 3, 2, 0, 100, 0.5);
+
+		for(uint i = 0; i < 6; i += 2)
+		{
+			EXPECT_DOUBLE_EQ(KnnClassification::Normalize(types[t], values[i], 0, 100, 0.5), column[i]);
+			EXPECT_EQ(-1, column[i + 1]);
+		}
+	}
+}
+
+TEST(KnnSnapshotTest, test_snapshotPerConfiguration)
+{
+	std::string first = KnnClassification::GetSnapshotPath("/usr/share/nova/config/CE_knn.config");
+	EXPECT_EQ(first, KnnClassification::GetSnapshotPath("/usr/share/nova/config/CE_knn.config"));
+	EXPECT_NE(first, KnnClassification::GetSnapshotPath("/usr/share/nova/config/CE_knn2.config"));
+	// Same file name somewhere else is a different engine too
+	EXPECT_NE(first, KnnClassification::GetSnapshotPath("/home/nova/CE_knn.config"));
+}
+
 /*
 TEST_F(KnnClassificationTest, DISABLED_test_kFoldCrossValidation)
 {
@@ -21,6 +21,14 @@
 #include "ClassificationAggregator.h"
 #include "Database.h"
 #include "DatabaseQueue.h"
+#include "DatabaseWriter.h"
+#include "InterfaceTable.h"
+#include "PacketSizeHistogram.h"
+#include "Snapshot.h"
+
+#include <unistd.h>
+#include <sys/time.h>
+#include <sstream>
 
 using namespace Nova;
 
@@ -57,7 +65,7 @@ TEST_F(DatabaseTest_DISABLED, testDatabase)
 	Evidence f;
 
 	f.m_evidencePacket.ip_p = 17;
-	f.m_evidencePacket.interface = "eth0";
+	f.m_evidencePacket.interface = InterfaceTable::Inst()->GetIndex("eth0");
 	f.m_evidencePacket.ip_dst = 42;
 
 	for (int i = 0; i < 250000; i++) {
@@ -82,3 +90,823 @@ TEST_F(DatabaseTest_DISABLED, testDatabase)
 }
 
 */
+
+TEST(DatabaseQueueTest, testShards)
+{
+	DatabaseQueue q;
+	EXPECT_EQ(1, q.GetShardCount());
+
+	q.SetShardCount(4);
+	EXPECT_EQ(4, q.GetShardCount());
+	EXPECT_TRUE(q.empty());
+
+	// A source IP always maps to the same shard, and the IPs are spread over all of them
+	bool used[4] = {false, false, false, false};
+	for(uint32_t ip = 0x0a000000; ip < 0x0a000100; ip++)
+	{
+		uint shard = q.GetShardIndex(ip);
+		ASSERT_LT(shard, 4);
+		EXPECT_EQ(shard, q.GetShardIndex(ip));
+		used[shard] = true;
+	}
+	EXPECT_TRUE(used[0] && used[1] && used[2] && used[3]);
+
+	Evidence f;
+	f.m_evidencePacket.ip_p = 17;
+	f.m_evidencePacket.interface = InterfaceTable::Inst()->GetIndex("eth0");
+	f.m_evidencePacket.ip_src = 0x0a000001;
+	q.ProcessEvidence(&f, true);
+	EXPECT_FALSE(q.empty());
+}
+
+TEST(DatabaseQueueTest, testMemoryAccounting)
+{
+	DatabaseQueue q;
+	q.SetShardCount(2);
+
+	SuspectMemoryStatistics stats = q.GetMemoryStatistics();
+	EXPECT_EQ(0, stats.m_bytesInUse);
+	EXPECT_EQ(0, stats.m_suspectCount);
+
+	// One suspect hitting a single port, another sweeping a few hundred
+	Evidence f;
+	f.m_evidencePacket.ip_p = 17;
+	f.m_evidencePacket.interface = InterfaceTable::Inst()->GetIndex("eth0");
+	f.m_evidencePacket.ip_src = 0x0a000001;
+	f.m_evidencePacket.ip_dst = 0x0a000100;
+	f.m_evidencePacket.dst_port = 53;
+	q.ProcessEvidence(&f, true);
+
+	f.m_evidencePacket.ip_src = 0x0a000002;
+	for(uint16_t port = 0; port < 500; port++)
+	{
+		f.m_evidencePacket.dst_port = port;
+		q.ProcessEvidence(&f, true);
+	}
+
+	stats = q.GetMemoryStatistics();
+	EXPECT_EQ(2, stats.m_suspectCount);
+	EXPECT_EQ(0, stats.m_evictions);
+
+	std::vector<std::pair<SuspectID_pb, size_t> > largest = q.GetLargestSuspects(5);
+	ASSERT_EQ(2, largest.size());
+	EXPECT_EQ(0x0a000002, largest[0].first.m_ip());
+	EXPECT_GT(largest[0].second, largest[1].second);
+	EXPECT_EQ(stats.m_bytesInUse, largest[0].second + largest[1].second);
+}
+
+TEST(DatabaseQueueTest, testSnapshot)
+{
+	std::string file = "/tmp/novaSuspectSnapshot";
+	unlink(file.c_str());
+
+	DatabaseQueue q;
+	q.SetShardCount(2);
+
+	Evidence f;
+	f.m_evidencePacket.ip_p = 17;
+	f.m_evidencePacket.interface = InterfaceTable::Inst()->GetIndex("eth0");
+	f.m_evidencePacket.ip_src = 0x0a000001;
+	f.m_evidencePacket.ip_dst = 0x0a000100;
+	f.m_evidencePacket.dst_port = 53;
+	q.ProcessEvidence(&f, true);
+
+	f.m_evidencePacket.ip_src = 0x0a000002;
+	for(uint16_t port = 0; port < 100; port++)
+	{
+		f.m_evidencePacket.dst_port = port;
+		q.ProcessEvidence(&f, true);
+	}
+	ASSERT_TRUE(q.SaveSnapshot(file));
+
+	// Shard counts don't have to match between runs
+	DatabaseQueue restored;
+	restored.SetShardCount(3);
+	ASSERT_TRUE(restored.LoadSnapshot(file));
+
+	EXPECT_EQ(2, restored.GetMemoryStatistics().m_suspectCount);
+	std::vector<std::pair<SuspectID_pb, size_t> > largest = restored.GetLargestSuspects(5);
+	ASSERT_EQ(2, largest.size());
+	EXPECT_EQ(0x0a000002, largest[0].first.m_ip());
+	EXPECT_EQ("eth0", largest[0].first.m_ifname());
+	EXPECT_EQ(0x0a000001, largest[1].first.m_ip());
+
+	// A snapshot cut short is refused outright
+	truncate(file.c_str(), 20);
+	DatabaseQueue damaged;
+	EXPECT_FALSE(damaged.LoadSnapshot(file));
+	EXPECT_TRUE(damaged.empty());
+
+	unlink(file.c_str());
+	EXPECT_FALSE(damaged.LoadSnapshot(file));
+}
+
+TEST(DatabaseQueueTest, testSnapshotWithDamagedSuspect)
+{
+	std::string file = "/tmp/novaSuspectSnapshot";
+
+	_evidencePacket packet;
+	memset(&packet, 0, sizeof(packet));
+	packet.ip_p = 17;
+	packet.ip_src = 0x0a000002;
+	packet.ip_dst = 0x0a000100;
+	packet.dst_port = 53;
+	packet.ts = 100;
+	Suspect good;
+	good.ReadEvidence(packet);
+	std::vector<u_char> evidence(good.m_features.GetSerializeLength());
+	uint32_t goodLength = good.m_features.Serialize(&evidence[0], evidence.size());
+
+	// The first suspect's record is intact as far as the snapshot goes, but its evidence is cut short
+	{
+		SnapshotWriter snapshot(file, SNAPSHOT_SUSPECTS);
+		std::string interface = "eth0";
+		uint32_t interfaceLength = interface.size();
+		uint32_t ips[2] = {0x0a000001, 0x0a000002};
+		uint32_t lengths[2] = {8, goodLength};
+		for(int i = 0; i < 2; i++)
+		{
+			snapshot.Write(ips[i]);
+			snapshot.Write(interfaceLength);
+			snapshot.WriteBytes(interface.data(), interfaceLength);
+			snapshot.Write(lengths[i]);
+			snapshot.WriteBytes(&evidence[0], lengths[i]);
+		}
+		ASSERT_TRUE(snapshot.Commit());
+	}
+
+	// The damaged suspect is skipped without throwing off the memory accounting
+	DatabaseQueue q;
+	q.SetShardCount(1);
+	ASSERT_TRUE(q.LoadSnapshot(file));
+
+	SuspectMemoryStatistics stats = q.GetMemoryStatistics();
+	EXPECT_EQ(1, stats.m_suspectCount);
+	std::vector<std::pair<SuspectID_pb, size_t> > largest = q.GetLargestSuspects(5);
+	ASSERT_EQ(1, largest.size());
+	EXPECT_EQ(0x0a000002, largest[0].first.m_ip());
+	EXPECT_EQ(stats.m_bytesInUse, largest[0].second);
+
+	unlink(file.c_str());
+}
+
+// The text keyed tables novad used before schema version 2
+static const char *VERSION_1_SCHEMA =
+	"CREATE TABLE suspects (ip TEXT, interface TEXT, startTime INTEGER, endTime INTEGER, lastTime INTEGER,"
+	" classification DOUBLE, hostileNeighbors INTEGER, isHostile INTEGER, classificationNotes TEXT,"
+	" ip_traffic_distribution DOUBLE, port_traffic_distribution DOUBLE, packet_size_mean DOUBLE, packet_size_deviation DOUBLE,"
+	" distinct_ips DOUBLE, distinct_tcp_ports DOUBLE, distinct_udp_ports DOUBLE, avg_tcp_ports_per_host DOUBLE,"
+	" avg_udp_ports_per_host DOUBLE, tcp_percent_syn DOUBLE, tcp_percent_fin DOUBLE, tcp_percent_rst DOUBLE,"
+	" tcp_percent_synack DOUBLE, haystack_percent_contacted DOUBLE, PRIMARY KEY(ip, interface));"
+	"CREATE TABLE packet_counts (ip TEXT, interface TEXT, count_tcp INTEGER, count_udp INTEGER, count_icmp INTEGER,"
+	" count_other INTEGER, count_total INTEGER, count_tcpRst INTEGER, count_tcpAck INTEGER, count_tcpSyn INTEGER,"
+	" count_tcpFin INTEGER, count_tcpSynAck INTEGER, count_bytes INTEGER, PRIMARY KEY(ip, interface));"
+	"CREATE TABLE packet_sizes (ip TEXT, interface, packetSize INTEGER, count INTEGER, PRIMARY KEY(ip, interface, packetSize));"
+	"CREATE TABLE ip_port_counts (ip TEXT, interface, type TEXT, dstip TEXT, port INTEGER, count INTEGER,"
+	" PRIMARY KEY(ip, interface, type, dstip, port));";
+
+static void RunSql(sqlite3 *db, const std::string &sql)
+{
+	char *err = NULL;
+	sqlite3_exec(db, sql.c_str(), NULL, NULL, &err);
+	ASSERT_TRUE(err == NULL) << err;
+}
+
+static std::string QueryText(sqlite3 *db, const std::string &sql)
+{
+	sqlite3_stmt *stmt;
+	std::string result;
+	sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
+	if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt, 0) != NULL)
+	{
+		result = (const char*)sqlite3_column_text(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+	return result;
+}
+
+TEST(DatabaseMigrationTest, testVersion1Migration)
+{
+	std::string file = "/tmp/novaMigrationTest.db";
+	unlink(file.c_str());
+
+	sqlite3 *db;
+	ASSERT_EQ(SQLITE_OK, sqlite3_open(file.c_str(), &db));
+	RunSql(db, VERSION_1_SCHEMA);
+	RunSql(db,
+		"INSERT INTO suspects (ip, interface, startTime, classification, isHostile, distinct_ips) VALUES"
+		" ('10.0.0.1', 'eth0', 5, 0.7, 1, 3), ('10.0.0.2', 'eth1', 6, 0.1, 0, 1);"
+		"INSERT INTO packet_counts VALUES ('10.0.0.1', 'eth0', 1, 2, 3, 4, 10, 6, 7, 8, 9, 10, 11);"
+		"INSERT INTO packet_sizes VALUES ('10.0.0.1', 'eth0', 60, 3), ('10.0.0.1', 'eth0', 1500, 2), ('10.0.0.2', 'eth1', 90, 1);"
+		"INSERT INTO ip_port_counts VALUES ('10.0.0.1', 'eth0', 'tcp', '192.168.1.1', 22, 4),"
+		" ('10.0.0.1', 'eth0', 'other', '192.168.1.2', 0, 2), ('10.0.0.2', 'eth1', 'udp', '8.8.8.8', 53, 9);");
+	sqlite3_close(db);
+
+	EXPECT_TRUE(Database::MigrateDatabase(file));
+	// Running it on a current database leaves it alone
+	EXPECT_TRUE(Database::MigrateDatabase(file));
+
+	ASSERT_EQ(SQLITE_OK, sqlite3_open(file.c_str(), &db));
+	EXPECT_EQ("3", QueryText(db, "PRAGMA user_version"));
+
+	// The integer keyed tables
+	EXPECT_EQ("2", QueryText(db, "SELECT COUNT(*) FROM suspect_records"));
+	EXPECT_EQ("3", QueryText(db, "SELECT COUNT(*) FROM suspect_ip_port_counts"));
+	EXPECT_EQ("4", QueryText(db, "SELECT count FROM suspect_ip_port_counts WHERE ip = 167772161 AND type = 6 AND dstip = 3232235777 AND port = 22"));
+	EXPECT_EQ("10", QueryText(db, "SELECT count_total FROM suspect_packet_counts WHERE ip = 167772161"));
+
+	// And the same rows through the old names
+	EXPECT_EQ("0.7", QueryText(db, "SELECT classification FROM suspects WHERE ip = '10.0.0.1' AND interface = 'eth0'"));
+	EXPECT_EQ("eth1", QueryText(db, "SELECT interface FROM suspects WHERE ip = '10.0.0.2'"));
+	EXPECT_EQ("8.8.8.8", QueryText(db, "SELECT dstip FROM ip_port_counts WHERE type = 'udp'"));
+	EXPECT_EQ("2", QueryText(db, "SELECT count FROM ip_port_counts WHERE ip = '10.0.0.1' AND type = 'other'"));
+	EXPECT_EQ("2", QueryText(db, "SELECT COUNT(*) FROM packet_sizes"));
+
+	// A suspect's rows of packet sizes are folded into one histogram
+	sqlite3_stmt *stmt;
+	ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "SELECT histogram FROM packet_sizes WHERE ip = '10.0.0.1' AND interface = 'eth0'", -1, &stmt, NULL));
+	ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+	PacketSizeHistogram histogram;
+	histogram.Deserialize((u_char*)sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0));
+	sqlite3_finalize(stmt);
+	EXPECT_EQ(5u, histogram.GetCount());
+	EXPECT_EQ(60u * 3 + 1500u * 2, histogram.GetSum());
+	EXPECT_EQ(3u, histogram.GetBucket(PacketSizeHistogram::GetBucketIndex(60)));
+
+	// There were no distinct counters, they're rebuilt from the ip_port_counts when the suspect is loaded
+	EXPECT_EQ("0", QueryText(db, "SELECT COUNT(*) FROM suspect_distinct_counts"));
+	sqlite3_close(db);
+
+	unlink(file.c_str());
+}
+
+// Database is a singleton, so every test that needs a connected one shares this file
+static const std::string TEST_DATABASE_FILE = "/tmp/novaTestDatabase.db";
+
+static Database *GetTestDatabase()
+{
+	static Database *database = NULL;
+	if(database == NULL)
+	{
+		unlink(TEST_DATABASE_FILE.c_str());
+		unlink((TEST_DATABASE_FILE + "-wal").c_str());
+		unlink((TEST_DATABASE_FILE + "-shm").c_str());
+
+		// The tables the installer creates that Connect expects to find
+		sqlite3 *db;
+		sqlite3_open(TEST_DATABASE_FILE.c_str(), &db);
+		RunSql(db,
+			"CREATE TABLE honeypots (ip TEXT PRIMARY KEY);"
+			"CREATE TABLE suspect_alerts (id INTEGER PRIMARY KEY AUTOINCREMENT, ip TEXT, interface TEXT,"
+			" startTime, endTime, lastTime, classification, hostileNeighbors, isHostile, classificationNotes,"
+			" ip_traffic_distribution, port_traffic_distribution, packet_size_mean, packet_size_deviation, distinct_ips,"
+			" distinct_tcp_ports, distinct_udp_ports, avg_tcp_ports_per_host, avg_udp_ports_per_host, tcp_percent_syn,"
+			" tcp_percent_fin, tcp_percent_rst, tcp_percent_synack, haystack_percent_contacted);");
+		sqlite3_close(db);
+
+		database = Database::Inst(TEST_DATABASE_FILE);
+	}
+	return database;
+}
+
+TEST(DatabaseReaderTest, testQueriesDontWaitOnWriter)
+{
+	Database *database = GetTestDatabase();
+
+	sqlite3 *db;
+	ASSERT_EQ(SQLITE_OK, sqlite3_open(TEST_DATABASE_FILE.c_str(), &db));
+	EXPECT_EQ("wal", QueryText(db, "PRAGMA journal_mode"));
+	RunSql(db,
+		"INSERT OR IGNORE INTO interfaces (name) VALUES ('eth0');"
+		"INSERT INTO suspect_records (ip, interface, isHostile, classificationNotes)"
+		" SELECT 167772161, id, 1, '' FROM interfaces WHERE name = 'eth0' UNION ALL"
+		" SELECT 167772162, id, 0, '' FROM interfaces WHERE name = 'eth0';");
+	sqlite3_close(db);
+
+	// The writer has an uncommitted reclassification and holds the database lock; the readers still see the last commit
+	Suspect benign;
+	SuspectID_pb id;
+	id.set_m_ip(167772161);
+	id.set_m_ifname("eth0");
+	benign.SetIdentifier(id);
+	benign.SetIsHostile(false);
+
+	database->StartTransaction();
+	database->WriteClassification(&benign);
+	EXPECT_EQ(2, database->GetSuspectList(SUSPECTLIST_ALL).size());
+	EXPECT_EQ(1, database->GetSuspects(SUSPECTLIST_HOSTILE).size());
+	std::vector<SuspectID_pb> hostiles = database->GetHostileSuspects();
+	ASSERT_EQ(1, hostiles.size());
+	EXPECT_EQ(167772161, hostiles[0].m_ip());
+	EXPECT_EQ("eth0", hostiles[0].m_ifname());
+	database->StopTransaction();
+
+	EXPECT_EQ(0, database->GetHostileSuspects().size());
+	EXPECT_EQ(2, database->GetSuspects(SUSPECTLIST_BENIGN).size());
+
+	database->Checkpoint();
+	ASSERT_EQ(SQLITE_OK, sqlite3_open(TEST_DATABASE_FILE.c_str(), &db));
+	EXPECT_EQ("0", QueryText(db, "SELECT COUNT(*) FROM suspect_records WHERE isHostile = 1"));
+	RunSql(db, "DELETE FROM suspect_records;");
+	sqlite3_close(db);
+}
+
+TEST(DatabaseWriterTest, testQueuedWrites)
+{
+	Database *database = GetTestDatabase();
+	DatabaseWriter *writer = DatabaseWriter::Inst();
+	writer->Start();
+
+	// The writer's counters are for the life of the process, other tests may have used it already
+	DatabaseWriterStatistics before = writer->GetStatistics();
+
+	std::vector<SuspectRecord> records;
+	for(uint32_t ip = 0x0b000001; ip <= 0x0b000002; ip++)
+	{
+		SuspectID_pb id;
+		id.set_m_ip(ip);
+		id.set_m_ifname("eth0");
+
+		SuspectRecord record;
+		record.m_suspect = new Suspect();
+		record.m_suspect->SetIdentifier(id);
+		record.m_suspect->m_features.m_startTime = 42;
+		record.m_classified = false;
+		records.push_back(record);
+	}
+
+	// The writer takes the suspects, and they're in the database once Flush returns
+	writer->WriteSuspects(records);
+	EXPECT_TRUE(records.empty());
+	writer->Flush();
+
+	SuspectID_pb id;
+	id.set_m_ip(0x0b000002);
+	id.set_m_ifname("eth0");
+	EXPECT_EQ(0x0b000002, database->GetSuspect(id).GetIdentifier().m_ip());
+	EXPECT_EQ(42, database->GetSuspect(id).m_features.m_startTime);
+
+	writer->ClearSuspect(0x0b000002, "eth0");
+	writer->Flush();
+	EXPECT_EQ(0, database->GetSuspect(id).GetIdentifier().m_ip());
+
+	DatabaseWriterStatistics stats = writer->GetStatistics();
+	EXPECT_EQ(0, stats.m_queueDepth);
+	EXPECT_EQ(3, stats.m_writesCommitted - before.m_writesCommitted);
+	EXPECT_GE(stats.m_commits - before.m_commits, 1);
+	EXPECT_LE(stats.m_commits - before.m_commits, 2);
+
+	// Once it's stopped, writes go straight to the database
+	writer->Stop();
+	writer->ClearSuspect(0x0b000001, "eth0");
+	id.set_m_ip(0x0b000001);
+	EXPECT_EQ(0, database->GetSuspect(id).GetIdentifier().m_ip());
+}
+
+TEST(DatabaseRetentionTest, testApplyRetention)
+{
+	Database *database = GetTestDatabase();
+	DatabaseWriter *writer = DatabaseWriter::Inst();
+	writer->Start();
+
+	// 12.0.0.1 has been idle for 100 hours, 12.0.0.2 for 70 and 12.0.0.3 is the newest
+	sqlite3 *db;
+	ASSERT_EQ(SQLITE_OK, sqlite3_open(TEST_DATABASE_FILE.c_str(), &db));
+	RunSql(db,
+		"INSERT OR IGNORE INTO interfaces (name) VALUES ('eth0');"
+		"INSERT INTO suspect_records (ip, interface, lastTime, classificationNotes)"
+		" SELECT 201326593, id, 1000, '' FROM interfaces WHERE name = 'eth0' UNION ALL"
+		" SELECT 201326594, id, 1000 + 30 * 3600, '' FROM interfaces WHERE name = 'eth0' UNION ALL"
+		" SELECT 201326595, id, 1000 + 100 * 3600, '' FROM interfaces WHERE name = 'eth0';"
+		"INSERT INTO suspect_ip_port_counts SELECT s.ip, s.interface, p.type, p.dstip, p.port, p.count"
+		" FROM suspect_records s, (SELECT 6 AS type, 167772161 AS dstip, 22 AS port, 4 AS count UNION ALL"
+		" SELECT 6, 167772162, 22, 3 UNION ALL SELECT 17, 167772161, 53, 2 UNION ALL SELECT 1, 167772162, 0, 5) p;"
+		"INSERT INTO suspect_alerts (ip) VALUES ('12.0.0.1'), ('12.0.0.1'), ('12.0.0.2'), ('12.0.0.2'), ('12.0.0.3');");
+
+	// The distinct pairs outlive the rollup in the suspect's distinct counts
+	DistinctCounter pairs[2];
+	pairs[0].Add(FeatureAggregate::GetIpPortKey(167772161, 22));
+	pairs[0].Add(FeatureAggregate::GetIpPortKey(167772162, 22));
+	pairs[1].Add(FeatureAggregate::GetIpPortKey(167772161, 53));
+	sqlite3_stmt *stmt;
+	sqlite3_prepare_v2(db, "INSERT INTO suspect_distinct_counts SELECT 201326594, id, ?, ? FROM interfaces WHERE name = 'eth0'", -1, &stmt, NULL);
+	for(int i = 0; i < 2; i++)
+	{
+		std::vector<u_char> blob(pairs[i].GetSerializeLength());
+		pairs[i].Serialize(&blob[0], blob.size());
+		sqlite3_bind_int(stmt, 1, i == 0 ? IPPROTO_TCP : IPPROTO_UDP);
+		sqlite3_bind_blob(stmt, 2, &blob[0], blob.size(), SQLITE_TRANSIENT);
+		EXPECT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+		sqlite3_reset(stmt);
+	}
+	sqlite3_finalize(stmt);
+
+	HoneypotSet honeypots;
+	FeatureAggregate detailed;
+	database->LoadFeatureAggregate(201326594, "eth0", detailed, honeypots);
+
+	RetentionPolicy policy;
+	policy.m_suspectHours = 72;
+	policy.m_detailHours = 24;
+	policy.m_maxAlerts = 2;
+	policy.m_batchSize = 1;
+
+	RetentionResult result;
+	result.m_rowsRemoved = 0;
+	result.m_suspectsRolledUp = 0;
+	result.m_alertsRemoved = 0;
+
+	// One suspect or alert per step at this batch size, so it takes a few of them
+	uint steps = 0;
+	do
+	{
+		writer->ApplyRetention(policy, result);
+		steps++;
+	} while(!result.m_finished && steps < 10);
+	EXPECT_EQ(4, steps);
+
+	ASSERT_EQ(1, result.m_removedSuspects.size());
+	EXPECT_EQ(201326593, result.m_removedSuspects[0].m_ip());
+	EXPECT_EQ("eth0", result.m_removedSuspects[0].m_ifname());
+	EXPECT_EQ(1, result.m_suspectsRolledUp);
+	EXPECT_EQ(3, result.m_alertsRemoved);
+	// The first suspect's record and 4 ip_port_counts, and the second's 4 ip_port_counts
+	EXPECT_EQ(9, result.m_rowsRemoved);
+
+	EXPECT_EQ("201326594,201326595", QueryText(db, "SELECT group_concat(ip) FROM (SELECT ip FROM suspect_records ORDER BY ip)"));
+	EXPECT_EQ("4", QueryText(db, "SELECT COUNT(*) FROM suspect_ip_port_counts WHERE ip = 201326595"));
+	EXPECT_EQ("0", QueryText(db, "SELECT COUNT(*) FROM suspect_ip_port_counts WHERE ip = 201326594"));
+	EXPECT_EQ("6,8", QueryText(db, "SELECT group_concat(count) FROM (SELECT count FROM suspect_ip_summaries WHERE ip = 201326594 ORDER BY dstip)"));
+	EXPECT_EQ("7", QueryText(db, "SELECT count FROM suspect_port_summaries WHERE ip = 201326594 AND type = 6 AND port = 22"));
+	EXPECT_EQ("2", QueryText(db, "SELECT count FROM suspect_port_summaries WHERE ip = 201326594 AND type = 17 AND port = 53"));
+	EXPECT_EQ("2", QueryText(db, "SELECT COUNT(*) FROM suspect_alerts"));
+
+	// Reloading the rolled up suspect gets the same features back
+	FeatureAggregate summarized;
+	database->LoadFeatureAggregate(201326594, "eth0", summarized, honeypots);
+	double detailedFeatures[DIM], summarizedFeatures[DIM];
+	detailed.ComputeFeatures(detailedFeatures, honeypots);
+	summarized.ComputeFeatures(summarizedFeatures, honeypots);
+	for(int i = 0; i < DIM; i++)
+	{
+		EXPECT_DOUBLE_EQ(detailedFeatures[i], summarizedFeatures[i]);
+	}
+
+	// Nothing left to do the next time around
+	RetentionResult again;
+	again.m_rowsRemoved = 0;
+	again.m_suspectsRolledUp = 0;
+	again.m_alertsRemoved = 0;
+	writer->ApplyRetention(policy, again);
+	EXPECT_TRUE(again.m_finished);
+	EXPECT_EQ(0, again.m_rowsRemoved + again.m_alertsRemoved);
+
+	uint64_t totalBytes, freeBytes;
+	database->GetDatabaseSize(totalBytes, freeBytes);
+	EXPECT_GT(totalBytes, 0);
+	EXPECT_LT(freeBytes, totalBytes);
+
+	writer->Stop();
+	RunSql(db,
+		"DELETE FROM suspect_ip_port_counts; DELETE FROM suspect_ip_summaries; DELETE FROM suspect_port_summaries;"
+		"DELETE FROM suspect_distinct_counts; DELETE FROM suspect_records; DELETE FROM suspect_alerts;");
+	sqlite3_close(db);
+}
+
+// Removes everything the DatabaseQueue tests wrote for their suspects
+static void ClearTestSuspects()
+{
+	sqlite3 *db;
+	ASSERT_EQ(SQLITE_OK, sqlite3_open(TEST_DATABASE_FILE.c_str(), &db));
+	RunSql(db,
+		"DELETE FROM suspect_ip_port_counts; DELETE FROM suspect_distinct_counts; DELETE FROM suspect_packet_counts;"
+		"DELETE FROM suspect_packet_sizes; DELETE FROM suspect_records;");
+	sqlite3_close(db);
+}
+
+// Fills the queue with single packet suspects from consecutive IPs, suspect i last seen at time i + 1
+static void AddIdleSuspects(DatabaseQueue &q, uint32_t firstIp, uint count)
+{
+	Evidence f;
+	f.m_evidencePacket.ip_p = 17;
+	f.m_evidencePacket.interface = InterfaceTable::Inst()->GetIndex("eth0");
+	f.m_evidencePacket.ip_dst = 0x0a000100;
+	f.m_evidencePacket.dst_port = 53;
+	for(uint i = 0; i < count; i++)
+	{
+		f.m_evidencePacket.ip_src = firstIp + i;
+		f.m_evidencePacket.ts = i + 1;
+		q.ProcessEvidence(&f, true);
+	}
+}
+
+TEST(DatabaseQueueTest, testEvictColdSuspects)
+{
+	Database *database = GetTestDatabase();
+	if(engine == NULL)
+	{
+		engine = new dummyce();
+	}
+
+	DatabaseQueue probe;
+	AddIdleSuspects(probe, 0x0d000000, 1);
+	uint64_t perSuspect = probe.GetMemoryStatistics().m_bytesInUse;
+	ASSERT_GT(perSuspect, 0);
+
+	// Room for 50 suspects, then 200 of them show up
+	DatabaseQueue q;
+	q.SetShardCount(1);
+	q.SetMemoryBudget(perSuspect * 50, 0);
+	AddIdleSuspects(q, 0x0d000000, 200);
+
+	SuspectMemoryStatistics stats = q.GetMemoryStatistics();
+	EXPECT_GT(stats.m_evictions, 0);
+	EXPECT_EQ(0, stats.m_oversizeFlushes);
+	EXPECT_EQ(200, stats.m_suspectCount + stats.m_evictions);
+	EXPECT_LE(stats.m_bytesInUse, perSuspect * 50);
+
+	// The ones seen last are the ones still waiting
+	std::vector<std::pair<SuspectID_pb, size_t> > waiting = q.GetLargestSuspects(200);
+	ASSERT_EQ(stats.m_suspectCount, waiting.size());
+	for(uint i = 0; i < waiting.size(); i++)
+	{
+		EXPECT_GE(waiting[i].first.m_ip(), 0x0d000000 + stats.m_evictions);
+	}
+
+	// The feature totals of the written out suspects count against the budget too, and are dropped
+	// once they're over their half of it since the database has everything in them
+	EXPECT_GT(stats.m_aggregateEvictions, 0);
+	EXPECT_LE(stats.m_aggregateBytes, perSuspect * 50 / 2);
+	EXPECT_EQ(stats.m_evictions, stats.m_aggregateCount + stats.m_aggregateEvictions);
+
+	// A suspect whose totals were dropped picks them back up from the database when it's seen again
+	AddIdleSuspects(q, 0x0d000000, 1);
+	q.WriteToDatabase();
+	HoneypotSet honeypots;
+	FeatureAggregate reloaded;
+	database->LoadFeatureAggregate(0x0d000000, "eth0", reloaded, honeypots);
+	EXPECT_EQ(2, reloaded.GetPacketCount());
+
+	stats = q.GetMemoryStatistics();
+	EXPECT_EQ(0, stats.m_bytesInUse);
+	EXPECT_EQ(0, stats.m_suspectCount);
+
+	ClearTestSuspects();
+}
+
+TEST(DatabaseQueueTest, testOversizeFlush)
+{
+	GetTestDatabase();
+	if(engine == NULL)
+	{
+		engine = new dummyce();
+	}
+
+	DatabaseQueue q;
+	q.SetShardCount(1);
+	q.SetMemoryBudget(0, 16 * 1024);
+
+	// A port sweep outgrows the per suspect budget on its own and goes out as soon as it does
+	Evidence f;
+	f.m_evidencePacket.ip_p = 17;
+	f.m_evidencePacket.interface = InterfaceTable::Inst()->GetIndex("eth0");
+	f.m_evidencePacket.ip_src = 0x0d000001;
+	f.m_evidencePacket.ip_dst = 0x0a000100;
+	for(uint port = 0; port < 5000; port++)
+	{
+		f.m_evidencePacket.dst_port = port;
+		q.ProcessEvidence(&f, true);
+	}
+
+	SuspectMemoryStatistics stats = q.GetMemoryStatistics();
+	EXPECT_GE(stats.m_oversizeFlushes, 1);
+	EXPECT_EQ(0, stats.m_evictions);
+	EXPECT_LE(stats.m_bytesInUse, 16 * 1024);
+
+	std::vector<std::pair<SuspectID_pb, size_t> > largest = q.GetLargestSuspects(1);
+	ASSERT_EQ(1, largest.size());
+	EXPECT_LE(largest[0].second, 16 * 1024);
+	EXPECT_EQ(stats.m_bytesInUse, largest[0].second);
+
+	// Its totals are kept from one early write to the next
+	EXPECT_EQ(1, stats.m_aggregateCount);
+	EXPECT_GT(stats.m_aggregateBytes, 0);
+
+	q.WriteToDatabase();
+	ClearTestSuspects();
+}
+
+TEST(DatabaseUpsertTest, testPersistSuspectsTwice)
+{
+	Database *database = GetTestDatabase();
+
+	// More suspects than fit in one statement of any of the tables, each with a small and a big
+	// packet to one destination
+	const uint32_t firstIp = 0x0e000000;
+	const uint count = UPSERT_BATCH_ROWS * 2 + 10;
+	for(int pass = 0; pass < 2; pass++)
+	{
+		std::vector<SuspectRecord> records(count);
+		for(uint i = 0; i < count; i++)
+		{
+			SuspectID_pb id;
+			id.set_m_ip(firstIp + i);
+			id.set_m_ifname("eth0");
+
+			_evidencePacket packet;
+			memset(&packet, 0, sizeof(packet));
+			packet.ip_p = 17;
+			packet.ip_src = firstIp + i;
+			packet.ip_dst = 0x0a000100;
+			packet.dst_port = 53;
+			packet.ts = 100 + pass;
+
+			records[i].m_suspect = new Suspect();
+			records[i].m_suspect->SetIdentifier(id);
+			packet.ip_len = 60;
+			records[i].m_suspect->ReadEvidence(packet);
+			packet.ip_len = 1400;
+			records[i].m_suspect->ReadEvidence(packet);
+			records[i].m_classified = false;
+		}
+
+		database->StartTransaction();
+		database->PersistSuspects(records);
+		database->StopTransaction();
+
+		for(uint i = 0; i < count; i++)
+		{
+			delete records[i].m_suspect;
+		}
+	}
+
+	// One row per suspect, with both windows added up
+	sqlite3 *db;
+	ASSERT_EQ(SQLITE_OK, sqlite3_open(TEST_DATABASE_FILE.c_str(), &db));
+	std::stringstream suspects;
+	suspects << " WHERE ip >= " << firstIp << " AND ip < " << firstIp + count;
+	std::stringstream expected;
+	expected << count;
+	EXPECT_EQ(expected.str(), QueryText(db, "SELECT COUNT(*) FROM suspect_records" + suspects.str()));
+	EXPECT_EQ("101", QueryText(db, "SELECT MIN(lastTime) FROM suspect_records" + suspects.str()));
+	EXPECT_EQ(expected.str(), QueryText(db, "SELECT COUNT(*) FROM suspect_packet_counts" + suspects.str()));
+	EXPECT_EQ("4,4", QueryText(db, "SELECT MIN(count_total) || ',' || MAX(count_total) FROM suspect_packet_counts" + suspects.str()));
+	EXPECT_EQ("2920,2920", QueryText(db, "SELECT MIN(count_bytes) || ',' || MAX(count_bytes) FROM suspect_packet_counts" + suspects.str()));
+	EXPECT_EQ(expected.str(), QueryText(db, "SELECT COUNT(*) FROM suspect_ip_port_counts" + suspects.str()));
+	EXPECT_EQ("4,4", QueryText(db, "SELECT MIN(count) || ',' || MAX(count) FROM suspect_ip_port_counts" + suspects.str()));
+
+	// The histograms were merged rather than replaced, for the last suspect as much as the first
+	sqlite3_stmt *stmt;
+	sqlite3_prepare_v2(db, ("SELECT histogram FROM suspect_packet_sizes" + suspects.str()).c_str(), -1, &stmt, NULL);
+	uint histograms = 0;
+	while(sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		PacketSizeHistogram histogram;
+		histogram.Deserialize((u_char *)sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0));
+		EXPECT_EQ(4, histogram.GetCount());
+		EXPECT_EQ(2 * (60 + 1400), histogram.GetSum());
+		EXPECT_EQ(2, histogram.GetBucket(PacketSizeHistogram::GetBucketIndex(60)));
+		EXPECT_EQ(2, histogram.GetBucket(PacketSizeHistogram::GetBucketIndex(1400)));
+		histograms++;
+	}
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+	EXPECT_EQ(count, histograms);
+
+	ClearTestSuspects();
+}
+
+// Writes a count of 1 for every suspect/destination pair, keyed either on text (version 1) or
+// integers (version 2). It's one single row upsert per pair, so this compares the keys and not the
+// multi-row statements Database::PersistSuspects batches its rows into.
+static double TimeIpPortFlush(sqlite3 *db, bool integerKeys, int suspects, int pairs)
+{
+	sqlite3_stmt *stmt;
+	sqlite3_prepare_v2(db, integerKeys ?
+		"INSERT INTO suspect_ip_port_counts VALUES (?1, ?2, ?3, ?4, ?5, ?6) ON CONFLICT(ip, interface, type, dstip, port) DO UPDATE SET count = count + excluded.count" :
+		"INSERT INTO ip_port_counts VALUES (?1, ?2, ?3, ?4, ?5, ?6) ON CONFLICT(ip, interface, type, dstip, port) DO UPDATE SET count = count + excluded.count",
+		-1, &stmt, NULL);
+
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	RunSql(db, "BEGIN");
+	for (int i = 0; i < suspects; i++)
+	{
+		for (int j = 0; j < pairs; j++)
+		{
+			uint32_t dst = 0xc0a80000 + j;
+			if (integerKeys)
+			{
+				sqlite3_bind_int64(stmt, 1, 0x0a000000 + i);
+				sqlite3_bind_int64(stmt, 2, 1);
+				sqlite3_bind_int64(stmt, 3, IPPROTO_TCP);
+				sqlite3_bind_int64(stmt, 4, dst);
+			}
+			else
+			{
+				sqlite3_bind_text(stmt, 1, Suspect::GetIpString(0x0a000000 + i).c_str(), -1, SQLITE_TRANSIENT);
+				sqlite3_bind_text(stmt, 2, "eth0", -1, SQLITE_STATIC);
+				sqlite3_bind_text(stmt, 3, "tcp", -1, SQLITE_STATIC);
+				sqlite3_bind_text(stmt, 4, Suspect::GetIpString(dst).c_str(), -1, SQLITE_TRANSIENT);
+			}
+			sqlite3_bind_int(stmt, 5, 80);
+			sqlite3_bind_int(stmt, 6, 1);
+			sqlite3_step(stmt);
+			sqlite3_reset(stmt);
+		}
+	}
+	RunSql(db, "COMMIT");
+	gettimeofday(&end, NULL);
+
+	sqlite3_finalize(stmt);
+	return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+}
+
+// Reads every suspect's ip_port_counts back, as LoadFeatureAggregate does
+static double TimeIpPortQueries(sqlite3 *db, bool integerKeys, int suspects)
+{
+	sqlite3_stmt *stmt;
+	sqlite3_prepare_v2(db, integerKeys ?
+		"SELECT type, dstip, port, count FROM suspect_ip_port_counts WHERE ip = ?1 AND interface = ?2" :
+		"SELECT type, dstip, port, count FROM ip_port_counts WHERE ip = ?1 AND interface = ?2",
+		-1, &stmt, NULL);
+
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	uint64_t total = 0;
+	for (int i = 0; i < suspects; i++)
+	{
+		if (integerKeys)
+		{
+			sqlite3_bind_int64(stmt, 1, 0x0a000000 + i);
+			sqlite3_bind_int64(stmt, 2, 1);
+		}
+		else
+		{
+			sqlite3_bind_text(stmt, 1, Suspect::GetIpString(0x0a000000 + i).c_str(), -1, SQLITE_TRANSIENT);
+			sqlite3_bind_text(stmt, 2, "eth0", -1, SQLITE_STATIC);
+		}
+		while (sqlite3_step(stmt) == SQLITE_ROW)
+		{
+			total += sqlite3_column_int64(stmt, 3);
+		}
+		sqlite3_reset(stmt);
+	}
+	gettimeofday(&end, NULL);
+
+	sqlite3_finalize(stmt);
+	EXPECT_GT(total, 0);
+	return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+}
+
+// Not a correctness test, run with --gtest_also_run_disabled_tests to compare the two schemas
+TEST(DatabaseMigrationTest, DISABLED_benchmarkSchemaVersions)
+{
+	const int suspects = 5000;
+	const int pairs = 40;
+	std::string file = "/tmp/novaSchemaBenchmark.db";
+
+	for (int version = 1; version <= 2; version++)
+	{
+		unlink(file.c_str());
+		sqlite3 *db;
+		sqlite3_open(file.c_str(), &db);
+		RunSql(db, "PRAGMA synchronous = OFF");
+
+		if (version == 1)
+		{
+			RunSql(db, VERSION_1_SCHEMA);
+		}
+		else
+		{
+			sqlite3_close(db);
+			ASSERT_TRUE(Database::MigrateDatabase(file));
+			sqlite3_open(file.c_str(), &db);
+			RunSql(db, "PRAGMA synchronous = OFF; INSERT INTO interfaces VALUES (1, 'eth0')");
+		}
+
+		// First write of every row, then a second window landing on all of them
+		double insert = TimeIpPortFlush(db, version == 2, suspects, pairs);
+		double update = TimeIpPortFlush(db, version == 2, suspects, pairs);
+		double query = TimeIpPortQueries(db, version == 2, suspects);
+		std::cout << "Schema version " << version << ": insert " << insert << "s, update " << update
+				<< "s, query " << query << "s for " << suspects * pairs << " ip_port_counts rows" << std::endl;
+		sqlite3_close(db);
+
+		if (version == 1)
+		{
+			// Parents for the rows, so the migration has something to carry over
+			sqlite3_open(file.c_str(), &db);
+			RunSql(db, "INSERT INTO suspects (ip, interface) SELECT DISTINCT ip, interface FROM ip_port_counts");
+			sqlite3_close(db);
+
+			struct timeval start, end;
+			gettimeofday(&start, NULL);
+			EXPECT_TRUE(Database::MigrateDatabase(file));
+			gettimeofday(&end, NULL);
+			std::cout << "Migrating to version 2 took " << (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0 << "s" << std::endl;
+		}
+	}
+
+	unlink(file.c_str());
+}
@@ -0,0 +1,120 @@
+//============================================================================
+// Name        : tester_DistinctCounter.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : This file contains unit tests for the class DistinctCounter
+//============================================================================/*
+
+#include "gtest/gtest.h"
+
+#include "DistinctCounter.h"
+#include "SerializationHelper.h"
+
+#include <math.h>
+#include <vector>
+
+using namespace Nova;
+
+class DistinctCounterTest : public ::testing::Test {
+protected:
+	DistinctCounter m_counter;
+
+	// Within 5%, about three standard errors at this precision
+	void ExpectClose(uint64_t expected, uint64_t actual)
+	{
+		EXPECT_LT(fabs((double)actual - expected), expected * 0.05);
+	}
+};
+
+TEST_F(DistinctCounterTest, test_exactUntilLimit)
+{
+	for(uint64_t i = 0; i < DISTINCT_COUNTER_EXACT_LIMIT; i++)
+	{
+		m_counter.Add(i);
+		m_counter.Add(i);
+	}
+	EXPECT_TRUE(m_counter.IsExact());
+	EXPECT_EQ((uint64_t)DISTINCT_COUNTER_EXACT_LIMIT, m_counter.GetCount());
+	// The exact set is never bigger than the sketch it turns into
+	EXPECT_LE(m_counter.GetMemoryUsage(), (size_t)DISTINCT_COUNTER_REGISTERS);
+
+	m_counter.Add(DISTINCT_COUNTER_EXACT_LIMIT);
+	EXPECT_FALSE(m_counter.IsExact());
+	ExpectClose(DISTINCT_COUNTER_EXACT_LIMIT + 1, m_counter.GetCount());
+
+	// A sketch never gets bigger no matter how much is added
+	uint32_t length = m_counter.GetSerializeLength();
+	for(uint64_t i = 0; i < 200000; i++)
+	{
+		m_counter.Add(i);
+	}
+	EXPECT_EQ(length, m_counter.GetSerializeLength());
+	ExpectClose(200000, m_counter.GetCount());
+}
+
+TEST_F(DistinctCounterTest, test_merge)
+{
+	// One small exact counter and one big sketch with half their items in common
+	DistinctCounter small, big;
+	for(uint64_t i = 0; i < 100; i++)
+	{
+		small.Add(i * 1000);
+	}
+	for(uint64_t i = 0; i < 50000; i++)
+	{
+		big.Add(i * 2);
+	}
+
+	DistinctCounter exactMerge;
+	exactMerge.Merge(small);
+	exactMerge.Merge(small);
+	EXPECT_TRUE(exactMerge.IsExact());
+	EXPECT_EQ(100, exactMerge.GetCount());
+
+	// Merging in either order gives the same sketch
+	DistinctCounter a = small, b = big;
+	a.Merge(big);
+	b.Merge(small);
+	EXPECT_EQ(a.GetCount(), b.GetCount());
+	ExpectClose(50050, a.GetCount());
+}
+
+TEST_F(DistinctCounterTest, test_serialization)
+{
+	for(uint64_t i = 0; i < 10; i++)
+	{
+		m_counter.Add(i);
+	}
+
+	std::vector<u_char> buffer(m_counter.GetSerializeLength());
+	EXPECT_EQ(buffer.size(), m_counter.Serialize(&buffer[0], buffer.size()));
+
+	DistinctCounter copy;
+	EXPECT_EQ(buffer.size(), copy.Deserialize(&buffer[0], buffer.size()));
+	EXPECT_TRUE(copy.IsExact());
+	EXPECT_EQ(10, copy.GetCount());
+
+	for(uint64_t i = 0; i < 10000; i++)
+	{
+		m_counter.Add(i);
+	}
+	buffer.resize(m_counter.GetSerializeLength());
+	m_counter.Serialize(&buffer[0], buffer.size());
+	copy.Deserialize(&buffer[0], buffer.size());
+	EXPECT_FALSE(copy.IsExact());
+	EXPECT_EQ(m_counter.GetCount(), copy.GetCount());
+
+	EXPECT_THROW(copy.Deserialize(&buffer[0], buffer.size() - 1), serializationException);
+	EXPECT_THROW(m_counter.Serialize(&buffer[0], buffer.size() - 1), serializationException);
+}
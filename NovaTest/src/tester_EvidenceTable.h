@@ -18,6 +18,11 @@
 
 #include "gtest/gtest.h"
 #include "EvidenceTable.h"
+#include "InterfaceTable.h"
+
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 
 using namespace Nova;
 
@@ -64,3 +69,182 @@ TEST_F(EvidenceTableTest, TestAll)
 	EXPECT_EQ(ev->m_next, m_ev1);
 }
 
+
+TEST_F(EvidenceTableTest, TestBatch)
+{
+	// Ethernet + IPv4 + the start of a TCP header, 10.0.0.1 -> 10.0.0.2:80 with SYN set
+	u_char tcpPacket[EVIDENCE_ETHER_HEADER_LENGTH + 20 + 14] = {0};
+	u_char *ip = tcpPacket + EVIDENCE_ETHER_HEADER_LENGTH;
+	ip[0] = 0x45;
+	ip[3] = 60;
+	ip[9] = IPPROTO_TCP;
+	ip[12] = 10; ip[15] = 1;
+	ip[16] = 10; ip[19] = 2;
+	ip[20 + 3] = 80;
+	ip[20 + 13] = TH_SYN;
+
+	// Same thing, but UDP from 10.0.0.3 to port 53
+	u_char udpPacket[EVIDENCE_ETHER_HEADER_LENGTH + 20 + 8] = {0};
+	memcpy(udpPacket, tcpPacket, sizeof(udpPacket));
+	ip = udpPacket + EVIDENCE_ETHER_HEADER_LENGTH;
+	ip[9] = IPPROTO_UDP;
+	ip[15] = 3;
+	ip[20 + 3] = 53;
+
+	struct pcap_pkthdr tcpHeader, udpHeader;
+	tcpHeader.ts.tv_sec = udpHeader.ts.tv_sec = 1000;
+	tcpHeader.caplen = tcpHeader.len = sizeof(tcpPacket);
+	udpHeader.caplen = udpHeader.len = sizeof(udpPacket);
+
+	EvidenceBatch batch;
+	batch.m_interface = InterfaceTable::Inst()->GetIndex("eth0");
+	batch.Add(tcpPacket, &tcpHeader);
+	batch.Add(udpPacket, &udpHeader);
+	batch.Add(tcpPacket, &tcpHeader);
+
+	// Too short to hold an IP header, shouldn't make it into the batch
+	tcpHeader.caplen = EVIDENCE_ETHER_HEADER_LENGTH + 10;
+	batch.Add(tcpPacket, &tcpHeader);
+	EXPECT_EQ(3, batch.m_count);
+
+	m_evidenceTable.InsertEvidence(batch);
+
+	Evidence *ev = m_evidenceTable.GetEvidence();
+	ASSERT_TRUE(ev != NULL);
+	EXPECT_EQ((uint32_t)0x0a000001, ev->m_evidencePacket.ip_src);
+	EXPECT_EQ((uint32_t)0x0a000002, ev->m_evidencePacket.ip_dst);
+	EXPECT_EQ(80, ev->m_evidencePacket.dst_port);
+	EXPECT_EQ(60, ev->m_evidencePacket.ip_len);
+	EXPECT_TRUE(ev->m_evidencePacket.tcp_hdr.syn);
+	EXPECT_FALSE(ev->m_evidencePacket.tcp_hdr.ack);
+	EXPECT_EQ("eth0", InterfaceTable::Inst()->GetName(ev->m_evidencePacket.interface));
+	ASSERT_TRUE(ev->m_next != NULL);
+	EXPECT_TRUE(ev->m_next->m_next == NULL);
+	delete ev->m_next;
+	delete ev;
+
+	ev = m_evidenceTable.GetEvidence();
+	ASSERT_TRUE(ev != NULL);
+	EXPECT_EQ((uint32_t)0x0a000003, ev->m_evidencePacket.ip_src);
+	EXPECT_EQ(IPPROTO_UDP, ev->m_evidencePacket.ip_p);
+	EXPECT_EQ(53, ev->m_evidencePacket.dst_port);
+	EXPECT_TRUE(ev->m_next == NULL);
+	delete ev;
+}
+
+struct EvidenceProducerArgs
+{
+	EvidenceTable *m_table;
+	uint32_t m_firstIp;
+};
+
+// Pushes 100 batches, each with two packets for every one of 8 source IPs
+static void *EvidenceProducer(void *ptr)
+{
+	EvidenceProducerArgs *args = (EvidenceProducerArgs *)ptr;
+	EvidenceBatch batch;
+	for(uint round = 0; round < 100; round++)
+	{
+		batch.Clear();
+		for(uint i = 0; i < 16; i++)
+		{
+			_evidencePacket &packet = batch.m_packets[batch.m_count++];
+			memset(&packet, 0, sizeof(packet));
+			packet.ip_src = args->m_firstIp + (i % 8);
+			packet.ts = round;
+		}
+		args->m_table->InsertEvidence(batch);
+	}
+	return NULL;
+}
+
+TEST_F(EvidenceTableTest, TestConcurrentProducers)
+{
+	pthread_t producers[4];
+	EvidenceProducerArgs args[4];
+	for(uint i = 0; i < 4; i++)
+	{
+		args[i].m_table = &m_evidenceTable;
+		args[i].m_firstIp = 0x0a000000 + 0x100 * i;
+		pthread_create(&producers[i], NULL, EvidenceProducer, &args[i]);
+	}
+
+	// Every packet has to come out exactly once, and any one chain must only hold a single IP
+	uint received = 0;
+	while(received < 4 * 100 * 16)
+	{
+		Evidence *ev = m_evidenceTable.GetEvidence();
+		ASSERT_TRUE(ev != NULL);
+		uint32_t ip = ev->m_evidencePacket.ip_src;
+		while(ev != NULL)
+		{
+			EXPECT_EQ(ip, ev->m_evidencePacket.ip_src);
+			Evidence *next = ev->m_next;
+			delete ev;
+			ev = next;
+			received++;
+		}
+	}
+
+	for(uint i = 0; i < 4; i++)
+	{
+		pthread_join(producers[i], NULL);
+	}
+	EXPECT_EQ(4 * 100 * 16, received);
+}
+
+static void *EvidenceConsumer(void *ptr)
+{
+	return ((EvidenceTable *)ptr)->GetEvidence();
+}
+
+TEST_F(EvidenceTableTest, TestStop)
+{
+	// Evidence inserted before the stop still gets handed out, and only then does GetEvidence give up
+	InitEvidence();
+	m_evidenceTable.InsertEvidence(m_ev1);
+	m_evidenceTable.Stop();
+	EXPECT_EQ(m_ev1, m_evidenceTable.GetEvidence());
+	EXPECT_TRUE(m_evidenceTable.GetEvidence() == NULL);
+
+	// A consumer that's already asleep has to be woken up by the stop
+	EvidenceTable table;
+	pthread_t consumer;
+	pthread_create(&consumer, NULL, EvidenceConsumer, &table);
+	usleep(10000);
+	table.Stop();
+	void *ret = &table;
+	pthread_join(consumer, &ret);
+	EXPECT_TRUE(ret == NULL);
+}
+
+TEST_F(EvidenceTableTest, TestDrainLimit)
+{
+	// A single call only takes so much out of the inbox, so a busy inbox can't keep GetEvidence from returning
+	EvidenceBatch batch;
+	for(uint i = 0; i < 3 * EVIDENCE_DRAIN_LIMIT / EVIDENCE_BATCH_SIZE; i++)
+	{
+		batch.Clear();
+		while(!batch.IsFull())
+		{
+			_evidencePacket &packet = batch.m_packets[batch.m_count++];
+			memset(&packet, 0, sizeof(packet));
+			packet.ip_src = 0x0a000001;
+		}
+		m_evidenceTable.InsertEvidence(batch);
+	}
+
+	for(uint i = 0; i < 3; i++)
+	{
+		Evidence *ev = m_evidenceTable.GetEvidence();
+		uint count = 0;
+		while(ev != NULL)
+		{
+			Evidence *next = ev->m_next;
+			delete ev;
+			ev = next;
+			count++;
+		}
+		EXPECT_EQ(EVIDENCE_DRAIN_LIMIT, count);
+	}
+}
@@ -0,0 +1,163 @@
+//============================================================================
+// Name        : tester_FeatureAggregate.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : This file contains unit tests for the class FeatureAggregate
+//============================================================================/*
+
+#include "gtest/gtest.h"
+
+#include "FeatureAggregate.h"
+#include "Suspect.h"
+
+#include <string.h>
+#include <vector>
+
+using namespace Nova;
+
+class FeatureAggregateTest : public ::testing::Test {
+protected:
+	HoneypotSet m_honeypots;
+
+	_evidencePacket Packet(uint8_t protocol, uint32_t dstIp, uint16_t port, uint16_t length)
+	{
+		_evidencePacket packet;
+		memset(&packet, 0, sizeof(packet));
+		packet.ip_src = 0x0a000001;
+		packet.ip_dst = dstIp;
+		packet.dst_port = port;
+		packet.ip_len = length;
+		packet.ip_p = protocol;
+		packet.ts = 1000;
+		return packet;
+	}
+
+	_evidencePacket Syn(uint32_t dstIp, uint16_t port)
+	{
+		_evidencePacket packet = Packet(IPPROTO_TCP, dstIp, port, 60);
+		packet.tcp_hdr.syn = true;
+		return packet;
+	}
+};
+
+TEST_F(FeatureAggregateTest, test_features)
+{
+	std::vector<uint32_t> honeypots;
+	honeypots.push_back(0x0a000002);
+	honeypots.push_back(0x0a000009);
+	m_honeypots.Set(honeypots);
+
+	EvidenceAccumulator first;
+	first.Add(Syn(0x0a000002, 22));
+	first.Add(Syn(0x0a000002, 80));
+	first.Add(Syn(0x0a000003, 80));
+	first.Add(Packet(IPPROTO_UDP, 0x0a000003, 53, 100));
+
+	// The second window contacts the same IP/port again, which mustn't count as a new distinct one
+	EvidenceAccumulator second;
+	second.Add(Syn(0x0a000002, 22));
+	second.Add(Packet(IPPROTO_UDP, 0x0a000004, 53, 100));
+
+	FeatureAggregate aggregate;
+	aggregate.Add(first, m_honeypots);
+	aggregate.Add(second, m_honeypots);
+
+	double features[DIM];
+	aggregate.ComputeFeatures(features, m_honeypots);
+
+	EXPECT_EQ(6, aggregate.GetPacketCount());
+	EXPECT_EQ(3, features[DISTINCT_IPS]);
+	EXPECT_EQ(2, features[DISTINCT_TCP_PORTS]);
+	EXPECT_EQ(1, features[DISTINCT_UDP_PORTS]);
+	EXPECT_DOUBLE_EQ(3.0 / 3, features[AVG_TCP_PORTS_PER_HOST]);
+	EXPECT_DOUBLE_EQ(2.0 / 3, features[AVG_UDP_PORTS_PER_HOST]);
+	EXPECT_DOUBLE_EQ(1, features[TCP_PERCENT_SYN]);
+	EXPECT_DOUBLE_EQ(0, features[TCP_PERCENT_RST]);
+
+	// 6 packets over 3 IPs, and 10.0.0.2 got 3 of them
+	EXPECT_DOUBLE_EQ(6.0 / 3 / 3, features[IP_TRAFFIC_DISTRIBUTION]);
+	// 6 packets over 3 ports, port 22 and port 53 both got 2
+	EXPECT_DOUBLE_EQ(6.0 / 3 / 2, features[PORT_TRAFFIC_DISTRIBUTION]);
+
+	EXPECT_DOUBLE_EQ(0.5, features[HAYSTACK_PERCENT_CONTACTED]);
+	EXPECT_DOUBLE_EQ((4 * 60 + 2 * 100) / 6.0, features[PACKET_SIZE_MEAN]);
+
+	// Changing the honeypots gets picked up on the next computation
+	honeypots.push_back(0x0a000004);
+	m_honeypots.Set(honeypots);
+	aggregate.ComputeFeatures(features, m_honeypots);
+	EXPECT_DOUBLE_EQ(2.0 / 3, features[HAYSTACK_PERCENT_CONTACTED]);
+}
+
+TEST_F(FeatureAggregateTest, test_reloadMatchesLive)
+{
+	std::vector<uint32_t> honeypots;
+	honeypots.push_back(0x0a000003);
+	m_honeypots.Set(honeypots);
+
+	EvidenceAccumulator window;
+	window.Add(Syn(0x0a000002, 22));
+	window.Add(Syn(0x0a000002, 22));
+	window.Add(Syn(0x0a000003, 443));
+	window.Add(Packet(IPPROTO_UDP, 0x0a000003, 53, 80));
+	window.Add(Packet(IPPROTO_ICMP, 0x0a000005, 8, 84));
+
+	FeatureAggregate live;
+	live.Add(window, m_honeypots);
+
+	// Same history, the way Database::LoadFeatureAggregate hands it over from the tables
+	FeatureAggregate reloaded;
+	reloaded.AddPacketCounts(window.m_packetCount, window.m_tcpPacketCount, window.m_rstCount,
+			window.m_synCount, window.m_finCount, window.m_synAckCount);
+	reloaded.AddPacketSizes(window.m_packetSizes);
+	reloaded.AddIpPortCount(IPPROTO_TCP, 0x0a000002, 22, 2, m_honeypots);
+	reloaded.AddIpPortCount(IPPROTO_TCP, 0x0a000003, 443, 1, m_honeypots);
+	reloaded.AddIpPortCount(IPPROTO_UDP, 0x0a000003, 53, 1, m_honeypots);
+	reloaded.AddIpPortCount(IPPROTO_ICMP, 0x0a000005, 8, 1, m_honeypots);
+
+	double liveFeatures[DIM], reloadedFeatures[DIM];
+	live.ComputeFeatures(liveFeatures, m_honeypots);
+	reloaded.ComputeFeatures(reloadedFeatures, m_honeypots);
+
+	for(int i = 0; i < DIM; i++)
+	{
+		EXPECT_DOUBLE_EQ(liveFeatures[i], reloadedFeatures[i]);
+	}
+}
+
+TEST_F(FeatureAggregateTest, test_sweepStaysBounded)
+{
+	FeatureAggregate aggregate;
+
+	// One busy destination, then a sweep that touches every port and far more IPs than the
+	// tables keep
+	const uint sweep = 100000;
+	aggregate.AddPacketCounts(100 + sweep, 100 + sweep, 0, 0, 0, 0);
+	aggregate.AddIpPortCount(IPPROTO_TCP, 0x0a000002, 80, 100, m_honeypots);
+	for(uint i = 0; i < sweep; i++)
+	{
+		aggregate.AddIpPortCount(IPPROTO_TCP, 0x0b000000 + i, i & 0xffff, 1, m_honeypots);
+	}
+
+	EXPECT_LT(aggregate.GetMemoryUsage(), 512 * 1024);
+
+	double features[DIM];
+	aggregate.ComputeFeatures(features, m_honeypots);
+	EXPECT_NEAR(sweep + 1, features[DISTINCT_IPS], (sweep + 1) * 0.05);
+	EXPECT_NEAR(65536, features[DISTINCT_TCP_PORTS], 65536 * 0.05);
+
+	// The busy destination survived every trim, so the distribution is still measured against it
+	double expected = (100.0 + sweep) / (sweep + 1) / 100;
+	EXPECT_NEAR(expected, features[IP_TRAFFIC_DISTRIBUTION], expected * 0.05);
+}
@@ -0,0 +1,107 @@
+//============================================================================
+// Name        : tester_FlatHashMap.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : This file contains unit tests for the FlatHashMap template
+//============================================================================/*
+
+#include "gtest/gtest.h"
+
+#include "FlatHashMap.h"
+#include "HashMapStructs.h"
+#include "EvidenceAccumulator.h"
+
+#include <map>
+
+using namespace Nova;
+
+typedef FlatHashMap<uint32_t, uint64_t, std::hash<uint32_t>, eq_uint32_t> TestFlatMap;
+
+class FlatHashMapTest : public ::testing::Test {
+protected:
+	TestFlatMap m_map;
+};
+
+TEST_F(FlatHashMapTest, test_upsert)
+{
+	EXPECT_TRUE(m_map.empty());
+	EXPECT_FALSE(m_map.keyExists(42));
+	EXPECT_TRUE(m_map.find(42) == m_map.end());
+
+	m_map.upsert(42, 0)++;
+	m_map.upsert(42, 0)++;
+	EXPECT_EQ(7, m_map.upsert(43, 7));
+	EXPECT_EQ(2, m_map[42]);
+	EXPECT_EQ(7, m_map[43]);
+	EXPECT_EQ(2, m_map.size());
+	EXPECT_EQ(0, m_map[44]);
+	EXPECT_EQ(3, m_map.size());
+}
+
+// Compares against std::map through enough inserts to grow the table several times, with erases mixed in
+TEST_F(FlatHashMapTest, test_growAndErase)
+{
+	std::map<uint32_t, uint64_t> expected;
+	for(uint32_t i = 0; i < 5000; i++)
+	{
+		// IPs in the same /16 with a few ports each, like a scan would produce
+		uint32_t key = 0x0a000000 + (i % 1300) * 256;
+		m_map.upsert(key, 0)++;
+		expected[key]++;
+
+		if(i % 7 == 0)
+		{
+			uint32_t eraseKey = 0x0a000000 + ((i / 7) % 1300) * 256;
+			m_map.erase(eraseKey);
+			expected.erase(eraseKey);
+		}
+	}
+
+	EXPECT_EQ(expected.size(), m_map.size());
+	for(std::map<uint32_t, uint64_t>::iterator it = expected.begin(); it != expected.end(); it++)
+	{
+		ASSERT_TRUE(m_map.keyExists(it->first));
+		EXPECT_EQ(it->second, m_map.find(it->first)->second);
+	}
+
+	uint iterated = 0;
+	for(TestFlatMap::iterator it = m_map.begin(); it != m_map.end(); it++)
+	{
+		EXPECT_EQ(expected[it->first], it->second);
+		iterated++;
+	}
+	EXPECT_EQ(expected.size(), iterated);
+
+	// Erasing while iterating visits every entry once
+	for(TestFlatMap::iterator it = m_map.begin(); it != m_map.end();)
+	{
+		it = m_map.erase(it);
+	}
+	EXPECT_TRUE(m_map.empty());
+	EXPECT_TRUE(m_map.begin() == m_map.end());
+}
+
+TEST_F(FlatHashMapTest, test_copy)
+{
+	IpPortTable table;
+	IpPortCombination t;
+	t.m_ip = 1;
+	t.m_port = 80;
+	table.upsert(t, 0)++;
+
+	IpPortTable copy = table;
+	copy.upsert(t, 0)++;
+	EXPECT_EQ(1, table[t]);
+	EXPECT_EQ(2, copy[t]);
+}
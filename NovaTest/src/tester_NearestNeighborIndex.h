@@ -0,0 +1,488 @@
+//============================================================================
+// Name        : tester_NearestNeighborIndex.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : This file contains unit tests for the KNN nearest neighbor backends
+//============================================================================/*
+
+#include "gtest/gtest.h"
+
+#include "NearestNeighborIndex.h"
+#include "HnswIndex.h"
+#include "KnnClassification.h"
+#include "Config.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace Nova;
+using namespace std;
+
+class NearestNeighborIndexTest : public ::testing::Test
+{
+protected:
+	// Not a multiple of the brute force block size, so the padding gets searched too
+	static const int m_count = 1003;
+	static const int m_dimensions = 9;
+	static const int m_k = 5;
+
+	vector<ANNcoord> m_storage;
+	vector<ANNpoint> m_points;
+
+	NearestNeighborIndexTest()
+	{
+		srand(42);
+		m_storage.resize(m_count * m_dimensions);
+		m_points.resize(m_count);
+		for(int i = 0; i < m_count; i++)
+		{
+			m_points[i] = &m_storage[i * m_dimensions];
+			for(int d = 0; d < m_dimensions; d++)
+			{
+				m_points[i][d] = (double)rand() / RAND_MAX;
+			}
+		}
+	}
+
+	void RandomQuery(ANNcoord *query)
+	{
+		for(int d = 0; d < m_dimensions; d++)
+		{
+			query[d] = (double)rand() / RAND_MAX;
+		}
+	}
+
+	// Share of the true k nearest neighbors (by brute force) that the index finds, over some random queries
+	double GetRecall(NearestNeighborIndex &index, const ANNpoint *points, int count, int dimensions, int k, int queries)
+	{
+		BruteForceIndex exact(points, count, dimensions);
+		vector<ANNcoord> query(dimensions);
+		vector<ANNidx> expectedIdx(k), actualIdx(k);
+		vector<ANNdist> expectedDists(k), actualDists(k);
+		int found = 0;
+
+		for(int q = 0; q < queries; q++)
+		{
+			for(int d = 0; d < dimensions; d++)
+			{
+				query[d] = (double)rand() / RAND_MAX;
+			}
+			exact.Search(&query[0], k, &expectedIdx[0], &expectedDists[0], 0);
+			index.Search(&query[0], k, &actualIdx[0], &actualDists[0], 0);
+
+			for(int i = 0; i < k; i++)
+			{
+				found += (find(actualIdx.begin(), actualIdx.end(), expectedIdx[i]) != actualIdx.end());
+			}
+		}
+		return (double)found / (queries * k);
+	}
+
+	// Every query has to give the same neighbors from both, in the same order
+	void ExpectSameNeighbors(NearestNeighborIndex &expected, NearestNeighborIndex &actual)
+	{
+		ANNcoord query[m_dimensions];
+		ANNidx expectedIdx[m_k], actualIdx[m_k];
+		ANNdist expectedDists[m_k], actualDists[m_k];
+
+		for(int q = 0; q < 50; q++)
+		{
+			RandomQuery(query);
+
+			expected.Search(query, m_k, expectedIdx, expectedDists, 0);
+			actual.Search(query, m_k, actualIdx, actualDists, 0);
+
+			for(int i = 0; i < m_k; i++)
+			{
+				EXPECT_EQ(expectedIdx[i], actualIdx[i]);
+				// The vector kernels use fused multiply-adds, so the last bit can differ
+				EXPECT_NEAR(expectedDists[i], actualDists[i], 1e-12);
+			}
+		}
+	}
+};
+
+const int NearestNeighborIndexTest::m_count;
+const int NearestNeighborIndexTest::m_dimensions;
+const int NearestNeighborIndexTest::m_k;
+
+TEST_F(NearestNeighborIndexTest, test_bruteForceMatchesKdTree)
+{
+	KdTreeIndex tree(&m_points[0], m_count, m_dimensions);
+
+	BruteForceIndex scalar(&m_points[0], m_count, m_dimensions, SIMD_SCALAR);
+	EXPECT_EQ(SIMD_SCALAR, scalar.GetSimdLevel());
+	ExpectSameNeighbors(tree, scalar);
+
+	// Whatever this machine has
+	BruteForceIndex best(&m_points[0], m_count, m_dimensions);
+	EXPECT_EQ(BruteForceIndex::DetectSimdLevel(), best.GetSimdLevel());
+	ExpectSameNeighbors(tree, best);
+
+	if(BruteForceIndex::DetectSimdLevel() >= SIMD_AVX512)
+	{
+		BruteForceIndex avx2(&m_points[0], m_count, m_dimensions, SIMD_AVX2);
+		ExpectSameNeighbors(tree, avx2);
+	}
+}
+
+TEST_F(NearestNeighborIndexTest, test_fewerPointsThanK)
+{
+	BruteForceIndex index(&m_points[0], 3, m_dimensions);
+
+	ANNidx nnIdx[m_k];
+	ANNdist dists[m_k];
+	index.Search(m_points[1], m_k, nnIdx, dists, 0);
+
+	EXPECT_EQ(1, nnIdx[0]);
+	EXPECT_EQ(0, dists[0]);
+	EXPECT_NE(ANN_NULL_IDX, nnIdx[1]);
+	EXPECT_NE(ANN_NULL_IDX, nnIdx[2]);
+	EXPECT_EQ(ANN_NULL_IDX, nnIdx[3]);
+	EXPECT_EQ(ANN_NULL_IDX, nnIdx[4]);
+}
+
+TEST_F(NearestNeighborIndexTest, test_hnswRecall)
+{
+	NearestNeighborSettings settings;
+	settings.m_backend = NN_HNSW;
+	HnswIndex index(&m_points[0], m_count, m_dimensions, settings);
+	EXPECT_EQ(m_count, index.GetCount());
+
+	EXPECT_GE(GetRecall(index, &m_points[0], m_count, m_dimensions, m_k, 200), 0.95);
+
+	// A point's nearest neighbor is itself
+	ANNidx nnIdx[m_k];
+	ANNdist dists[m_k];
+	for(int i = 0; i < m_count; i += 100)
+	{
+		index.Search(m_points[i], m_k, nnIdx, dists, 0);
+		EXPECT_EQ(i, nnIdx[0]);
+		EXPECT_EQ(0, dists[0]);
+		for(int j = 1; j < m_k; j++)
+		{
+			EXPECT_LE(dists[j - 1], dists[j]);
+		}
+	}
+}
+
+TEST_F(NearestNeighborIndexTest, test_hnswAdd)
+{
+	NearestNeighborSettings settings;
+	HnswIndex index(&m_points[0], m_count / 2, m_dimensions, settings);
+
+	ANNidx nnIdx[m_k];
+	ANNdist dists[m_k];
+	for(int i = m_count / 2; i < m_count; i++)
+	{
+		EXPECT_EQ(i, index.Add(m_points[i]));
+	}
+	EXPECT_EQ(m_count, index.GetCount());
+
+	for(int i = m_count / 2; i < m_count; i += 50)
+	{
+		index.Search(m_points[i], m_k, nnIdx, dists, 0);
+		EXPECT_EQ(i, nnIdx[0]);
+	}
+	EXPECT_GE(GetRecall(index, &m_points[0], m_count, m_dimensions, m_k, 200), 0.95);
+}
+
+TEST_F(NearestNeighborIndexTest, test_hnswSnapshot)
+{
+	string file = "/tmp/novaHnswSnapshot";
+	NearestNeighborSettings settings;
+	HnswIndex index(&m_points[0], m_count, m_dimensions, settings);
+
+	{
+		SnapshotWriter snapshot(file, SNAPSHOT_KNN);
+		index.Write(snapshot);
+		ASSERT_TRUE(snapshot.Commit());
+	}
+
+	MappedSnapshot snapshot;
+	ASSERT_TRUE(snapshot.Open(file, SNAPSHOT_KNN));
+	HnswIndex *restored = HnswIndex::Read(snapshot, &m_points[0], m_count, m_dimensions, settings);
+	ASSERT_TRUE(restored != NULL);
+	ExpectSameNeighbors(index, *restored);
+
+	// Adding to either one has to give the same graph
+	EXPECT_EQ(index.Add(m_points[0]), restored->Add(m_points[0]));
+	ExpectSameNeighbors(index, *restored);
+	delete restored;
+
+	// Not a graph over these points
+	snapshot.Close();
+	ASSERT_TRUE(snapshot.Open(file, SNAPSHOT_KNN));
+	EXPECT_TRUE(HnswIndex::Read(snapshot, &m_points[0], m_count - 1, m_dimensions, settings) == NULL);
+
+	unlink(file.c_str());
+}
+
+// Overwrites 4 bytes of a file in place, returning what was there
+static int32_t PatchFile(const string &file, long offset, int32_t value)
+{
+	int32_t old = 0;
+	FILE *f = fopen(file.c_str(), "r+b");
+	if(f == NULL)
+	{
+		ADD_FAILURE() << "Unable to open " << file;
+		return old;
+	}
+	fseek(f, offset, SEEK_SET);
+	EXPECT_EQ(1, fread(&old, sizeof(old), 1, f));
+	fseek(f, offset, SEEK_SET);
+	fwrite(&value, sizeof(value), 1, f);
+	fclose(f);
+	return old;
+}
+
+TEST_F(NearestNeighborIndexTest, test_hnswDamagedSnapshot)
+{
+	string file = "/tmp/novaHnswSnapshot";
+	NearestNeighborSettings settings;
+	HnswIndex index(&m_points[0], m_count, m_dimensions, settings);
+
+	// After the snapshot header comes the graph's own (padded to 32 bytes), then each node's link
+	// count and links on the bottom layer
+	long topLevelOffset = sizeof(SnapshotHeader) + 24;
+	long baseLinksOffset = sizeof(SnapshotHeader) + 32;
+	int32_t maxBaseLinks = 2 * max(settings.m_hnswM, 2u);
+
+	// A link past the last point, more links than there's room for, and a top layer the entry point isn't on
+	long offsets[3] = {baseLinksOffset + 4, baseLinksOffset, topLevelOffset};
+	for(int i = 0; i < 3; i++)
+	{
+		{
+			SnapshotWriter snapshot(file, SNAPSHOT_KNN);
+			index.Write(snapshot);
+			ASSERT_TRUE(snapshot.Commit());
+		}
+		int32_t values[3] = {m_count, maxBaseLinks + 1, 0};
+		if(i == 2)
+		{
+			values[2] = PatchFile(file, topLevelOffset, 0) + 1;
+		}
+		PatchFile(file, offsets[i], values[i]);
+
+		MappedSnapshot snapshot;
+		ASSERT_TRUE(snapshot.Open(file, SNAPSHOT_KNN));
+		EXPECT_TRUE(HnswIndex::Read(snapshot, &m_points[0], m_count, m_dimensions, settings) == NULL) << i;
+	}
+
+	unlink(file.c_str());
+}
+
+// Recall and queries per second of the kd-tree and HNSW over a training set sized like months of
+// merged captures: clusters of points in 14 dimensions
+TEST(NearestNeighborBenchmark, DISABLED_benchmarkHnsw)
+{
+	const int count = 1000000, dimensions = 14, k = 3, queries = 2000, clusters = 500;
+
+	srand(7);
+	vector<ANNcoord> centers(clusters * dimensions);
+	for(uint i = 0; i < centers.size(); i++)
+	{
+		centers[i] = (double)rand() / RAND_MAX;
+	}
+	vector<ANNcoord> storage((size_t)count * dimensions);
+	vector<ANNpoint> points(count);
+	for(int i = 0; i < count; i++)
+	{
+		points[i] = &storage[(size_t)i * dimensions];
+		const ANNcoord *center = &centers[(rand() % clusters) * dimensions];
+		for(int d = 0; d < dimensions; d++)
+		{
+			points[i][d] = center[d] + ((double)rand() / RAND_MAX - 0.5) * 0.05;
+		}
+	}
+	vector<ANNcoord> queryPoints(queries * dimensions);
+	for(int q = 0; q < queries; q++)
+	{
+		const ANNcoord *center = &centers[(rand() % clusters) * dimensions];
+		for(int d = 0; d < dimensions; d++)
+		{
+			queryPoints[q * dimensions + d] = center[d] + ((double)rand() / RAND_MAX - 0.5) * 0.05;
+		}
+	}
+
+	struct timeval start, end;
+	vector<ANNidx> exactIdx(queries * k);
+	vector<ANNdist> dists(k);
+
+	gettimeofday(&start, NULL);
+	KdTreeIndex tree(&points[0], count, dimensions);
+	gettimeofday(&end, NULL);
+	double buildTime = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+	gettimeofday(&start, NULL);
+	for(int q = 0; q < queries; q++)
+	{
+		tree.Search(&queryPoints[q * dimensions], k, &exactIdx[q * k], &dists[0], 0);
+	}
+	gettimeofday(&end, NULL);
+	double searchTime = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	cout << "kd-tree: built in " << buildTime << "s, " << queries / searchTime << " queries/s" << endl;
+
+	NearestNeighborSettings settings;
+	gettimeofday(&start, NULL);
+	HnswIndex graph(&points[0], count, dimensions, settings);
+	gettimeofday(&end, NULL);
+	buildTime = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	cout << "HNSW: built in " << buildTime << "s" << endl;
+
+	// Only the search setting changes from one run to the next, so load the graph rather than building it again
+	string file = "/tmp/novaHnswBenchmark";
+	{
+		SnapshotWriter snapshot(file, SNAPSHOT_KNN);
+		graph.Write(snapshot);
+		ASSERT_TRUE(snapshot.Commit());
+	}
+
+	uint efs[] = {16, 32, 64, 128, 256};
+	for(uint e = 0; e < sizeof(efs) / sizeof(efs[0]); e++)
+	{
+		settings.m_hnswEfSearch = efs[e];
+		MappedSnapshot snapshot;
+		ASSERT_TRUE(snapshot.Open(file, SNAPSHOT_KNN));
+		HnswIndex *index = HnswIndex::Read(snapshot, &points[0], count, dimensions, settings);
+		ASSERT_TRUE(index != NULL);
+
+		vector<ANNidx> nnIdx(k);
+		int found = 0;
+		gettimeofday(&start, NULL);
+		for(int q = 0; q < queries; q++)
+		{
+			index->Search(&queryPoints[q * dimensions], k, &nnIdx[0], &dists[0], 0);
+			for(int i = 0; i < k; i++)
+			{
+				found += (find(nnIdx.begin(), nnIdx.end(), exactIdx[q * k + i]) != nnIdx.end());
+			}
+		}
+		gettimeofday(&end, NULL);
+		searchTime = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+		cout << "HNSW ef " << efs[e] << ": recall " << (double)found / (queries * k) << ", " << queries / searchTime << " queries/s" << endl;
+
+		delete index;
+	}
+	unlink(file.c_str());
+}
+
+// Classifications per second of the KNN engine at each CLASSIFICATION_NOTES level, and for suspects
+// being explained, which get full notes whatever the level
+TEST(NearestNeighborBenchmark, DISABLED_benchmarkClassifyBatchNotes)
+{
+	const int count = 100000, clusters = 500, suspectCount = 1000, rounds = 20;
+
+	srand(7);
+	vector<double> centers(clusters * DIM);
+	for(uint i = 0; i < centers.size(); i++)
+	{
+		centers[i] = rand() % 1000;
+	}
+
+	// A training file of clusters, each all hostile or all benign, and an engine configuration using every feature
+	string trainingFile = "/tmp/novaKnnNotesBenchmark.txt";
+	string configFile = "/tmp/novaKnnNotesBenchmark.config";
+	{
+		ofstream training(trainingFile.c_str());
+		for(int i = 0; i < count; i++)
+		{
+			int cluster = rand() % clusters;
+			for(int d = 0; d < DIM; d++)
+			{
+				training << centers[cluster * DIM + d] * (0.95 + 0.1 * rand() / RAND_MAX) << " ";
+			}
+			training << cluster % 2 << endl;
+		}
+
+		ofstream config(configFile.c_str());
+		config << "ENABLED_FEATURES " << string(DIM, '1') << endl;
+		config << "FEATURE_WEIGHTS";
+		for(int d = 0; d < DIM; d++)
+		{
+			config << " 1";
+		}
+		config << endl;
+		config << "DATAFILE " << trainingFile << endl;
+	}
+
+	KnnClassification engine;
+	engine.LoadConfiguration(configFile);
+
+	vector<Suspect> suspects(suspectCount);
+	vector<Suspect *> batch(suspectCount);
+	for(int s = 0; s < suspectCount; s++)
+	{
+		batch[s] = &suspects[s];
+		const double *center = &centers[(rand() % clusters) * DIM];
+		for(int d = 0; d < DIM; d++)
+		{
+			suspects[s].m_features.m_features[d] = center[d] * (0.9 + 0.2 * rand() / RAND_MAX);
+		}
+	}
+	vector<double> classifications(suspectCount);
+
+	uint notesLevel = Config::Inst()->GetClassificationNotes();
+	uint levels[] = {NOTES_NONE, NOTES_ON_DEMAND, NOTES_FULL, NOTES_ON_DEMAND};
+	const char *names[] = {"CLASSIFICATION_NOTES 0", "CLASSIFICATION_NOTES 1", "CLASSIFICATION_NOTES 2", "CLASSIFICATION_NOTES 1, explained"};
+	for(uint l = 0; l < sizeof(levels) / sizeof(levels[0]); l++)
+	{
+		Config::Inst()->SetClassificationNotes(levels[l]);
+		for(int s = 0; s < suspectCount; s++)
+		{
+			suspects[s].m_explainClassification = (l == 3);
+		}
+
+		// One batch first so this thread's search buffers have grown
+		engine.ClassifyBatch(&batch[0], suspectCount, &classifications[0]);
+
+		double elapsed = 0;
+		for(int r = 0; r < rounds; r++)
+		{
+			// Suspects are fresh every time they're classified in Novad, so their notes start out empty
+			for(int s = 0; s < suspectCount; s++)
+			{
+				string().swap(suspects[s].m_classificationNotes);
+			}
+
+			struct timeval start, end;
+			gettimeofday(&start, NULL);
+			engine.ClassifyBatch(&batch[0], suspectCount, &classifications[0]);
+			gettimeofday(&end, NULL);
+			elapsed += (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+		}
+		cout << names[l] << ": " << rounds * suspectCount / elapsed << " classifications/s" << endl;
+	}
+	Config::Inst()->SetClassificationNotes(notesLevel);
+
+	unlink(KnnClassification::GetSnapshotPath(configFile).c_str());
+	unlink(configFile.c_str());
+	unlink(trainingFile.c_str());
+}
+
+TEST(NearestNeighborBackendTest, test_parseBackend)
+{
+	NearestNeighborBackend backend = NN_KDTREE;
+	EXPECT_TRUE(NearestNeighborIndex::ParseBackend("bruteforce", backend));
+	EXPECT_EQ(NN_BRUTE_FORCE, backend);
+	EXPECT_FALSE(NearestNeighborIndex::ParseBackend("octree", backend));
+	EXPECT_EQ(NN_BRUTE_FORCE, backend);
+	EXPECT_TRUE(NearestNeighborIndex::ParseBackend("hnsw", backend));
+	EXPECT_EQ(NN_HNSW, backend);
+	EXPECT_TRUE(NearestNeighborIndex::ParseBackend("kdtree", backend));
+	EXPECT_EQ(NN_KDTREE, backend);
+}
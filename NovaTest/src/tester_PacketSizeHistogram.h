@@ -0,0 +1,106 @@
+//============================================================================
+// Name        : tester_PacketSizeHistogram.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : This file contains unit tests for the class PacketSizeHistogram
+//============================================================================/*
+
+#include "gtest/gtest.h"
+
+#include "PacketSizeHistogram.h"
+#include "SerializationHelper.h"
+
+#include <math.h>
+#include <vector>
+
+using namespace Nova;
+
+class PacketSizeHistogramTest : public ::testing::Test {
+protected:
+	PacketSizeHistogram m_histogram;
+};
+
+TEST_F(PacketSizeHistogramTest, test_buckets)
+{
+	// Every size lands in a bucket whose bounds contain it, and the buckets tile the whole range
+	uint16_t expectedLow = 0;
+	for(uint index = 0; index < PACKET_SIZE_BUCKETS; index++)
+	{
+		EXPECT_EQ(expectedLow, PacketSizeHistogram::GetBucketLowerBound(index));
+		expectedLow = PacketSizeHistogram::GetBucketUpperBound(index) + 1;
+	}
+	EXPECT_EQ(0, expectedLow);
+
+	for(uint size = 0; size <= 65535; size += 7)
+	{
+		uint index = PacketSizeHistogram::GetBucketIndex(size);
+		ASSERT_LT(index, PACKET_SIZE_BUCKETS);
+		EXPECT_LE(PacketSizeHistogram::GetBucketLowerBound(index), size);
+		EXPECT_GE(PacketSizeHistogram::GetBucketUpperBound(index), size);
+	}
+
+	// Small sizes are exact
+	EXPECT_EQ(PacketSizeHistogram::GetBucketLowerBound(PacketSizeHistogram::GetBucketIndex(60)), 60);
+	EXPECT_EQ(PacketSizeHistogram::GetBucketUpperBound(PacketSizeHistogram::GetBucketIndex(60)), 60);
+}
+
+TEST_F(PacketSizeHistogramTest, test_moments)
+{
+	EXPECT_EQ(0, m_histogram.GetMean());
+	EXPECT_EQ(0, m_histogram.GetDeviation());
+
+	m_histogram.Add(40, 3);
+	m_histogram.Add(1500);
+	m_histogram.Add(1501);
+
+	EXPECT_EQ(5, m_histogram.GetCount());
+	EXPECT_EQ(3 * 40 + 1500 + 1501, m_histogram.GetSum());
+	EXPECT_DOUBLE_EQ(3121.0 / 5, m_histogram.GetMean());
+
+	// Deviation is exact even though 1500 and 1501 share a bucket
+	double mean = 3121.0 / 5;
+	double variance = (3 * (40 - mean) * (40 - mean) + (1500 - mean) * (1500 - mean) + (1501 - mean) * (1501 - mean)) / 5;
+	EXPECT_NEAR(sqrt(variance), m_histogram.GetDeviation(), 1e-9);
+	EXPECT_EQ(3, m_histogram.GetBucket(PacketSizeHistogram::GetBucketIndex(40)));
+	EXPECT_EQ(2, m_histogram.GetBucket(PacketSizeHistogram::GetBucketIndex(1500)));
+}
+
+TEST_F(PacketSizeHistogramTest, test_serializeAndMerge)
+{
+	m_histogram.Add(40, 10);
+	m_histogram.Add(576);
+	m_histogram.Add(65535);
+
+	std::vector<u_char> buffer(m_histogram.GetSerializeLength());
+	EXPECT_EQ(buffer.size(), m_histogram.Serialize(&buffer[0], buffer.size()));
+
+	PacketSizeHistogram copy;
+	copy.Add(1000);
+	EXPECT_EQ(buffer.size(), copy.Deserialize(&buffer[0], buffer.size()));
+	EXPECT_EQ(m_histogram.GetCount(), copy.GetCount());
+	EXPECT_EQ(m_histogram.GetSumOfSquares(), copy.GetSumOfSquares());
+	EXPECT_EQ(0, copy.GetBucket(PacketSizeHistogram::GetBucketIndex(1000)));
+	for(uint index = 0; index < PACKET_SIZE_BUCKETS; index++)
+	{
+		EXPECT_EQ(m_histogram.GetBucket(index), copy.GetBucket(index));
+	}
+
+	copy.Merge(m_histogram);
+	EXPECT_EQ(2 * m_histogram.GetCount(), copy.GetCount());
+	EXPECT_EQ(20, copy.GetBucket(PacketSizeHistogram::GetBucketIndex(40)));
+	EXPECT_DOUBLE_EQ(m_histogram.GetMean(), copy.GetMean());
+
+	// Truncated blobs are rejected
+	EXPECT_THROW(copy.Deserialize(&buffer[0], buffer.size() - 1), serializationException);
+}
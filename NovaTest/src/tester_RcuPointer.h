@@ -0,0 +1,89 @@
+//============================================================================
+// Name        : tester_RcuPointer.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : This file contains unit tests for the RcuPointer template
+//============================================================================/*
+
+#include "gtest/gtest.h"
+
+#include "RcuPointer.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+using namespace Nova;
+
+// Counts how many have been destroyed
+struct RcuTestObject
+{
+	static int m_destroyed;
+	int m_value;
+
+	RcuTestObject(int value)
+	{
+		m_value = value;
+	}
+
+	~RcuTestObject()
+	{
+		m_destroyed++;
+	}
+};
+int RcuTestObject::m_destroyed = 0;
+
+static RcuPointer<RcuTestObject> *rcuTestPointer;
+
+static void *RcuTestPublisher(void *ptr)
+{
+	rcuTestPointer->Publish(new RcuTestObject(2));
+	return NULL;
+}
+
+TEST(RcuPointerTest, test_publishWaitsForReaders)
+{
+	RcuTestObject::m_destroyed = 0;
+	rcuTestPointer = new RcuPointer<RcuTestObject>(new RcuTestObject(1));
+
+	pthread_t publisher;
+	{
+		RcuPointer<RcuTestObject>::ReadGuard reader(*rcuTestPointer);
+		EXPECT_EQ(1, reader->m_value);
+
+		pthread_create(&publisher, NULL, RcuTestPublisher, NULL);
+
+		// Readers that start after the publish get the new object right away, while the old one
+		// is kept for the reader that still has it
+		int value = 1;
+		for(int i = 0; i < 1000 && value == 1; i++)
+		{
+			RcuPointer<RcuTestObject>::ReadGuard later(*rcuTestPointer);
+			value = later->m_value;
+			usleep(1000);
+		}
+		EXPECT_EQ(2, value);
+		EXPECT_EQ(1, reader->m_value);
+		EXPECT_EQ(0, RcuTestObject::m_destroyed);
+	}
+
+	pthread_join(publisher, NULL);
+	EXPECT_EQ(1, RcuTestObject::m_destroyed);
+
+	// Nothing to wait for with no readers about
+	rcuTestPointer->Publish(new RcuTestObject(3));
+	EXPECT_EQ(2, RcuTestObject::m_destroyed);
+
+	delete rcuTestPointer;
+	EXPECT_EQ(3, RcuTestObject::m_destroyed);
+}
@@ -0,0 +1,138 @@
+//============================================================================
+// Name        : tester_SlabAllocator.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : This file contains unit tests for the SlabAllocator template
+//============================================================================/*
+
+#include "gtest/gtest.h"
+
+#include "SlabAllocator.h"
+
+using namespace Nova;
+
+// Every test gets its own element type, and so its own allocator, so the tests don't see each
+// other's counters or free lists and can run in any order
+template <int test>
+struct SlabTestNode
+{
+	SlabTestNode *m_next;
+	int m_value;
+};
+
+template <int test>
+static SlabTestNode<test> *MakeChain(uint length)
+{
+	SlabTestNode<test> *first = NULL;
+	for(uint i = 0; i < length; i++)
+	{
+		SlabTestNode<test> *node = new (SlabAllocator<SlabTestNode<test> >::Allocate()) SlabTestNode<test>();
+		node->m_value = i;
+		node->m_next = first;
+		first = node;
+	}
+	return first;
+}
+
+TEST(SlabAllocatorTest, test_chainAccounting)
+{
+	typedef SlabAllocator<SlabTestNode<0> > Allocator;
+
+	SlabTestNode<0> *chain = MakeChain<0>(10);
+	Allocator::FreeChain(chain);
+
+	SlabStatistics stats = Allocator::GetStatistics();
+	EXPECT_EQ(1, stats.m_slabs);
+	EXPECT_EQ(Allocator::SLAB_OBJECTS, stats.m_capacity);
+	EXPECT_EQ(10, stats.m_allocations);
+	EXPECT_EQ(0, stats.m_inUse);
+}
+
+TEST(SlabAllocatorTest, test_freedObjectsAreReused)
+{
+	typedef SlabAllocator<SlabTestNode<1> > Allocator;
+
+	void *first = Allocator::Allocate();
+	Allocator::Free(first);
+	void *second = Allocator::Allocate();
+	EXPECT_EQ(first, second);
+	Allocator::Free(second);
+
+	// Chains handed to the depot come back once the current slab is used up
+	SlabTestNode<1> *chain = MakeChain<1>(Allocator::SLAB_OBJECTS);
+	Allocator::FreeChain(chain);
+	chain = MakeChain<1>(Allocator::SLAB_OBJECTS);
+	Allocator::FreeChain(chain);
+
+	SlabStatistics stats = Allocator::GetStatistics();
+	EXPECT_LE(stats.m_slabs, 2);
+	EXPECT_GT(stats.m_recycled, 0);
+	EXPECT_EQ(0, stats.m_inUse);
+}
+
+TEST(SlabAllocatorTest, test_statisticsAreCurrent)
+{
+	typedef SlabAllocator<SlabTestNode<2> > Allocator;
+
+	// Nothing here goes near the depot, the counts still have to show up straight away
+	void *a = Allocator::Allocate();
+	void *b = Allocator::Allocate();
+	Allocator::Free(a);
+
+	SlabStatistics stats = Allocator::GetStatistics();
+	EXPECT_EQ(2, stats.m_allocations);
+	EXPECT_EQ(1, stats.m_inUse);
+
+	Allocator::Free(b);
+	EXPECT_EQ(0, Allocator::GetStatistics().m_inUse);
+}
+
+static void *AllocateAndExit(void *)
+{
+	typedef SlabAllocator<SlabTestNode<3> > Allocator;
+
+	// Few enough that they stay in the thread's own free list
+	void *objects[10];
+	for(uint i = 0; i < 10; i++)
+	{
+		objects[i] = Allocator::Allocate();
+	}
+	for(uint i = 0; i < 10; i++)
+	{
+		Allocator::Free(objects[i]);
+	}
+	return NULL;
+}
+
+TEST(SlabAllocatorTest, test_exitedThreadsGiveBackTheirCache)
+{
+	typedef SlabAllocator<SlabTestNode<3> > Allocator;
+
+	pthread_t thread;
+	ASSERT_EQ(0, pthread_create(&thread, NULL, AllocateAndExit, NULL));
+	pthread_join(thread, NULL);
+
+	SlabStatistics stats = Allocator::GetStatistics();
+	EXPECT_EQ(1, stats.m_slabs);
+	EXPECT_EQ(10, stats.m_allocations);
+	EXPECT_EQ(0, stats.m_inUse);
+
+	// This thread has nothing of its own yet, so it gets the exited thread's objects and the
+	// rest of its slab rather than a new slab
+	SlabTestNode<3> *chain = MakeChain<3>(Allocator::SLAB_OBJECTS);
+	stats = Allocator::GetStatistics();
+	EXPECT_EQ(1, stats.m_slabs);
+	EXPECT_EQ(Allocator::SLAB_OBJECTS, stats.m_recycled);
+	Allocator::FreeChain(chain);
+}
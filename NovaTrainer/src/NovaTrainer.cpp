@@ -20,6 +20,7 @@
 #include "ClassificationEngine.h"
 #include "FilePacketCapture.h"
 #include "HaystackControl.h"
+#include "InterfaceTable.h"
 #include "EvidenceTable.h"
 #include "SuspectTable.h"
 #include "NovaTrainer.h"
@@ -144,9 +145,17 @@ void HandleTrainingPacket(u_char *index,const struct pcap_pkthdr *pkthdr,const u
 		case ETHERTYPE_IP:
 		{
 			//Prepare Packet structure
-			Evidence evidencePacket(packet + sizeof(struct ether_header), pkthdr);
+			_evidencePacket evidencePacket;
+			if(pkthdr->caplen <= sizeof(struct ether_header)
+				|| !Evidence::ParseHeaders(packet + sizeof(struct ether_header), pkthdr->caplen - sizeof(struct ether_header), pkthdr->ts.tv_sec, evidencePacket))
+			{
+				return;
+			}
 
-			suspects.ProcessEvidence(&evidencePacket, true);
+			PacketCapture *cap = reinterpret_cast<PacketCapture*>(index);
+			evidencePacket.interface = InterfaceTable::Inst()->GetIndex(cap->GetIdentifier());
+
+			suspects.ProcessEvidence(evidencePacket);
 			return;
 		}
 		default:
@@ -90,6 +90,10 @@ void ClearAllSuspects(int32_t messageID = -1);
 //	suspectAddress - The IP address (unique identifier) of the suspect to forget
 void ClearSuspect(SuspectID_pb suspectAddress, int32_t messageID = -1);
 
+//Asks Novad to reclassify the specified suspect with full classification notes, unless CLASSIFICATION_NOTES
+//	is 0. Replies with CONTROL_EXPLAIN_SUSPECT_REPLY, the notes in m_classificationNotes if it succeeded.
+void ExplainSuspect(SuspectID_pb suspectAddress, int32_t messageID = -1);
+
 //Asks Novad to reclassify all suspects
 void ReclassifyAllSuspects(int32_t messageID = -1);
 
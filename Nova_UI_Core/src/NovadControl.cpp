@@ -148,6 +148,18 @@ void ClearSuspect(SuspectID_pb suspectId, int32_t messageID)
 	MessageManager::Instance().WriteMessage(&clearRequest, 0);
 }
 
+void ExplainSuspect(SuspectID_pb suspectId, int32_t messageID)
+{
+	Message_pb explainRequest;
+	explainRequest.set_m_type(CONTROL_EXPLAIN_SUSPECT_REQUEST);
+	*explainRequest.mutable_m_suspectid() = suspectId;
+	if(messageID != -1)
+	{
+		explainRequest.set_m_messageid(messageID);
+	}
+	MessageManager::Instance().WriteMessage(&explainRequest, 0);
+}
+
 void ReclassifyAllSuspects(int32_t messageID)
 {
 	Message_pb request;
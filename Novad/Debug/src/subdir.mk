@@ -5,11 +5,14 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 CPP_SRCS += \
 ../src/ClassificationAggregator.cpp \
+../src/ClassificationCache.cpp \
 ../src/ClassificationEngine.cpp \
 ../src/ClassificationEngineFactory.cpp \
 ../src/Control.cpp \
+../src/HnswIndex.cpp \
 ../src/KnnClassification.cpp \
 ../src/Main.cpp \
+../src/NearestNeighborIndex.cpp \
 ../src/Novad.cpp \
 ../src/ProtocolHandler.cpp \
 ../src/ScriptAlertClassification.cpp \
@@ -18,11 +21,14 @@ CPP_SRCS += \
 
 OBJS += \
 ./src/ClassificationAggregator.o \
+./src/ClassificationCache.o \
 ./src/ClassificationEngine.o \
 ./src/ClassificationEngineFactory.o \
 ./src/Control.o \
+./src/HnswIndex.o \
 ./src/KnnClassification.o \
 ./src/Main.o \
+./src/NearestNeighborIndex.o \
 ./src/Novad.o \
 ./src/ProtocolHandler.o \
 ./src/ScriptAlertClassification.o \
@@ -31,11 +37,14 @@ OBJS += \
 
 CPP_DEPS += \
 ./src/ClassificationAggregator.d \
+./src/ClassificationCache.d \
 ./src/ClassificationEngine.d \
 ./src/ClassificationEngineFactory.d \
 ./src/Control.d \
+./src/HnswIndex.d \
 ./src/KnnClassification.d \
 ./src/Main.d \
+./src/NearestNeighborIndex.d \
 ./src/Novad.d \
 ./src/ProtocolHandler.d \
 ./src/ScriptAlertClassification.d \
@@ -5,6 +5,7 @@
 #include "Lock.h"
 
 #include <stdlib.h>
+#include <sys/time.h>
 
 
 using namespace std;
@@ -14,15 +15,25 @@ using namespace std;
 namespace Nova
 {
 
+static double MillisecondsSince(const struct timeval &start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start.tv_sec) * 1000.0 + (now.tv_usec - start.tv_usec) / 1000.0;
+}
+
 ClassificationAggregator::ClassificationAggregator()
 {
 	pthread_mutex_init(&lock, NULL);
+	m_epoch = 0;
 	LoadConfiguration("");
+	m_engineTime.assign(m_engines.size(), 0);
+	m_engineSuspects.assign(m_engines.size(), 0);
 }
 
 ClassificationAggregator::~ClassificationAggregator()
 {
-	Lock(&this->lock);
+	Lock destroyLock(&this->lock);
 	for (uint i = 0; i < m_engines.size(); i++) {
 		delete m_engines[i];
 	}
@@ -34,16 +45,19 @@ ClassificationAggregator::~ClassificationAggregator()
 
 void ClassificationAggregator::Reload()
 {
-	Lock(&this->lock);
-	for (uint i = 0; i < m_engines.size(); i++) {
-		delete m_engines[i];
+	// The new engines (and KNN's training data) are loaded before the lock is taken, so
+	// classification only ever waits for the swap
+	ClassificationAggregator replacement;
+	{
+		Lock reloadLock(&this->lock);
+		m_engines.swap(replacement.m_engines);
+		m_modes.swap(replacement.m_modes);
+		m_engineWeights.swap(replacement.m_engineWeights);
+		m_engineTime.swap(replacement.m_engineTime);
+		m_engineSuspects.swap(replacement.m_engineSuspects);
+		m_epoch++;
 	}
-
-	m_engines.clear();
-	m_modes.clear();
-	m_engineWeights.clear();
-
-	LoadConfiguration("");
+	// The old engines go with replacement
 }
 
 void ClassificationAggregator::LoadConfiguration(std::string filePath)
@@ -107,57 +121,165 @@ void ClassificationAggregator::LoadConfiguration(std::string filePath)
 
 double ClassificationAggregator::Classify(Suspect *s)
 {
-	Lock(&this->lock);
+	double classification;
+	ClassifyBatch(&s, 1, &classification);
+	return classification;
+}
 
-	// Clear the classification notes. The child engines will append to this.
-	s->m_classificationNotes = "";
+void ClassificationAggregator::ClassifyBatch(Suspect **suspects, uint count, double *classifications)
+{
+	Lock classifyLock(&this->lock);
 
-	double classification = 0;
-	for (uint i = 0; i < m_engines.size(); i++)
+	double threshold = Config::Inst()->GetClassificationThreshold();
+	uint notesLevel = Config::Inst()->GetClassificationNotes();
+	uint resolution = Config::Inst()->GetClassificationCacheResolution();
+	if(resolution != 0)
 	{
-		double engineVote = m_engines.at(i)->Classify(s);
-		//cout << "Suspect: " << s->GetIpAddress() << " Engine: " << i << " Classification: " << engineVote << endl;
+		m_cache.Trim(Config::Inst()->GetClassificationCacheSize());
+	}
 
-		classification += engineVote * m_engineWeights.at(i);
+	m_undecided.assign(suspects, suspects + count);
+	m_undecidedIndex.resize(count);
+	m_cacheEntries.resize(count);
+	for(uint i = 0; i < count; i++)
+	{
+		// Clear the classification notes. The child engines will append to this.
+		suspects[i]->m_classificationNotes = "";
+		classifications[i] = 0;
+		m_undecidedIndex[i] = i;
+
+		// A suspect being explained always gets a fresh look
+		m_cacheEntries[i] = NULL;
+		if(resolution != 0 && !suspects[i]->m_explainClassification)
+		{
+			m_cacheEntries[i] = m_cache.Lookup(suspects[i], m_engines.size(), m_epoch, notesLevel, resolution);
+		}
+	}
 
-		if (m_modes[i] == CLASSIFIER_WEIGHTED)
+	for(uint i = 0; i < m_engines.size() && !m_undecided.empty(); i++)
+	{
+		m_votes.resize(m_undecided.size());
+		if(resolution != 0 && m_engines.at(i)->IsCacheable())
+		{
+			ClassifyCached(i);
+		}
+		else
 		{
-			//
+			m_engines.at(i)->ClassifyBatch(&m_undecided[0], m_undecided.size(), &m_votes[0]);
 		}
-		else if (m_modes[i] == CLASSIFIER_HOSTILE_OVERRIDE)
+
+		// Suspects an override settles drop out here, the rest move down to fill the gaps
+		uint kept = 0;
+		for(uint j = 0; j < m_undecided.size(); j++)
 		{
-			if (engineVote > Config::Inst()->GetClassificationThreshold())
+			double engineVote = m_votes[j];
+			uint index = m_undecidedIndex[j];
+
+			classifications[index] += engineVote * m_engineWeights.at(i);
+
+			if((m_modes[i] == CLASSIFIER_HOSTILE_OVERRIDE && engineVote > threshold)
+				|| (m_modes[i] == CLASSIFIER_BENIGN_OVERRIDE && engineVote < threshold))
 			{
-				classification = engineVote;
-				break;
+				classifications[index] = engineVote;
+				continue;
 			}
+
+			m_undecided[kept] = m_undecided[j];
+			m_undecidedIndex[kept] = index;
+			kept++;
 		}
-		else if (m_modes[i] == CLASSIFIER_BENIGN_OVERRIDE)
+		m_undecided.resize(kept);
+		m_undecidedIndex.resize(kept);
+	}
+
+	for(uint i = 0; i < count; i++)
+	{
+		suspects[i]->SetClassification(classifications[i]);
+		suspects[i]->SetIsHostile(classifications[i] > threshold);
+	}
+}
+
+void ClassificationAggregator::ClassifyCached(uint engine)
+{
+	m_misses.clear();
+	m_missIndex.clear();
+
+	// Whatever the engine would do to the features happens to hits as well as misses, so what's
+	// left in them for the engines after this one (and the database) doesn't depend on the cache
+	m_comparable.resize(m_undecided.size() * DIM);
+	m_engines.at(engine)->GetComparableFeatures(&m_undecided[0], m_undecided.size(), &m_comparable[0]);
+
+	uint reused = 0;
+	for(uint j = 0; j < m_undecided.size(); j++)
+	{
+		Suspect *suspect = m_undecided[j];
+		ClassificationCacheEntry *entry = m_cacheEntries[m_undecidedIndex[j]];
+
+		if(entry != NULL && m_cache.Match(entry, engine, &m_comparable[j * DIM]))
 		{
-			if (engineVote < Config::Inst()->GetClassificationThreshold())
+			m_votes[j] = entry->m_votes[engine];
+			suspect->m_classificationNotes += entry->m_notes[engine];
+			suspect->SetHostileNeighbors(entry->m_hostileNeighbors);
+			for(uint f = 0; f < DIM; f++)
 			{
-				classification = engineVote;
-				break;
+				suspect->SetFeatureAccuracy((FeatureIndex)f, entry->m_featureAccuracy[f]);
 			}
+			reused++;
+			continue;
 		}
 
-
+		m_misses.push_back(suspect);
+		m_missIndex.push_back(j);
 	}
-    //cout << "Suspect: " << s->GetIpAddress() << " Engine: aggrigated" << " Classification: " << classification << endl;
-    //cout << endl;
-    s->SetClassification(classification);
 
+	if(!m_misses.empty())
+	{
+		// Each suspect's notes so far, so what this engine adds can be cut out and kept
+		m_notesStart.resize(m_misses.size());
+		for(uint k = 0; k < m_misses.size(); k++)
+		{
+			m_notesStart[k] = m_misses[k]->m_classificationNotes.size();
+		}
 
-    if (classification > Config::Inst()->GetClassificationThreshold())
-    {
-    	s->SetIsHostile(true);
-    }
-    else
-    {
-    	s->SetIsHostile(false);
-    }
+		m_missVotes.resize(m_misses.size());
+		struct timeval start;
+		gettimeofday(&start, NULL);
+		m_engines.at(engine)->ClassifyBatch(&m_misses[0], m_misses.size(), &m_missVotes[0]);
+		m_engineTime[engine] += MillisecondsSince(start);
+		m_engineSuspects[engine] += m_misses.size();
 
-	return classification;
+		for(uint k = 0; k < m_misses.size(); k++)
+		{
+			Suspect *suspect = m_misses[k];
+			uint j = m_missIndex[k];
+			m_votes[j] = m_missVotes[k];
+
+			ClassificationCacheEntry *entry = m_cacheEntries[m_undecidedIndex[j]];
+			if(entry == NULL)
+			{
+				continue;
+			}
+			entry->m_hasVote[engine] = true;
+			entry->m_votes[engine] = m_missVotes[k];
+			entry->m_notes[engine].assign(suspect->m_classificationNotes, m_notesStart[k], string::npos);
+			entry->m_hostileNeighbors = suspect->GetHostileNeighbors();
+			for(uint f = 0; f < DIM; f++)
+			{
+				entry->m_featureAccuracy[f] = suspect->GetFeatureAccuracy((FeatureIndex)f);
+			}
+		}
+	}
+
+	if(reused > 0 && m_engineSuspects[engine] > 0)
+	{
+		m_cache.RecordReuse(reused, reused * m_engineTime[engine] / m_engineSuspects[engine]);
+	}
+}
+
+ClassificationCacheStatistics ClassificationAggregator::GetCacheStatistics()
+{
+	Lock statisticsLock(&this->lock);
+	return m_cache.GetStatistics();
 }
 
 } /* namespace Nova */
@@ -4,6 +4,7 @@
 #include <pthread.h>
 
 #include "ClassificationEngine.h"
+#include "ClassificationCache.h"
 #include "Config.h"
 
 namespace Nova
@@ -20,13 +21,41 @@ public:
 	std::vector<double> m_engineWeights;
 
 	double Classify(Suspect *s);
+	// Runs each engine once over the whole batch. Suspects an override engine already decided
+	// are left out of the engines after it. Cacheable engines only see the suspects whose
+	// comparable features have left the buckets they were in when the engine last voted on them.
+	void ClassifyBatch(Suspect **suspects, uint count, double *classifications);
 	void Reload();
 
+	ClassificationCacheStatistics GetCacheStatistics();
+
 private:
 	void LoadConfiguration(std::string filePath);
 
+	// Fills in m_votes for engine from the cache where it can, running the engine on the rest
+	void ClassifyCached(uint engine);
+
 	pthread_mutex_t lock;
 
+	ClassificationCache m_cache;
+	// Bumped by every Reload, so nothing cached from the old engines is reused
+	uint64_t m_epoch;
+
+	// Time spent in each engine and the suspects it classified, for guessing the time the cache saves
+	std::vector<double> m_engineTime;
+	std::vector<uint64_t> m_engineSuspects;
+
+	// Reused from batch to batch, only touched with the lock held
+	std::vector<Suspect *> m_undecided;
+	std::vector<uint> m_undecidedIndex;
+	std::vector<double> m_votes;
+	std::vector<ClassificationCacheEntry *> m_cacheEntries;
+	std::vector<double> m_comparable;
+	std::vector<Suspect *> m_misses;
+	std::vector<uint> m_missIndex;
+	std::vector<double> m_missVotes;
+	std::vector<size_t> m_notesStart;
+
 };
 
 } /* namespace Nova */
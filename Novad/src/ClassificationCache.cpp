@@ -0,0 +1,186 @@
+//============================================================================
+// Name        : ClassificationCache.cpp
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Remembers each suspect's last engine votes so that a suspect
+//               whose features haven't moved much isn't classified all over again
+//============================================================================
+
+#include "ClassificationCache.h"
+
+#include <math.h>
+#include <string.h>
+
+using namespace std;
+
+// Where buckets stop, for features far outside anything normalized (or infinite)
+#define CACHE_MAX_BUCKET 2000000000.0
+
+namespace Nova
+{
+
+ClassificationCacheEntry::ClassificationCacheEntry()
+{
+	m_epoch = 0;
+	m_notesLevel = 0;
+	// Resolution 0 means the cache is off, so a new entry never matches a lookup
+	m_resolution = 0;
+	m_used = false;
+	m_hostileNeighbors = 0;
+	memset(m_featureAccuracy, 0, sizeof(m_featureAccuracy));
+}
+
+ClassificationCache::ClassificationCache()
+{
+	m_maxEntries = 0;
+	memset(&m_statistics, 0, sizeof(m_statistics));
+}
+
+int32_t ClassificationCache::Quantize(double value, uint resolution)
+{
+	if(value != value)
+	{
+		// NaN, keep it apart from every real value
+		return INT32_MIN;
+	}
+
+	double bucket = floor(value * resolution);
+	if(bucket > CACHE_MAX_BUCKET)
+	{
+		bucket = CACHE_MAX_BUCKET;
+	}
+	else if(bucket < -CACHE_MAX_BUCKET)
+	{
+		bucket = -CACHE_MAX_BUCKET;
+	}
+	return (int32_t)bucket;
+}
+
+void ClassificationCache::Quantize(const double *features, uint resolution, int32_t *key)
+{
+	for(uint i = 0; i < DIM; i++)
+	{
+		key[i] = Quantize(features[i], resolution);
+	}
+}
+
+ClassificationCacheEntry *ClassificationCache::Lookup(Suspect *suspect, uint engineCount, uint64_t epoch, uint notesLevel, uint resolution)
+{
+	SuspectID_pb id = suspect->GetIdentifier();
+	ClassificationCacheEntry *entry;
+	EntryTable::iterator it = m_entries.find(id);
+	if(it != m_entries.end())
+	{
+		entry = &it->second;
+	}
+	else
+	{
+		if(m_entries.size() >= m_maxEntries)
+		{
+			return NULL;
+		}
+		// Pointers into the table stay good when it rehashes, so the caller can hold
+		// on to this while more suspects are looked up
+		entry = &m_entries[id];
+	}
+	entry->m_used = true;
+
+	if(entry->m_epoch == epoch && entry->m_notesLevel == notesLevel && entry->m_resolution == resolution
+		&& entry->m_votes.size() == engineCount)
+	{
+		return entry;
+	}
+
+	entry->m_epoch = epoch;
+	entry->m_notesLevel = notesLevel;
+	entry->m_resolution = resolution;
+	entry->m_keys.assign((size_t)engineCount * DIM, 0);
+	entry->m_hasVote.assign(engineCount, false);
+	entry->m_votes.assign(engineCount, 0);
+	entry->m_notes.resize(engineCount);
+	for(uint i = 0; i < engineCount; i++)
+	{
+		entry->m_notes[i].clear();
+	}
+	return entry;
+}
+
+bool ClassificationCache::Match(ClassificationCacheEntry *entry, uint engine, const double *features)
+{
+	m_statistics.m_lookups++;
+
+	int32_t key[DIM];
+	Quantize(features, entry->m_resolution, key);
+
+	int32_t *savedKey = &entry->m_keys[(size_t)engine * DIM];
+	if(entry->m_hasVote[engine] && !memcmp(savedKey, key, sizeof(key)))
+	{
+		m_statistics.m_hits++;
+		return true;
+	}
+
+	memcpy(savedKey, key, sizeof(key));
+	entry->m_hasVote[engine] = false;
+	entry->m_notes[engine].clear();
+	return false;
+}
+
+void ClassificationCache::Trim(uint maxEntries)
+{
+	m_maxEntries = maxEntries;
+	if(m_entries.size() < m_maxEntries)
+	{
+		return;
+	}
+
+	for(EntryTable::iterator it = m_entries.begin(); it != m_entries.end();)
+	{
+		if(!it->second.m_used)
+		{
+			it = m_entries.erase(it);
+		}
+		else
+		{
+			it->second.m_used = false;
+			++it;
+		}
+	}
+
+	// If nearly everything is still in use, the next batch would sweep again and free next
+	// to nothing. Start over instead so sweeps stay rare.
+	if(m_entries.size() > m_maxEntries - m_maxEntries / 4)
+	{
+		m_entries.clear();
+	}
+}
+
+void ClassificationCache::RecordReuse(uint votes, double milliseconds)
+{
+	m_statistics.m_votesReused += votes;
+	m_statistics.m_timeSaved += milliseconds;
+}
+
+void ClassificationCache::Clear()
+{
+	m_entries.clear();
+}
+
+ClassificationCacheStatistics ClassificationCache::GetStatistics()
+{
+	ClassificationCacheStatistics statistics = m_statistics;
+	statistics.m_entries = m_entries.size();
+	return statistics;
+}
+
+} /* namespace Nova */
@@ -0,0 +1,118 @@
+//============================================================================
+// Name        : ClassificationCache.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Remembers each suspect's last engine votes so that a suspect
+//               whose features haven't moved much isn't classified all over again
+//============================================================================
+
+#ifndef CLASSIFICATIONCACHE_H_
+#define CLASSIFICATIONCACHE_H_
+
+#include "DatabaseQueue.h"
+#include "HashMap.h"
+#include "Suspect.h"
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace Nova
+{
+
+struct ClassificationCacheStatistics
+{
+	uint m_entries;
+
+	// Engine votes looked up, and how many of them were there for features in the same buckets
+	uint64_t m_lookups;
+	uint64_t m_hits;
+
+	// Engine votes taken from the cache instead of running the engine, and about how long
+	// running them would have taken, in ms
+	uint64_t m_votesReused;
+	double m_timeSaved;
+
+	double GetHitRate() const
+	{
+		return m_lookups == 0 ? 0 : (double)m_hits / m_lookups;
+	}
+};
+
+struct ClassificationCacheEntry
+{
+	ClassificationCacheEntry();
+
+	// What the entry was made from. Its votes are all dropped if any of these change.
+	uint64_t m_epoch;
+	uint m_notesLevel;
+	uint m_resolution;
+	// DIM per engine: the bucketed features each engine's vote was made from
+	std::vector<int32_t> m_keys;
+
+	// Set on every lookup and cleared by sweeps, entries that stay clear are dropped
+	bool m_used;
+
+	// One per engine in the aggregator, in the same order. Engines that aren't cacheable, or
+	// that the suspect never reached because of an override, have no vote.
+	std::vector<bool> m_hasVote;
+	std::vector<double> m_votes;
+	std::vector<std::string> m_notes;
+
+	// What the KNN engine leaves on the suspect besides its vote
+	int32_t m_hostileNeighbors;
+	double m_featureAccuracy[DIM];
+};
+
+class ClassificationCache
+{
+public:
+	ClassificationCache();
+
+	// Finds the suspect's entry, emptying it if it was made with another epoch, notes level or
+	// resolution. Returns NULL for a new suspect if the cache is full. Entries stay put until the
+	// next Trim, however many more suspects are looked up.
+	ClassificationCacheEntry *Lookup(Suspect *suspect, uint engineCount, uint64_t epoch, uint notesLevel, uint resolution);
+
+	// True if the entry has a vote from engine for features in the same buckets as these (from the
+	// engine's GetComparableFeatures). Otherwise drops the vote, keeping the buckets for the caller's.
+	bool Match(ClassificationCacheEntry *entry, uint engine, const double *features);
+
+	// Counts votes the caller took from the cache, and how long the engines would have spent on them
+	void RecordReuse(uint votes, double milliseconds);
+
+	// Call between batches. If there are maxEntries or more, drops the ones nobody has looked up
+	// since the last time, or everything if that doesn't free a quarter of the room.
+	void Trim(uint maxEntries);
+	void Clear();
+
+	ClassificationCacheStatistics GetStatistics();
+
+	// Which bucket a comparable feature value falls in: resolution buckets per unit, so for the
+	// KNN engine's normalized features, per the whole training range of a feature of weight 1.
+	// [0, 1/resolution) is bucket 0.
+	static int32_t Quantize(double value, uint resolution);
+	static void Quantize(const double *features, uint resolution, int32_t *key);
+
+private:
+	typedef HashMap<SuspectID_pb, ClassificationCacheEntry, std::hash<SuspectID_pb>, SuspectIDEq> EntryTable;
+
+	EntryTable m_entries;
+	uint m_maxEntries;
+
+	ClassificationCacheStatistics m_statistics;
+};
+
+} /* namespace Nova */
+#endif /* CLASSIFICATIONCACHE_H_ */
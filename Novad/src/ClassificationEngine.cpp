@@ -20,6 +20,7 @@
 #include "Config.h"
 
 #include <string>
+#include <string.h>
 
 using namespace Nova;
 using namespace std;
@@ -28,5 +29,20 @@ ClassificationEngine::ClassificationEngine() {}
 ClassificationEngine::~ClassificationEngine() {}
 void ClassificationEngine::Reload() {}
 
+void ClassificationEngine::ClassifyBatch(Suspect **suspects, uint count, double *classifications)
+{
+	for(uint i = 0; i < count; i++)
+	{
+		classifications[i] = Classify(suspects[i]);
+	}
+}
+
+void ClassificationEngine::GetComparableFeatures(Suspect **suspects, uint count, double *features)
+{
+	for(uint i = 0; i < count; i++)
+	{
+		memcpy(features + i * DIM, suspects[i]->m_features.m_features, sizeof(double) * DIM);
+	}
+}
 
 void ClassificationEngine::LoadConfiguration(string filePath){}
@@ -24,6 +24,8 @@
 #include "Novad.h"
 #include "ClassificationEngine.h"
 #include "Lock.h"
+#include "DatabaseWriter.h"
+#include "DatabaseQueue.h"
 
 extern Nova::ClassificationEngine *engine;
 extern pthread_t classificationLoopThread;
@@ -32,6 +34,7 @@ extern pthread_mutex_t shutdownClassificationMutex;
 extern bool shutdownClassification;
 extern pthread_cond_t shutdownClassificationCond;
 extern bool classificationRunning;
+extern Nova::DatabaseQueue suspects;
 
 using namespace std;
 
@@ -40,6 +43,8 @@ namespace Nova
 void SaveAndExit(int param)
 {	
 	StopCapture();
+	// The consumers classify suspects they evict for memory, so they have to be gone before the engine is
+	StopConsumers();
 
 	if(Config::Inst()->GetIsDmEnabled())
 	{
@@ -74,6 +79,13 @@ void SaveAndExit(int param)
 
 		delete engine;
 	}
+
+	// Keep what hasn't been written out yet for the next start, rather than waiting on the database
+	suspects.SaveSnapshot(Config::Inst()->GetPathHome() + "/" + SUSPECT_SNAPSHOT_FILE);
+
+	// Commit whatever is still waiting to be written
+	DatabaseWriter::Inst()->Stop();
+
 	annClose();
 	LOG(ALERT, "Novad is exiting cleanly.", "");
 	exit(EXIT_SUCCESS);
@@ -0,0 +1,486 @@
+//============================================================================
+// Name        : HnswIndex.cpp
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Approximate nearest neighbor search over a hierarchical navigable small
+//               world graph, for training sets too big to build a kd-tree over quickly
+//============================================================================
+
+#include "HnswIndex.h"
+#include "Lock.h"
+
+#include <algorithm>
+#include <functional>
+#include <math.h>
+
+// Layers are numbered in a byte, and a graph never gets anywhere near this many
+#define HNSW_MAX_LEVEL 32
+
+using namespace std;
+
+namespace Nova
+{
+
+HnswIndex::HnswIndex(int dimensions, const NearestNeighborSettings &settings)
+{
+	Init(dimensions, settings);
+}
+
+HnswIndex::HnswIndex(const ANNpoint *points, int count, int dimensions, const NearestNeighborSettings &settings)
+{
+	Init(dimensions, settings);
+
+	m_points.reserve(count);
+	m_levels.reserve(count);
+	m_baseLinks.reserve((size_t)count * (m_maxBaseLinks + 1));
+	m_upperOffsets.reserve(count);
+	for(int i = 0; i < count; i++)
+	{
+		Add(points[i]);
+	}
+}
+
+void HnswIndex::Init(int dimensions, const NearestNeighborSettings &settings)
+{
+	m_dimensions = dimensions;
+	m_maxLinks = max(settings.m_hnswM, 2u);
+	m_maxBaseLinks = m_maxLinks * 2;
+	m_efConstruction = max(settings.m_hnswEfConstruction, m_maxLinks);
+	m_efSearch = max(settings.m_hnswEfSearch, 1u);
+	m_levelScale = 1 / log((double)m_maxLinks);
+	// Fixed, so the same points always build the same graph
+	m_random = 0x9E3779B97F4A7C15ULL;
+
+	m_entryPoint = ANN_NULL_IDX;
+	m_topLevel = -1;
+
+	pthread_mutex_init(&m_scratchLock, NULL);
+	pthread_key_create(&m_scratchKey, NULL);
+}
+
+HnswIndex::~HnswIndex()
+{
+	pthread_key_delete(m_scratchKey);
+	for(uint i = 0; i < m_scratches.size(); i++)
+	{
+		delete m_scratches[i];
+	}
+	pthread_mutex_destroy(&m_scratchLock);
+}
+
+int HnswIndex::GetCount() const
+{
+	return m_points.size();
+}
+
+ANNidx *HnswIndex::GetLinks(ANNidx node, int level)
+{
+	if(level == 0)
+	{
+		return &m_baseLinks[(size_t)node * (m_maxBaseLinks + 1)];
+	}
+	return &m_upperLinks[m_upperOffsets[node] + (size_t)(level - 1) * (m_maxLinks + 1)];
+}
+
+const ANNidx *HnswIndex::GetLinks(ANNidx node, int level) const
+{
+	return const_cast<HnswIndex *>(this)->GetLinks(node, level);
+}
+
+ANNdist HnswIndex::Distance(const ANNcoord *a, const ANNcoord *b) const
+{
+	ANNdist dist = 0;
+	for(int d = 0; d < m_dimensions; d++)
+	{
+		ANNcoord diff = a[d] - b[d];
+		dist += diff * diff;
+	}
+	return dist;
+}
+
+int HnswIndex::RandomLevel()
+{
+	// xorshift64*, uniform on (0, 1]
+	m_random ^= m_random >> 12;
+	m_random ^= m_random << 25;
+	m_random ^= m_random >> 27;
+	double uniform = ((m_random * 0x2545F4914F6CDD1DULL >> 11) + 1) * (1.0 / 9007199254740992.0);
+
+	int level = (int)(-log(uniform) * m_levelScale);
+	return min(level, HNSW_MAX_LEVEL - 1);
+}
+
+HnswIndex::Scratch *HnswIndex::GetScratch() const
+{
+	Scratch *scratch = (Scratch *)pthread_getspecific(m_scratchKey);
+	if(scratch == NULL)
+	{
+		scratch = new Scratch();
+		pthread_setspecific(m_scratchKey, scratch);
+
+		Lock lock(&m_scratchLock);
+		m_scratches.push_back(scratch);
+	}
+	return scratch;
+}
+
+void HnswIndex::StartSearch(Scratch &scratch) const
+{
+	if(scratch.m_visited.size() < m_points.size())
+	{
+		scratch.m_visited.resize(m_points.size() + m_points.size() / 2, 0);
+	}
+
+	scratch.m_tag++;
+	if(scratch.m_tag == 0)
+	{
+		// Wrapped around, so old tags could be mistaken for this one
+		fill(scratch.m_visited.begin(), scratch.m_visited.end(), 0);
+		scratch.m_tag = 1;
+	}
+
+	scratch.m_candidates.clear();
+	scratch.m_results.clear();
+}
+
+ANNidx HnswIndex::Descend(const ANNcoord *query, ANNidx entry, ANNdist &entryDist, int level) const
+{
+	bool moved = true;
+	while(moved)
+	{
+		moved = false;
+		const ANNidx *links = GetLinks(entry, level);
+		for(ANNidx i = 1; i <= links[0]; i++)
+		{
+			ANNdist dist = Distance(query, m_points[links[i]]);
+			if(dist < entryDist)
+			{
+				entryDist = dist;
+				entry = links[i];
+				moved = true;
+			}
+		}
+	}
+	return entry;
+}
+
+void HnswIndex::SearchLayer(const ANNcoord *query, ANNidx entry, ANNdist entryDist, int level, uint ef, Scratch &scratch) const
+{
+	StartSearch(scratch);
+
+	Candidate start = {entryDist, entry};
+	scratch.m_visited[entry] = scratch.m_tag;
+	scratch.m_candidates.push_back(start);
+	scratch.m_results.push_back(start);
+
+	while(!scratch.m_candidates.empty())
+	{
+		Candidate nearest = scratch.m_candidates.front();
+		if(nearest.m_dist > scratch.m_results.front().m_dist && scratch.m_results.size() >= ef)
+		{
+			// Everything left to explore is further away than all of the ef nearest found
+			break;
+		}
+		pop_heap(scratch.m_candidates.begin(), scratch.m_candidates.end(), greater<Candidate>());
+		scratch.m_candidates.pop_back();
+
+		const ANNidx *links = GetLinks(nearest.m_id, level);
+		for(ANNidx i = 1; i <= links[0]; i++)
+		{
+			ANNidx neighbor = links[i];
+			if(scratch.m_visited[neighbor] == scratch.m_tag)
+			{
+				continue;
+			}
+			scratch.m_visited[neighbor] = scratch.m_tag;
+
+			ANNdist dist = Distance(query, m_points[neighbor]);
+			if(scratch.m_results.size() < ef || dist < scratch.m_results.front().m_dist)
+			{
+				Candidate found = {dist, neighbor};
+				scratch.m_candidates.push_back(found);
+				push_heap(scratch.m_candidates.begin(), scratch.m_candidates.end(), greater<Candidate>());
+				scratch.m_results.push_back(found);
+				push_heap(scratch.m_results.begin(), scratch.m_results.end());
+				if(scratch.m_results.size() > ef)
+				{
+					pop_heap(scratch.m_results.begin(), scratch.m_results.end());
+					scratch.m_results.pop_back();
+				}
+			}
+		}
+	}
+}
+
+void HnswIndex::Search(const ANNcoord *query, int k, ANNidx *nnIdx, ANNdist *dists, double eps) const
+{
+	if(k <= 0)
+	{
+		return;
+	}
+
+	int found = 0;
+	if(m_entryPoint != ANN_NULL_IDX)
+	{
+		ANNdist entryDist = Distance(query, m_points[m_entryPoint]);
+		ANNidx entry = m_entryPoint;
+		for(int level = m_topLevel; level > 0; level--)
+		{
+			entry = Descend(query, entry, entryDist, level);
+		}
+
+		Scratch &scratch = *GetScratch();
+		SearchLayer(query, entry, entryDist, 0, max(m_efSearch, (uint)k), scratch);
+
+		// Sorting a max heap leaves it nearest first
+		sort_heap(scratch.m_results.begin(), scratch.m_results.end());
+		found = min((int)scratch.m_results.size(), k);
+		for(int i = 0; i < found; i++)
+		{
+			nnIdx[i] = scratch.m_results[i].m_id;
+			dists[i] = scratch.m_results[i].m_dist;
+		}
+	}
+
+	for(int i = found; i < k; i++)
+	{
+		nnIdx[i] = ANN_NULL_IDX;
+		dists[i] = ANN_DIST_INF;
+	}
+}
+
+void HnswIndex::SelectNeighbors(const vector<Candidate> &candidates, uint maxLinks, vector<Candidate> &selected) const
+{
+	selected.clear();
+	for(uint i = 0; i < candidates.size() && selected.size() < maxLinks; i++)
+	{
+		bool keep = true;
+		for(uint j = 0; j < selected.size(); j++)
+		{
+			if(Distance(m_points[candidates[i].m_id], m_points[selected[j].m_id]) < candidates[i].m_dist)
+			{
+				keep = false;
+				break;
+			}
+		}
+		if(keep)
+		{
+			selected.push_back(candidates[i]);
+		}
+	}
+}
+
+void HnswIndex::Link(ANNidx from, ANNidx to, ANNdist dist, int level)
+{
+	ANNidx *links = GetLinks(from, level);
+	uint maxLinks = (level == 0) ? m_maxBaseLinks : m_maxLinks;
+
+	if((uint)links[0] < maxLinks)
+	{
+		links[++links[0]] = to;
+		return;
+	}
+
+	// Full, so choose again from what it has and the new one
+	m_pruneCandidates.clear();
+	Candidate added = {dist, to};
+	m_pruneCandidates.push_back(added);
+	for(ANNidx i = 1; i <= links[0]; i++)
+	{
+		Candidate existing = {Distance(m_points[from], m_points[links[i]]), links[i]};
+		m_pruneCandidates.push_back(existing);
+	}
+	sort(m_pruneCandidates.begin(), m_pruneCandidates.end());
+
+	SelectNeighbors(m_pruneCandidates, maxLinks, m_pruneSelected);
+	links[0] = m_pruneSelected.size();
+	for(uint i = 0; i < m_pruneSelected.size(); i++)
+	{
+		links[i + 1] = m_pruneSelected[i].m_id;
+	}
+}
+
+ANNidx HnswIndex::Add(const ANNcoord *point)
+{
+	ANNidx id = m_points.size();
+	int level = RandomLevel();
+
+	m_points.push_back(point);
+	m_levels.push_back(level);
+	m_baseLinks.resize(m_baseLinks.size() + m_maxBaseLinks + 1, 0);
+	m_upperOffsets.push_back(m_upperLinks.size());
+	m_upperLinks.resize(m_upperLinks.size() + (size_t)level * (m_maxLinks + 1), 0);
+
+	if(m_entryPoint == ANN_NULL_IDX)
+	{
+		m_entryPoint = id;
+		m_topLevel = level;
+		return id;
+	}
+
+	ANNidx entry = m_entryPoint;
+	ANNdist entryDist = Distance(point, m_points[entry]);
+	for(int l = m_topLevel; l > level; l--)
+	{
+		entry = Descend(point, entry, entryDist, l);
+	}
+
+	Scratch &scratch = m_buildScratch;
+	for(int l = min(level, m_topLevel); l >= 0; l--)
+	{
+		SearchLayer(point, entry, entryDist, l, m_efConstruction, scratch);
+		sort_heap(scratch.m_results.begin(), scratch.m_results.end());
+
+		SelectNeighbors(scratch.m_results, m_maxLinks, scratch.m_selected);
+		ANNidx *links = GetLinks(id, l);
+		links[0] = scratch.m_selected.size();
+		for(uint i = 0; i < scratch.m_selected.size(); i++)
+		{
+			links[i + 1] = scratch.m_selected[i].m_id;
+		}
+		for(uint i = 0; i < scratch.m_selected.size(); i++)
+		{
+			Link(scratch.m_selected[i].m_id, id, scratch.m_selected[i].m_dist, l);
+		}
+
+		// The layer below is explored from the nearest found on this one
+		entry = scratch.m_results[0].m_id;
+		entryDist = scratch.m_results[0].m_dist;
+	}
+
+	if(level > m_topLevel)
+	{
+		m_entryPoint = id;
+		m_topLevel = level;
+	}
+	return id;
+}
+
+void HnswIndex::Write(SnapshotWriter &snapshot) const
+{
+	uint64_t count = m_points.size();
+	uint64_t upperLinks = m_upperLinks.size();
+	uint32_t maxLinks = m_maxLinks;
+	int32_t entryPoint = m_entryPoint;
+	int32_t topLevel = m_topLevel;
+
+	snapshot.Align();
+	snapshot.Write(count);
+	snapshot.Write(upperLinks);
+	snapshot.Write(maxLinks);
+	snapshot.Write(entryPoint);
+	snapshot.Write(topLevel);
+	snapshot.Align();
+	snapshot.WriteBytes(m_baseLinks.data(), m_baseLinks.size() * sizeof(ANNidx));
+	snapshot.WriteBytes(m_upperOffsets.data(), m_upperOffsets.size() * sizeof(uint32_t));
+	snapshot.WriteBytes(m_upperLinks.data(), m_upperLinks.size() * sizeof(ANNidx));
+	snapshot.WriteBytes(m_levels.data(), m_levels.size());
+}
+
+HnswIndex *HnswIndex::Read(MappedSnapshot &snapshot, const ANNpoint *points, int count, int dimensions,
+		const NearestNeighborSettings &settings)
+{
+	HnswIndex *index = new HnswIndex(dimensions, settings);
+
+	uint64_t savedCount, upperLinks;
+	uint32_t maxLinks;
+	int32_t entryPoint, topLevel;
+
+	snapshot.Align();
+	if(!snapshot.Read(savedCount) || !snapshot.Read(upperLinks) || !snapshot.Read(maxLinks)
+			|| !snapshot.Read(entryPoint) || !snapshot.Read(topLevel)
+			|| savedCount != (uint64_t)count || maxLinks != index->m_maxLinks
+			|| topLevel >= HNSW_MAX_LEVEL || (count > 0 && (entryPoint < 0 || entryPoint >= count))
+			|| upperLinks > (uint64_t)count * (HNSW_MAX_LEVEL - 1) * (maxLinks + 1))
+	{
+		delete index;
+		return NULL;
+	}
+	snapshot.Align();
+
+	size_t baseLinks = (size_t)count * (index->m_maxBaseLinks + 1);
+	const ANNidx *savedBaseLinks = (const ANNidx *)snapshot.ReadBytes(baseLinks * sizeof(ANNidx));
+	const uint32_t *savedOffsets = (const uint32_t *)snapshot.ReadBytes(count * sizeof(uint32_t));
+	const ANNidx *savedUpperLinks = (const ANNidx *)snapshot.ReadBytes(upperLinks * sizeof(ANNidx));
+	const uint8_t *savedLevels = (const uint8_t *)snapshot.ReadBytes(count);
+	if(savedBaseLinks == NULL || savedOffsets == NULL || savedUpperLinks == NULL || savedLevels == NULL)
+	{
+		delete index;
+		return NULL;
+	}
+
+	index->m_points.assign(points, points + count);
+	index->m_baseLinks.assign(savedBaseLinks, savedBaseLinks + baseLinks);
+	index->m_upperOffsets.assign(savedOffsets, savedOffsets + count);
+	index->m_upperLinks.assign(savedUpperLinks, savedUpperLinks + upperLinks);
+	index->m_levels.assign(savedLevels, savedLevels + count);
+	index->m_entryPoint = (count > 0) ? entryPoint : ANN_NULL_IDX;
+	index->m_topLevel = (count > 0) ? topLevel : -1;
+	if(!index->IsConsistent())
+	{
+		delete index;
+		return NULL;
+	}
+
+	// Carry on from where the build left off, so anything added now goes where it would have
+	for(int i = 0; i < count; i++)
+	{
+		index->RandomLevel();
+	}
+	return index;
+}
+
+bool HnswIndex::IsConsistent() const
+{
+	int count = m_points.size();
+	if(count == 0)
+	{
+		return true;
+	}
+	if(m_topLevel < 0 || m_levels[m_entryPoint] != m_topLevel)
+	{
+		return false;
+	}
+
+	for(int node = 0; node < count; node++)
+	{
+		int levels = m_levels[node];
+		if(levels > m_topLevel
+				|| m_upperOffsets[node] + (uint64_t)levels * (m_maxLinks + 1) > m_upperLinks.size())
+		{
+			return false;
+		}
+
+		for(int level = 0; level <= levels; level++)
+		{
+			const ANNidx *links = GetLinks(node, level);
+			if((uint)links[0] > (level == 0 ? m_maxBaseLinks : m_maxLinks))
+			{
+				return false;
+			}
+			for(int i = 1; i <= links[0]; i++)
+			{
+				// A link to a node that isn't on this layer would have the search read its block for
+				// a layer it doesn't have
+				if(links[i] < 0 || links[i] >= count || m_levels[links[i]] < level)
+				{
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+}
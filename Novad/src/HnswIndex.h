@@ -0,0 +1,154 @@
+//============================================================================
+// Name        : HnswIndex.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Approximate nearest neighbor search over a hierarchical navigable small
+//               world graph, for training sets too big to build a kd-tree over quickly
+//============================================================================
+
+#ifndef HNSWINDEX_H_
+#define HNSWINDEX_H_
+
+#include "NearestNeighborIndex.h"
+#include "Snapshot.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+namespace Nova
+{
+
+// Each point is a node in a stack of graphs. Every node is on the bottom layer and a random,
+// exponentially shrinking share of them on each layer above, linked to up to m_hnswM of their nearest
+// neighbors on each layer. A search walks greedily down from the top layer and then keeps the
+// m_hnswEfSearch nearest it has seen while exploring the bottom one, so it only measures the distance
+// to a small part of the points. It can miss some of the true nearest neighbors; how many
+// depends on the settings.
+//
+// Searching is safe from several threads at once. Adding a point isn't, not even alongside a search.
+class HnswIndex : public NearestNeighborIndex
+{
+public:
+	// Builds the graph by adding the points one at a time
+	HnswIndex(const ANNpoint *points, int count, int dimensions, const NearestNeighborSettings &settings);
+	~HnswIndex();
+
+	void Search(const ANNcoord *query, int k, ANNidx *nnIdx, ANNdist *dists, double eps) const;
+
+	// Links a new point into the graph and returns its index, which is one past the last point's.
+	// The point isn't copied and has to outlive the index.
+	ANNidx Add(const ANNcoord *point);
+
+	int GetCount() const;
+
+	// Writes the graph (not the points) into a snapshot, from its current position
+	void Write(SnapshotWriter &snapshot) const;
+	// Reads a graph Write saved over these same points, copying it out of the snapshot. NULL if
+	// what's there isn't a graph over count points with the same m_hnswM, or is damaged.
+	static HnswIndex *Read(MappedSnapshot &snapshot, const ANNpoint *points, int count, int dimensions,
+			const NearestNeighborSettings &settings);
+
+private:
+	struct Candidate
+	{
+		ANNdist m_dist;
+		ANNidx m_id;
+
+		bool operator<(const Candidate &other) const {return m_dist < other.m_dist;}
+		bool operator>(const Candidate &other) const {return m_dist > other.m_dist;}
+	};
+
+	// What a search needs besides the graph. One per searching thread, kept from one search to
+	// the next so searching doesn't allocate once they've grown.
+	struct Scratch
+	{
+		// A node has been seen in this search if its entry is m_tag
+		std::vector<uint32_t> m_visited;
+		uint32_t m_tag;
+		// Min heap of nodes still to explore, and max heap of the nearest found
+		std::vector<Candidate> m_candidates;
+		std::vector<Candidate> m_results;
+		std::vector<Candidate> m_selected;
+
+		Scratch() : m_tag(0) {}
+	};
+
+	int m_dimensions;
+	uint m_maxLinks;
+	uint m_maxBaseLinks;
+	uint m_efConstruction;
+	uint m_efSearch;
+	// Scales the random level of a new node, 1/ln(M) as in the paper
+	double m_levelScale;
+	uint64_t m_random;
+
+	std::vector<const ANNcoord *> m_points;
+	// Highest layer each node is on
+	std::vector<uint8_t> m_levels;
+	// The bottom layer: for each node a link count and then m_maxBaseLinks links
+	std::vector<ANNidx> m_baseLinks;
+	// The layers above: a node on layer L > 0 has L blocks of a link count and m_maxLinks links,
+	// starting at its m_upperOffsets in m_upperLinks
+	std::vector<uint32_t> m_upperOffsets;
+	std::vector<ANNidx> m_upperLinks;
+	ANNidx m_entryPoint;
+	int m_topLevel;
+
+	// For Add, which only ever runs on one thread at a time
+	Scratch m_buildScratch;
+	std::vector<Candidate> m_pruneCandidates;
+	std::vector<Candidate> m_pruneSelected;
+
+	// Each searching thread's Scratch, and all of them so they can be freed with the index
+	pthread_key_t m_scratchKey;
+	mutable pthread_mutex_t m_scratchLock;
+	mutable std::vector<Scratch *> m_scratches;
+
+	// An empty graph
+	HnswIndex(int dimensions, const NearestNeighborSettings &settings);
+	void Init(int dimensions, const NearestNeighborSettings &settings);
+
+	// Checks a graph Read copied in: every link count fits its block, every link is to a node that's
+	// on that layer, every node's blocks are inside m_upperLinks, and the entry point is on the top layer
+	bool IsConsistent() const;
+
+	// The link count of a node on a layer, followed by its links
+	ANNidx *GetLinks(ANNidx node, int level);
+	const ANNidx *GetLinks(ANNidx node, int level) const;
+
+	ANNdist Distance(const ANNcoord *a, const ANNcoord *b) const;
+	int RandomLevel();
+
+	// Moves from entry to its nearest neighbor on the layer for as long as that's nearer to the query
+	ANNidx Descend(const ANNcoord *query, ANNidx entry, ANNdist &entryDist, int level) const;
+	// Explores a layer from entry, leaving the ef nearest nodes found in scratch.m_results as a heap
+	void SearchLayer(const ANNcoord *query, ANNidx entry, ANNdist entryDist, int level, uint ef, Scratch &scratch) const;
+	// Keeps up to maxLinks of the candidates, which are sorted nearest first, skipping any that are
+	// nearer to one already kept than to the node they'd be linked to. This keeps links spread out
+	// in every direction rather than all into the nearest cluster.
+	void SelectNeighbors(const std::vector<Candidate> &candidates, uint maxLinks, std::vector<Candidate> &selected) const;
+	// Links from to to on a layer, pruning from's links back down if that's one too many
+	void Link(ANNidx from, ANNidx to, ANNdist dist, int level);
+
+	Scratch *GetScratch() const;
+	// Starts a new search: a fresh tag, and room in the visited list for every node
+	void StartSearch(Scratch &scratch) const;
+
+	HnswIndex(const HnswIndex &);
+	HnswIndex &operator=(const HnswIndex &);
+};
+
+}
+
+#endif /* HNSWINDEX_H_ */
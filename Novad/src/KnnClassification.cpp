@@ -21,27 +21,93 @@
 #include "Lock.h"
 #include "Suspect.h"
 
+#include <algorithm>
+#include <math.h>
 #include <sstream>
 #include <string>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 
 using namespace std;
 using namespace Nova;
 
-KnnClassification::KnnClassification()
+KnnModel::KnnModel()
 {
-	pthread_rwlock_init(&m_lock, NULL);
-
 	m_pathTrainingFile = Config::Inst()->GetPathHome() + "/" + Config::Inst()->GetPathTrainingData();
 
 	m_normalization = Config::Inst()->GetNormalizationFunctions();
 
-	m_normalizedDataPts = NULL;
-	m_dataPts = NULL;
-	m_kdTree = NULL;
+	for(int i = 0; i < DIM; i++)
+	{
+		m_isFeatureEnabled[i] = false;
+		m_maxFeatureValues[i] = 0;
+		m_minFeatureValues[i] = 0;
+		m_meanFeatureValues[i] = 0;
+	}
+	m_enabledFeatureCount = 0;
+	m_squrtEnabledFeatures = 0;
+
+	m_nPts = 0;
+	m_classes = NULL;
+	m_index = NULL;
+}
+
+KnnModel::~KnnModel()
+{
+	// The snapshot the points may be in is closed after this
+	delete m_index;
+}
+
+void KnnModel::CopySettings(const KnnModel &settings)
+{
+	m_normalization = settings.m_normalization;
+	for(int i = 0; i < DIM; i++)
+	{
+		m_isFeatureEnabled[i] = settings.m_isFeatureEnabled[i];
+	}
+	m_enabledFeatureCount = settings.m_enabledFeatureCount;
+	m_squrtEnabledFeatures = settings.m_squrtEnabledFeatures;
+	m_featureWeights = settings.m_featureWeights;
+	m_pathTrainingFile = settings.m_pathTrainingFile;
+	m_search = settings.m_search;
+}
+
+KnnClassification::KnnClassification()
+	: m_model(new KnnModel())
+{
+	pthread_mutex_init(&m_reloadLock, NULL);
+	pthread_mutex_init(&m_scratchLock, NULL);
+	pthread_key_create(&m_scratchKey, NULL);
+}
+
+KnnClassification::~KnnClassification()
+{
+	// The threads' keys are dropped along with the buffers, whether or not the threads are still around
+	pthread_key_delete(m_scratchKey);
+	for(uint i = 0; i < m_scratches.size(); i++)
+	{
+		delete m_scratches[i];
+	}
+	pthread_mutex_destroy(&m_scratchLock);
+	pthread_mutex_destroy(&m_reloadLock);
+}
+
+KnnModel *KnnClassification::NewModel()
+{
+	RcuPointer<KnnModel>::ReadGuard current(m_model);
+
+	KnnModel *model = new KnnModel();
+	model->CopySettings(*current.Get());
+	return model;
 }
 
 void KnnClassification::LoadConfiguration(string filePath)
 {
+	Lock lock(&m_reloadLock);
+	m_configurationPath = filePath;
+
+	KnnModel *model = new KnnModel();
 	ifstream settings(filePath);
 	string prefix, line;
 
@@ -58,21 +124,21 @@ void KnnClassification::LoadConfiguration(string filePath)
 				if(line.size() == DIM)
 				{
 					string enabledFeatureMask = line;
-					m_enabledFeatureCount = 0;
+					model->m_enabledFeatureCount = 0;
 					for(uint i = 0; i < DIM; i++)
 					{
 						if('1' == enabledFeatureMask.at(i))
 						{
-							m_isFeatureEnabled[i] = true;
-							m_enabledFeatureCount++;
+							model->m_isFeatureEnabled[i] = true;
+							model->m_enabledFeatureCount++;
 						}
 						else
 						{
-							m_isFeatureEnabled[i] = false;
+							model->m_isFeatureEnabled[i] = false;
 						}
 					}
 
-					m_squrtEnabledFeatures = sqrt(m_enabledFeatureCount);
+					model->m_squrtEnabledFeatures = sqrt(model->m_enabledFeatureCount);
 				}
 				continue;
 			}
@@ -85,17 +151,52 @@ void KnnClassification::LoadConfiguration(string filePath)
 				{
 
 					istringstream is(line);
-					m_featureWeights.clear();
+					model->m_featureWeights.clear();
 					double n;
 					while (is >> n)
 					{
-						m_featureWeights.push_back(n);
+						model->m_featureWeights.push_back(n);
 					}
 				}
 				continue;
 			}
 
 
+			prefix = "NN_BACKEND";
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				if(!NearestNeighborIndex::ParseBackend(line, model->m_search.m_backend))
+				{
+					LOG(WARNING, "Unknown NN_BACKEND " + line + " in " + filePath + ", using kdtree", "");
+				}
+				continue;
+			}
+
+			prefix = "HNSW_M";
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				model->m_search.m_hnswM = max(atoi(line.c_str()), 2);
+				continue;
+			}
+
+			prefix = "HNSW_EF_CONSTRUCTION";
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				model->m_search.m_hnswEfConstruction = max(atoi(line.c_str()), 1);
+				continue;
+			}
+
+			prefix = "HNSW_EF_SEARCH";
+			if(!line.substr(0, prefix.size()).compare(prefix))
+			{
+				line = line.substr(prefix.size() + 1, line.size());
+				model->m_search.m_hnswEfSearch = max(atoi(line.c_str()), 1);
+				continue;
+			}
+
 			prefix = "DATAFILE";
 			if(!line.substr(0, prefix.size()).compare(prefix))
 			{
@@ -103,7 +204,7 @@ void KnnClassification::LoadConfiguration(string filePath)
 				if(line.size() > 0 && !line.substr(line.size() - 4,
 						line.size()).compare(".txt"))
 				{
-					m_pathTrainingFile = line;
+					model->m_pathTrainingFile = line;
 				}
 				continue;
 			}
@@ -111,45 +212,151 @@ void KnnClassification::LoadConfiguration(string filePath)
 		}
 	} else {
 		LOG(CRITICAL, "Unable to load configuration file for classification engine at " + filePath, "");
+		delete model;
 		exit(EXIT_FAILURE);
 	}
 
 
 	settings.close();
 
-	LoadDataPointsFromFile(m_pathTrainingFile);
+	// Parsing and normalizing the training file is only done when it (or the settings) changed
+	string snapshotPath = GetSnapshotPath(filePath);
+	if(!model->LoadSnapshot(snapshotPath))
+	{
+		model->LoadFile(model->m_pathTrainingFile);
+		model->SaveSnapshot(snapshotPath);
+	}
+
+	m_model.Publish(model);
 }
 
-KnnClassification::~KnnClassification()
+string KnnClassification::GetSnapshotPath(const string &configurationPath)
+{
+	// The name is there to tell them apart by eye, the hash of the whole path is what keeps two
+	// configuration files of the same name apart
+	string name = configurationPath.substr(configurationPath.find_last_of('/') + 1);
+	stringstream ss;
+	ss << Config::Inst()->GetPathHome() << "/" << KNN_SNAPSHOT_PREFIX << name << "-"
+		<< hex << std::hash<string>()(configurationPath) << ".snapshot";
+	return ss.str();
+}
+
+void KnnClassification::Reload()
+{
+	string filePath;
+	{
+		Lock lock(&m_reloadLock);
+		filePath = m_configurationPath;
+	}
+
+	if(!filePath.empty())
+	{
+		LoadConfiguration(filePath);
+	}
+}
+
+bool KnnClassification::IsCacheable()
+{
+	return true;
+}
+
+void KnnClassification::GetComparableFeatures(Suspect **suspects, uint count, double *features)
 {
-	for(uint i = 0; i < m_dataPtsWithClass.size(); i++)
+	RcuPointer<KnnModel>::ReadGuard model(m_model);
+	if(model->m_index == NULL)
 	{
-		delete m_dataPtsWithClass[i];
+		// Nothing to classify them against, ClassifyBatch won't touch them either
+		ClassificationEngine::GetComparableFeatures(suspects, count, features);
+		return;
 	}
-	if(m_kdTree != NULL)
+
+	KnnScratch *scratch = GetScratch();
+	uint dimensions = model->m_enabledFeatureCount;
+	if(scratch->m_queries.size() < count * dimensions)
 	{
-		delete m_kdTree;
+		scratch->m_queries.resize(count * dimensions);
 	}
-	if(m_dataPts != NULL)
+	model->NormalizeQueries(suspects, count, &scratch->m_queries[0]);
+
+	for(uint s = 0; s < count; s++)
 	{
-		annDeallocPts(m_dataPts);
+		const ANNcoord *query = &scratch->m_queries[s * dimensions];
+		uint ai = 0;
+		for(int i = 0; i < DIM; i++)
+		{
+			features[s * DIM + i] = model->m_isFeatureEnabled[i] ? query[ai++] : 0;
+		}
 	}
-	if(m_normalizedDataPts != NULL)
+}
+
+void KnnClassification::LoadDataPointsFromFile(string inFilePath)
+{
+	Lock lock(&m_reloadLock);
+
+	KnnModel *model = NewModel();
+	model->LoadFile(inFilePath);
+	m_model.Publish(model);
+}
+
+void KnnClassification::LoadDataPointsFromVector(vector<double*> points)
+{
+	Lock lock(&m_reloadLock);
+
+	KnnModel *model = NewModel();
+	model->LoadVector(points);
+	m_model.Publish(model);
+}
+
+bool KnnClassification::SaveSnapshot(string snapshotPath)
+{
+	RcuPointer<KnnModel>::ReadGuard model(m_model);
+	return model->SaveSnapshot(snapshotPath);
+}
+
+bool KnnClassification::LoadSnapshot(string snapshotPath)
+{
+	Lock lock(&m_reloadLock);
+
+	KnnModel *model = NewModel();
+	if(!model->LoadSnapshot(snapshotPath))
 	{
-		annDeallocPts(m_normalizedDataPts);
+		delete model;
+		return false;
 	}
+	m_model.Publish(model);
+	return true;
 }
 
 double KnnClassification::Classify(Suspect *suspect)
 {
-	Lock lock(&m_lock, READ_LOCK);
-	double sqrtDIM = m_squrtEnabledFeatures;
-	int k = Config::Inst()->GetK();
-	double d;
-	FeatureIndex fi;
+	double classification;
+	ClassifyBatch(&suspect, 1, &classification);
+	return classification;
+}
 
-	EvidenceAccumulator &fs = suspect->m_features;
-	uint ai = 0;
+void KnnClassification::ClassifyBatch(Suspect **suspects, uint count, double *classifications)
+{
+	if(count == 0)
+	{
+		return;
+	}
+
+	// The model stays as it is until this is done, even if a reload publishes a new one meanwhile
+	RcuPointer<KnnModel>::ReadGuard model(m_model);
+	if(model->m_index == NULL)
+	{
+		LOG(ERROR, "Classification engine has encountered an error.", "No training data has been loaded.");
+		for(uint i = 0; i < count; i++)
+		{
+			classifications[i] = -1;
+		}
+		return;
+	}
+
+	int k = Config::Inst()->GetK();
+	double eps = Config::Inst()->GetEps();
+	double hostileThreshold = Config::Inst()->GetClassificationThreshold();
+	uint notesLevel = Config::Inst()->GetClassificationNotes();
 
 	// TODO DTC fix after suspecttable->sqlite conversion
 	// Do we not have enough data to classify?
@@ -161,80 +368,133 @@ double KnnClassification::Classify(Suspect *suspect)
 		return -2;
 	}*/
 
-	//Allocate the ANNpoint;
-	ANNpoint aNN = annAllocPt(m_enabledFeatureCount);
-	if(aNN == NULL)
+	// This thread's buffers only ever grow, so once they're big enough nothing here allocates
+	KnnScratch *scratch = GetScratch();
+	uint dimensions = model->m_enabledFeatureCount;
+	if(scratch->m_queries.size() < count * dimensions)
+	{
+		scratch->m_queries.resize(count * dimensions);
+	}
+	if(scratch->m_nnIdx.size() < (uint)k)
+	{
+		scratch->m_nnIdx.resize(k);
+		scratch->m_dists.resize(k);
+	}
+
+	// One query point per suspect, all in one block
+	model->NormalizeQueries(suspects, count, &scratch->m_queries[0]);
+
+	for(uint i = 0; i < count; i++)
 	{
-		LOG(ERROR, "Classification engine has encountered an error.",
-			"Classify had trouble allocating the ANN point. Aborting.");
-		return -1;
+		ANNpoint query = &scratch->m_queries[i * dimensions];
+
+		model->m_index->Search(query, k, &scratch->m_nnIdx[0], &scratch->m_dists[0], eps);
+
+		classifications[i] = model->ScoreNeighbors(suspects[i], query, &scratch->m_nnIdx[0], &scratch->m_dists[0], k,
+				hostileThreshold, GetNotesLevel(suspects[i], notesLevel));
 	}
+}
+
+KnnScratch *KnnClassification::GetScratch()
+{
+	KnnScratch *scratch = (KnnScratch *)pthread_getspecific(m_scratchKey);
+	if(scratch == NULL)
+	{
+		scratch = new KnnScratch();
+		pthread_setspecific(m_scratchKey, scratch);
 
-	ANNidxArray nnIdx = new ANNidx[k];			// allocate near neigh indices
-	ANNdistArray dists = new ANNdist[k];		// allocate near neighbor dists
+		Lock lock(&m_scratchLock);
+		m_scratches.push_back(scratch);
+	}
+	return scratch;
+}
 
-	//Iterate over the features, asserting the range is [min,max] and normalizing over that range
-	for(int i = 0;i < DIM;i++)
+void KnnModel::NormalizeQueries(Suspect **suspects, uint count, ANNcoord *queries) const
+{
+	// A feature at a time across the whole batch, so its range and normalization are looked up once
+	uint ai = 0;
+	for(int i = 0; i < DIM; i++)
 	{
-		if(m_isFeatureEnabled[i])
+		if(!m_isFeatureEnabled[i])
 		{
-			if(fs.m_features[i] > m_maxFeatureValues[ai])
-			{
-				fs.m_features[i] = m_maxFeatureValues[ai];
-			}
-			else if(fs.m_features[i] < m_minFeatureValues[ai])
-			{
-				fs.m_features[i] = m_minFeatureValues[ai];
-			}
-			if(m_maxFeatureValues[ai] != 0)
+			continue;
+		}
+
+		double min = m_minFeatureValues[ai];
+		double max = m_maxFeatureValues[ai];
+
+		//Clamp the features to [min,max] first, the suspects are left with the clamped values
+		for(uint s = 0; s < count; s++)
+		{
+			double &value = suspects[s]->m_features.m_features[i];
+			if(value > max)
 			{
-				aNN[ai] = Normalize(m_normalization[i], fs.m_features[i],
-					m_minFeatureValues[ai], m_maxFeatureValues[ai], m_featureWeights[i]);
+				value = max;
 			}
-			else
+			else if(value < min)
 			{
-				LOG(ERROR, "Classification engine has encountered an error.",
-					"Max value for a feature is 0. Normalization failed.");
+				value = min;
 			}
-			ai++;
+			queries[s * m_enabledFeatureCount + ai] = value;
 		}
-	}
 
-	m_kdTree->annkSearch(							// search
-			aNN,								// query point
-			k,									// number of near neighbors
-			nnIdx,								// nearest neighbors (returned)
-			dists,								// distance (returned)
-			Config::Inst()->GetEps());								// error bound
+		if(max != 0)
+		{
+			KnnClassification::NormalizeColumn(m_normalization[i], queries + ai, count, m_enabledFeatureCount, min, max, m_featureWeights[i]);
+		}
+		else
+		{
+			LOG(ERROR, "Classification engine has encountered an error.",
+				"Max value for a feature is 0. Normalization failed.");
+		}
+		ai++;
+	}
+}
 
+string KnnModel::GetNeighborNotes(ANNidxArray nnIdx, ANNdistArray dists, int k) const
+{
 	stringstream classificationNotes;
 
 	for (int i = 0; i < k; i++)
 	{
 		classificationNotes << "k=" << i << ":d=" << dists[i];
-		classificationNotes << ":c=" << m_dataPtsWithClass[nnIdx[i]]->m_classification;
+		classificationNotes << ":c=" << m_classes[nnIdx[i]];
 		classificationNotes << ":i=" << nnIdx[i];
 		classificationNotes << "\n:o ";
 		for (uint j = 0; j < m_enabledFeatureCount; j++)
 		{
-			classificationNotes << m_dataPtsWithClass[nnIdx[i]]->m_annPoint[j] << " ";
+			classificationNotes << m_dataPts[nnIdx[i]][j] << " ";
 		}
 
 		classificationNotes << "\n:n ";
 
 		for (uint j = 0; j < m_enabledFeatureCount; j++)
 		{
-			classificationNotes << m_kdTree->thePoints()[nnIdx[i]][j] << " ";
+			classificationNotes << m_normalizedDataPts[nnIdx[i]][j] << " ";
 		}
 
-		classificationNotes << endl << endl;;
+		classificationNotes << endl << endl;
 	}
 
+	return classificationNotes.str();
+}
+
+double KnnModel::ScoreNeighbors(Suspect *suspect, ANNpoint query, ANNidxArray nnIdx, ANNdistArray dists, int k,
+		double hostileThreshold, uint notesLevel) const
+{
+	double sqrtDIM = m_squrtEnabledFeatures;
+
+	// Written before the distances below are unsquared
+	string neighborNotes;
+	if(notesLevel >= NOTES_FULL)
+	{
+		neighborNotes = GetNeighborNotes(nnIdx, dists, k);
+	}
 
+	double featureAccuracy[DIM];
 	for(int i = 0; i < DIM; i++)
 	{
-		fi = (FeatureIndex)i;
-		suspect->SetFeatureAccuracy(fi, 0);
+		featureAccuracy[i] = 0;
 	}
 	suspect->SetHostileNeighbors(0);
 
@@ -246,414 +506,393 @@ double KnnClassification::Classify(Suspect *suspect)
 	for(int i = 0; i < k; i++)
 	{
 		dists[i] = sqrt(dists[i]);				// unsquare distance
+
+		if(nnIdx[i] == -1)
+		{
+			stringstream ss;
+			ss << "Unable to find a nearest neighbor for Data point " << i <<" Try decreasing the Error bound";
+			LOG(ERROR, "Classification engine has encountered an error.", ss.str());
+			continue;
+		}
+
+		ANNpoint neighbor = m_normalizedDataPts[nnIdx[i]];
+		uint ai = 0;
 		for(int j = 0; j < DIM; j++)
 		{
 			if(m_isFeatureEnabled[j])
 			{
-				double distance = (aNN[j] - m_kdTree->thePoints()[nnIdx[i]][j]);
-
-				if(distance < 0)
-				{
-					distance *= -1;
-				}
-
-				fi = (FeatureIndex)j;
-				d  = suspect->GetFeatureAccuracy(fi) + distance;
-				suspect->SetFeatureAccuracy(fi, d);
+				featureAccuracy[j] += fabs(query[ai] - neighbor[ai]);
+				ai++;
 			}
 		}
 
-		if(nnIdx[i] == -1)
+		//If Hostile
+		if(m_classes[nnIdx[i]] == 1)
 		{
-			stringstream ss;
-			ss << "Unable to find a nearest neighbor for Data point " << i <<" Try decreasing the Error bound";
-			LOG(ERROR, "Classification engine has encountered an error.", ss.str());
+			classifyCount += (sqrtDIM - dists[i]);
+			suspect->SetHostileNeighbors(suspect->GetHostileNeighbors()+1);
+		}
+		//If benign
+		else if(m_classes[nnIdx[i]] == 0)
+		{
+			classifyCount -= (sqrtDIM - dists[i]);
 		}
 		else
 		{
-			//If Hostile
-			if(m_dataPtsWithClass[nnIdx[i]]->m_classification == 1)
-			{
-				classifyCount += (sqrtDIM - dists[i]);
-				suspect->SetHostileNeighbors(suspect->GetHostileNeighbors()+1);
-			}
-			//If benign
-			else if(m_dataPtsWithClass[nnIdx[i]]->m_classification == 0)
-			{
-				classifyCount -= (sqrtDIM - dists[i]);
-			}
-			else
-			{
-				stringstream ss;
-				ss << "Data point has invalid classification. Should by 0 or 1, but is " << m_dataPtsWithClass[nnIdx[i]]->m_classification;
-				LOG(ERROR, "Classification engine has encountered an error.", ss.str());
-				suspect->SetClassification(-1);
-				delete [] nnIdx;
-			    delete [] dists;
-			    annClose();
-			    annDeallocPt(aNN);
-				return -1;
-			}
+			stringstream ss;
+			ss << "Data point has invalid classification. Should by 0 or 1, but is " << m_classes[nnIdx[i]];
+			LOG(ERROR, "Classification engine has encountered an error.", ss.str());
+			suspect->SetClassification(-1);
+			return -1;
 		}
 	}
 	for(int j = 0; j < DIM; j++)
 	{
-		fi = (FeatureIndex)j;
-		d = suspect->GetFeatureAccuracy(fi) / k;
-		suspect->SetFeatureAccuracy(fi, d);
+		suspect->SetFeatureAccuracy((FeatureIndex)j, featureAccuracy[j] / k);
 	}
 
-	suspect->SetClassification(.5 + (classifyCount / ((2.0*(double)k)*sqrtDIM )));
+	double classification = .5 + (classifyCount / ((2.0*(double)k)*sqrtDIM ));
 
 	// Fix for rounding errors caused by double's not being precise enough if DIM is something like 2
-	if(suspect->GetClassification() < 0)
+	if(classification < 0)
 	{
-		suspect->SetClassification(0);
+		classification = 0;
 	}
-	else if(suspect->GetClassification() > 1)
+	else if(classification > 1)
 	{
-		suspect->SetClassification(1);
+		classification = 1;
 	}
 
-	if(suspect->GetClassification() > Config::Inst()->GetClassificationThreshold())
-	{
-		suspect->SetIsHostile(true);
-	}
-	else
+	suspect->SetClassification(classification);
+	suspect->SetIsHostile(classification > hostileThreshold);
+
+	if(notesLevel >= NOTES_FULL)
 	{
-		suspect->SetIsHostile(false);
+		suspect->m_classificationNotes += "=== Notes from KNN Classification Engine ===\n";
+		suspect->m_classificationNotes += "Classification vote: " + to_string(classification) + "\n";
+		suspect->m_classificationNotes += neighborNotes;
 	}
 
-	delete [] nnIdx;
-    delete [] dists;
-    annClose();
-    annDeallocPt(aNN);
-
-	suspect->m_classificationNotes += "=== Notes from KNN Classification Engine ===\n";
-	suspect->m_classificationNotes += "Classification vote: " + to_string(suspect->GetClassification()) + "\n";
-	suspect->m_classificationNotes += classificationNotes.str();
-
-	return suspect->GetClassification();
+	return classification;
 }
 
-void KnnClassification::LoadDataPointsFromFile(string inFilePath)
+void KnnModel::LoadFile(const string &inFilePath)
 {
-	Lock lock(&m_lock, WRITE_LOCK);
 	ifstream myfile (inFilePath.data());
 	string line;
 
-	// Clear max and min values
-	for(int i = 0; i < DIM; i++)
+	if(!myfile.is_open())
 	{
-		m_maxFeatureValues[i] = 0;
-	}
-
-	for(int i = 0; i < DIM; i++)
-	{
-		m_minFeatureValues[i] = 0;
-	}
-
-	for(int i = 0; i < DIM; i++)
-	{
-		m_meanFeatureValues[i] = 0;
+		LOG(CRITICAL,"Classification Engine has encountered a problem",
+			"Unable to open the training data file at "+ inFilePath+".");
+		exit(EXIT_FAILURE);
 	}
 
-	// Reload the data file
-	if(m_dataPts != NULL)
-	{
-		annDeallocPts(m_dataPts);
-	}
-	if(m_normalizedDataPts != NULL)
-	{
-		annDeallocPts(m_normalizedDataPts);
-	}
+	int badLines = 0;
 
-	//Delete any contents of the points list first
-	for(uint i = 0; i < m_dataPtsWithClass.size(); i++)
+	// Each line is the DIM feature values followed by the classification (0 or 1), space separated.
+	// Lines without all of them are skipped.
+	while(getline(myfile, line))
 	{
-		delete m_dataPtsWithClass[i];
-	}
-	m_dataPtsWithClass.clear();
+		double values[DIM + 1];
+		const char *position = line.c_str();
+		char *end;
+		int fields;
 
-	//string array to check whether a line in data.txt file has the right number of fields
-	string fieldsCheck[DIM];
-	bool valid = true;
+		for(fields = 0; fields < DIM + 1; fields++)
+		{
+			values[fields] = strtod(position, &end);
+			if(end == position)
+			{
+				break;
+			}
+			position = end;
+		}
 
-	int i = 0;
-	int k = 0;
-	int badLines = 0;
+		if(fields < DIM + 1)
+		{
+			badLines++;
+			continue;
+		}
 
-	//Count the number of data points for allocation
-	if(myfile.is_open())
-	{
-		while(!myfile.eof())
+		for(int i = 0; i < DIM; i++)
 		{
-			if(myfile.peek() == EOF)
+			if(m_isFeatureEnabled[i])
 			{
-				break;
+				m_pointStorage.push_back(values[i]);
 			}
-			getline(myfile,line);
-			i++;
 		}
+		m_classStorage.push_back((int32_t)values[DIM]);
 	}
+	myfile.close();
+
+	m_nPts = m_classStorage.size();
 
-	else
+	stringstream ss;
+	ss << "Loaded " << m_nPts << " data points into KNN tree";
+	if(badLines != 0)
 	{
-		LOG(CRITICAL,"Classification Engine has encountered a problem",
-			"Unable to open the training data file at "+ m_pathTrainingFile+".");
-		exit(EXIT_FAILURE);
+		ss << ", skipped " << badLines << " malformed lines";
 	}
+	LOG(DEBUG, ss.str(), "");
 
-	myfile.close();
-	int maxPts = i;
-
-	//Open the file again, allocate the number of points and assign
-	myfile.open(inFilePath.data(), ifstream::in);
-	m_dataPts = annAllocPts(maxPts, m_enabledFeatureCount); // allocate data points
-	m_normalizedDataPts = annAllocPts(maxPts, m_enabledFeatureCount);
+	Build();
+}
 
-	if(myfile.is_open())
+void KnnModel::LoadVector(const vector<double*> &points)
+{
+	for(uint i = 0; i < points.size(); i++)
 	{
-		i = 0;
-
-		while(!myfile.eof() && (i < maxPts))
+		for(int j = 0; j < DIM; j++)
 		{
-			k = 0;
-
-			if(myfile.peek() == EOF)
-			{
-				break;
-			}
-
-			//initializes fieldsCheck to have all array indices contain the string "NotPresent"
-			for(int j = 0; j < DIM; j++)
+			if(m_isFeatureEnabled[j])
 			{
-				fieldsCheck[j] = "NotPresent";
+				m_pointStorage.push_back(points.at(i)[j]);
 			}
+		}
+		m_classStorage.push_back(points.at(i)[DIM]);
+	}
 
-			//this will grab a line of values up to a newline or until DIM values have been taken in.
-			while(myfile.peek() != '\n' && k < DIM)
-			{
-				getline(myfile, fieldsCheck[k], ' ');
-				k++;
-			}
+	m_nPts = points.size();
 
+	Build();
+}
 
-			//starting from the end of fieldsCheck, if NotPresent is still inside the array, then
-			//the line of the data.txt file is incorrect, set valid to false. Note that this
-			//only works in regards to the 9 data points preceding the classification,
-			//not the classification itself.
-			for(int m = DIM - 1; m >= 0 && valid; m--)
-			{
-				if(!fieldsCheck[m].compare("NotPresent"))
-				{
-					valid = false;
-				}
-			}
+void KnnModel::Build()
+{
+	// Clear max and min values
+	for(int i = 0; i < DIM; i++)
+	{
+		m_maxFeatureValues[i] = 0;
+		m_minFeatureValues[i] = 0;
+		m_meanFeatureValues[i] = 0;
+	}
 
-			//if the next character is a newline after extracting as many data points as possible,
-			//then the classification is not present. For now, I will merely discard the line;
-			//there may be a more elegant way to do it. (i.e. pass the data to Classify or something)
-			if(myfile.peek() == '\n' || myfile.peek() == ' ')
-			{
-				valid = false;
-			}
+	//Set the max and min values of each feature. (Used later in normalization)
+	for(int point = 0; point < m_nPts; point++)
+	{
+		for(uint ai = 0; ai < m_enabledFeatureCount; ai++)
+		{
+			double temp = m_pointStorage[point * m_enabledFeatureCount + ai];
 
-			//if the line is valid, continue as normal
-			if(valid)
+			if(temp > m_maxFeatureValues[ai])
 			{
-				m_dataPtsWithClass.push_back(new Point(m_enabledFeatureCount));
-
-				// Used for matching the 0->DIM index with the 0->Config::Inst()->getEnabledFeatureCount() index
-				int actualDimension = 0;
-				for(int defaultDimension = 0;defaultDimension < DIM;defaultDimension++)
-				{
-					double temp = strtod(fieldsCheck[defaultDimension].data(), NULL);
-
-					if(m_isFeatureEnabled[defaultDimension])
-					{
-						m_dataPtsWithClass[i]->m_annPoint[actualDimension] = temp;
-						m_dataPts[i][actualDimension] = temp;
-
-						//Set the max values of each feature. (Used later in normalization)
-						if(temp > m_maxFeatureValues[actualDimension])
-						{
-							m_maxFeatureValues[actualDimension] = temp;
-						}
-						if(temp < m_minFeatureValues[actualDimension])
-						{
-							m_minFeatureValues[actualDimension] = temp;
-						}
-
-						m_meanFeatureValues[actualDimension] += temp;
-
-						actualDimension++;
-					}
-				}
-				getline(myfile,line);
-				m_dataPtsWithClass[i]->m_classification = atoi(line.data());
-				i++;
+				m_maxFeatureValues[ai] = temp;
 			}
-			//but if it isn't, just get to the next line without incrementing i.
-			//this way every correct line will be inserted in sequence
-			//without any gaps due to perhaps multiple line failures, etc.
-			else
+			if(temp < m_minFeatureValues[ai])
 			{
-				getline(myfile,line);
-				badLines++;
+				m_minFeatureValues[ai] = temp;
 			}
-		}
-		m_nPts = i;
 
-		stringstream ss;
-		ss << "Loaded " << m_nPts << " data points into KNN tree" << endl;
-		LOG(DEBUG, ss.str(), "");
-
-		for(int j = 0; j < DIM; j++)
-			m_meanFeatureValues[j] /= m_nPts;
+			m_meanFeatureValues[ai] += temp;
+		}
 	}
-	else
+
+	for(int j = 0; j < DIM; j++)
 	{
-		LOG(ERROR,"Classification Engine has encountered a problem",
-			"Unable to open the training data file at "+inFilePath+".");
+		m_meanFeatureValues[j] /= m_nPts;
 	}
-	myfile.close();
 
 	//Normalize the data points
-	uint ai = 0;
-	for (uint i = 0; i < DIM; i++)
+	m_normalizedStorage.resize(m_pointStorage.size());
+	for(int point = 0; point < m_nPts; point++)
 	{
-		if (m_isFeatureEnabled[i])
+		for(uint ai = 0; ai < m_enabledFeatureCount; ai++)
 		{
-			//Foreach data point
-			for(int point=0; point < m_nPts; point++)
-			{
-				m_normalizedDataPts[point][ai] = Normalize(m_normalization[ai],
-						m_dataPts[point][ai],
-						m_minFeatureValues[ai],
-						m_maxFeatureValues[ai],
-						m_featureWeights[ai]);
-			}
-
-			ai++;
+			uint index = point * m_enabledFeatureCount + ai;
+			m_normalizedStorage[index] = KnnClassification::Normalize(m_normalization[ai],
+					m_pointStorage[index],
+					m_minFeatureValues[ai],
+					m_maxFeatureValues[ai],
+					m_featureWeights[ai]);
 		}
 	}
 
-	if(m_kdTree != NULL)
-	{
-		delete m_kdTree;
-	}
-	m_kdTree = new ANNkd_tree(					// build search structure
-			m_normalizedDataPts,					// the data points
-					m_nPts,						// number of points
-					m_enabledFeatureCount);						// dimension of space
+	SetPoints(m_pointStorage.data(), m_normalizedStorage.data(), m_classStorage.data());
 }
 
-void KnnClassification::LoadDataPointsFromVector(vector<double*> points)
+void KnnModel::SetPoints(const ANNcoord *points, const ANNcoord *normalizedPoints, const int32_t *classes, MappedSnapshot *savedGraph)
 {
-	Lock lock(&m_lock, WRITE_LOCK);
-	// Clear max and min values
-	for(int i = 0; i < DIM; i++)
+	if(m_index != NULL)
 	{
-		m_maxFeatureValues[i] = 0;
+		delete m_index;
+		m_index = NULL;
 	}
 
-	for(int i = 0; i < DIM; i++)
+	// ANN only ever reads the points, it just doesn't say so
+	m_dataPts.resize(m_nPts);
+	m_normalizedDataPts.resize(m_nPts);
+	for(int point = 0; point < m_nPts; point++)
 	{
-		m_minFeatureValues[i] = 0;
-	}
-
-	for(int i = 0; i < DIM; i++)
-	{
-		m_meanFeatureValues[i] = 0;
+		m_dataPts[point] = (ANNpoint)points + point * m_enabledFeatureCount;
+		m_normalizedDataPts[point] = (ANNpoint)normalizedPoints + point * m_enabledFeatureCount;
 	}
+	m_classes = classes;
 
-	// Reload the data file
-	if(m_dataPts != NULL)
+	if(savedGraph != NULL && m_search.m_backend == NN_HNSW)
 	{
-		annDeallocPts(m_dataPts);
+		m_index = HnswIndex::Read(*savedGraph, m_normalizedDataPts.data(), m_nPts, m_enabledFeatureCount, m_search);
+		if(m_index == NULL)
+		{
+			LOG(WARNING, "Saved HNSW graph doesn't match the training points, building it again", "");
+		}
 	}
-	if(m_normalizedDataPts != NULL)
+	if(m_index == NULL)
 	{
-		annDeallocPts(m_normalizedDataPts);
+		m_index = NearestNeighborIndex::Make(m_search, m_normalizedDataPts.data(), m_nPts, m_enabledFeatureCount);
 	}
+}
 
-	//Delete any contents of the points list first
-	for(uint i = 0; i < m_dataPtsWithClass.size(); i++)
+bool KnnModel::GetSnapshotKey(vector<uint8_t> &key) const
+{
+	struct stat info;
+	if(stat(m_pathTrainingFile.c_str(), &info) != 0)
 	{
-		delete m_dataPtsWithClass[i];
+		return false;
 	}
-	m_dataPtsWithClass.clear();
-
-	//Open the file again, allocate the number of points and assign
-	m_dataPts = annAllocPts(points.size(), m_enabledFeatureCount); // allocate data points
-	m_normalizedDataPts = annAllocPts(points.size(), m_enabledFeatureCount);
 
+	int64_t fileSize = info.st_size;
+	int64_t modified = info.st_mtime;
+	int32_t dimensions = DIM;
+	uint32_t weights = m_featureWeights.size();
+	uint32_t normalizations = m_normalization.size();
 
-	for(uint i = 0; i < points.size(); i++)
+	key.clear();
+	key.insert(key.end(), (uint8_t *)&fileSize, (uint8_t *)(&fileSize + 1));
+	key.insert(key.end(), (uint8_t *)&modified, (uint8_t *)(&modified + 1));
+	key.insert(key.end(), (uint8_t *)&dimensions, (uint8_t *)(&dimensions + 1));
+	for(int i = 0; i < DIM; i++)
+	{
+		key.push_back(m_isFeatureEnabled[i]);
+	}
+	key.insert(key.end(), (uint8_t *)&weights, (uint8_t *)(&weights + 1));
+	key.insert(key.end(), (uint8_t *)m_featureWeights.data(), (uint8_t *)(m_featureWeights.data() + weights));
+	key.insert(key.end(), (uint8_t *)&normalizations, (uint8_t *)(&normalizations + 1));
+	for(uint i = 0; i < normalizations; i++)
 	{
-		m_dataPtsWithClass.push_back(new Point(m_enabledFeatureCount));
+		int32_t type = m_normalization[i];
+		key.insert(key.end(), (uint8_t *)&type, (uint8_t *)(&type + 1));
+	}
+	key.insert(key.end(), m_pathTrainingFile.begin(), m_pathTrainingFile.end());
 
-		// Used for matching the 0->DIM index with the 0->Config::Inst()->getEnabledFeatureCount() index
-		int actualDimension = 0;
-		for(int defaultDimension = 0;defaultDimension < DIM;defaultDimension++)
-		{
-			double temp = points.at(i)[defaultDimension];
+	// Whether there's a graph after the points, and what it was built with
+	int32_t backend = m_search.m_backend;
+	key.insert(key.end(), (uint8_t *)&backend, (uint8_t *)(&backend + 1));
+	if(m_search.m_backend == NN_HNSW)
+	{
+		uint32_t graphSettings[2] = {m_search.m_hnswM, m_search.m_hnswEfConstruction};
+		key.insert(key.end(), (uint8_t *)graphSettings, (uint8_t *)(graphSettings + 2));
+	}
 
-			if(m_isFeatureEnabled[defaultDimension])
-			{
-				m_dataPtsWithClass[i]->m_annPoint[actualDimension] = temp;
-				m_dataPts[i][actualDimension] = temp;
+	return true;
+}
 
-				//Set the max values of each feature. (Used later in normalization)
-				if(temp > m_maxFeatureValues[actualDimension])
-				{
-					m_maxFeatureValues[actualDimension] = temp;
-				}
-				if(temp < m_minFeatureValues[actualDimension])
-				{
-					m_minFeatureValues[actualDimension] = temp;
-				}
+bool KnnModel::SaveSnapshot(const string &snapshotPath) const
+{
+	vector<uint8_t> key;
+	if(!GetSnapshotKey(key))
+	{
+		return false;
+	}
 
-				m_meanFeatureValues[actualDimension] += temp;
+	// The key, the point count and normalization ranges, then the arrays 8 byte aligned so
+	// they can be used straight out of the mapping
+	SnapshotWriter snapshot(snapshotPath, SNAPSHOT_KNN);
+	uint32_t keyLength = key.size();
+	uint64_t points = m_nPts;
+	snapshot.Write(keyLength);
+	snapshot.WriteBytes(key.data(), keyLength);
+	snapshot.Align();
+	snapshot.Write(points);
+	snapshot.Write(m_minFeatureValues);
+	snapshot.Write(m_maxFeatureValues);
+	snapshot.Write(m_meanFeatureValues);
 
-				actualDimension++;
-			}
-		}
+	uint64_t values = points * m_enabledFeatureCount;
+	for(int point = 0; point < m_nPts; point++)
+	{
+		snapshot.WriteBytes(m_dataPts[point], m_enabledFeatureCount * sizeof(ANNcoord));
+	}
+	for(int point = 0; point < m_nPts; point++)
+	{
+		snapshot.WriteBytes(m_normalizedDataPts[point], m_enabledFeatureCount * sizeof(ANNcoord));
+	}
+	snapshot.WriteBytes(m_classes, points * sizeof(int32_t));
+	if(m_search.m_backend == NN_HNSW)
+	{
+		static_cast<HnswIndex *>(m_index)->Write(snapshot);
+	}
 
-		m_dataPtsWithClass[i]->m_classification = points.at(i)[DIM];
+	if(!snapshot.Commit())
+	{
+		return false;
 	}
 
-	m_nPts = points.size();
+	stringstream ss;
+	ss << "Saved a snapshot of " << m_nPts << " training points (" << values << " values) to " << snapshotPath;
+	LOG(DEBUG, ss.str(), "");
+	return true;
+}
 
-	for(int j = 0; j < DIM; j++)
-		m_meanFeatureValues[j] /= m_nPts;
+bool KnnModel::LoadSnapshot(const string &snapshotPath)
+{
+	vector<uint8_t> key;
+	if(!GetSnapshotKey(key))
+	{
+		return false;
+	}
 
+	MappedSnapshot snapshot;
+	if(!snapshot.Open(snapshotPath, SNAPSHOT_KNN))
+	{
+		return false;
+	}
 
-	//Normalize the data points
-	uint ai = 0;
-	for (uint i = 0; i < DIM; i++)
+	uint32_t keyLength;
+	const void *savedKey;
+	if(!snapshot.Read(keyLength)
+			|| keyLength != key.size()
+			|| (savedKey = snapshot.ReadBytes(keyLength)) == NULL
+			|| memcmp(savedKey, key.data(), keyLength) != 0)
 	{
-		if (m_isFeatureEnabled[i])
-		{
-			//Foreach data point
-			for(int point=0; point < m_nPts; point++)
-			{
-				m_normalizedDataPts[point][ai] = Normalize(m_normalization[ai], m_dataPts[point][ai], m_minFeatureValues[ai], m_maxFeatureValues[ai], m_featureWeights[ai]);
-			}
+		LOG(DEBUG, "Training data or feature settings changed since " + snapshotPath + " was saved, not using it", "");
+		return false;
+	}
+	snapshot.Align();
 
-			ai++;
-		}
+	uint64_t points;
+	double minimums[DIM], maximums[DIM], means[DIM];
+	if(!snapshot.Read(points) || !snapshot.Read(minimums) || !snapshot.Read(maximums) || !snapshot.Read(means))
+	{
+		return false;
 	}
 
-	if(m_kdTree != NULL)
+	uint64_t values = points * m_enabledFeatureCount;
+	// Only an HNSW graph follows the points
+	size_t pointBytes = values * 2 * sizeof(ANNcoord) + points * sizeof(int32_t);
+	if(snapshot.GetRemaining() < pointBytes || (m_search.m_backend != NN_HNSW && snapshot.GetRemaining() != pointBytes))
 	{
-		delete m_kdTree;
+		LOG(WARNING, "Snapshot " + snapshotPath + " is the wrong size, not using it", "");
+		return false;
 	}
-	m_kdTree = new ANNkd_tree(					// build search structure
-			m_normalizedDataPts,					// the data points
-					m_nPts,						// number of points
-					m_enabledFeatureCount);						// dimension of space
+
+	memcpy(m_minFeatureValues, minimums, sizeof(minimums));
+	memcpy(m_maxFeatureValues, maximums, sizeof(maximums));
+	memcpy(m_meanFeatureValues, means, sizeof(means));
+
+	const ANNcoord *dataPoints = (const ANNcoord *)snapshot.ReadBytes(values * sizeof(ANNcoord));
+	const ANNcoord *normalizedPoints = (const ANNcoord *)snapshot.ReadBytes(values * sizeof(ANNcoord));
+	const int32_t *classes = (const int32_t *)snapshot.ReadBytes(points * sizeof(int32_t));
+
+	// The points stay where they are in the mapping, which is kept open for as long as they're in use
+	m_snapshot.Take(snapshot);
+	m_nPts = points;
+	SetPoints(dataPoints, normalizedPoints, classes, &m_snapshot);
+
+	stringstream ss;
+	ss << "Loaded " << m_nPts << " data points into KNN tree from " << snapshotPath;
+	LOG(DEBUG, ss.str(), "");
+	return true;
 }
 
 double KnnClassification::Normalize(NormalizationType type, double value, double min, double max, double weight)
@@ -702,3 +941,56 @@ double KnnClassification::Normalize(NormalizationType type, double value, double
 	}
 	return ret;
 }
+
+void KnnClassification::NormalizeColumn(NormalizationType type, double *values, uint count, uint stride, double min, double max, double weight)
+{
+	// Same as Normalize, with the switch taken once for the whole column rather than per value
+	double *end = values + count * stride;
+	switch(type)
+	{
+		case LINEAR:
+		{
+			double scale = weight / max;
+			for(double *value = values; value != end; value += stride)
+			{
+				*value *= scale;
+			}
+			break;
+		}
+		case LINEAR_SHIFT:
+		{
+			double scale = weight / (max - min);
+			for(double *value = values; value != end; value += stride)
+			{
+				*value = (*value - min) * scale;
+			}
+			break;
+		}
+		case NONORM:
+		{
+			for(double *value = values; value != end; value += stride)
+			{
+				*value *= weight;
+			}
+			break;
+		}
+		case LOGARITHMIC:
+		{
+			double scale = weight / log(max + 1);
+			for(double *value = values; value != end; value += stride)
+			{
+				*value = (*value != 0) ? log(*value + 1) * scale : 0;
+			}
+			break;
+		}
+		default:
+		{
+			LOG(ERROR, "Unknown normalization type", "");
+			for(double *value = values; value != end; value += stride)
+			{
+				*value = -weight;
+			}
+			break;
+		}
+	}
+}
@@ -20,17 +20,115 @@
 #define KNNCLASSIFICATIONENGINE_H_
 
 #include <string>
+#include <vector>
 #include <fstream>
 
 #include "ANN/ANN.h"
 
 #include "Logger.h"
 #include "Suspect.h"
+#include "Snapshot.h"
+#include "RcuPointer.h"
+#include "NearestNeighborIndex.h"
+#include "HnswIndex.h"
 #include "Doppelganger.h"
 #include "ClassificationEngine.h"
 
+// Where the loaded training data is saved, relative to the home directory. Startup maps this instead
+// of parsing the training file again, as long as neither the file nor the feature settings changed.
+// Each engine's configuration file gets its own, see KnnClassification::GetSnapshotPath.
+#define KNN_SNAPSHOT_PREFIX "data/knn-"
+
 namespace Nova
 {
+
+// Buffers a classifying thread keeps from one batch to the next, so once they've grown to
+// fit, classification doesn't allocate
+struct KnnScratch
+{
+	std::vector<ANNcoord> m_queries;
+	std::vector<ANNidx> m_nnIdx;
+	std::vector<ANNdist> m_dists;
+};
+
+// Everything a classification reads: the feature settings, the training points and the tree over
+// them. Nothing changes once it's been published; reloading builds a whole new model instead.
+class KnnModel
+{
+public:
+	// Default feature settings from the main config, no points
+	KnnModel();
+	~KnnModel();
+
+	// Takes the feature settings (not the points) from another model
+	void CopySettings(const KnnModel &settings);
+
+	// Types of normalization to apply to our features
+	std::vector<NormalizationType> m_normalization;
+	bool m_isFeatureEnabled[DIM];
+	uint m_enabledFeatureCount;
+	double m_squrtEnabledFeatures;
+	std::vector<double> m_featureWeights;
+	std::string m_pathTrainingFile;
+	NearestNeighborSettings m_search;
+
+	// kdtree stuff
+	int m_nPts;						//actual number of data points
+	std::vector<ANNpoint> m_dataPts;			//data points
+	std::vector<ANNpoint> m_normalizedDataPts;	//normalized data points
+	const int32_t *m_classes;				//classification of each data point, 0 or 1
+	NearestNeighborIndex *m_index;			// search structure, whichever backend m_search picks
+
+	// Used for data normalization
+	double m_maxFeatureValues[DIM];
+	double m_minFeatureValues[DIM];
+	double m_meanFeatureValues[DIM];
+
+	// Reads the training points from a file, should contain Feature dimensions followed by hostile
+	// classification (0 or 1), all space separated, and builds the tree over them
+	void LoadFile(const std::string &inFilePath);
+	void LoadVector(const std::vector<double*> &points);
+
+	// Saves the points (raw and normalized), their classes and the normalization ranges, along with what
+	// they were built from: the training file's size and modification time and the feature settings.
+	// An HNSW graph is saved too, since building it is the slow part of loading a big training set.
+	bool SaveSnapshot(const std::string &snapshotPath) const;
+	// Maps a snapshot from SaveSnapshot and uses the points in it where they lie. False if there's
+	// no snapshot or it was built from anything else.
+	bool LoadSnapshot(const std::string &snapshotPath);
+
+	// Clamps each suspect's enabled features to the training ranges and writes out their normalized
+	// values, m_enabledFeatureCount per suspect
+	void NormalizeQueries(Suspect **suspects, uint count, ANNcoord *queries) const;
+	// Works out a suspect's classification, hostile neighbors and feature accuracy from its k nearest
+	// neighbors, and the notes if notesLevel is NOTES_FULL
+	double ScoreNeighbors(Suspect *suspect, ANNpoint query, ANNidxArray nnIdx, ANNdistArray dists, int k,
+			double hostileThreshold, uint notesLevel) const;
+	// Every neighbor's distance, class and values, raw and normalized
+	std::string GetNeighborNotes(ANNidxArray nnIdx, ANNdistArray dists, int k) const;
+
+private:
+	// What the points above point into: either these, when they were loaded from the training file,
+	// or the mapped snapshot
+	std::vector<ANNcoord> m_pointStorage;
+	std::vector<ANNcoord> m_normalizedStorage;
+	std::vector<int32_t> m_classStorage;
+	MappedSnapshot m_snapshot;
+
+	// Takes the m_nPts points in m_pointStorage/m_classStorage: works out the normalization ranges,
+	// normalizes them and builds the tree
+	void Build();
+	// Points m_dataPts and m_normalizedDataPts at m_nPts rows of m_enabledFeatureCount values each
+	// and builds the index over the normalized ones, or reads it from savedGraph if there's one there
+	void SetPoints(const ANNcoord *points, const ANNcoord *normalizedPoints, const int32_t *classes, MappedSnapshot *savedGraph = NULL);
+
+	// Fills in whatever a snapshot has to match to be used in place of the training file. False if the file isn't there.
+	bool GetSnapshotKey(std::vector<uint8_t> &key) const;
+
+	KnnModel(const KnnModel &);
+	KnnModel &operator=(const KnnModel &);
+};
+
 class KnnClassification : public Nova::ClassificationEngine
 {
 public:
@@ -44,42 +142,59 @@ public:
 	// Note: this updates the classification of the suspect in dataPtsWithClass as well as it's isHostile variable
 	double Classify(Suspect *suspect);
 
+	// Classifies the suspects against one model, with one set of search buffers and the query points
+	// all normalized together before any searching is done. Never waits on a reload.
+	void ClassifyBatch(Suspect **suspects, uint count, double *classifications);
+
 	// Reads into the list of suspects from a file specified by inFilePath
 	//		inFilePath - path to input file, should contain Feature dimensions
 	//					 followed by hostile classification (0 or 1), all space separated
+	// The new points replace the old ones all at once, classification carries on with the old ones until then.
 	void LoadDataPointsFromFile(std::string inFilePath);
 	void LoadDataPointsFromVector(std::vector<double*> points);
 
+	// See KnnModel::SaveSnapshot and KnnModel::LoadSnapshot. Loading leaves the current points alone if it fails.
+	bool SaveSnapshot(std::string snapshotPath);
+	bool LoadSnapshot(std::string snapshotPath);
+
 	// Normalized a single value
 	static double Normalize(NormalizationType type, double value, double min, double max, double weight);
+	// Normalizes count values stride apart in place, giving the same results as Normalize on each
+	static void NormalizeColumn(NormalizationType type, double *values, uint count, uint stride, double min, double max, double weight);
 
 	void LoadConfiguration(std::string filePath);
 
-private:
-	// Types of normalization to apply to our features
-	std::vector<NormalizationType> m_normalization;
+	// Snapshot file for the engine loaded from this configuration file. Engines with different
+	// configurations would otherwise keep replacing each other's snapshot.
+	static std::string GetSnapshotPath(const std::string &configurationPath);
 
-	std::vector <Point*> m_dataPtsWithClass;
+	// Loads the configuration file again, building the new model while the old one stays in use
+	void Reload();
 
-	// kdtree stuff
-	int m_nPts;						//actual number of data points
-	ANNpointArray m_dataPts;				//data points
-	ANNpointArray m_normalizedDataPts;	//normalized data points
-	ANNkd_tree*	m_kdTree;					// search structure
+	// The vote, notes, neighbor count and feature accuracy only depend on the features and the model
+	bool IsCacheable();
+	// Clamps the enabled features to the training ranges and gives their normalized values, the
+	// ones the neighbors are searched with. Disabled features are 0, they make no difference to the vote.
+	void GetComparableFeatures(Suspect **suspects, uint count, double *features);
 
-	pthread_rwlock_t m_lock;
+private:
+	RcuPointer<KnnModel> m_model;
 
-	// Used for data normalization
-	double m_maxFeatureValues[DIM];
-	double m_minFeatureValues[DIM];
-	double m_meanFeatureValues[DIM];
+	// Configuration file last loaded, for Reload
+	std::string m_configurationPath;
 
-	bool m_isFeatureEnabled[DIM];
-	uint m_enabledFeatureCount;
-	double m_squrtEnabledFeatures;
-	std::string m_pathTrainingFile;
+	// Only one reload is built at a time
+	pthread_mutex_t m_reloadLock;
 
-	std::vector<double> m_featureWeights;
+	// Each classifying thread's KnnScratch, and all of them so they can be freed with the engine
+	pthread_key_t m_scratchKey;
+	pthread_mutex_t m_scratchLock;
+	std::vector<KnnScratch *> m_scratches;
+
+	// A model with the current feature settings and no points yet
+	KnnModel *NewModel();
+
+	KnnScratch *GetScratch();
 };
 
 } // End namespace
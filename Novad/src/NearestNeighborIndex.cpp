@@ -0,0 +1,292 @@
+//============================================================================
+// Name        : NearestNeighborIndex.cpp
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Nearest neighbor search backends for the KNN classification engine
+//============================================================================
+
+#include "NearestNeighborIndex.h"
+#include "HnswIndex.h"
+
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NN_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace Nova
+{
+
+// Points the brute force scan takes at a time, one AVX-512 vector or two AVX2 ones
+#define BRUTE_FORCE_BLOCK 8
+
+NearestNeighborIndex *NearestNeighborIndex::Make(const NearestNeighborSettings &settings, const ANNpoint *points, int count, int dimensions)
+{
+	switch(settings.m_backend)
+	{
+		case NN_BRUTE_FORCE:
+		{
+			return new BruteForceIndex(points, count, dimensions);
+		}
+		case NN_HNSW:
+		{
+			return new HnswIndex(points, count, dimensions, settings);
+		}
+		case NN_KDTREE:
+		default:
+		{
+			return new KdTreeIndex(points, count, dimensions);
+		}
+	}
+}
+
+bool NearestNeighborIndex::ParseBackend(const string &name, NearestNeighborBackend &backend)
+{
+	if(!name.compare("kdtree"))
+	{
+		backend = NN_KDTREE;
+		return true;
+	}
+	if(!name.compare("bruteforce"))
+	{
+		backend = NN_BRUTE_FORCE;
+		return true;
+	}
+	if(!name.compare("hnsw"))
+	{
+		backend = NN_HNSW;
+		return true;
+	}
+	return false;
+}
+
+KdTreeIndex::KdTreeIndex(const ANNpoint *points, int count, int dimensions)
+{
+	// ANN only ever reads the points, it just doesn't say so
+	m_tree = new ANNkd_tree((ANNpointArray)points, count, dimensions);
+}
+
+KdTreeIndex::~KdTreeIndex()
+{
+	delete m_tree;
+}
+
+void KdTreeIndex::Search(const ANNcoord *query, int k, ANNidx *nnIdx, ANNdist *dists, double eps) const
+{
+	m_tree->annkSearch((ANNpoint)query, k, nnIdx, dists, eps);
+}
+
+// Puts a point into the k nearest so far, which are sorted nearest first. The caller has already
+// checked that it's nearer than the last of them.
+static inline void InsertNeighbor(ANNidx index, ANNdist dist, int k, ANNidx *nnIdx, ANNdist *dists)
+{
+	int slot = k - 1;
+	while(slot > 0 && dists[slot - 1] > dist)
+	{
+		dists[slot] = dists[slot - 1];
+		nnIdx[slot] = nnIdx[slot - 1];
+		slot--;
+	}
+	dists[slot] = dist;
+	nnIdx[slot] = index;
+}
+
+// Inserts the points of a block whose bit is set in closer, if they're still nearer than the kth
+// nearest once the ones before them went in
+static inline void InsertBlock(int block, const ANNdist *blockDists, uint closer, int k, ANNidx *nnIdx, ANNdist *dists)
+{
+	for(int j = 0; closer != 0; j++, closer >>= 1)
+	{
+		if((closer & 1) && blockDists[j] < dists[k - 1])
+		{
+			InsertNeighbor(block + j, blockDists[j], k, nnIdx, dists);
+		}
+	}
+}
+
+// Plain C++ fallback, which the compiler vectorizes as far as the baseline instruction set lets it
+static void ScanScalar(const ANNcoord *columns, int paddedCount, int dimensions, const ANNcoord *query, int k, ANNidx *nnIdx, ANNdist *dists)
+{
+	for(int block = 0; block < paddedCount; block += BRUTE_FORCE_BLOCK)
+	{
+		ANNdist blockDists[BRUTE_FORCE_BLOCK];
+		for(int j = 0; j < BRUTE_FORCE_BLOCK; j++)
+		{
+			blockDists[j] = 0;
+		}
+
+		for(int d = 0; d < dimensions; d++)
+		{
+			const ANNcoord *column = columns + (size_t)d * paddedCount + block;
+			for(int j = 0; j < BRUTE_FORCE_BLOCK; j++)
+			{
+				ANNcoord diff = column[j] - query[d];
+				blockDists[j] += diff * diff;
+			}
+		}
+
+		uint closer = 0;
+		for(int j = 0; j < BRUTE_FORCE_BLOCK; j++)
+		{
+			closer |= (uint)(blockDists[j] < dists[k - 1]) << j;
+		}
+		if(closer != 0)
+		{
+			InsertBlock(block, blockDists, closer, k, nnIdx, dists);
+		}
+	}
+}
+
+#ifdef NN_X86
+__attribute__((target("avx2,fma")))
+static void ScanAvx2(const ANNcoord *columns, int paddedCount, int dimensions, const ANNcoord *query, int k, ANNidx *nnIdx, ANNdist *dists)
+{
+	for(int block = 0; block < paddedCount; block += BRUTE_FORCE_BLOCK)
+	{
+		__m256d low = _mm256_setzero_pd();
+		__m256d high = _mm256_setzero_pd();
+
+		for(int d = 0; d < dimensions; d++)
+		{
+			const ANNcoord *column = columns + (size_t)d * paddedCount + block;
+			__m256d value = _mm256_broadcast_sd(&query[d]);
+			__m256d diffLow = _mm256_sub_pd(_mm256_loadu_pd(column), value);
+			__m256d diffHigh = _mm256_sub_pd(_mm256_loadu_pd(column + 4), value);
+			low = _mm256_fmadd_pd(diffLow, diffLow, low);
+			high = _mm256_fmadd_pd(diffHigh, diffHigh, high);
+		}
+
+		// Most blocks have nothing nearer than the kth nearest so far, and are done with here
+		__m256d worst = _mm256_set1_pd(dists[k - 1]);
+		uint closer = _mm256_movemask_pd(_mm256_cmp_pd(low, worst, _CMP_LT_OQ))
+				| (_mm256_movemask_pd(_mm256_cmp_pd(high, worst, _CMP_LT_OQ)) << 4);
+		if(closer != 0)
+		{
+			ANNdist blockDists[BRUTE_FORCE_BLOCK];
+			_mm256_storeu_pd(blockDists, low);
+			_mm256_storeu_pd(blockDists + 4, high);
+			InsertBlock(block, blockDists, closer, k, nnIdx, dists);
+		}
+	}
+}
+
+__attribute__((target("avx512f")))
+static void ScanAvx512(const ANNcoord *columns, int paddedCount, int dimensions, const ANNcoord *query, int k, ANNidx *nnIdx, ANNdist *dists)
+{
+	for(int block = 0; block < paddedCount; block += BRUTE_FORCE_BLOCK)
+	{
+		__m512d sum = _mm512_setzero_pd();
+
+		for(int d = 0; d < dimensions; d++)
+		{
+			const ANNcoord *column = columns + (size_t)d * paddedCount + block;
+			__m512d diff = _mm512_sub_pd(_mm512_loadu_pd(column), _mm512_set1_pd(query[d]));
+			sum = _mm512_fmadd_pd(diff, diff, sum);
+		}
+
+		uint closer = _mm512_cmp_pd_mask(sum, _mm512_set1_pd(dists[k - 1]), _CMP_LT_OQ);
+		if(closer != 0)
+		{
+			ANNdist blockDists[BRUTE_FORCE_BLOCK];
+			_mm512_storeu_pd(blockDists, sum);
+			InsertBlock(block, blockDists, closer, k, nnIdx, dists);
+		}
+	}
+}
+#endif
+
+BruteForceIndex::BruteForceIndex(const ANNpoint *points, int count, int dimensions, SimdLevel maxLevel)
+{
+	m_count = count;
+	m_dimensions = dimensions;
+	m_paddedCount = (count + BRUTE_FORCE_BLOCK - 1) / BRUTE_FORCE_BLOCK * BRUTE_FORCE_BLOCK;
+
+	m_simdLevel = DetectSimdLevel();
+	if(m_simdLevel > maxLevel)
+	{
+		m_simdLevel = maxLevel;
+	}
+
+	// The padding is infinitely far from any query, so it never beats a real point
+	m_columns.assign((size_t)m_paddedCount * dimensions, numeric_limits<ANNcoord>::infinity());
+	for(int d = 0; d < dimensions; d++)
+	{
+		ANNcoord *column = &m_columns[(size_t)d * m_paddedCount];
+		for(int i = 0; i < count; i++)
+		{
+			column[i] = points[i][d];
+		}
+	}
+}
+
+void BruteForceIndex::Search(const ANNcoord *query, int k, ANNidx *nnIdx, ANNdist *dists, double eps) const
+{
+	if(k <= 0)
+	{
+		return;
+	}
+
+	for(int i = 0; i < k; i++)
+	{
+		nnIdx[i] = ANN_NULL_IDX;
+		dists[i] = ANN_DIST_INF;
+	}
+
+	switch(m_simdLevel)
+	{
+#ifdef NN_X86
+		case SIMD_AVX512:
+		{
+			ScanAvx512(m_columns.data(), m_paddedCount, m_dimensions, query, k, nnIdx, dists);
+			break;
+		}
+		case SIMD_AVX2:
+		{
+			ScanAvx2(m_columns.data(), m_paddedCount, m_dimensions, query, k, nnIdx, dists);
+			break;
+		}
+#endif
+		default:
+		{
+			ScanScalar(m_columns.data(), m_paddedCount, m_dimensions, query, k, nnIdx, dists);
+			break;
+		}
+	}
+}
+
+SimdLevel BruteForceIndex::GetSimdLevel() const
+{
+	return m_simdLevel;
+}
+
+SimdLevel BruteForceIndex::DetectSimdLevel()
+{
+#ifdef NN_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f"))
+	{
+		return SIMD_AVX512;
+	}
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+	{
+		return SIMD_AVX2;
+	}
+#endif
+	return SIMD_SCALAR;
+}
+
+}
@@ -0,0 +1,137 @@
+//============================================================================
+// Name        : NearestNeighborIndex.h
+// Copyright   : DataSoft Corporation 2011-2013
+//	Nova is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   Nova is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with Nova.  If not, see <http://www.gnu.org/licenses/>.
+// Description : Nearest neighbor search backends for the KNN classification engine
+//============================================================================
+
+#ifndef NEARESTNEIGHBORINDEX_H_
+#define NEARESTNEIGHBORINDEX_H_
+
+#include <string>
+#include <vector>
+
+#include "ANN/ANN.h"
+
+namespace Nova
+{
+
+// Which NearestNeighborIndex a KNN engine searches with, from NN_BACKEND in its config
+enum NearestNeighborBackend
+{
+	NN_KDTREE = 0,
+	NN_BRUTE_FORCE,
+	NN_HNSW
+};
+
+#define HNSW_DEFAULT_M 16
+#define HNSW_DEFAULT_EF_CONSTRUCTION 100
+#define HNSW_DEFAULT_EF_SEARCH 64
+
+// How a KNN engine searches, from its config
+struct NearestNeighborSettings
+{
+	NearestNeighborBackend m_backend;
+
+	// HNSW: links per node and layer (twice as many on the bottom layer), and how many candidates are
+	// kept while building the graph and while searching it. Raising any of them finds more of the true
+	// nearest neighbors at the cost of speed; only m_hnswEfSearch can change without rebuilding the graph.
+	uint m_hnswM;
+	uint m_hnswEfConstruction;
+	uint m_hnswEfSearch;
+
+	NearestNeighborSettings()
+	{
+		m_backend = NN_KDTREE;
+		m_hnswM = HNSW_DEFAULT_M;
+		m_hnswEfConstruction = HNSW_DEFAULT_EF_CONSTRUCTION;
+		m_hnswEfSearch = HNSW_DEFAULT_EF_SEARCH;
+	}
+};
+
+// Instruction sets the brute force scan can use, best last
+enum SimdLevel
+{
+	SIMD_SCALAR = 0,
+	SIMD_AVX2,
+	SIMD_AVX512
+};
+
+// Finds the k nearest of a fixed set of points. Searches don't change the index, but whether they
+// can run at the same time depends on the backend (ANN's kd-tree keeps its search state in globals).
+class NearestNeighborIndex
+{
+public:
+	virtual ~NearestNeighborIndex() {}
+
+	// Fills in the indices and squared distances of the k nearest points, nearest first, the way
+	// ANNkd_tree::annkSearch does. Slots past the number of points get ANN_NULL_IDX. eps is the
+	// kd-tree's error bound; the other backends ignore it.
+	virtual void Search(const ANNcoord *query, int k, ANNidx *nnIdx, ANNdist *dists, double eps) const = 0;
+
+	// Builds the configured backend over count points of dimensions values each. The points aren't
+	// copied by every backend, so they have to outlive the index.
+	static NearestNeighborIndex *Make(const NearestNeighborSettings &settings, const ANNpoint *points, int count, int dimensions);
+
+	// "kdtree", "bruteforce" or "hnsw". False (and backend left alone) for anything else.
+	static bool ParseBackend(const std::string &name, NearestNeighborBackend &backend);
+};
+
+// ANN's kd-tree
+class KdTreeIndex : public NearestNeighborIndex
+{
+public:
+	KdTreeIndex(const ANNpoint *points, int count, int dimensions);
+	~KdTreeIndex();
+
+	void Search(const ANNcoord *query, int k, ANNidx *nnIdx, ANNdist *dists, double eps) const;
+
+private:
+	ANNkd_tree *m_tree;
+
+	KdTreeIndex(const KdTreeIndex &);
+	KdTreeIndex &operator=(const KdTreeIndex &);
+};
+
+// Exact search that measures the distance to every point. With the dozen or so dimensions and up to
+// a few hundred thousand points we train on, a vectorized scan is quicker than walking the kd-tree,
+// and it's safe to search from several threads at once. The points are copied one dimension to an
+// array (structure of arrays), so each step of the scan takes the next several points' values of
+// one dimension in a single load.
+class BruteForceIndex : public NearestNeighborIndex
+{
+public:
+	// Scans with the best instruction set this CPU supports, or no better than maxLevel
+	BruteForceIndex(const ANNpoint *points, int count, int dimensions, SimdLevel maxLevel = SIMD_AVX512);
+
+	void Search(const ANNcoord *query, int k, ANNidx *nnIdx, ANNdist *dists, double eps) const;
+
+	SimdLevel GetSimdLevel() const;
+
+	// Best instruction set the CPU we're running on supports
+	static SimdLevel DetectSimdLevel();
+
+private:
+	int m_count;
+	int m_dimensions;
+	// m_count rounded up to whole vectors; the points past m_count are too far away to ever be found
+	int m_paddedCount;
+	// Dimension d of point i is at m_columns[d * m_paddedCount + i]
+	std::vector<ANNcoord> m_columns;
+	SimdLevel m_simdLevel;
+};
+
+}
+
+#endif /* NEARESTNEIGHBORINDEX_H_ */
@@ -19,6 +19,7 @@
 #include "HoneydConfiguration/HoneydConfiguration.h"
 #include "ClassificationAggregator.h"
 #include "InterfacePacketCapture.h"
+#include "RingPacketCapture.h"
 #include "WhitelistConfiguration.h"
 #include "EvidenceAccumulator.h"
 #include "FilePacketCapture.h"
@@ -31,6 +32,7 @@
 #include "DatabaseQueue.h"
 #include "NovaUtil.h"
 #include "Database.h"
+#include "DatabaseWriter.h"
 #include "Threads.h"
 #include "Control.h"
 #include "Config.h"
@@ -65,13 +67,16 @@ using namespace Nova;
 
 // Maintains a list of suspects and information on network activity
 DatabaseQueue suspects;
-//Contains packet evidence yet to be included in a suspect
-EvidenceTable suspectEvidence;
+//Contains packet evidence yet to be included in a suspect, one table per consumer thread
+vector<EvidenceTable*> suspectEvidence;
 
 pthread_mutex_t packetCapturesLock;
 vector<PacketCapture*> packetCaptures;
 vector<int> dropCounts;
 
+// Set while a pcap file is being read. There are no consumer threads then, so evidence is processed right away
+bool readingPcapFile = false;
+
 Doppelganger *doppel;
 
 
@@ -95,9 +100,11 @@ int whitelistWatch;
 ClassificationEngine *engine = NULL;
 
 pthread_t classificationLoopThread;
+pthread_t checkpointThread;
+pthread_t retentionThread;
 pthread_t ipUpdateThread;
 pthread_t ipWhitelistUpdateThread;
-pthread_t consumer;
+vector<pthread_t> consumerThreads;
 
 pthread_mutex_t shutdownClassificationMutex;
 bool shutdownClassification;
@@ -176,6 +183,7 @@ int RunNovaD()
 	Logger::Inst();
 	HoneydConfiguration::Inst();
 	Database::Inst();
+	DatabaseWriter::Inst()->Start();
 
 	if(!LockNovad())
 	{
@@ -249,9 +257,39 @@ int RunNovaD()
 	pthread_create(&classificationLoopThread,NULL,ClassificationLoop, NULL);
 	pthread_detach(classificationLoopThread);
 
-	// TODO: Figure out if having multiple Consumer Loops has a performance benefit
-	pthread_create(&consumer, NULL, ConsumerLoop, NULL);
-	pthread_detach(consumer);
+	pthread_create(&checkpointThread, NULL, CheckpointLoop, NULL);
+	pthread_detach(checkpointThread);
+
+	pthread_create(&retentionThread, NULL, RetentionLoop, NULL);
+	pthread_detach(retentionThread);
+
+	// Each consumer owns one suspect shard and drains the evidence table feeding it
+	uint consumerThreads = Config::Inst()->GetConsumerThreads();
+	if(consumerThreads < 1)
+	{
+		consumerThreads = 1;
+	}
+	if(consumerThreads > MAX_SUSPECT_SHARDS)
+	{
+		stringstream ss;
+		ss << "CONSUMER_THREADS is limited to " << MAX_SUSPECT_SHARDS << ", using that many consumer threads.";
+		LOG(WARNING, ss.str(), "");
+		consumerThreads = MAX_SUSPECT_SHARDS;
+	}
+	suspects.SetShardCount(consumerThreads);
+	suspects.SetMemoryBudget((uint64_t)Config::Inst()->GetMaxSuspectMemory() * 1024 * 1024,
+			(uint64_t)Config::Inst()->GetMaxMemoryPerSuspect() * 1024);
+
+	// Pick up the evidence that hadn't been written out when novad last stopped
+	suspects.LoadSnapshot(Config::Inst()->GetPathHome() + "/" + SUSPECT_SNAPSHOT_FILE);
+
+	for(uint i = 0; i < consumerThreads; i++)
+	{
+		pthread_t consumer;
+		suspectEvidence.push_back(new EvidenceTable());
+		pthread_create(&consumer, NULL, ConsumerLoop, suspectEvidence[i]);
+		consumerThreads.push_back(consumer);
+	}
 
 	StartCapture();
 
@@ -321,12 +359,16 @@ void StartCapture()
 			FilePacketCapture *cap = new FilePacketCapture(pcapFilePath.c_str());
 			cap->Init();
 			cap->SetPacketCb(&Packet_Handler);
+			cap->SetBatchCb(&Batch_Handler);
 			string captureFilterString = ConstructFilterString(cap->GetIdentifier());
 			cap->SetFilter(captureFilterString);
 			cap->SetIdIndex(packetCaptures.size());
 			packetCaptures.push_back(cap);
+			dropCounts.push_back(0);
 
+			readingPcapFile = true;
 			cap->StartCaptureBlocking();
+			readingPcapFile = false;
 
 			LOG(DEBUG, "Done reading pcap file. Processing...", "");
 			ClassificationLoop(NULL);
@@ -350,25 +392,55 @@ void StartCapture()
 		stringstream temp;
 		temp << ifList.size() << endl;
 
-		for(uint i = 0; i < ifList.size(); i++)
+		// Each fanout thread gets its own socket on the interface, the kernel splits packets between them by source IP
+		uint fanoutThreads = Config::Inst()->GetCaptureFanoutThreads();
+		if(fanoutThreads < 1)
 		{
-			dropCounts.push_back(0);
-			InterfacePacketCapture *cap = new InterfacePacketCapture(ifList[i].c_str());
+			fanoutThreads = 1;
+		}
+		if(fanoutThreads > 1 && !Config::Inst()->GetCaptureRingEnabled())
+		{
+			LOG(WARNING, "CAPTURE_FANOUT_THREADS requires CAPTURE_RING_ENABLED. Using one capture thread per interface.", "");
+			fanoutThreads = 1;
+		}
 
-			try
-			{
-				cap->SetPacketCb(&Packet_Handler);
-				cap->Init();
-				string captureFilterString = ConstructFilterString(cap->GetIdentifier());
-				cap->SetFilter(captureFilterString);
-				cap->StartCapture();
-				cap->SetIdIndex(packetCaptures.size());
-				packetCaptures.push_back(cap);
-			}
-			catch (Nova::PacketCaptureException &e)
+		for(uint i = 0; i < ifList.size(); i++)
+		{
+			for(uint j = 0; j < fanoutThreads; j++)
 			{
-				LOG(CRITICAL, string("Exception when starting packet capture on device " + ifList[i] + ": ") + e.what(), "");
-				exit(EXIT_FAILURE);
+				dropCounts.push_back(0);
+				PacketCapture *cap = NULL;
+
+				try
+				{
+					// The ring capture walks whole blocks of frames and runs Packet_Handler on each of them
+					if(Config::Inst()->GetCaptureRingEnabled())
+					{
+						RingPacketCapture *ringCap = new RingPacketCapture(ifList[i]);
+						cap = ringCap;
+						ringCap->SetFanout(fanoutThreads);
+						ringCap->Init();
+					}
+					else
+					{
+						InterfacePacketCapture *interfaceCap = new InterfacePacketCapture(ifList[i]);
+						cap = interfaceCap;
+						interfaceCap->Init();
+					}
+
+					cap->SetPacketCb(&Packet_Handler);
+					cap->SetBatchCb(&Batch_Handler);
+					string captureFilterString = ConstructFilterString(cap->GetIdentifier());
+					cap->SetFilter(captureFilterString);
+					cap->StartCapture();
+					cap->SetIdIndex(packetCaptures.size());
+					packetCaptures.push_back(cap);
+				}
+				catch (Nova::PacketCaptureException &e)
+				{
+					LOG(CRITICAL, string("Exception when starting packet capture on device " + ifList[i] + ": ") + e.what(), "");
+					exit(EXIT_FAILURE);
+				}
 			}
 		}
 	}
@@ -389,6 +461,20 @@ void StopCapture_noLocking()
 	}
 
 	packetCaptures.clear();
+	dropCounts.clear();
+}
+
+void StopConsumers()
+{
+	for(uint i = 0; i < suspectEvidence.size(); i++)
+	{
+		suspectEvidence[i]->Stop();
+	}
+	for(uint i = 0; i < consumerThreads.size(); i++)
+	{
+		pthread_join(consumerThreads[i], NULL);
+	}
+	consumerThreads.clear();
 }
 
 void Packet_Handler(u_char *index,const struct pcap_pkthdr *pkthdr,const u_char *packet)
@@ -404,29 +490,15 @@ void Packet_Handler(u_char *index,const struct pcap_pkthdr *pkthdr,const u_char
 		//IPv4, currently the only handled case
 		case ETHERTYPE_IP:
 		{
+			// Parse straight into the capture's batch, it gets published by Batch_Handler
+			PacketCapture *cap = reinterpret_cast<PacketCapture*>(index);
+			EvidenceBatch *batch = cap->GetEvidenceBatch();
+			batch->Add(packet, pkthdr);
 
-			//Prepare Packet structure
-			Evidence *evidencePacket = new Evidence(packet + sizeof(struct ether_header), pkthdr);
-			PacketCapture* cap = reinterpret_cast<PacketCapture*>(index);
-
-			if (cap == NULL)
+			// A ring block can hold more packets than a batch
+			if(batch->IsFull())
 			{
-				LOG(ERROR, "Packet capture object is NULL. Can't tell what interface this packet came from.", "");
-				evidencePacket->m_evidencePacket.interface = "UNKNOWN";
-			}
-			else
-			{
-				evidencePacket->m_evidencePacket.interface = cap->GetIdentifier();
-			}
-
-			if (!Config::Inst()->GetReadPcap())
-			{
-				suspectEvidence.InsertEvidence(evidencePacket);
-			}
-			else
-			{
-				// If reading from pcap file no Consumer threads, so process the evidence right away
-				suspects.ProcessEvidence(evidencePacket, false);
+				Batch_Handler(cap);
 			}
 			return;
 		}
@@ -450,6 +522,65 @@ void Packet_Handler(u_char *index,const struct pcap_pkthdr *pkthdr,const u_char
 	}
 }
 
+void Batch_Handler(PacketCapture *cap)
+{
+	EvidenceBatch *batch = cap->GetEvidenceBatch();
+	if(batch->m_count == 0)
+	{
+		return;
+	}
+
+	if(!readingPcapFile)
+	{
+		DistributeEvidence(*batch);
+	}
+	else
+	{
+		// If reading from pcap file no Consumer threads, so process the evidence right away
+		for(uint i = 0; i < batch->m_count; i++)
+		{
+			suspects.ProcessEvidence(batch->m_packets[i]);
+		}
+	}
+
+	batch->Clear();
+}
+
+void DistributeEvidence(const EvidenceBatch &batch)
+{
+	if(suspectEvidence.size() == 1)
+	{
+		suspectEvidence[0]->InsertEvidence(batch);
+		return;
+	}
+
+	// Split the batch into one chain per consumer, so each table still only gets a single push
+	Evidence *first[MAX_SUSPECT_SHARDS] = {NULL};
+	Evidence *last[MAX_SUSPECT_SHARDS];
+	for(uint i = 0; i < batch.m_count; i++)
+	{
+		uint shard = suspects.GetShardIndex(batch.m_packets[i].ip_src);
+		Evidence *evidence = new Evidence(batch.m_packets[i]);
+		if(first[shard] == NULL)
+		{
+			first[shard] = evidence;
+		}
+		else
+		{
+			last[shard]->m_next = evidence;
+		}
+		last[shard] = evidence;
+	}
+
+	for(uint i = 0; i < suspectEvidence.size(); i++)
+	{
+		if(first[i] != NULL)
+		{
+			suspectEvidence[i]->InsertEvidence(first[i], last[i]);
+		}
+	}
+}
+
 //Convert monitored ip address into a csv string
 string ConstructFilterString(string captureIdentifier)
 {
@@ -569,24 +700,82 @@ void CheckForDroppedPackets()
 	}
 }
 
-void UpdateHaystackFeatures()
+void LogAllocatorStatistics()
+{
+	SlabStatistics evidence = SlabAllocator<Evidence>::GetStatistics();
+	SlabStatistics wrappers = SlabAllocator<IpWrapper>::GetStatistics();
+
+	stringstream ss;
+	ss << "Evidence slab: " << evidence.m_inUse << " of " << evidence.m_capacity << " in use ("
+		<< (int)(evidence.GetOccupancy() * 100) << "%), " << (int)(evidence.GetHitRate() * 100) << "% of allocations recycled. "
+		<< "IpWrapper slab: " << wrappers.m_inUse << " of " << wrappers.m_capacity << " in use ("
+		<< (int)(wrappers.GetOccupancy() * 100) << "%), " << (int)(wrappers.GetHitRate() * 100) << "% of allocations recycled.";
+	LOG(DEBUG, ss.str(), "");
+}
+
+void LogSuspectMemoryStatistics()
 {
-	Database::Inst()->StartTransaction();
+	SuspectMemoryStatistics stats = suspects.GetMemoryStatistics();
+
+	stringstream ss;
+	ss << stats.m_suspectCount << " suspects waiting to be written are holding " << stats.m_bytesInUse / 1024 << "KB. "
+		<< stats.m_evictions << " idle suspects and " << stats.m_oversizeFlushes << " oversized suspects have been written out early. "
+		<< "Feature totals of " << stats.m_aggregateCount << " suspects are holding " << stats.m_aggregateBytes / 1024 << "KB, "
+		<< stats.m_aggregateEvictions << " have been dropped to be read back from the database.";
 
+	vector<pair<SuspectID_pb, size_t> > largest = suspects.GetLargestSuspects(3);
+	if(!largest.empty())
+	{
+		ss << " Largest:";
+		for(uint i = 0; i < largest.size(); i++)
+		{
+			ss << " " << Suspect::GetIpString(largest[i].first) << "/" << largest[i].first.m_ifname() << " (" << largest[i].second / 1024 << "KB)";
+		}
+	}
+	LOG(DEBUG, ss.str(), "");
+}
+
+void LogDatabaseWriterStatistics()
+{
+	DatabaseWriterStatistics stats = DatabaseWriter::Inst()->GetStatistics();
+
+	stringstream ss;
+	ss << "Database writer: " << stats.m_queueDepth << " writes queued (peak " << stats.m_peakQueueDepth << "), "
+		<< stats.m_writesCommitted << " written in " << stats.m_commits << " commits. Commit latency "
+		<< (int)stats.m_averageCommitLatency << "ms on average, " << (int)stats.m_maxCommitLatency << "ms at worst. "
+		<< "Producers have waited on the queue " << stats.m_producerStalls << " times (" << (int)stats.m_producerStallTime << "ms).";
+	LOG(DEBUG, ss.str(), "");
+}
+
+void LogClassificationCacheStatistics()
+{
+	ClassificationCacheStatistics stats = static_cast<ClassificationAggregator *>(engine)->GetCacheStatistics();
+
+	stringstream ss;
+	ss << "Classification cache: " << stats.m_entries << " suspects cached, " << stats.m_hits << " of " << stats.m_lookups
+		<< " engine vote lookups hit (" << (int)(stats.GetHitRate() * 100) << "%). " << stats.m_votesReused
+		<< " engine votes reused, saving about " << (int)stats.m_timeSaved << "ms.";
+	LOG(DEBUG, ss.str(), "");
+}
+
+void UpdateHaystackFeatures()
+{
 	vector<uint32_t> haystackNodes;
 	for(uint i = 0; i < haystackAddresses.size(); i++)
 	{
-		Database::Inst()->InsertHoneypotIp(haystackAddresses[i]);
 		haystackNodes.push_back(htonl(inet_addr(haystackAddresses[i].c_str())));
 	}
 
 	for(uint i = 0; i < haystackDhcpAddresses.size(); i++)
 	{
-		Database::Inst()->InsertHoneypotIp(haystackDhcpAddresses[i]);
 		haystackNodes.push_back(htonl(inet_addr(haystackDhcpAddresses[i].c_str())));
 	}
 
-	Database::Inst()->StopTransaction();
+	vector<string> honeypotIps = haystackAddresses;
+	honeypotIps.insert(honeypotIps.end(), haystackDhcpAddresses.begin(), haystackDhcpAddresses.end());
+	DatabaseWriter::Inst()->InsertHoneypotIps(honeypotIps);
+
+	suspects.SetHoneypots(haystackNodes);
 
 	stringstream ss;
 	ss << "Currently monitoring " << haystackAddresses.size() << " static honeypot IP addresses";
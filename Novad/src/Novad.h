@@ -20,6 +20,7 @@
 #define NOVAD_H_
 
 #include "HashMapStructs.h"
+#include "PacketCapture.h"
 #include "Evidence.h"
 #include "Suspect.h"
 #include "protobuf/marshalled_classes.pb.h"
@@ -64,6 +65,10 @@ void StartCapture();
 void StopCapture();
 void StopCapture_noLocking();
 
+// Lets the consumer threads finish the evidence already captured and waits for them to exit.
+// Call StopCapture first, or they'll keep finding more to do
+void StopConsumers();
+
 // Do any cleanup needed before exit when in training mode
 void CloseTrainingCapture();
 
@@ -82,11 +87,19 @@ std::vector <std::string> GetIpAddresses(std::string honeyDConfigPath);
 
 std::string ConstructFilterString(std::string captureIdentifier);
 
-// Callback function that is passed to pcap_loop(..) and called each time a packet is received
-//		useless - Unused
+// Callback function that is passed to pcap_dispatch(..) and called each time a packet is received
+//		index - The PacketCapture the packet came from
 //		pkthdr - pcap packet header
 //		packet - packet data
-void Packet_Handler(u_char *useless,const struct pcap_pkthdr *pkthdr,const u_char *packet);
+void Packet_Handler(u_char *index,const struct pcap_pkthdr *pkthdr,const u_char *packet);
+
+// Called after each pcap_dispatch or ring block. Publishes the packets Packet_Handler collected for the capture
+//		cap - The PacketCapture whose batch is published
+void Batch_Handler(PacketCapture *cap);
+
+// Hands the packets of a batch to the evidence tables of the consumers owning their suspects
+//		batch - Packets to publish
+void DistributeEvidence(const EvidenceBatch &batch);
 
 // Masks the kill signals of a thread so they will get
 // sent to the main thread's signal handler.
@@ -95,6 +108,18 @@ void MaskKillSignals();
 //Logs and prints if any packets were dropped since the last time this was called
 void CheckForDroppedPackets();
 
+// Logs how full the Evidence and IpWrapper slabs are and how often allocations are recycled
+void LogAllocatorStatistics();
+
+// Logs how much memory the suspects waiting to be written are using, and which are the biggest
+void LogSuspectMemoryStatistics();
+
+// Logs how deep the database write queue is, how long commits are taking and how often producers waited on it
+void LogDatabaseWriterStatistics();
+
+// Logs how often classification found a suspect's features unchanged and reused the last votes, and the time it saved
+void LogClassificationCacheStatistics();
+
 // Call this to update the featuresets based on a haystack change
 void UpdateHaystackFeatures();
 
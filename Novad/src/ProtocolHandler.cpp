@@ -16,7 +16,10 @@
 // Description : Manages the message sending protocol to and from the Nova UI
 //============================================================================
 
+#include "DatabaseQueue.h"
 #include "Database.h"
+#include "DatabaseWriter.h"
+#include "ClassificationEngine.h"
 #include "ProtocolHandler.h"
 #include "MessageManager.h"
 #include "Config.h"
@@ -44,6 +47,8 @@ using namespace std;
 int IPCParentSocket = -1;
 
 extern time_t startTime;
+extern DatabaseQueue suspects;
+extern ClassificationEngine *engine;
 
 struct sockaddr_un msgRemote, msgLocal;
 int UIsocketSize;
@@ -60,9 +65,10 @@ void HandleExitRequest(Message_pb *incoming)
 
 void HandleClearAllRequest(Message_pb *incoming)
 {
-	Database::Inst()->StartTransaction();
-	Database::Inst()->ClearAllSuspects();
-	Database::Inst()->StopTransaction();
+	// Wait for the clear to commit before forgetting the aggregates, so none of them are reloaded from the old rows
+	DatabaseWriter::Inst()->ClearAllSuspects();
+	DatabaseWriter::Inst()->Flush();
+	suspects.ForgetAllSuspects();
 
 	LOG(DEBUG, "Cleared all suspects due to UI request",
 			"Got a CONTROL_CLEAR_ALL_REQUEST, cleared all suspects.");
@@ -86,9 +92,9 @@ void HandleClearSuspectRequest(Message_pb *incoming)
 	struct in_addr suspectAddress;
 	suspectAddress.s_addr = ntohl(incoming->m_suspectid().m_ip());
 
-	Database::Inst()->StartTransaction();
-	Database::Inst()->ClearSuspect(string(inet_ntoa(suspectAddress)), incoming->m_suspectid().m_ifname());
-	Database::Inst()->StopTransaction();
+	DatabaseWriter::Inst()->ClearSuspect(incoming->m_suspectid().m_ip(), incoming->m_suspectid().m_ifname());
+	DatabaseWriter::Inst()->Flush();
+	suspects.ForgetSuspect(incoming->m_suspectid());
 
 	LOG(DEBUG, "Cleared a suspect due to UI request",
 			"Got a CONTROL_CLEAR_SUSPECT_REQUEST, cleared suspect: "
@@ -110,6 +116,35 @@ void HandleClearSuspectRequest(Message_pb *incoming)
 	MessageManager::Instance().WriteMessageExcept(&updateMessage, incoming->m_sessionindex());
 }
 
+void HandleExplainSuspectRequest(Message_pb *incoming)
+{
+	Message_pb reply;
+	reply.set_m_type(CONTROL_EXPLAIN_SUSPECT_REPLY);
+	reply.set_m_success(false);
+
+	// CLASSIFICATION_NOTES 0 turns notes off altogether
+	if(Config::Inst()->GetClassificationNotes() != NOTES_NONE)
+	{
+		Suspect suspect = Database::Inst()->GetSuspect(incoming->m_suspectid());
+		if(suspect.GetIdentifier().m_ifname() != "")
+		{
+			// The notes go back in the reply rather than into the suspect's record, where the next
+			// flush of the suspect would overwrite them
+			suspect.m_explainClassification = true;
+			engine->Classify(&suspect);
+			reply.set_m_success(true);
+			reply.set_m_classificationnotes(suspect.m_classificationNotes);
+		}
+	}
+
+	if(incoming->has_m_messageid())
+	{
+		reply.set_m_messageid(incoming->m_messageid());
+	}
+	reply.mutable_m_suspectid()->CopyFrom(incoming->m_suspectid());
+	MessageManager::Instance().WriteMessage(&reply, incoming->m_sessionindex());
+}
+
 void HandleReclassifyAllRequest(Message_pb *incoming)
 {
 	Reload();
@@ -30,6 +30,10 @@ void HandleClearAllRequest(Message_pb *incoming);
 
 void HandleClearSuspectRequest(Message_pb *incoming);
 
+// Reclassifies one suspect with full classification notes and replies with them. Unless
+// CLASSIFICATION_NOTES is 2, this is the only time notes are formatted at all.
+void HandleExplainSuspectRequest(Message_pb *incoming);
+
 void HandleReclassifyAllRequest(Message_pb *incoming);
 
 void HandleStartCaptureRequest(Message_pb *incoming);
@@ -54,8 +54,12 @@ double ScriptAlertClassification::Classify(Suspect *suspect)
 {
 	int res;
 	double classification = 0;
+	bool notes = GetNotesLevel(suspect, Config::Inst()->GetClassificationNotes()) >= NOTES_FULL;
 
-	suspect->m_classificationNotes += "\n=== Notes from Script Alert Classification Engine ===\n";
+	if(notes)
+	{
+		suspect->m_classificationNotes += "\n=== Notes from Script Alert Classification Engine ===\n";
+	}
 
 	SQL_RUN(SQLITE_OK, sqlite3_bind_text(getScriptAlerts, 1, suspect->GetIpString().c_str(), -1, SQLITE_TRANSIENT));
 	SQL_RUN(SQLITE_OK, sqlite3_bind_text(getScriptAlerts, 2, suspect->GetInterface().c_str(), -1, SQLITE_TRANSIENT));
@@ -65,8 +69,11 @@ double ScriptAlertClassification::Classify(Suspect *suspect)
 
 	while(res == SQLITE_ROW)
 	{
-		suspect->m_classificationNotes += "Script '" + string((const char*)sqlite3_column_text(getScriptAlerts, 3)) +
-				"' threw alert '" + string((const char*)sqlite3_column_text(getScriptAlerts, 4)) + "'\n";
+		if(notes)
+		{
+			suspect->m_classificationNotes += "Script '" + string((const char*)sqlite3_column_text(getScriptAlerts, 3)) +
+					"' threw alert '" + string((const char*)sqlite3_column_text(getScriptAlerts, 4)) + "'\n";
+		}
 		classification = 1;
 
 
@@ -78,4 +85,17 @@ double ScriptAlertClassification::Classify(Suspect *suspect)
 	return classification;
 }
 
+void ScriptAlertClassification::ClassifyBatch(Suspect **suspects, uint count, double *classifications)
+{
+	int res;
+
+	// Otherwise every lookup takes and drops the database's shared lock on its own
+	SQL_RUN(SQLITE_OK, sqlite3_exec(db, "BEGIN", NULL, NULL, NULL));
+	for(uint i = 0; i < count; i++)
+	{
+		classifications[i] = Classify(suspects[i]);
+	}
+	SQL_RUN(SQLITE_OK, sqlite3_exec(db, "COMMIT", NULL, NULL, NULL));
+}
+
 } /* namespace Nova */
@@ -33,6 +33,8 @@ public:
 	void LoadConfiguration(std::string filePath);
 
 	double Classify(Suspect *suspect);
+	// Looks every suspect up inside a single read transaction
+	void ClassifyBatch(Suspect **suspects, uint count, double *classifications);
 
 private:
 	sqlite3 *db;
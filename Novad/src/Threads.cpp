@@ -34,6 +34,7 @@
 #include "Novad.h"
 #include "Lock.h"
 #include "Database.h"
+#include "DatabaseWriter.h"
 
 #include <vector>
 #include <math.h>
@@ -73,7 +74,7 @@ extern int whitelistWatch;
 
 extern pthread_mutex_t packetCapturesLock;
 
-extern EvidenceTable suspectEvidence;
+extern vector<EvidenceTable*> suspectEvidence;
 
 extern Doppelganger *doppel;
 
@@ -116,6 +117,10 @@ void *ClassificationLoop(void *ptr)
 		}
 
 		CheckForDroppedPackets();
+		LogAllocatorStatistics();
+		LogSuspectMemoryStatistics();
+		LogDatabaseWriterStatistics();
+		LogClassificationCacheStatistics();
 
 		Database::Inst()->m_count = 0;
 		suspects.WriteToDatabase();
@@ -137,6 +142,74 @@ void *ClassificationLoop(void *ptr)
 	return NULL;
 }
 
+void *CheckpointLoop(void *ptr)
+{
+	MaskKillSignals();
+
+	while(true)
+	{
+		sleep(DATABASE_CHECKPOINT_INTERVAL);
+		Database::Inst()->Checkpoint();
+	}
+	return NULL;
+}
+
+void *RetentionLoop(void *ptr)
+{
+	MaskKillSignals();
+
+	while(true)
+	{
+		sleep(RETENTION_INTERVAL);
+
+		RetentionPolicy policy;
+		policy.m_suspectHours = Config::Inst()->GetSuspectRetentionHours();
+		policy.m_detailHours = Config::Inst()->GetIpPortDetailHours();
+		policy.m_maxAlerts = Config::Inst()->GetMaxSuspectAlerts();
+		policy.m_batchSize = RETENTION_BATCH_SIZE;
+
+		if(policy.m_suspectHours == 0 && policy.m_detailHours == 0 && policy.m_maxAlerts == 0)
+		{
+			continue;
+		}
+
+		RetentionResult result;
+		result.m_rowsRemoved = 0;
+		result.m_suspectsRolledUp = 0;
+		result.m_alertsRemoved = 0;
+
+		do
+		{
+			size_t removed = result.m_removedSuspects.size();
+			DatabaseWriter::Inst()->ApplyRetention(policy, result);
+
+			for(uint i = removed; i < result.m_removedSuspects.size(); i++)
+			{
+				suspects.ForgetSuspect(result.m_removedSuspects[i]);
+			}
+		} while(!result.m_finished);
+
+		uint64_t totalBytes, freeBytes;
+		Database::Inst()->GetDatabaseSize(totalBytes, freeBytes);
+
+		stringstream ss;
+		ss << "Retention removed " << result.m_removedSuspects.size() << " idle suspects, rolled up "
+			<< result.m_suspectsRolledUp << " suspects' IP/port counts and removed " << result.m_alertsRemoved
+			<< " alerts, " << result.m_rowsRemoved + result.m_alertsRemoved << " rows in all. The database is "
+			<< totalBytes / 1024 << " KB, " << freeBytes / 1024 << " KB of it free pages";
+
+		if(result.m_rowsRemoved != 0 || result.m_alertsRemoved != 0)
+		{
+			LOG(INFO, ss.str(), "");
+		}
+		else
+		{
+			LOG(DEBUG, ss.str(), "");
+		}
+	}
+	return NULL;
+}
+
 void *UpdateIPFilter(void *ptr)
 {
 	MaskKillSignals();
@@ -238,10 +311,19 @@ void *UpdateWhitelistIPFilter(void *ptr)
 
 void *ConsumerLoop(void *ptr)
 {
+	// SaveAndExit joins the consumers, so it mustn't ever end up running on one of them
+	MaskKillSignals();
+
+	EvidenceTable *table = (EvidenceTable *)ptr;
 	while(true)
 	{
-		//Blocks on a mutex/condition if there's no evidence to process
-		Evidence *cur = suspectEvidence.GetEvidence();
+		//Blocks on the evidence table's eventfd if there's no evidence to process
+		Evidence *cur = table->GetEvidence();
+		if(cur == NULL)
+		{
+			// The table was stopped and everything in it has been processed
+			break;
+		}
 
 		suspects.ProcessEvidence(cur, false);
 	}
@@ -270,6 +352,11 @@ void *MessageWorker(void *ptr)
 				HandleClearSuspectRequest(message);
 				break;
 			}
+			case CONTROL_EXPLAIN_SUSPECT_REQUEST:
+			{
+				HandleExplainSuspectRequest(message);
+				break;
+			}
 			case CONTROL_RECLASSIFY_ALL_REQUEST:
 			{
 				HandleReclassifyAllRequest(message);
@@ -47,10 +47,21 @@ void *UpdateWhitelistIPFilter(void *ptr);
 //		ptr - Required for pthread start routines
 void *TCPTimeout(void *ptr);
 
-//Loop for consumer threads, one is created for every producer, but they are not paired.
+//Loop for consumer threads, there are CONSUMER_THREADS of them and each owns one suspect shard.
 // a consumer may consume packets generated by many different producers
+//		ptr - The EvidenceTable this consumer drains
 void *ConsumerLoop(void *ptr);
 
+// Checkpoints the database's write-ahead log every DATABASE_CHECKPOINT_INTERVAL seconds,
+// so neither the classification flush nor the UI's queries ever have to wait on a big one
+//		ptr - Required for pthread start routines
+void *CheckpointLoop(void *ptr);
+
+// Applies the retention policy every RETENTION_INTERVAL seconds, a batch at a time on the database
+// writer, and forgets the suspects it deletes
+//		ptr - Required for pthread start routines
+void *RetentionLoop(void *ptr);
+
 //One of many (configurable) workers that grab messages off the messaging queue
 void *MessageWorker(void *ptr);
 
@@ -151,20 +151,43 @@ void ThresholdTriggerClassification::LoadConfiguration(string filePath)
 }
 
 double ThresholdTriggerClassification::Classify(Suspect *suspect)
+{
+	return ClassifySuspect(suspect, Config::Inst()->GetClassificationThreshold(),
+			GetNotesLevel(suspect, Config::Inst()->GetClassificationNotes()));
+}
+
+void ThresholdTriggerClassification::ClassifyBatch(Suspect **suspects, uint count, double *classifications)
+{
+	double hostileThreshold = Config::Inst()->GetClassificationThreshold();
+	uint notesLevel = Config::Inst()->GetClassificationNotes();
+	for(uint i = 0; i < count; i++)
+	{
+		classifications[i] = ClassifySuspect(suspects[i], hostileThreshold, GetNotesLevel(suspects[i], notesLevel));
+	}
+}
+
+double ThresholdTriggerClassification::ClassifySuspect(Suspect *suspect, double hostileThreshold, uint notesLevel)
 {
 	double classification = 0;
+	bool notes = notesLevel >= NOTES_FULL;
 
-	suspect->m_classificationNotes += "=== Notes from threshold based classification engine ===\n";
+	if (notes)
+	{
+		suspect->m_classificationNotes += "=== Notes from threshold based classification engine ===\n";
+	}
 
 	//vector<HostileThreshold> thresholds = Config::Inst()->GetHostileThresholds();
 	for(uint i = 0; i < DIM; i++)
 	{
-		HostileThreshold threshold = m_hostileThresholds.at(i);
+		const HostileThreshold &threshold = m_hostileThresholds.at(i);
 		if (threshold.m_hasMaxValueTrigger)
 		{
 			if (suspect->m_features.m_features[i] >= threshold.m_maxValueTrigger)
 			{
-				suspect->m_classificationNotes += "Feature '" + EvidenceAccumulator::m_featureNames[i] + "' has surpassed threshold of " + to_string(threshold.m_maxValueTrigger) + "\n";
+				if (notes)
+				{
+					suspect->m_classificationNotes += "Feature '" + EvidenceAccumulator::m_featureNames[i] + "' has surpassed threshold of " + to_string(threshold.m_maxValueTrigger) + "\n";
+				}
 				classification = 1;
 			}
 		}
@@ -173,18 +196,21 @@ double ThresholdTriggerClassification::Classify(Suspect *suspect)
 		{
 			if (suspect->m_features.m_features[i] <= threshold.m_minValueTrigger)
 			{
-				suspect->m_classificationNotes += "Feature '" + EvidenceAccumulator::m_featureNames[i] + "' is below threshold of " + to_string(threshold.m_minValueTrigger) + "\n";
+				if (notes)
+				{
+					suspect->m_classificationNotes += "Feature '" + EvidenceAccumulator::m_featureNames[i] + "' is below threshold of " + to_string(threshold.m_minValueTrigger) + "\n";
+				}
 				classification = 1;
 			}
 		}
 	}
 
-	if (!classification)
+	if (notes && !classification)
 	{
 		suspect->m_classificationNotes += "No threshold alerts triggered\n";
 	}
 
-	if (classification > Config::Inst()->GetClassificationThreshold())
+	if (classification > hostileThreshold)
 	{
 		suspect->SetIsHostile(true);
 	}
@@ -40,9 +40,13 @@ public:
 	void LoadConfiguration(std::string filePath);
 
 	double Classify(Suspect *suspect);
+	void ClassifyBatch(Suspect **suspects, uint count, double *classifications);
 
 	std::vector<HostileThreshold> m_hostileThresholds;
 
+private:
+	double ClassifySuspect(Suspect *suspect, double hostileThreshold, uint notesLevel);
+
 };
 
 } /* namespace Nova */
@@ -232,6 +232,23 @@ everyone.now.ClearSuspect = function (suspectIp, ethinterface, cb)
     }
 };
 
+// Has Novad classify the suspect again with full classification notes, which it otherwise only
+// formats with CLASSIFICATION_NOTES 2. Calls back with an error or the notes.
+everyone.now.ExplainSuspect = function (suspectIp, ethinterface, cb)
+{
+    NovaCommon.nova.CheckConnection();
+    if (!NovaCommon.nova.IsNovadConnected())
+    {
+        cb && cb("Unable to connect to Novad", null);
+        return;
+    }
+
+    NovaCommon.nova.ExplainSuspect(suspectIp, ethinterface, function(err, notes)
+    {
+        cb && cb(err, notes);
+    });
+};
+
 everyone.now.GetInheritedEthernetList = function (parent, cb)
 {
     var prof = NovaCommon.honeydConfig.GetProfile(parent);
@@ -1497,10 +1514,40 @@ everyone.now.GetIpPortsContacted = function(ip, iface, cb) {
     });
 };
 
+// Expands a packet_sizes histogram blob (layout in NovaLibrary/src/PacketSizeHistogram.h) into packetSize/count rows.
+// Buckets wider than one byte get a "low-high" packetSize.
+var DecodePacketSizeHistogram = function(blob) {
+    var SUB_BUCKETS = 64;
+    var HEADER_LENGTH = 27;
+    var rows = [];
+
+    if (!blob || blob.length < HEADER_LENGTH || blob[0] != 1) {
+        return rows;
+    }
+
+    var usedBuckets = blob.readUInt16LE(HEADER_LENGTH - 2);
+    var offset = HEADER_LENGTH;
+    for (var i = 0; i < usedBuckets && offset + 10 <= blob.length; i++, offset += 10) {
+        var index = blob.readUInt16LE(offset);
+        var count = blob.readUInt32LE(offset + 2) + blob.readUInt32LE(offset + 6) * 4294967296;
+
+        var low = index;
+        var high = index;
+        if (index >= 2 * SUB_BUCKETS) {
+            var shift = Math.floor(index / SUB_BUCKETS) - 1;
+            low = (index - shift * SUB_BUCKETS) << shift;
+            high = low + (1 << shift) - 1;
+        }
+
+        rows.push({packetSize: (low == high) ? low : low + "-" + high, count: count});
+    }
+    return rows;
+};
+
 everyone.now.GetPacketSizes = function(ip, iface, cb) {
-    NovaCommon.dbqGetSuspectPacketSizes.all(ip, iface, function(err, results) {
+    NovaCommon.dbqGetSuspectPacketSizes.get(ip, iface, function(err, result) {
         if (databaseError(err, cb)) {return;}
-            cb && cb(null, results);
+            cb && cb(null, result ? DecodePacketSizeHistogram(result.histogram) : []);
     });
 };
 